@@ -0,0 +1,231 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "AbrController.h"
+
+#include <algorithm>
+#include <cmath>
+
+HarmonicMeanEstimator::HarmonicMeanEstimator(size_t windowSize)
+    : m_windowSize(windowSize == 0 ? 1 : windowSize)
+    , m_inverseSum(0.0)
+{
+}
+
+void HarmonicMeanEstimator::AddSample(uint64_t bytes, double seconds)
+{
+    if (bytes == 0 || seconds <= 0.0)
+        return;
+
+    double bps = bytes * 8.0 / seconds;
+    m_samples.push_back(bps);
+    m_inverseSum += 1.0 / bps;
+
+    if (m_samples.size() > m_windowSize)
+    {
+        m_inverseSum -= 1.0 / m_samples.front();
+        m_samples.pop_front();
+    }
+}
+
+double HarmonicMeanEstimator::EstimateBps() const
+{
+    if (m_samples.empty() || m_inverseSum <= 0.0)
+        return 0.0;
+
+    return m_samples.size() / m_inverseSum;
+}
+
+void HarmonicMeanEstimator::Reset()
+{
+    m_samples.clear();
+    m_inverseSum = 0.0;
+}
+
+void EwmaEstimator::Average::Add(double seconds, double bps)
+{
+    double alpha = pow(0.5, seconds / halfLife);
+    estimate = alpha * estimate + (1.0 - alpha) * bps;
+    totalWeight += seconds;
+}
+
+double EwmaEstimator::Average::Get() const
+{
+    // the average starts at 0, divide the bias out while few samples went in
+    double zeroFactor = 1.0 - pow(0.5, totalWeight / halfLife);
+    return zeroFactor > 0.0 ? estimate / zeroFactor : 0.0;
+}
+
+EwmaEstimator::EwmaEstimator(double fastHalfLifeSeconds, double slowHalfLifeSeconds)
+    : m_fast{ fastHalfLifeSeconds > 0.0 ? fastHalfLifeSeconds : 1.0, 0.0, 0.0 }
+    , m_slow{ slowHalfLifeSeconds > 0.0 ? slowHalfLifeSeconds : 1.0, 0.0, 0.0 }
+    , m_sampleCount(0)
+{
+}
+
+void EwmaEstimator::AddSample(uint64_t bytes, double seconds)
+{
+    if (bytes == 0 || seconds <= 0.0)
+        return;
+
+    double bps = bytes * 8.0 / seconds;
+    m_fast.Add(seconds, bps);
+    m_slow.Add(seconds, bps);
+    m_sampleCount++;
+}
+
+double EwmaEstimator::EstimateBps() const
+{
+    if (m_sampleCount == 0)
+        return 0.0;
+
+    return (std::min)(m_fast.Get(), m_slow.Get());
+}
+
+void EwmaEstimator::Reset()
+{
+    m_fast.estimate = m_fast.totalWeight = 0.0;
+    m_slow.estimate = m_slow.totalWeight = 0.0;
+    m_sampleCount = 0;
+}
+
+AbrController::AbrController(std::unique_ptr<ThroughputEstimator> estimator, const AbrSettings& settings)
+    : m_estimator(std::move(estimator))
+    , m_settings(settings)
+    , m_current(0)
+    , m_lastSwitchSeconds(0.0)
+    , m_hasSwitched(false)
+    , m_switchCount(0)
+{
+    if (m_estimator == nullptr)
+    {
+        m_estimator = std::make_unique<HarmonicMeanEstimator>();
+    }
+}
+
+void AbrController::SetLadder(const std::vector<uint32_t>& bitrates)
+{
+    uint32_t current = CurrentBitrate();
+
+    m_ladder = bitrates;
+    std::sort(m_ladder.begin(), m_ladder.end());
+    m_ladder.erase(std::unique(m_ladder.begin(), m_ladder.end()), m_ladder.end());
+
+    // stay on the same bitrate, or the closest one below it
+    m_current = 0;
+    for (size_t i = 0; i < m_ladder.size(); ++i)
+    {
+        if (m_ladder[i] <= current)
+            m_current = i;
+    }
+}
+
+void AbrController::OnDownloadCompleted(uint64_t bytes, double seconds)
+{
+    if (bytes < m_settings.minSampleBytes || seconds < m_settings.minSampleSeconds)
+        return;
+
+    m_estimator->AddSample(bytes, seconds);
+}
+
+uint32_t AbrController::InitialBitrate() const
+{
+    if (m_ladder.empty())
+        return 0;
+
+    double estimate = m_estimator->EstimateBps();
+    if (estimate <= 0.0)
+        return m_ladder.front();
+
+    return m_ladder[HighestIndexBelow(estimate * m_settings.safetyFactor)];
+}
+
+uint32_t AbrController::Decide(double bufferSeconds, double nowSeconds)
+{
+    if (m_ladder.empty())
+        return 0;
+
+    double estimate = m_estimator->EstimateBps();
+    if (estimate <= 0.0)
+        return CurrentBitrate();
+
+    double usable = estimate * m_settings.safetyFactor;
+
+    // close to a stall, only what refills the buffer in time is usable
+    if (bufferSeconds < m_settings.panicBufferSeconds && m_settings.panicBufferSeconds > 0.0)
+    {
+        usable *= (std::max)(bufferSeconds, 0.0) / m_settings.panicBufferSeconds;
+    }
+
+    size_t target = HighestIndexBelow(usable);
+
+    if (target < m_current)
+    {
+        // down-switches are never held back
+        SwitchTo(target, nowSeconds);
+    }
+    else if (target > m_current)
+    {
+        // one rung at a time, with margin, a healthy buffer and enough time since the last switch
+        size_t next = m_current + 1;
+        bool heldLongEnough = !m_hasSwitched || (nowSeconds - m_lastSwitchSeconds) >= m_settings.upSwitchHoldSeconds;
+        if (bufferSeconds >= m_settings.lowBufferSeconds
+            && heldLongEnough
+            && m_ladder[next] * m_settings.upSwitchMargin <= usable)
+        {
+            SwitchTo(next, nowSeconds);
+        }
+    }
+
+    return CurrentBitrate();
+}
+
+uint32_t AbrController::CurrentBitrate() const
+{
+    return m_ladder.empty() ? 0 : m_ladder[m_current];
+}
+
+void AbrController::StartAtLowest()
+{
+    m_current = 0;
+    m_hasSwitched = false;
+}
+
+void AbrController::Reset()
+{
+    m_estimator->Reset();
+    m_current = 0;
+    m_lastSwitchSeconds = 0.0;
+    m_hasSwitched = false;
+    m_switchCount = 0;
+}
+
+size_t AbrController::HighestIndexBelow(double bps) const
+{
+    size_t index = 0;
+    for (size_t i = 0; i < m_ladder.size(); ++i)
+    {
+        if (m_ladder[i] <= bps)
+            index = i;
+    }
+    return index;
+}
+
+void AbrController::SwitchTo(size_t index, double nowSeconds)
+{
+    if (index == m_current)
+        return;
+
+    m_current = index;
+    m_lastSwitchSeconds = nowSeconds;
+    m_hasSwitched = true;
+    m_switchCount++;
+}
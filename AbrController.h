@@ -0,0 +1,134 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable adaptive bitrate decision logic. No Windows dependencies and no clock of its own:
+// callers pass download samples, buffer level and time, so the same code runs in the streamer,
+// in offline simulations and against recorded bandwidth traces. Not thread-safe.
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class ThroughputEstimator
+{
+public:
+    virtual ~ThroughputEstimator() = default;
+
+    virtual void AddSample(uint64_t bytes, double seconds) = 0;
+
+    // bits per second, 0 until the first sample
+    virtual double EstimateBps() const = 0;
+
+    virtual size_t SampleCount() const = 0;
+    virtual void Reset() = 0;
+};
+
+// Harmonic mean of the last windowSize samples, dominated by the slow ones
+class HarmonicMeanEstimator : public ThroughputEstimator
+{
+public:
+    explicit HarmonicMeanEstimator(size_t windowSize = 5);
+
+    void AddSample(uint64_t bytes, double seconds) override;
+    double EstimateBps() const override;
+    size_t SampleCount() const override { return m_samples.size(); }
+    void Reset() override;
+
+private:
+    size_t m_windowSize;
+    std::deque<double> m_samples; // bps
+    double m_inverseSum;
+};
+
+// Fast and slow exponentially weighted averages, weighted by download time, the lower one wins
+class EwmaEstimator : public ThroughputEstimator
+{
+public:
+    EwmaEstimator(double fastHalfLifeSeconds = 2.0, double slowHalfLifeSeconds = 5.0);
+
+    void AddSample(uint64_t bytes, double seconds) override;
+    double EstimateBps() const override;
+    size_t SampleCount() const override { return m_sampleCount; }
+    void Reset() override;
+
+private:
+    struct Average
+    {
+        double halfLife;
+        double estimate;
+        double totalWeight;
+
+        void Add(double seconds, double bps);
+        double Get() const;
+    };
+
+    Average m_fast;
+    Average m_slow;
+    size_t m_sampleCount;
+};
+
+struct AbrSettings
+{
+    double safetyFactor = 0.85;         // share of the estimate a rung may use
+    double panicBufferSeconds = 4.0;    // below this the usable throughput shrinks with the buffer
+    double lowBufferSeconds = 10.0;     // no up-switches below this
+    double upSwitchHoldSeconds = 8.0;   // minimum time between a switch and the next up-switch
+    double upSwitchMargin = 1.2;        // the next rung must fit this many times into the usable throughput
+    uint64_t minSampleBytes = 16 * 1024; // smaller downloads measure latency, not throughput
+    double minSampleSeconds = 0.01;     // faster downloads were served locally
+};
+
+class AbrController
+{
+public:
+    AbrController(std::unique_ptr<ThroughputEstimator> estimator, const AbrSettings& settings = AbrSettings());
+
+    // Bitrates of the available variants, any order. Keeps the current bitrate if it is still there.
+    void SetLadder(const std::vector<uint32_t>& bitrates);
+    const std::vector<uint32_t>& Ladder() const { return m_ladder; }
+
+    void OnDownloadCompleted(uint64_t bytes, double seconds);
+
+    // Bitrate to start a new source at, the lowest rung until there is an estimate
+    uint32_t InitialBitrate() const;
+
+    // Re-evaluates the choice, returns the bitrate to cap the source at
+    uint32_t Decide(double bufferSeconds, double nowSeconds);
+
+    uint32_t CurrentBitrate() const;
+    size_t CurrentIndex() const { return m_current; }
+    double EstimateBps() const { return m_estimator->EstimateBps(); }
+    uint32_t SwitchCount() const { return m_switchCount; }
+
+    const AbrSettings& Settings() const { return m_settings; }
+
+    // Drops to the lowest rung and lifts the up-switch hold, samples are kept
+    void StartAtLowest();
+
+    // Forgets samples and the current choice, the ladder is kept
+    void Reset();
+
+private:
+    size_t HighestIndexBelow(double bps) const;
+    void SwitchTo(size_t index, double nowSeconds);
+
+    std::unique_ptr<ThroughputEstimator> m_estimator;
+    AbrSettings m_settings;
+    std::vector<uint32_t> m_ladder; // ascending
+    size_t m_current;
+    double m_lastSwitchSeconds;
+    bool m_hasSwitched;
+    uint32_t m_switchCount;
+};
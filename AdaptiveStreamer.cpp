@@ -1,8 +1,10 @@
 #include "AdaptiveStreamer.h"
 
-#include <iostream>
+#include <algorithm>
 
 #include "MediaHelpers.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 using namespace Windows::Foundation;
 using namespace Microsoft::WRL;
@@ -12,10 +14,49 @@ using namespace Core;
 using namespace Playback;
 using namespace Audio;
 using namespace Effects;
+using namespace Streaming::Adaptive;
 using namespace ABI::Windows::Storage::Streams;
 
 bool AdaptiveStreamer::m_deviceNotReady = true;
 
+namespace
+{
+    // Registered once, the streamers of the process record into the same metrics
+    struct StreamerMetrics
+    {
+        Metrics::Counter& framesAvailable;
+        Metrics::Counter& framesCopied;
+        Metrics::Histogram& frameCopyUs;
+        Metrics::Counter& audioQuanta;
+        Metrics::Counter& rebuffers;
+        Metrics::Counter& failures;
+        Metrics::Counter& bitrateSwitches;
+        Metrics::Gauge& bitrateCapBps;
+        Metrics::Histogram& timeToFirstFrameMs;
+        Metrics::Histogram& seekMs;
+        Metrics::Histogram& channelChangeMs;
+    };
+
+    StreamerMetrics& GetMetrics()
+    {
+        Metrics::Registry& registry = Metrics::Registry::Instance();
+        static StreamerMetrics s_metrics = {
+            registry.GetCounter("streamer_frames_available_total", "Video frames the player said were ready"),
+            registry.GetCounter("streamer_frames_copied_total", "Video frames copied to the shared texture"),
+            registry.GetHistogram("streamer_frame_copy_us", "CopyFrameToVideoSurface time in microseconds"),
+            registry.GetCounter("streamer_audio_quanta_total", "Audio graph quanta started"),
+            registry.GetCounter("streamer_rebuffers_total", "Playing sessions that went back to buffering"),
+            registry.GetCounter("streamer_failures_total", "Media player failures"),
+            registry.GetCounter("streamer_bitrate_switches_total", "Bitrate caps the ABR controller set"),
+            registry.GetGauge("streamer_bitrate_cap_bps", "Bitrate cap set last, by any stream"),
+            registry.GetHistogram("streamer_time_to_first_frame_ms", "Load to first frame in milliseconds"),
+            registry.GetHistogram("streamer_seek_ms", "Seek call to first frame in milliseconds"),
+            registry.GetHistogram("streamer_channel_change_ms", "Content switch to first frame in milliseconds"),
+        };
+        return s_metrics;
+    }
+}
+
 AdaptiveStreamer::AdaptiveStreamer() :
     m_d3dDevice(nullptr)
     , m_mediaDevice(nullptr)
@@ -23,24 +64,124 @@ AdaptiveStreamer::AdaptiveStreamer() :
     , m_primarySharedHandle(INVALID_HANDLE_VALUE)
     , m_readyForFrames(false)
     , m_createTextures(false)
+    , m_sharedDevice(false)
+    , m_activeMediaPlayer(nullptr)
+    , m_activePlaybackSession(nullptr)
+    , m_activeAudioGraph(nullptr)
+    , m_channelChangeStart(0)
+    , m_lastChannelChangeMs(0)
+    , m_loadStart(0)
+    , m_lastTimeToFirstFrameMs(0)
+    , m_fastStart(false)
+    , m_fastStartPending(false)
+    , m_audioNodesPending(false)
+    , m_currentItemChangedToken()
+    , m_nextPrefetchIndex(0)
+    , m_playlistGeneration(0)
+    , m_forkedAudioGeneration(0)
+    , m_fmp4Movie()
+    , m_hasFmp4Movie(false)
+    , m_metadataOriginPts(0)
+    , m_metadataOriginTime(0.0)
+    , m_hasMetadataOrigin(false)
+    , m_seekMovie()
+    , m_hasSeekMovie(false)
+    , m_seekHasVariants(false)
+    , m_seekBitrate(0)
+    , m_seekIndexGeneration(0)
+    , m_keyframeIndexVersion(0)
+    , m_seekId(0)
+    , m_seekStart(0)
+    , m_lastSeekMs(0)
+    , m_trickPlaySpeed(0.0)
+    , m_trickPlayId(0)
+    , m_subtitleTrack(-1)
+    , m_subtitleGeneration(0)
+    , m_subtitleNextSequence(0)
+    , m_subtitleLive(false)
+    , m_subtitleLoading(false)
+    , m_subtitleRefreshTime(0.0)
+    , m_lowLatencyGeneration(0)
+    , m_lowLatencyOffsetApplied(false)
+    , m_bandwidthBudgetBps(0)
+    , m_memoryBudgetBytes(SEGMENT_CACHE_BYTE_BUDGET)
+    , m_callbackCpuTime(0)
+    , m_frameCopies(0)
+    , m_frameCopyTicks(0)
+    , m_frameCopyMaxTicks(0)
+    , m_frameCopiesGpuTimed(0)
+    , m_frameCopyGpuNs(0)
+    , m_frameCopyGpuMaxNs(0)
+    , m_mediaEvents(MEDIA_EVENT_QUEUE_CAPACITY)
 {
+    QueryPerformanceFrequency(&m_qpcFrequency);
 }
 
 AdaptiveStreamer::~AdaptiveStreamer()
 {
-#ifdef USE_AUDIOGRAPH
-    m_audioGraph->Stop();
-#endif
+    m_bIgnoreEvents = true;
+
+    // a blocking reload would hold the drain for up to three target durations
+    StopLowLatency();
+
+    // scheduled completions hold a raw this as well, downloads in flight are aborted
+    if (m_downloadScheduler != nullptr)
+    {
+        m_downloadScheduler->Close();
+    }
+
+    // queued prefetches hold a raw this as well, they may queue CPU work so they go first
+    m_workQueue.Drain();
+    m_taskQueue.Drain();
+    DetachTrickPlayer();
+    ReleasePlaylist();
+    RemoveAdaptiveSourceHandlers();
+
+    // callbacks hold a raw this, every entry must be unregistered before we go away
+    std::unique_ptr<PooledMediaPlayer> entry = DetachMediaPlayer();
+    DestroyPooledMediaPlayer(entry.get());
+
+    if (m_playerPool != nullptr)
+    {
+        m_playerPool->Shutdown();
+    }
 }
 
 HRESULT AdaptiveStreamer::Initialize()
 {
-    CreateMediaPlayer();
+    TRACE_SPAN("Initialize");
+
+    m_segmentCache = std::make_shared<SegmentCache>(static_cast<size_t>(m_memoryBudgetBytes.load()));
+#ifdef SHARE_DOWNLOADS_ACROSS_STREAMERS
+    m_downloadScheduler = std::make_shared<DownloadScheduler>(DOWNLOAD_SCHEDULER_MAX_PER_HOST, &SharedFetch::Instance());
+#else
+    m_downloadScheduler = std::make_shared<DownloadScheduler>();
+#endif
+    m_prefetcher = std::make_unique<PlaylistPrefetcher>(m_segmentCache, PlaylistPrefetcher::DefaultSettings(), m_downloadScheduler);
+    m_seekFetcher = std::make_unique<PlaylistPrefetcher>(m_segmentCache, PlaylistPrefetcher::DefaultSettings(), m_downloadScheduler, DownloadOrigin::Seek);
+    m_decryptor = std::make_unique<SegmentDecryptor>();
+    m_lowLatencyLoader = std::make_unique<LowLatencyLoader>(m_segmentCache, m_downloadScheduler);
+    m_iFrameCache = std::make_shared<SegmentCache>(I_FRAME_CACHE_BYTE_BUDGET);
+
+#ifdef USE_CUSTOM_ABR
+    SetAbrController(std::make_unique<AbrController>(std::make_unique<HarmonicMeanEstimator>()));
+#endif
+
+    m_playerPool = std::make_unique<PrewarmedPool<PooledMediaPlayer>>(
+        PLAYER_POOL_SIZE,
+        [this](std::unique_ptr<PooledMediaPlayer>* ppEntry) { return CreatePooledMediaPlayer(ppEntry); },
+        [this](PooledMediaPlayer* pEntry) { return ResetPooledMediaPlayer(pEntry); },
+        [this](PooledMediaPlayer* pEntry) { DestroyPooledMediaPlayer(pEntry); });
+
+    // the first player is created inline, the pool then warms up a spare in the background
+    IFR(CreateMediaPlayer());
     return S_OK;
 }
 
 HRESULT AdaptiveStreamer::LoadContent(const std::wstring& sURL)
 {
+    TRACE_SPAN("LoadContent");
+
     Log(Log_Level_Info, L"AdaptiveStreamer::LoadContent()");
 
     if (m_mediaPlayer.Get() == nullptr)
@@ -48,8 +189,12 @@ HRESULT AdaptiveStreamer::LoadContent(const std::wstring& sURL)
         return E_UNEXPECTED;
     }
 
+    LARGE_INTEGER loadStart;
+    QueryPerformanceCounter(&loadStart);
+    m_loadStart = loadStart.QuadPart;
+
     // Check if MediaPlayer now has a source (Stop was not called). 
-    // If so, call stop. It will recreate and reinitialize MediaPlayer (m_mediaPlayer) 
+    // If so, call stop. It swaps in a pre-warmed MediaPlayer (m_mediaPlayer) from the pool
     ComPtr<IMediaPlayerSource2> spPlayerAsMediaPlayerSource;
     ComPtr<IMediaPlaybackSource> spCurrentSource;
     IFR(m_mediaPlayer.As(&spPlayerAsMediaPlayerSource));
@@ -57,10 +202,20 @@ HRESULT AdaptiveStreamer::LoadContent(const std::wstring& sURL)
 
     if (spCurrentSource.Get())
     {
+        // channel change, timed until the first frame of the new content
+        m_channelChangeStart = loadStart.QuadPart;
+
         IFR(Stop());
+        IFR(m_mediaPlayer.As(&spPlayerAsMediaPlayerSource));
     }
 
-    m_subtitleTracks.clear();
+    ClearSubtitles();
+
+    // fast start fetches the first segments while the source resolves the manifest below
+    if (m_fastStart)
+    {
+        LOG_RESULT(BeginFastStart(sURL));
+    }
 
     // create the media source for content (fromUri)
     ComPtr<IMediaSource2> spMediaSource2;
@@ -71,19 +226,61 @@ HRESULT AdaptiveStreamer::LoadContent(const std::wstring& sURL)
     {
         assert(m_spAdaptiveMediaSource.Get() == nullptr);
         spMediaSource4->get_AdaptiveMediaSource(m_spAdaptiveMediaSource.ReleaseAndGetAddressOf());
+        LOG_RESULT(AddAdaptiveSourceHandlers(m_spAdaptiveMediaSource.Get(), true));
+
+        if (m_fastStart)
+        {
+            LOG_RESULT(ApplyFastStartBitrate(m_spAdaptiveMediaSource.Get()));
+        }
+
+        LOG_RESULT(BuildKeyframeIndex(sURL));
+
+        std::wstring url = sURL;
+        UINT64 generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_subtitleLock);
+            generation = m_subtitleGeneration;
+        }
+        LOG_RESULT(m_workQueue.Queue([this, url, generation]()
+            {
+                LOG_RESULT_MSG(LoadSubtitleTracks(url, generation), L"AdaptiveStreamer - subtitle tracks unavailable");
+            }));
     }
 
 #ifdef USE_AUDIOGRAPH
     #ifdef ONE_SINGLE_MEDIASOURCE
-        CreateAudioGraphNodes(spMediaSource2.Get());
+        ComPtr<IMediaSource2> spMediaSourceForAudioGraph = spMediaSource2;
+        // the node opens the player's own source, it has to be done before put_Source below. The graph
+        // and its output node come warm from the player pool, only this node is on the load's path
+        bool queueNodes = false;
     #else
         // Mute the Media Player as the sound will be played via the audio graph
         m_mediaPlayer.Get()->put_Volume(0.0);
-        // create the media source for the audiograph
         ComPtr<IMediaSource2> spMediaSourceForAudioGraph;
-        IFR(CreateMediaSource(sURL.c_str(), &spMediaSourceForAudioGraph));
-        CreateAudioGraphNodes(spMediaSourceForAudioGraph.Get());
+        bool forkedInput = false;
+        #ifdef AUDIOGRAPH_FORKED_INPUT
+        // HLS audio comes from the segments the player downloads anyway, nothing is fetched twice
+        if (m_spAdaptiveMediaSource != nullptr)
+        {
+            HRESULT hrForked = StartForkedAudioInput(sURL);
+            LOG_RESULT_MSG(hrForked, L"AdaptiveStreamer - no forked audio input, the graph gets a media source");
+            forkedInput = SUCCEEDED(hrForked);
+        }
+        #endif
+        if (!forkedInput)
+        {
+            // create the media source for the audiograph
+            IFR(CreateMediaSource(sURL.c_str(), &spMediaSourceForAudioGraph));
+        }
+        bool queueNodes = m_fastStart;
     #endif
+
+    // the player does not need the graph to start, fast start builds the nodes of a source of their
+    // own in the background
+    if (spMediaSourceForAudioGraph != nullptr && (!queueNodes || FAILED(QueueAudioGraphNodes(spMediaSourceForAudioGraph.Get()))))
+    {
+        CreateAudioGraphNodes(spMediaSourceForAudioGraph.Get());
+    }
 #endif
 
     IFR(CreateMediaPlaybackItem(spMediaSource2.Get(), m_spPlaybackItem.ReleaseAndGetAddressOf()));
@@ -96,42 +293,2079 @@ HRESULT AdaptiveStreamer::LoadContent(const std::wstring& sURL)
     return S_OK;
 }
 
-HRESULT AdaptiveStreamer::Play()
+HRESULT AdaptiveStreamer::LoadPlaylist(const std::vector<std::wstring>& urls)
 {
-    Log(Log_Level_Info, L"AdaptiveStreamer::Play()");
+    Log(Log_Level_Info, L"AdaptiveStreamer::LoadPlaylist()");
 
-    if (nullptr != m_mediaPlayer)
+    if (urls.empty())
     {
-        IFR(m_mediaPlayer->Play());
-#ifdef USE_AUDIOGRAPH
-        IFR(PlayAudioGraph());
-#endif
+        return E_INVALIDARG;
+    }
+
+    if (m_mediaPlayer.Get() == nullptr || m_prefetcher == nullptr)
+    {
+        return E_UNEXPECTED;
+    }
+
+    LARGE_INTEGER loadStart;
+    QueryPerformanceCounter(&loadStart);
+    m_loadStart = loadStart.QuadPart;
+
+    ComPtr<IMediaPlayerSource2> spPlayerAsMediaPlayerSource;
+    ComPtr<IMediaPlaybackSource> spCurrentSource;
+    IFR(m_mediaPlayer.As(&spPlayerAsMediaPlayerSource));
+    spPlayerAsMediaPlayerSource->get_Source(&spCurrentSource);
+
+    if (spCurrentSource.Get())
+    {
+        m_channelChangeStart = loadStart.QuadPart;
+
+        IFR(Stop());
+        IFR(m_mediaPlayer.As(&spPlayerAsMediaPlayerSource));
+    }
+
+    ClearSubtitles();
+
+    if (m_fastStart)
+    {
+        LOG_RESULT(BeginFastStart(urls[0]));
+    }
+
+    // the first item is needed now, only the items after it are prefetched
+    ComPtr<IMediaSource2> spMediaSource2;
+    IFR(CreateMediaSource(urls[0].c_str(), &spMediaSource2));
+    ComPtr<IMediaSource4> spMediaSource4;
+    spMediaSource2.As(&spMediaSource4);
+    if (spMediaSource4.Get() != nullptr)
+    {
+        assert(m_spAdaptiveMediaSource.Get() == nullptr);
+        spMediaSource4->get_AdaptiveMediaSource(m_spAdaptiveMediaSource.ReleaseAndGetAddressOf());
+        LOG_RESULT(AddAdaptiveSourceHandlers(m_spAdaptiveMediaSource.Get(), true));
+
+        if (m_fastStart)
+        {
+            LOG_RESULT(ApplyFastStartBitrate(m_spAdaptiveMediaSource.Get()));
+        }
+
+        LOG_RESULT(BuildKeyframeIndex(urls[0]));
+
+        std::wstring url = urls[0];
+        UINT64 generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_subtitleLock);
+            generation = m_subtitleGeneration;
+        }
+        LOG_RESULT(m_workQueue.Queue([this, url, generation]()
+            {
+                LOG_RESULT_MSG(LoadSubtitleTracks(url, generation), L"AdaptiveStreamer - subtitle tracks unavailable");
+            }));
+    }
+
+    // the player renders the audio of a playlist itself, graph input nodes are bound to one source
+    ComPtr<IMediaPlaybackSource> spMediaPlaybackSource;
+    IFR(CreatePlaylistSource(spMediaSource2.Get(), &spMediaPlaybackSource));
+
+    ComPtr<IMediaPlaybackList> spPlaybackList;
+    IFR(spMediaPlaybackSource.As(&spPlaybackList));
+
+    {
+        std::lock_guard<std::mutex> lock(m_playlistLock);
+
+        auto currentItemChanged = Microsoft::WRL::Callback<ICurrentItemChangedEventHandler>(this, &AdaptiveStreamer::OnCurrentItemChanged);
+        IFR(spPlaybackList->add_CurrentItemChanged(currentItemChanged.Get(), &m_currentItemChangedToken));
+
+        m_spPlaybackList = spPlaybackList;
+        m_playlistUrls = urls;
+        m_nextPrefetchIndex = 1;
+    }
+
+    IFR(spPlayerAsMediaPlayerSource->put_Source(spMediaPlaybackSource.Get()));
+
+    // look ahead right away, the whole first item is the prefetch window
+    LOG_RESULT(PrefetchNextPlaylistItem());
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::BeginFastStart(const std::wstring& url)
+{
+    NULL_CHK_HR(m_prefetcher.get(), E_ILLEGAL_METHOD_CALL);
+
+    m_fastStartPending = true;
+
+    // lowest rung, from where the player starts, DownloadRequested serves the segments once the
+    // source asks for them. The manifests are read fresh, the source reloads them on its own.
+    return m_workQueue.Queue([this, url]()
+        {
+            PrefetchedItem item;
+            LOG_RESULT(m_prefetcher->PrefetchSegments(url, 0, FAST_START_PREFETCH_SEGMENTS, &item));
+        });
+}
+
+HRESULT AdaptiveStreamer::ApplyFastStartBitrate(IAdaptiveMediaSource* pSource)
+{
+    NULL_CHK(pSource);
+
+    ComPtr<ABI::Windows::Foundation::Collections::IVectorView<UINT32>> spBitrates;
+    IFR(pSource->get_AvailableBitrates(&spBitrates));
+
+    unsigned int count = 0;
+    IFR(spBitrates->get_Size(&count));
+    if (count == 0)
         return S_OK;
+
+    UINT32 lowest = 0;
+    IFR(spBitrates->GetAt(0, &lowest));
+    for (unsigned int i = 1; i < count; ++i)
+    {
+        UINT32 bitrate = 0;
+        IFR(spBitrates->GetAt(i, &bitrate));
+        lowest = (std::min)(lowest, bitrate);
     }
-    return E_ILLEGAL_METHOD_CALL;
+
+    // the controller steps up from the bottom once the hold is released
+    {
+        std::lock_guard<std::mutex> lock(m_abrLock);
+        if (m_abrController != nullptr)
+        {
+            m_abrController->StartAtLowest();
+        }
+    }
+
+    // held until OnDownloadCompleted sees a healthy buffer
+    ComPtr<ABI::Windows::Foundation::IReference<UINT32>> spCap;
+    CreateUInt32Reference(lowest, &spCap);
+    IFR(pSource->put_InitialBitrate(lowest));
+    IFR(pSource->put_DesiredMaxBitrate(spCap.Get()));
+    GetMetrics().bitrateCapBps.Set(lowest);
+
+    return S_OK;
 }
 
-HRESULT AdaptiveStreamer::PlayAudioGraph()
-{
-    ComPtr<IAudioNode> spNode;
-    m_audioInNode.As(&spNode);
-    spNode->Start();
-    m_audioOutNode.As(&spNode);
-    spNode->Start();
-    m_audioGraph->Start();
+HRESULT AdaptiveStreamer::QueueAudioGraphNodes(IMediaSource2* pSource)
+{
+    NULL_CHK(pSource);
+
+    {
+        std::lock_guard<std::mutex> lock(m_audioNodesLock);
+        m_audioNodesPending = true;
+    }
+
+    BuildAudioGraphNodes(pSource);
+
+    return S_OK;
+}
+
+// Starts the node creation on the calling thread and finishes on the one that completes it, no
+// thread waits for the node in between
+AsyncAction AdaptiveStreamer::BuildAudioGraphNodes(ComPtr<IMediaSource2> spSource)
+{
+    HRESULT hr = co_await CreateAudioGraphNodesAsync(spSource.Get());
+    LOG_RESULT(hr);
+
+    std::lock_guard<std::mutex> lock(m_audioNodesLock);
+    m_audioNodesPending = false;
+    m_audioNodesReady.notify_all();
+}
+
+// m_audioInNode is written by the queued node creation, wait before touching it
+void AdaptiveStreamer::WaitForAudioGraphNodes()
+{
+    std::unique_lock<std::mutex> lock(m_audioNodesLock);
+    m_audioNodesReady.wait(lock, [this]() { return !m_audioNodesPending; });
+}
+
+void AdaptiveStreamer::SetPrefetchSettings(const PREFETCH_SETTINGS& settings)
+{
+    if (m_prefetcher != nullptr)
+    {
+        m_prefetcher->SetSettings(settings);
+    }
+}
+
+void AdaptiveStreamer::SetSharedDevice(ID3D11Device* pDevice)
+{
+    m_d3dDevice = pDevice;
+    m_mediaDevice = pDevice;
+    m_sharedDevice = pDevice != nullptr;
+
+    // the device is multithread protected and ready, there is no engine to wait for
+    if (m_sharedDevice)
+    {
+        m_deviceNotReady = false;
+
+        m_copyTimer = std::make_unique<GpuTimer>();
+        LOG_RESULT_MSG(m_copyTimer->Initialize(pDevice), L"AdaptiveStreamer - frame copies are not GPU timed");
+    }
+    else
+    {
+        m_copyTimer = nullptr;
+    }
+}
+
+void AdaptiveStreamer::SetTaskPool(std::shared_ptr<TaskPool> taskPool)
+{
+    m_taskQueue.SetTaskPool(std::move(taskPool));
+}
+
+void AdaptiveStreamer::SetResourceBudget(UINT64 memoryBytes, UINT32 bandwidthBps)
+{
+    m_memoryBudgetBytes = memoryBytes;
+    m_bandwidthBudgetBps = bandwidthBps;
+
+    if (m_segmentCache != nullptr)
+    {
+        m_segmentCache->SetByteBudget(static_cast<size_t>(memoryBytes));
+    }
+}
+
+STREAMER_USAGE AdaptiveStreamer::GetUsage() const
+{
+    STREAMER_USAGE usage;
+    ZeroMemory(&usage, sizeof(usage));
+
+    usage.cpuTime = m_workQueue.CpuTime() + m_taskQueue.CpuTime() + m_callbackCpuTime;
+    if (m_downloadScheduler != nullptr)
+    {
+        usage.cpuTime += m_downloadScheduler->CpuTime();
+    }
+
+    usage.frameCopies = m_frameCopies;
+    usage.frameCopyCallSeconds = static_cast<double>(m_frameCopyTicks) / m_qpcFrequency.QuadPart;
+    usage.frameCopyCallMaxSeconds = static_cast<double>(m_frameCopyMaxTicks) / m_qpcFrequency.QuadPart;
+    usage.frameCopiesGpuTimed = m_frameCopiesGpuTimed;
+    usage.frameCopyGpuSeconds = m_frameCopyGpuNs / 1e9;
+    usage.frameCopyGpuMaxSeconds = m_frameCopyGpuMaxNs / 1e9;
+
+    if (m_segmentCache != nullptr)
+    {
+        usage.cacheBytes += m_segmentCache->SizeBytes();
+    }
+    if (m_iFrameCache != nullptr)
+    {
+        usage.cacheBytes += m_iFrameCache->SizeBytes();
+    }
+
+    // B8G8R8A8, the texture is opened on the media device without a copy
+    if (m_primaryTexture != nullptr)
+    {
+        usage.textureBytes = static_cast<UINT64>(m_textureDesc.Width) * m_textureDesc.Height * 4;
+    }
+
+    usage.memoryBudgetBytes = m_memoryBudgetBytes;
+    usage.bandwidthBudgetBps = m_bandwidthBudgetBps;
+
+    return usage;
+}
+
+HRESULT AdaptiveStreamer::PrefetchNextPlaylistItem()
+{
+    std::wstring url;
+    UINT64 generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_playlistLock);
+        if (m_spPlaybackList == nullptr || m_nextPrefetchIndex >= m_playlistUrls.size())
+            return S_OK;
+
+        url = m_playlistUrls[m_nextPrefetchIndex++];
+        generation = m_playlistGeneration;
+    }
+
+    // start the next item where the network is now, not at the lowest variant
+    UINT32 maxInitialBitrate = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_abrLock);
+        if (m_abrController != nullptr)
+        {
+            maxInitialBitrate = m_abrController->InitialBitrate();
+        }
+    }
+    if (maxInitialBitrate == 0 && m_spAdaptiveMediaSource != nullptr)
+    {
+        m_spAdaptiveMediaSource->get_CurrentDownloadBitrate(&maxInitialBitrate);
+    }
+
+    return m_workQueue.Queue([this, url, generation, maxInitialBitrate]()
+        {
+            PrefetchedItem item;
+            HRESULT hr = m_prefetcher->Prefetch(url, maxInitialBitrate, &item);
+            if (FAILED(hr))
+            {
+                LOG_RESULT_MSG(hr, L"AdaptiveStreamer - playlist item prefetch failed");
+                return;
+            }
+
+            m_decryptor->AddPlaylist(item.masterPlaylist, item.mediaPlaylist);
+
+            std::lock_guard<std::mutex> lock(m_playlistLock);
+            if (generation != m_playlistGeneration || m_spPlaybackList == nullptr)
+                return;
+
+            if (item.adaptiveMediaSource != nullptr)
+            {
+                LOG_RESULT(AddAdaptiveSourceHandlers(item.adaptiveMediaSource.Get(), false));
+            }
+
+            LOG_RESULT(AppendPlaylistItem(m_spPlaybackList.Get(), item.mediaSource.Get()));
+        });
+}
+
+void AdaptiveStreamer::ReleasePlaylist()
+{
+    std::lock_guard<std::mutex> lock(m_playlistLock);
+
+    if (m_spPlaybackList != nullptr)
+    {
+        LOG_RESULT(m_spPlaybackList->remove_CurrentItemChanged(m_currentItemChangedToken));
+        m_spPlaybackList.Reset();
+    }
+
+    m_playlistUrls.clear();
+    m_nextPrefetchIndex = 0;
+    m_playlistGeneration++;
+}
+
+HRESULT AdaptiveStreamer::BuildKeyframeIndex(const std::wstring& url)
+{
+    NULL_CHK_HR(m_spAdaptiveMediaSource.Get(), E_ILLEGAL_METHOD_CALL);
+
+    // index the variant the source starts on, a seek on another one reloads it
+    UINT32 bitrate = 0;
+    IFR(m_spAdaptiveMediaSource->get_InitialBitrate(&bitrate));
+
+    UINT64 generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_seekLock);
+        generation = m_seekIndexGeneration;
+    }
+
+    return m_workQueue.Queue([this, url, bitrate, generation]()
+        {
+            LOG_RESULT_MSG(LoadKeyframeIndex(url, bitrate, generation), L"AdaptiveStreamer - keyframe index unavailable");
+        });
+}
+
+// Resolves the media playlist of the variant and its init segment, the init segment is served
+// from the cache when the player asks for it. Registers the playlists with the decryptor and
+// starts following an LL-HLS playlist. Blocks on network I/O.
+HRESULT AdaptiveStreamer::LoadKeyframeIndex(const std::wstring& url, UINT32 bitrate, UINT64 generation)
+{
+    NULL_CHK_HR(m_seekFetcher.get(), E_ILLEGAL_METHOD_CALL);
+
+    PrefetchedItem item;
+    IFR(m_seekFetcher->PrefetchSegments(url, bitrate, 0, &item));
+    if (item.mediaPlaylist.segments.empty())
+        return E_NOT_SET;
+
+    m_decryptor->AddPlaylist(item.masterPlaylist, item.mediaPlaylist);
+
+    bool lowLatency = item.mediaPlaylist.partTargetDuration > 0.0 && !item.mediaPlaylist.endList;
+    std::string playlistUri = item.mediaPlaylist.uri;
+
+    HRESULT hr = IndexSeekPlaylist(url, generation, &item);
+    IFR(hr);
+    if (hr == S_FALSE)
+        return S_OK;
+
+    {
+        std::lock_guard<std::mutex> lock(m_downloadLock);
+        m_audioPlaylists.clear();
+        for (const HlsRendition& rendition : item.masterPlaylist.audio)
+        {
+            m_audioPlaylists.push_back(rendition.uri);
+        }
+    }
+
+    // LL-HLS live, the loader takes over the reloads of the variant
+    if (lowLatency)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lowLatencyLock);
+            m_lowLatencyVariants.clear();
+            for (const HlsVariant& variant : item.masterPlaylist.variants)
+            {
+                m_lowLatencyVariants.push_back(variant.uri);
+            }
+        }
+
+        IFR(FollowLowLatencyPlaylist(playlistUri));
+    }
+
+    return S_OK;
+}
+
+// The index alone, for a seek on another variant: the decryptor finds the variant's keys on its
+// own and the playlist following stays as it is. Blocks on network I/O.
+HRESULT AdaptiveStreamer::ReloadKeyframeIndex(const std::wstring& url, UINT32 bitrate, UINT64 generation)
+{
+    NULL_CHK_HR(m_seekFetcher.get(), E_ILLEGAL_METHOD_CALL);
+
+    PrefetchedItem item;
+    IFR(m_seekFetcher->PrefetchSegments(url, bitrate, 0, &item));
+    if (item.mediaPlaylist.segments.empty())
+        return E_NOT_SET;
+
+    HRESULT hr = IndexSeekPlaylist(url, generation, &item);
+    IFR(hr);
+
+    return S_OK;
+}
+
+// Swaps the seek index to the item's media playlist, S_FALSE when the content changed since generation
+HRESULT AdaptiveStreamer::IndexSeekPlaylist(const std::wstring& url, UINT64 generation, PrefetchedItem* pItem)
+{
+    Mp4MovieInfo movie = {};
+    bool hasMovie = false;
+    const HlsSegment& init = pItem->mediaPlaylist.initSegment;
+    if (!init.uri.empty())
+    {
+        SegmentBuffer spInit;
+        // needed before any segment, like a playlist
+        if (SUCCEEDED(m_seekFetcher->FetchToCache(init.uri, init.byteOffset, init.byteLength, &spInit, DownloadPriority::Playlist))
+            && SUCCEEDED(m_decryptor->Decrypt(init, spInit, true, &spInit)))
+        {
+            hasMovie = Mp4::ParseMovie(spInit->data(), spInit->size(), &movie);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_seekLock);
+    if (generation != m_seekIndexGeneration)
+        return S_FALSE;
+
+    // keyframes parsed against the old playlist must not land in this one
+    m_keyframeIndexVersion++;
+    m_keyframeIndex.Reset(pItem->mediaPlaylist);
+    m_seekPlaylist = std::move(pItem->mediaPlaylist);
+    m_seekMovie = movie;
+    m_hasSeekMovie = hasMovie;
+    m_seekHasVariants = !pItem->masterPlaylist.variants.empty();
+    m_seekContentUrl = url;
+    m_seekBitrate = pItem->selectedBitrate;
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::FollowLowLatencyPlaylist(const std::string& playlistUri)
+{
+    NULL_CHK_HR(m_lowLatencyLoader.get(), E_ILLEGAL_METHOD_CALL);
+
+    UINT64 generation = ++m_lowLatencyGeneration;
+    m_lowLatencyOffsetApplied = false;
+
+    return m_workQueue.Queue([this, playlistUri, generation]()
+        {
+            if (generation != m_lowLatencyGeneration)
+                return;
+
+            HRESULT hr = m_lowLatencyLoader->Start(playlistUri);
+            LOG_RESULT_MSG(hr, L"AdaptiveStreamer - LL-HLS playlist not followed");
+            if (hr == S_OK && generation == m_lowLatencyGeneration)
+            {
+                QueueLowLatencyReload(generation, 0);
+            }
+        });
+}
+
+// One blocking reload per work item, the next one is queued when it returns. A few failures in
+// a row hand the reloads back to the player.
+void AdaptiveStreamer::QueueLowLatencyReload(UINT64 generation, UINT32 failures)
+{
+    LOG_RESULT(m_workQueue.Queue([this, generation, failures]()
+        {
+            if (generation != m_lowLatencyGeneration)
+                return;
+
+            HRESULT hr = m_lowLatencyLoader->Reload();
+            if (hr == S_FALSE || generation != m_lowLatencyGeneration)
+                return; // ended, stopped or following another variant
+
+            if (FAILED(hr))
+            {
+                LOG_RESULT_MSG(hr, L"AdaptiveStreamer - blocking playlist reload failed");
+                if (failures + 1 >= LOW_LATENCY_MAX_RELOAD_FAILURES)
+                {
+                    m_lowLatencyLoader->Stop();
+                    return;
+                }
+            }
+
+            QueueLowLatencyReload(generation, FAILED(hr) ? failures + 1 : 0);
+        }));
+}
+
+void AdaptiveStreamer::StopLowLatency()
+{
+    m_lowLatencyGeneration++;
+    if (m_lowLatencyLoader != nullptr)
+    {
+        m_lowLatencyLoader->Stop();
+    }
+
+    std::lock_guard<std::mutex> lock(m_lowLatencyLock);
+    m_lowLatencyVariants.clear();
+}
+
+void AdaptiveStreamer::ClearKeyframeIndex()
+{
+    std::lock_guard<std::mutex> lock(m_seekLock);
+
+    m_keyframeIndex.Clear();
+    m_seekPlaylist = HlsMediaPlaylist();
+    m_hasSeekMovie = false;
+    m_seekContentUrl.clear();
+    m_seekIndexGeneration++;
+    m_keyframeIndexVersion++;
+}
+
+void AdaptiveStreamer::ParseSegmentKeyframes(size_t segmentIndex, UINT64 indexVersion, const SegmentBuffer& spSegment)
+{
+    Mp4MovieInfo movie;
+    bool hasMovie;
+    {
+        std::lock_guard<std::mutex> lock(m_seekLock);
+        movie = m_seekMovie;
+        hasMovie = m_hasSeekMovie;
+    }
+
+    // parsed outside the lock, a segment takes a few hundred microseconds
+    std::vector<double> offsets;
+    if (spSegment->size() >= TS_PACKET_SIZE && (*spSegment)[0] == TS_SYNC_BYTE)
+    {
+        Keyframes::FindInTransportStream(spSegment->data(), spSegment->size(), &offsets);
+    }
+    else if (hasMovie)
+    {
+        Keyframes::FindInFragments(spSegment->data(), spSegment->size(), movie, &offsets);
+    }
+
+    // the index was swapped while the segment was parsed, the offsets are of another playlist
+    std::lock_guard<std::mutex> lock(m_seekLock);
+    if (indexVersion != m_keyframeIndexVersion)
+        return;
+
+    m_keyframeIndex.SetSegmentKeyframes(segmentIndex, offsets);
+}
+
+HRESULT AdaptiveStreamer::AddAdaptiveSourceHandlers(IAdaptiveMediaSource* pSource, bool current)
+{
+    NULL_CHK(pSource);
+
+    AdaptiveSourceHooks hooks = {};
+    hooks.source = pSource;
+
+    auto downloadRequested = Microsoft::WRL::Callback<IDownloadRequestedEventHandler>(this, &AdaptiveStreamer::OnDownloadRequested);
+    IFR(pSource->add_DownloadRequested(downloadRequested.Get(), &hooks.downloadRequestedToken));
+
+    auto downloadCompleted = Microsoft::WRL::Callback<IDownloadCompletedEventHandler>(this, &AdaptiveStreamer::OnDownloadCompleted);
+    HRESULT hr = pSource->add_DownloadCompleted(downloadCompleted.Get(), &hooks.downloadCompletedToken);
+    if (FAILED(hr))
+    {
+        pSource->remove_DownloadRequested(hooks.downloadRequestedToken);
+        IFR(hr);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_hooksLock);
+        m_adaptiveSourceHooks.push_back(hooks);
+    }
+
+    // an upcoming item was started at the controller's choice by its prefetch, it gets the
+    // controller once it becomes current
+    if (!current)
+        return S_OK;
+
+    LOG_RESULT(ApplyAbrLadder(pSource));
+
+    UINT32 initialBitrate = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_abrLock);
+        if (m_abrController == nullptr || m_spAbrSource.Get() != pSource)
+            return S_OK;
+
+        initialBitrate = m_abrController->InitialBitrate();
+    }
+
+    IFR(pSource->put_InitialBitrate(initialBitrate));
+
+    return S_OK;
+}
+
+void AdaptiveStreamer::RemoveAdaptiveSourceHandlers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_hooksLock);
+
+        for (auto& hooks : m_adaptiveSourceHooks)
+        {
+            LOG_RESULT(hooks.source->remove_DownloadRequested(hooks.downloadRequestedToken));
+            LOG_RESULT(hooks.source->remove_DownloadCompleted(hooks.downloadCompletedToken));
+        }
+        m_adaptiveSourceHooks.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(m_abrLock);
+    m_spAbrSource.Reset();
+}
+
+void AdaptiveStreamer::SetAbrController(std::unique_ptr<AbrController> controller)
+{
+    std::lock_guard<std::mutex> lock(m_abrLock);
+    m_abrController = std::move(controller);
+}
+
+// Hands the ladder of the source that plays to the controller, which from then on decides for
+// that source only. The ladders of upcoming items may differ, they wait until their item is current.
+HRESULT AdaptiveStreamer::ApplyAbrLadder(IAdaptiveMediaSource* pSource)
+{
+    NULL_CHK(pSource);
+
+    ComPtr<ABI::Windows::Foundation::Collections::IVectorView<UINT32>> spBitrates;
+    IFR(pSource->get_AvailableBitrates(&spBitrates));
+
+    unsigned int count = 0;
+    IFR(spBitrates->get_Size(&count));
+
+    std::vector<uint32_t> ladder(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        IFR(spBitrates->GetAt(i, &ladder[i]));
+    }
+
+    std::lock_guard<std::mutex> lock(m_abrLock);
+    m_spAbrSource = pSource;
+    if (m_abrController != nullptr && !ladder.empty())
+    {
+        m_abrController->SetLadder(ladder);
+    }
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::ApplyAbrLadder(IMediaPlaybackItem* pItem)
+{
+    NULL_CHK(pItem);
+
+    ComPtr<IMediaSource2> spMediaSource2;
+    IFR(pItem->get_Source(&spMediaSource2));
+
+    ComPtr<IMediaSource4> spMediaSource4;
+    ComPtr<IAdaptiveMediaSource> spAdaptiveMediaSource;
+    if (spMediaSource2 == nullptr || FAILED(spMediaSource2.As(&spMediaSource4))
+        || FAILED(spMediaSource4->get_AdaptiveMediaSource(&spAdaptiveMediaSource)) || spAdaptiveMediaSource == nullptr)
+        return S_OK; // not adaptive, nothing to decide
+
+    return ApplyAbrLadder(spAdaptiveMediaSource.Get());
+}
+
+double AdaptiveStreamer::GetClockSeconds() const
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return static_cast<double>(now.QuadPart) / m_qpcFrequency.QuadPart;
+}
+
+ComPtr<IMediaPlaybackSession> AdaptiveStreamer::GetPlaybackSession() const
+{
+    std::lock_guard<std::mutex> lock(m_sessionLock);
+    return m_mediaPlaybackSession;
+}
+
+// Seconds of media buffered ahead of the playback position
+double AdaptiveStreamer::GetBufferedSeconds()
+{
+    ComPtr<IMediaPlaybackSession> spSession = GetPlaybackSession();
+    if (spSession == nullptr)
+        return 0.0;
+
+    ComPtr<IMediaPlaybackSession2> spSession2;
+    if (FAILED(spSession.As(&spSession2)))
+        return 0.0;
+
+    ABI::Windows::Foundation::TimeSpan position;
+    if (FAILED(spSession->get_Position(&position)))
+        return 0.0;
+
+    ComPtr<ABI::Windows::Foundation::Collections::IVectorView<MediaTimeRange>> spRanges;
+    if (FAILED(spSession2->GetBufferedRanges(&spRanges)))
+        return 0.0;
+
+    unsigned int count = 0;
+    spRanges->get_Size(&count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        MediaTimeRange range;
+        if (SUCCEEDED(spRanges->GetAt(i, &range))
+            && range.Start.Duration <= position.Duration && position.Duration <= range.End.Duration)
+        {
+            return (range.End.Duration - position.Duration) / 10000000.0;
+        }
+    }
+
+    return 0.0;
+}
+
+HRESULT AdaptiveStreamer::OnDownloadCompleted(IAdaptiveMediaSource* sender, IAdaptiveMediaSourceDownloadCompletedEventArgs* args)
+{
+    if (m_bIgnoreEvents)
+        return S_OK;
+
+    AdaptiveMediaSourceResourceType resourceType;
+    IFR(args->get_ResourceType(&resourceType));
+    if (resourceType != AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_MediaSegment)
+        return S_OK;
+
+    ComPtr<IAdaptiveMediaSourceDownloadCompletedEventArgs> spArgs(args);
+    ComPtr<IAdaptiveMediaSourceDownloadCompletedEventArgs2> spArgs2;
+    IFR(spArgs.As(&spArgs2));
+
+    UINT64 bytes = 0;
+    double seconds = 0.0;
+    if (!TakeScheduledSample(args, &bytes, &seconds))
+    {
+        ComPtr<IAdaptiveMediaSourceDownloadStatistics> spStatistics;
+        IFR(spArgs2->get_Statistics(&spStatistics));
+
+        IFR(spStatistics->get_ContentBytesReceivedCount(&bytes));
+
+        // request to last byte, latency included, is what the next segment will take too
+        ComPtr<ABI::Windows::Foundation::IReference<ABI::Windows::Foundation::TimeSpan>> spTimeToLastByte;
+        IFR(spStatistics->get_TimeToLastByteReceived(&spTimeToLastByte));
+        if (spTimeToLastByte == nullptr)
+            return S_OK;
+
+        ABI::Windows::Foundation::TimeSpan timeToLastByte;
+        IFR(spTimeToLastByte->get_Value(&timeToLastByte));
+        seconds = timeToLastByte.Duration / 10000000.0;
+    }
+
+    double bufferSeconds = GetBufferedSeconds();
+
+    // an upcoming item's downloads measure the same network, but neither fast start nor the
+    // controller's ladder are about its source
+    bool current = false;
+    {
+        std::lock_guard<std::mutex> lock(m_abrLock);
+        current = sender == m_spAbrSource.Get();
+    }
+
+    // fast start keeps the lowest rung until the buffer is healthy, then lets the controller step up
+    bool holdLowest = false;
+    if (m_fastStartPending && current)
+    {
+        holdLowest = bufferSeconds < FAST_START_HEALTHY_BUFFER_SECONDS;
+        if (!holdLowest && m_fastStartPending.exchange(false))
+        {
+            Log(Log_Level_Info, L"AdaptiveStreamer - fast start done, %.1f s buffered\n", bufferSeconds);
+            IFR(sender->put_DesiredMaxBitrate(nullptr));
+            GetMetrics().bitrateCapBps.Set(0);
+        }
+    }
+
+    UINT32 bitrate = 0;
+    double estimate = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(m_abrLock);
+        if (m_abrController == nullptr)
+            return S_OK;
+
+        m_abrController->OnDownloadCompleted(bytes, seconds);
+        if (!current)
+            return S_OK;
+
+        if (!holdLowest)
+        {
+            bitrate = m_abrController->Decide(bufferSeconds, GetClockSeconds());
+
+            // the stream's share of the host's bandwidth, the lowest rung when none fits
+            UINT32 budget = m_bandwidthBudgetBps;
+            if (budget != 0 && bitrate > budget)
+            {
+                const std::vector<uint32_t>& ladder = m_abrController->Ladder();
+                UINT32 capped = ladder.empty() ? budget : ladder.front();
+                for (uint32_t rung : ladder)
+                {
+                    if (rung <= budget)
+                    {
+                        capped = rung;
+                    }
+                }
+                bitrate = capped;
+            }
+        }
+        estimate = m_abrController->EstimateBps();
+    }
+
+    if (bitrate == 0)
+        return S_OK;
+
+    // only touch the source when the cap moves
+    UINT32 currentCap = 0;
+    ComPtr<ABI::Windows::Foundation::IReference<UINT32>> spCurrentCap;
+    if (SUCCEEDED(sender->get_DesiredMaxBitrate(&spCurrentCap)) && spCurrentCap != nullptr)
+    {
+        spCurrentCap->get_Value(&currentCap);
+    }
+
+    if (currentCap != bitrate)
+    {
+        ComPtr<ABI::Windows::Foundation::IReference<UINT32>> spCap;
+        CreateUInt32Reference(bitrate, &spCap);
+        IFR(sender->put_DesiredMaxBitrate(spCap.Get()));
+        GetMetrics().bitrateSwitches.Add();
+        GetMetrics().bitrateCapBps.Set(bitrate);
+
+        Log(Log_Level_Info, L"AdaptiveStreamer - ABR cap %u bps (estimate %u bps, buffer %.1f s)\n",
+            bitrate, static_cast<UINT32>(estimate), bufferSeconds);
+
+        // the link got slower, next item segments prefetched above the cap compete with this one's
+        if (m_downloadScheduler != nullptr && (currentCap == 0 || bitrate < currentCap))
+        {
+            m_downloadScheduler->Cancel([bitrate](const DownloadRequest& request)
+                {
+                    return request.origin == DownloadOrigin::Prefetch && request.bitrate > bitrate;
+                });
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::OnCurrentItemChanged(IMediaPlaybackList* sender, ICurrentMediaPlaybackItemChangedEventArgs* args)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_playlistLock);
+        if (m_bIgnoreEvents || sender != m_spPlaybackList.Get())
+            return S_OK;
+    }
+
+    // the controller follows the item that plays now, its ladder may differ from the last one's
+    ComPtr<IMediaPlaybackItem> spNewItem;
+    if (SUCCEEDED(args->get_NewItem(&spNewItem)) && spNewItem != nullptr)
+    {
+        LOG_RESULT(ApplyAbrLadder(spNewItem.Get()));
+    }
+
+    ComPtr<IMediaPlaybackItem> spOldItem;
+    IFR(args->get_OldItem(&spOldItem));
+
+    // a transition inside the playlist, timed until the first frame of the new item
+    if (spOldItem != nullptr)
+    {
+        LARGE_INTEGER switchStart;
+        QueryPerformanceCounter(&switchStart);
+        m_channelChangeStart = switchStart.QuadPart;
+
+        // the index described the old item, seeks in this one go straight to the position
+        ClearKeyframeIndex();
+        DetachTrickPlayer();
+        m_iFrameCache->Clear();
+        ResetTimedMetadataOrigin();
+        StopLowLatency();
+    }
+
+    // the next item was prefetched while this one played, fetch the one after it
+    return PrefetchNextPlaylistItem();
+}
+
+HRESULT AdaptiveStreamer::OnDownloadRequested(IAdaptiveMediaSource* sender, IAdaptiveMediaSourceDownloadRequestedEventArgs* args)
+{
+    // stopping or a pooled player that is not active, the source downloads on its own
+    if (m_bIgnoreEvents || m_segmentCache == nullptr)
+        return S_OK;
+
+    ComPtr<ABI::Windows::Foundation::IUriRuntimeClass> spUri;
+    IFR(args->get_ResourceUri(&spUri));
+
+    SafeString absoluteUri;
+    IFR(spUri->get_AbsoluteUri(absoluteUri.GetAddressOf()));
+
+    UINT64 offset = 0;
+    UINT64 length = 0;
+    ComPtr<ABI::Windows::Foundation::IReference<UINT64>> spOffset;
+    ComPtr<ABI::Windows::Foundation::IReference<UINT64>> spLength;
+    if (SUCCEEDED(args->get_ResourceByteRangeOffset(&spOffset)) && spOffset != nullptr)
+    {
+        spOffset->get_Value(&offset);
+    }
+    if (SUCCEEDED(args->get_ResourceByteRangeLength(&spLength)) && spLength != nullptr)
+    {
+        spLength->get_Value(&length);
+    }
+
+    AdaptiveMediaSourceResourceType resourceType;
+    IFR(args->get_ResourceType(&resourceType));
+
+    // only segments never change under their URI, a live playlist does on every reload
+    bool segment = resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_MediaSegment
+        || resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_InitializationSegment;
+    bool forkSegment = segment && HasSegmentConsumers();
+
+    if (resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_Manifest && m_lowLatencyLoader != nullptr)
+    {
+        std::string uri = WideToUtf8(absoluteUri.c_str());
+        std::string text;
+        if (m_lowLatencyLoader->GetPlayerPlaylist(uri, &text))
+        {
+            // the playlist is as fresh as the last blocking reload, the player can stay one
+            // segment behind the edge instead of three target durations
+            if (!m_lowLatencyOffsetApplied.exchange(true))
+            {
+                ABI::Windows::Foundation::TimeSpan liveOffset;
+                liveOffset.Duration = static_cast<INT64>(m_lowLatencyLoader->LiveOffset() * 10000000.0);
+                LOG_RESULT(sender->put_DesiredLiveOffset(liveOffset));
+            }
+
+            ComPtr<IBuffer> spBuffer;
+            IFR(CreateBufferFromBytes(reinterpret_cast<const BYTE*>(text.data()), static_cast<UINT32>(text.size()), &spBuffer));
+
+            ComPtr<IAdaptiveMediaSourceDownloadResult> spResult;
+            IFR(args->get_Result(&spResult));
+            IFR(spResult->put_Buffer(spBuffer.Get()));
+
+            return S_OK;
+        }
+
+        // an ABR switch, the loader moves to the variant the player moved to
+        bool variant = false;
+        {
+            std::lock_guard<std::mutex> lock(m_lowLatencyLock);
+            variant = std::find(m_lowLatencyVariants.begin(), m_lowLatencyVariants.end(), uri) != m_lowLatencyVariants.end();
+        }
+        if (variant)
+        {
+            LOG_RESULT(FollowLowLatencyPlaylist(uri));
+        }
+    }
+
+    std::string key = SegmentCache::MakeKey(WideToUtf8(absoluteUri.c_str()), offset, length);
+    SegmentBuffer spCached = segment ? m_segmentCache->Find(key) : nullptr;
+    if (spCached == nullptr && resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_MediaSegment
+        && m_lowLatencyLoader != nullptr)
+    {
+        // LL-HLS, the parts fetched while the segment was produced make it up
+        spCached = m_lowLatencyLoader->AssembleSegment(key);
+        if (spCached != nullptr)
+        {
+            m_segmentCache->Insert(key, spCached);
+        }
+    }
+
+    if (spCached != nullptr)
+    {
+        if (forkSegment)
+        {
+            // off the media thread, decryption may have to fetch its key
+            LOG_RESULT(m_taskQueue.Queue([this, key, spCached]()
+                {
+                    ForkSegment(key, spCached);
+                }));
+        }
+
+        ComPtr<IBuffer> spBuffer;
+        IFR(CreateBufferOverBytes(spCached, &spBuffer));
+
+        ComPtr<IAdaptiveMediaSourceDownloadResult> spResult;
+        IFR(args->get_Result(&spResult));
+        IFR(spResult->put_Buffer(spBuffer.Get()));
+
+        return S_OK;
+    }
+
+#ifndef SCHEDULE_PLAYER_DOWNLOADS
+    if (!forkSegment)
+        return S_OK; // not prefetched, the source downloads it
+#endif
+
+    if (m_downloadScheduler == nullptr)
+        return S_OK;
+
+    // downloaded here, in priority order with everything else, and one copy feeds both the player and the fork
+    ComPtr<IAdaptiveMediaSourceDownloadRequestedDeferral> spDeferral;
+    IFR(args->GetDeferral(&spDeferral));
+
+    ComPtr<IAdaptiveMediaSourceDownloadResult> spResult;
+    IFR(args->get_Result(&spResult));
+
+    DownloadRequest request;
+    request.url = absoluteUri.c_str();
+    request.offset = offset;
+    request.length = length;
+    request.priority = GetPlayerDownloadPriority(args, resourceType, key);
+    request.origin = DownloadOrigin::Player;
+
+    HRESULT hrSchedule = m_downloadScheduler->Schedule(std::move(request), [this, key, resourceType, forkSegment, spResult, spDeferral](const DownloadResult& result)
+        {
+            HRESULT hr = result.hr;
+            if (SUCCEEDED(hr))
+            {
+                OnScheduledDownloadCompleted(key, resourceType, result);
+
+                // the player reads the scheduler's buffer itself, no copy per segment
+                ComPtr<IBuffer> spBuffer;
+                hr = CreateBufferOverBytes(result.data, &spBuffer);
+                if (SUCCEEDED(hr))
+                {
+                    hr = spResult->put_Buffer(spBuffer.Get());
+                }
+            }
+
+            // on failure or cancellation the source falls back to its own download
+            if (hr != E_ABORT)
+            {
+                LOG_RESULT(hr);
+            }
+            spDeferral->Complete();
+
+            // after the player has its copy, demuxing and decrypting do not hold it up
+            if (SUCCEEDED(result.hr) && forkSegment)
+            {
+                SegmentBuffer spSegment = result.data;
+                LOG_RESULT(m_taskQueue.Queue([this, key, spSegment]()
+                    {
+                        ForkSegment(key, spSegment);
+                    }));
+            }
+        });
+
+    if (FAILED(hrSchedule))
+    {
+        spDeferral->Complete();
+    }
+
+    return S_OK;
+}
+
+// Throughput of a scheduled download for the ABR controller, found by the cache key of the request
+bool AdaptiveStreamer::TakeScheduledSample(IAdaptiveMediaSourceDownloadCompletedEventArgs* args, UINT64* pBytes, double* pSeconds)
+{
+    ComPtr<ABI::Windows::Foundation::IUriRuntimeClass> spUri;
+    SafeString absoluteUri;
+    if (FAILED(args->get_ResourceUri(&spUri)) || spUri == nullptr || FAILED(spUri->get_AbsoluteUri(absoluteUri.GetAddressOf())))
+        return false;
+
+    UINT64 offset = 0;
+    UINT64 length = 0;
+    ComPtr<ABI::Windows::Foundation::IReference<UINT64>> spOffset;
+    ComPtr<ABI::Windows::Foundation::IReference<UINT64>> spLength;
+    if (SUCCEEDED(args->get_ResourceByteRangeOffset(&spOffset)) && spOffset != nullptr)
+    {
+        spOffset->get_Value(&offset);
+    }
+    if (SUCCEEDED(args->get_ResourceByteRangeLength(&spLength)) && spLength != nullptr)
+    {
+        spLength->get_Value(&length);
+    }
+
+    std::string key = SegmentCache::MakeKey(WideToUtf8(absoluteUri.c_str()), offset, length);
+
+    std::lock_guard<std::mutex> lock(m_downloadLock);
+    auto it = std::find_if(m_scheduledSamples.begin(), m_scheduledSamples.end(), [&key](const ThroughputSample& sample) { return sample.key == key; });
+    if (it == m_scheduledSamples.end())
+        return false;
+
+    *pBytes = it->bytes;
+    *pSeconds = it->seconds;
+    m_scheduledSamples.erase(it);
+    return true;
+}
+
+// Playlists and keys first, then audio before video and the segments the playhead is about to
+// reach before the ones further ahead
+DownloadPriority AdaptiveStreamer::GetPlayerDownloadPriority(IAdaptiveMediaSourceDownloadRequestedEventArgs* args, AdaptiveMediaSourceResourceType resourceType, const std::string& key)
+{
+    if (resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_Manifest
+        || resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_Key)
+        return DownloadPriority::Playlist;
+
+    bool audio = false;
+    {
+        std::lock_guard<std::mutex> lock(m_downloadLock);
+        for (const auto& playlist : m_audioSegmentKeys)
+        {
+            if (playlist.second.count(key) != 0)
+            {
+                audio = true;
+                break;
+            }
+        }
+    }
+
+    // an init segment holds up every segment after it
+    bool nearPlayhead = resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_InitializationSegment;
+    if (!nearPlayhead)
+    {
+        double ahead = 0.0;
+        ComPtr<IAdaptiveMediaSourceDownloadRequestedEventArgs> spArgs(args);
+        ComPtr<IAdaptiveMediaSourceDownloadRequestedEventArgs2> spArgs2;
+        ComPtr<ABI::Windows::Foundation::IReference<ABI::Windows::Foundation::TimeSpan>> spSegmentStart;
+        ABI::Windows::Foundation::TimeSpan segmentStart;
+        ABI::Windows::Foundation::TimeSpan position;
+        ComPtr<IMediaPlaybackSession> spSession = GetPlaybackSession();
+        if (spSession != nullptr
+            && SUCCEEDED(spArgs.As(&spArgs2)) && SUCCEEDED(spArgs2->get_Position(&spSegmentStart)) && spSegmentStart != nullptr
+            && SUCCEEDED(spSegmentStart->get_Value(&segmentStart)) && SUCCEEDED(spSession->get_Position(&position)))
+        {
+            ahead = (segmentStart.Duration - position.Duration) / 10000000.0;
+        }
+        else
+        {
+            // the source asks for the segment at the end of the buffer
+            ahead = GetBufferedSeconds();
+        }
+
+        nearPlayhead = ahead < DOWNLOAD_NEAR_PLAYHEAD_SECONDS;
+    }
+
+    if (audio)
+        return nearPlayhead ? DownloadPriority::AudioNearPlayhead : DownloadPriority::AudioLookahead;
+
+    return nearPlayhead ? DownloadPriority::VideoNearPlayhead : DownloadPriority::VideoLookahead;
+}
+
+void AdaptiveStreamer::OnScheduledDownloadCompleted(const std::string& key, AdaptiveMediaSourceResourceType resourceType, const DownloadResult& result)
+{
+    if (resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_MediaSegment
+        || resourceType == AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_InitializationSegment)
+    {
+        m_segmentCache->Insert(key, result.data);
+
+        // DownloadCompleted times the hand over of the buffer, the ABR controller needs the network's time
+        std::lock_guard<std::mutex> lock(m_downloadLock);
+        m_scheduledSamples.push_back({ key, result.data->size(), result.downloadSeconds });
+        if (m_scheduledSamples.size() > SCHEDULED_THROUGHPUT_SAMPLES)
+        {
+            m_scheduledSamples.pop_front();
+        }
+        return;
+    }
+
+    if (resourceType != AdaptiveMediaSourceResourceType::AdaptiveMediaSourceResourceType_Manifest)
+        return;
+
+    // the key of a whole resource is its URI
+    {
+        std::lock_guard<std::mutex> lock(m_downloadLock);
+        if (std::find(m_audioPlaylists.begin(), m_audioPlaylists.end(), key) == m_audioPlaylists.end())
+            return;
+    }
+
+    // the segments of an audio rendition are scheduled ahead of the video ones
+    HlsMediaPlaylist playlist;
+    if (!Hls::ParseMediaPlaylist(std::string(result.data->begin(), result.data->end()), key, &playlist))
+        return;
+
+    std::unordered_set<std::string> keys;
+    if (!playlist.initSegment.uri.empty())
+    {
+        keys.insert(SegmentCache::MakeKey(playlist.initSegment.uri, playlist.initSegment.byteOffset, playlist.initSegment.byteLength));
+    }
+    for (const HlsSegment& segment : playlist.segments)
+    {
+        keys.insert(SegmentCache::MakeKey(segment.uri, segment.byteOffset, segment.byteLength));
+    }
+
+    std::lock_guard<std::mutex> lock(m_downloadLock);
+    m_audioSegmentKeys[key] = std::move(keys);
+}
+
+void AdaptiveStreamer::SetAudioForkCallback(AudioForkCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_audioForkLock);
+    m_audioForkCallback = std::move(callback);
+}
+
+std::shared_ptr<AdaptiveStreamer::TimedMetadataQueue> AdaptiveStreamer::SubscribeTimedMetadata(size_t capacity)
+{
+    auto queue = std::make_shared<TimedMetadataQueue>(capacity);
+
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    m_metadataQueues.push_back(queue);
+
+    return queue;
+}
+
+void AdaptiveStreamer::UnsubscribeTimedMetadata(const std::shared_ptr<TimedMetadataQueue>& queue)
+{
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    m_metadataQueues.erase(std::remove(m_metadataQueues.begin(), m_metadataQueues.end(), queue), m_metadataQueues.end());
+}
+
+bool AdaptiveStreamer::HasSegmentConsumers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        if (m_audioForkCallback || m_forkedAudioInput != nullptr)
+            return true;
+    }
+
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    return !m_metadataQueues.empty();
+}
+
+void AdaptiveStreamer::ResetTimedMetadataOrigin()
+{
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    m_hasMetadataOrigin = false;
+}
+
+// The graph plays the audio of the segments the player downloads, the fork hands it to a frame
+// input node. A stream the node cannot decode falls back to a media source input node.
+HRESULT AdaptiveStreamer::StartForkedAudioInput(const std::wstring& url)
+{
+    NULL_CHK_HR(m_audioGraph.Get(), E_UNEXPECTED);
+    NULL_CHK_HR(m_audioOutNode.Get(), E_UNEXPECTED);
+
+    ComPtr<IAudioNode> spOutputNode;
+    IFR(m_audioOutNode.As(&spOutputNode));
+
+    UINT64 generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        generation = ++m_forkedAudioGeneration;
+    }
+
+    std::shared_ptr<ForkedAudioInput> input;
+    IFR(ForkedAudioInput::Create(m_audioGraph.Get(), spOutputNode.Get(), [this, url, generation]()
+        {
+            // runs inside the fork, the fallback creates nodes and waits for nothing there
+            LOG_RESULT(m_workQueue.Queue([this, url, generation]()
+                {
+                    FallBackFromForkedAudioInput(url, generation);
+                }));
+        }, &input));
+
+    std::lock_guard<std::mutex> lock(m_audioForkLock);
+    m_forkedAudioInput = std::move(input);
+
+    return S_OK;
+}
+
+void AdaptiveStreamer::StopForkedAudioInput()
+{
+    std::shared_ptr<ForkedAudioInput> input;
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        input = std::move(m_forkedAudioInput);
+        m_forkedAudioInput = nullptr;
+    }
+
+    // a segment being forked may hold it a little longer, closed it plays nothing more
+    if (input != nullptr)
+    {
+        input->Close();
+    }
+}
+
+void AdaptiveStreamer::ResetForkedAudioInput()
+{
+    std::shared_ptr<ForkedAudioInput> input;
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        input = m_forkedAudioInput;
+    }
+
+    if (input != nullptr)
+    {
+        input->Reset();
+    }
+}
+
+// The fork carries audio the frame input node cannot decode, AC-3 or fMP4, the graph gets a
+// media source of its own as it would without AUDIOGRAPH_FORKED_INPUT
+void AdaptiveStreamer::FallBackFromForkedAudioInput(const std::wstring& url, UINT64 generation)
+{
+    // held until the nodes are queued, ReleaseMediaPlayer stops the input before it waits for them
+    std::lock_guard<std::mutex> lock(m_audioForkLock);
+    if (m_forkedAudioInput == nullptr || generation != m_forkedAudioGeneration)
+        return;
+
+    m_forkedAudioInput->Close();
+    m_forkedAudioInput = nullptr;
+
+    ComPtr<IMediaSource2> spMediaSourceForAudioGraph;
+    HRESULT hr = CreateMediaSource(url.c_str(), &spMediaSourceForAudioGraph);
+    if (SUCCEEDED(hr))
+    {
+        hr = QueueAudioGraphNodes(spMediaSourceForAudioGraph.Get());
+    }
+    LOG_RESULT_MSG(hr, L"AdaptiveStreamer - the audio graph has no input for this content");
+}
+
+// Hands the audio of a segment to the fork callback and its ID3 metadata to the subscribers,
+// AES-128 segments are decrypted first.
+// MPEG-TS segments are demuxed once for both, packed audio goes through its cached frame index,
+// fMP4 init segments remember the track table and fMP4 media segments are indexed in place.
+void AdaptiveStreamer::ForkSegment(const std::string& key, const SegmentBuffer& spEncrypted)
+{
+    SegmentBuffer spSegment;
+    HRESULT hr = m_decryptor->Decrypt(key, spEncrypted, &spSegment);
+    if (FAILED(hr))
+    {
+        LOG_RESULT_MSG(hr, L"AdaptiveStreamer - segment not forked, it could not be decrypted");
+        return;
+    }
+
+    const std::vector<uint8_t>& segment = *spSegment;
+
+    AudioForkCallback callback;
+    std::shared_ptr<ForkedAudioInput> forkedInput;
+    Mp4MovieInfo movie;
+    bool hasMovie;
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        callback = m_audioForkCallback;
+        forkedInput = m_forkedAudioInput;
+        movie = m_fmp4Movie;
+        hasMovie = m_hasFmp4Movie;
+    }
+
+    // the graph's input takes the audio next to the application's callback
+    if (forkedInput != nullptr)
+    {
+        callback = [forkedInput, applicationCallback = std::move(callback)](const PesPacket& packet)
+            {
+                forkedInput->Push(packet);
+                if (applicationCallback)
+                {
+                    applicationCallback(packet);
+                }
+            };
+    }
+
+    bool metadata = false;
+    {
+        std::lock_guard<std::mutex> lock(m_metadataLock);
+        metadata = !m_metadataQueues.empty();
+    }
+
+    if (segment.size() >= TS_PACKET_SIZE && segment[0] == TS_SYNC_BYTE)
+    {
+        std::vector<Id3Cue> cues;
+        int64_t earliestPts = 0;
+        bool hasPts = false;
+
+        TsDemuxer demuxer([&](const PesPacket& packet)
+            {
+                if (packet.hasPts && (!hasPts || packet.pts < earliestPts))
+                {
+                    earliestPts = packet.pts;
+                    hasPts = true;
+                }
+
+                TsElementaryStream stream = { packet.pid, packet.streamType };
+                if (stream.IsAudio() && callback)
+                {
+                    callback(packet);
+                }
+                else if (metadata && packet.hasPts && packet.streamType == static_cast<uint8_t>(TsStreamType::TsStreamType_Id3Metadata))
+                {
+                    Id3Cue cue;
+                    cue.pts = packet.pts;
+                    if (Id3::ParseTags(packet.data, packet.size, &cue.frames))
+                    {
+                        cues.push_back(std::move(cue));
+                    }
+                }
+            });
+
+        demuxer.Push(segment.data(), segment.size());
+        demuxer.Flush();
+
+        if (metadata && hasPts)
+        {
+            PublishTimedMetadata(key, cues, earliestPts);
+        }
+        return;
+    }
+
+    // timed metadata rides in MPEG-TS only, the rest is audio
+    if (!callback)
+        return;
+
+    AudioFrameHeader header;
+    if (AudioFrames::GetId3TagSize(segment.data(), segment.size()) != 0
+        || AudioFrames::ParseHeader(segment.data(), segment.size(), &header))
+    {
+        ForkPackedAudio(key, spSegment, callback);
+        return;
+    }
+
+    if (Mp4::ParseMovie(segment.data(), segment.size(), &movie))
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        m_fmp4Movie = movie;
+        m_hasFmp4Movie = hasMovie = true;
+    }
+
+    if (hasMovie)
+    {
+        ForkFragmentedAudio(segment, movie, callback);
+    }
+}
+
+// Stamps the cues with their playback clock time and pushes them to every subscriber. A cue is
+// at the playlist start time of its segment plus its PTS distance from the segment's first PTS.
+// A segment no playlist lists is placed by the last one that was listed.
+void AdaptiveStreamer::PublishTimedMetadata(const std::string& key, std::vector<Id3Cue>& cues, int64_t segmentPts)
+{
+    // 33-bit PTS, the difference wraps with it
+    auto ptsSeconds = [](int64_t pts, int64_t from)
+        {
+            int64_t elapsed = (pts - from) & ((1LL << 33) - 1);
+            if (elapsed >= (1LL << 32))
+            {
+                elapsed -= (1LL << 33);
+            }
+            return elapsed / 90000.0;
+        };
+
+    double startTime = 0.0;
+    bool listed = m_decryptor->FindStartTime(key, &startTime);
+
+    std::vector<std::shared_ptr<TimedMetadataQueue>> queues;
+    {
+        std::lock_guard<std::mutex> lock(m_metadataLock);
+        if (listed)
+        {
+            m_metadataOriginPts = segmentPts;
+            m_metadataOriginTime = startTime;
+            m_hasMetadataOrigin = true;
+        }
+        else if (!m_hasMetadataOrigin)
+        {
+            m_metadataOriginPts = segmentPts;
+            m_metadataOriginTime = 0.0;
+            m_hasMetadataOrigin = true;
+        }
+        else
+        {
+            startTime = m_metadataOriginTime + ptsSeconds(segmentPts, m_metadataOriginPts);
+        }
+
+        queues = m_metadataQueues;
+    }
+
+    for (Id3Cue& cue : cues)
+    {
+        cue.time = startTime + ptsSeconds(cue.pts, segmentPts);
+
+        for (const std::shared_ptr<TimedMetadataQueue>& queue : queues)
+        {
+            // the producer never waits, a subscriber that falls behind loses cues
+            if (!queue->TryPush(cue))
+            {
+                Log(Log_Level_Warning, L"AdaptiveStreamer - timed metadata queue full, cue at %.3f s dropped\n", cue.time);
+            }
+        }
+    }
+}
+
+void AdaptiveStreamer::ForkPackedAudio(
+    const std::string& key,
+    const SegmentBuffer& spSegment,
+    const AudioForkCallback& callback)
+{
+    // built once per cached segment, replays and cache hits reuse it
+    SegmentAudioIndex spIndex = m_segmentCache->FindAudioIndex(key);
+    if (spIndex == nullptr)
+    {
+        auto spBuilt = std::make_shared<AudioFrameIndex>();
+        if (!AudioFrames::IndexElementaryStream(spSegment->data(), spSegment->size(), 0, spBuilt.get()))
+            return;
+
+        spBuilt->frames.shrink_to_fit();
+        m_segmentCache->SetAudioIndex(key, spBuilt);
+        spIndex = spBuilt;
+    }
+
+    for (const AudioFrame& frame : spIndex->frames)
+    {
+        PesPacket packet = {};
+        packet.streamType = static_cast<uint8_t>(
+            (frame.codec == AudioCodec::AudioCodec_Aac) ? TsStreamType::TsStreamType_AacAdts
+            : (frame.codec == AudioCodec::AudioCodec_Ac3) ? TsStreamType::TsStreamType_Ac3
+            : TsStreamType::TsStreamType_Eac3);
+        packet.hasPts = true;
+        packet.hasDts = true;
+        packet.pts = frame.pts;
+        packet.dts = frame.pts;
+        packet.data = spSegment->data() + frame.offset;
+        packet.size = frame.size;
+
+        callback(packet);
+    }
+}
+
+void AdaptiveStreamer::ForkFragmentedAudio(
+    const std::vector<uint8_t>& segment,
+    const Mp4MovieInfo& movie,
+    const AudioForkCallback& callback)
+{
+    // count first so the index is sized once
+    Mp4FragmentStats stats;
+    if (!Mp4::IndexFragments(segment.data(), segment.size(), movie, nullptr, 0, &stats) || stats.sampleCount == 0)
+        return;
+
+    std::vector<Mp4Sample> samples(stats.sampleCount);
+    if (!Mp4::IndexFragments(segment.data(), segment.size(), movie, samples.data(), samples.size(), &stats))
+        return;
+
+    for (const Mp4Sample& sample : samples)
+    {
+        const Mp4TrackInfo& track = movie.tracks[sample.trackIndex];
+        if (track.handler != Mp4FourCC("soun") || track.timescale == 0)
+            continue;
+
+        // raw access units, pid is the track id and the timestamps are rescaled to 90 kHz
+        PesPacket packet = {};
+        packet.pid = static_cast<uint16_t>(track.trackId);
+        packet.hasPts = true;
+        packet.hasDts = true;
+        packet.dts = static_cast<int64_t>(sample.decodeTime * 90000 / track.timescale);
+        packet.pts = packet.dts + static_cast<int64_t>(sample.compositionOffset) * 90000 / track.timescale;
+        packet.data = segment.data() + sample.offset;
+        packet.size = sample.size;
+
+        callback(packet);
+    }
+}
+
+HRESULT AdaptiveStreamer::Play()
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::Play()");
+
+    if (nullptr != m_mediaPlayer)
+    {
+        IFR(m_mediaPlayer->Play());
+#ifdef USE_AUDIOGRAPH
+        IFR(PlayAudioGraph());
+#endif
+        return S_OK;
+    }
+    return E_ILLEGAL_METHOD_CALL;
+}
+
+HRESULT AdaptiveStreamer::PlayAudioGraph()
+{
+    WaitForAudioGraphNodes();
+
+    bool forkedInput = false;
+    {
+        std::lock_guard<std::mutex> lock(m_audioForkLock);
+        forkedInput = m_forkedAudioInput != nullptr;
+    }
+
+    // playlists play their audio through the player
+    if ((m_audioInNode == nullptr && !forkedInput) || m_audioGraph == nullptr)
+        return S_OK;
+
+    // the forked input creates its node, started, once the first audio is downloaded
+    ComPtr<IAudioNode> spNode;
+    if (m_audioInNode != nullptr)
+    {
+        m_audioInNode.As(&spNode);
+        spNode->Start();
+    }
+    m_audioOutNode.As(&spNode);
+    spNode->Start();
+    m_audioGraph->Start();
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::Pause()
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::Pause()");
+
+    if (nullptr != m_mediaPlayer)
+    {
+        IFR(m_mediaPlayer->Pause());
+        return S_OK;
+    }
+    return E_ILLEGAL_METHOD_CALL;
+}
+
+HRESULT AdaptiveStreamer::Seek(INT64 position)
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::Seek()");
+
+    NULL_CHK_HR(m_mediaPlaybackSession.Get(), E_ILLEGAL_METHOD_CALL);
+
+    boolean canSeek = false;
+    IFR(m_mediaPlaybackSession->get_CanSeek(&canSeek));
+    if (!canSeek)
+        return E_ILLEGAL_METHOD_CALL;
+
+    LARGE_INTEGER seekStart;
+    QueryPerformanceCounter(&seekStart);
+    m_seekStart = seekStart.QuadPart;
+
+    UINT64 seekId = ++m_seekId;
+
+    // what was fetched ahead of the old position only holds up the new one, the index stays
+    if (m_downloadScheduler != nullptr)
+    {
+        m_downloadScheduler->Cancel([](const DownloadRequest& request)
+            {
+                if (request.origin == DownloadOrigin::Seek)
+                    return request.priority != DownloadPriority::Playlist;
+
+                return request.origin == DownloadOrigin::Player
+                    && (request.priority == DownloadPriority::AudioLookahead || request.priority == DownloadPriority::VideoLookahead);
+            });
+    }
+
+    // the segment has to come from the variant the player will request
+    UINT32 bitrate = 0;
+    if (m_spAdaptiveMediaSource != nullptr)
+    {
+        m_spAdaptiveMediaSource->get_CurrentDownloadBitrate(&bitrate);
+    }
+
+    double seconds = static_cast<double>(position) / 10000000.0;
+    ComPtr<IMediaPlaybackSession> spSession = GetPlaybackSession();
+
+    // a cached target seeks right here, one that needs the network goes to the work queue
+    HRESULT hr = SeekToKeyframe(spSession.Get(), seconds, bitrate, seekId, false);
+    if (hr == S_FALSE)
+    {
+        hr = m_workQueue.Queue([this, spSession, seconds, bitrate, seekId]()
+            {
+                LOG_RESULT(SeekToKeyframe(spSession.Get(), seconds, bitrate, seekId, true));
+            });
+    }
+
+    return hr;
+}
+
+HRESULT AdaptiveStreamer::SeekToKeyframe(IMediaPlaybackSession* pSession, double position, UINT32 bitrate, UINT64 seekId, bool allowFetch)
+{
+    NULL_CHK(pSession);
+
+    SeekTarget target = {};
+    bool indexed = false;
+
+    // the second pass looks again once the target segment's own keyframes are known
+    for (int pass = 0; pass < 2 && m_seekFetcher != nullptr; ++pass)
+    {
+        HlsSegment segment;
+        std::wstring contentUrl;
+        UINT64 generation = 0;
+        UINT64 indexVersion = 0;
+        bool variantChanged = false;
+        {
+            std::lock_guard<std::mutex> lock(m_seekLock);
+            indexed = m_keyframeIndex.Lookup(position, &target);
+            variantChanged = m_seekHasVariants && bitrate != 0 && bitrate != m_seekBitrate;
+            contentUrl = m_seekContentUrl;
+            generation = m_seekIndexGeneration;
+            indexVersion = m_keyframeIndexVersion;
+            if (indexed)
+            {
+                segment = m_seekPlaylist.segments[target.segmentIndex];
+            }
+        }
+
+        if (!indexed)
+            break; // not HLS or the index is not loaded yet
+
+        if (variantChanged)
+        {
+            if (!allowFetch)
+                return S_FALSE;
+
+            IFR(ReloadKeyframeIndex(contentUrl, bitrate, generation));
+            pass--;
+            bitrate = 0; // loaded for it, do not come back here
+            continue;
+        }
+
+        SegmentBuffer spSegment = m_segmentCache->Find(SegmentCache::MakeKey(segment.uri, segment.byteOffset, segment.byteLength));
+        if (spSegment == nullptr)
+        {
+            if (!allowFetch)
+                return S_FALSE;
+
+            IFR(m_seekFetcher->FetchToCache(segment.uri, segment.byteOffset, segment.byteLength, &spSegment, DownloadPriority::VideoNearPlayhead));
+        }
+
+        if (target.parsed)
+            break;
+
+        HRESULT hr = m_decryptor->Decrypt(segment, spSegment, allowFetch, &spSegment);
+        if (hr == E_PENDING)
+            return S_FALSE;
+
+        // one that cannot be decrypted seeks to its start, as if it had no keyframes
+        LOG_RESULT(hr);
+        ParseSegmentKeyframes(target.segmentIndex, indexVersion, spSegment);
+    }
+
+    // a newer seek took over while this one waited for the network
+    if (seekId != m_seekId)
+        return S_OK;
+
+    ABI::Windows::Foundation::TimeSpan time;
+    time.Duration = static_cast<INT64>((indexed ? target.keyframeTime : position) * 10000000.0 + 0.5);
+    IFR(pSession->put_Position(time));
+
+    // the audio queued for the graph is from the old position
+    ResetForkedAudioInput();
+
+    if (indexed)
+    {
+        Log(Log_Level_Info, L"AdaptiveStreamer - seek to %.3f s snapped to %.3f s in segment %zu (%s)\n",
+            position, target.keyframeTime, target.segmentIndex, target.parsed ? L"keyframe" : L"segment start");
+    }
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::StartTrickPlay(double speed)
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::StartTrickPlay()");
+
+    NULL_CHK_HR(m_mediaPlaybackSession.Get(), E_ILLEGAL_METHOD_CALL);
+    NULL_CHK_HR(m_iFrameCache.get(), E_ILLEGAL_METHOD_CALL);
+
+    // the I-frame playlist is found through the master playlist the seek index was loaded from
+    std::wstring url;
+    {
+        std::lock_guard<std::mutex> lock(m_seekLock);
+        url = m_seekContentUrl;
+    }
+
+    if (url.empty())
+        return E_ILLEGAL_METHOD_CALL; // not HLS or its playlist is not loaded yet
+
+    UINT64 trickPlayId = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_trickPlayLock);
+        m_trickPlaySpeed = speed;
+        if (m_trickPlayer != nullptr)
+        {
+            m_trickPlayer->SetSpeed(speed);
+            return S_OK;
+        }
+
+        trickPlayId = ++m_trickPlayId;
+    }
+
+    ABI::Windows::Foundation::TimeSpan position;
+    IFR(m_mediaPlaybackSession->get_Position(&position));
+    IFR(m_mediaPlayer->Pause());
+
+    double seconds = static_cast<double>(position.Duration) / 10000000.0;
+
+    return m_workQueue.Queue([this, url, seconds, trickPlayId]()
+        {
+            LOG_RESULT_MSG(BeginTrickPlay(url, seconds, trickPlayId), L"AdaptiveStreamer - trick play unavailable");
+        });
+}
+
+// Resolves the I-frame playlist and starts the thumbnails. Blocks on network I/O.
+HRESULT AdaptiveStreamer::BeginTrickPlay(const std::wstring& url, double position, UINT64 trickPlayId)
+{
+    auto trickPlayer = std::make_unique<TrickPlayer>(m_iFrameCache, m_prefetcher.get());
+
+    TrickPlayer* pTrickPlayer = trickPlayer.get();
+    IFR(trickPlayer->Initialize(url, [this, pTrickPlayer]() { OnTrickPlayFrame(pTrickPlayer); }));
+
+    {
+        std::lock_guard<std::mutex> lock(m_trickPlayLock);
+        if (trickPlayId == m_trickPlayId)
+        {
+            IFR(trickPlayer->Start(position, m_trickPlaySpeed));
+            m_trickPlayer = std::move(trickPlayer);
+            return S_OK;
+        }
+    }
+
+    // trick play ended while the playlist loaded, the player goes outside the lock
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::SetTrickPlaySpeed(double speed)
+{
+    std::lock_guard<std::mutex> lock(m_trickPlayLock);
+    m_trickPlaySpeed = speed;
+    if (m_trickPlayer != nullptr)
+    {
+        m_trickPlayer->SetSpeed(speed);
+    }
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::StopTrickPlay(bool resume)
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::StopTrickPlay()");
+
+    NULL_CHK_HR(m_mediaPlayer.Get(), E_ILLEGAL_METHOD_CALL);
+
+    std::unique_ptr<TrickPlayer> trickPlayer = DetachTrickPlayer();
+    if (trickPlayer != nullptr)
+    {
+        double position = 0.0;
+        double iFrameBitsPerSecond = trickPlayer->GetFetchedBitsPerSecond();
+        HRESULT hr = trickPlayer->Stop(&position);
+        trickPlayer.reset();
+        IFR(hr);
+
+        UINT32 bitrate = 0;
+        if (m_spAdaptiveMediaSource != nullptr)
+        {
+            m_spAdaptiveMediaSource->get_CurrentDownloadBitrate(&bitrate);
+        }
+
+        Log(Log_Level_Info, L"AdaptiveStreamer - trick play fetched %.0f kbps of I-frames, the stream plays at %u kbps\n",
+            iFrameBitsPerSecond / 1000.0, bitrate / 1000);
+
+        IFR(Seek(static_cast<INT64>(position * 10000000.0 + 0.5)));
+    }
+
+    if (resume)
+    {
+        IFR(m_mediaPlayer->Play());
+    }
+
+    return S_OK;
+}
+
+std::unique_ptr<TrickPlayer> AdaptiveStreamer::DetachTrickPlayer()
+{
+    // thumbnails that will not be shown
+    if (m_downloadScheduler != nullptr)
+    {
+        m_downloadScheduler->Cancel([](const DownloadRequest& request) { return request.origin == DownloadOrigin::TrickPlay; });
+    }
+
+    std::lock_guard<std::mutex> lock(m_trickPlayLock);
+    m_trickPlayId++;
+    return std::move(m_trickPlayer);
+}
+
+std::vector<SUBTITLE_TRACK> AdaptiveStreamer::GetSubtitleTracks()
+{
+    std::lock_guard<std::mutex> lock(m_subtitleLock);
+    return m_subtitleTracks;
+}
+
+HRESULT AdaptiveStreamer::SelectSubtitleTrack(int index)
+{
+    Log(Log_Level_Info, L"AdaptiveStreamer::SelectSubtitleTrack()");
+
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (index >= static_cast<int>(m_subtitleTracks.size()))
+            return E_INVALIDARG;
+
+        m_subtitleTrack = (index < 0) ? -1 : index;
+        m_subtitleCues.Clear();
+        m_subtitleCursor = WebVttCursor();
+        m_subtitleNextSequence = 0;
+        m_subtitleLive = false;
+        m_subtitleLoading = false;
+        m_subtitleRefreshTime = 0.0;
+        m_subtitleGeneration++;
+
+        if (m_subtitleTrack < 0)
+            return S_OK;
+    }
+
+    return QueueSubtitleSegments();
+}
+
+HRESULT AdaptiveStreamer::GetActiveSubtitles(std::vector<std::wstring>* pCues)
+{
+    NULL_CHK(pCues);
+    NULL_CHK_HR(m_mediaPlaybackSession.Get(), E_ILLEGAL_METHOD_CALL);
+
+    ABI::Windows::Foundation::TimeSpan position;
+    IFR(m_mediaPlaybackSession->get_Position(&position));
+    double seconds = static_cast<double>(position.Duration) / 10000000.0;
+
+    bool refresh = false;
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (m_subtitleTrack < 0)
+        {
+            pCues->clear();
+            return S_OK;
+        }
+
+        // the cursor makes this a constant time check on every frame of normal playback
+        changed = m_subtitleCues.Advance(seconds, &m_subtitleCursor);
+        if (changed)
+        {
+            pCues->clear();
+            for (uint32_t cue : m_subtitleCursor.active)
+            {
+                pCues->push_back(Utf8ToWide(m_subtitleCues.GetText(cue)));
+            }
+        }
+
+        refresh = m_subtitleLive && !m_subtitleLoading && GetClockSeconds() >= m_subtitleRefreshTime;
+    }
+
+    if (refresh)
+    {
+        LOG_RESULT(QueueSubtitleSegments());
+    }
+
+    return changed ? S_OK : S_FALSE;
+}
+
+// Lists the subtitle renditions of the master playlist, a DEFAULT=YES one is selected
+HRESULT AdaptiveStreamer::LoadSubtitleTracks(const std::wstring& url, UINT64 generation)
+{
+    NULL_CHK_HR(m_prefetcher.get(), E_ILLEGAL_METHOD_CALL);
+
+    std::string uri = WideToUtf8(url);
+    SegmentBuffer spText;
+    IFR(m_prefetcher->FetchPlaylist(uri, &spText));
+
+    std::string text(spText->begin(), spText->end());
+    HlsMasterPlaylist master;
+    if (!Hls::IsMasterPlaylist(text) || !Hls::ParseMasterPlaylist(text, uri, &master))
+        return S_OK; // a media playlist has no renditions
+
+    int defaultTrack = -1;
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (generation != m_subtitleGeneration)
+            return S_OK;
+
+        m_subtitleTracks.clear();
+        for (const HlsRendition& rendition : master.subtitles)
+        {
+            SUBTITLE_TRACK track;
+            track.id = Utf8ToWide(rendition.groupId);
+            track.title = Utf8ToWide(rendition.name);
+            track.language = Utf8ToWide(rendition.language);
+            track.uri = Utf8ToWide(rendition.uri);
+            track.isDefault = rendition.isDefault;
+            if (rendition.isDefault && defaultTrack < 0)
+            {
+                defaultTrack = static_cast<int>(m_subtitleTracks.size());
+            }
+            m_subtitleTracks.push_back(track);
+        }
+    }
+
+    Log(Log_Level_Info, L"AdaptiveStreamer - %zu subtitle tracks\n", master.subtitles.size());
+
+    return (defaultTrack >= 0) ? SelectSubtitleTrack(defaultTrack) : S_OK;
+}
+
+HRESULT AdaptiveStreamer::QueueSubtitleSegments()
+{
+    UINT64 generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (m_subtitleLoading)
+            return S_OK;
+
+        m_subtitleLoading = true;
+        generation = m_subtitleGeneration;
+    }
+
+    HRESULT hr = m_workQueue.Queue([this, generation]()
+        {
+            LOG_RESULT_MSG(LoadSubtitleSegments(generation), L"AdaptiveStreamer - subtitle segments unavailable");
+
+            // a track change meanwhile started a load of its own
+            std::lock_guard<std::mutex> lock(m_subtitleLock);
+            if (generation == m_subtitleGeneration)
+            {
+                m_subtitleLoading = false;
+            }
+        });
+
+    if (FAILED(hr))
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        m_subtitleLoading = false;
+    }
+
+    return hr;
+}
+
+// Appends the WebVTT segments of the selected track not appended yet. The playlist is downloaded
+// every time, a live one grows between calls. Subtitles bypass the segment cache, they are
+// small and would only push out video. Blocks on network I/O.
+HRESULT AdaptiveStreamer::LoadSubtitleSegments(UINT64 generation)
+{
+    std::wstring url;
+    UINT64 nextSequence = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (generation != m_subtitleGeneration || m_subtitleTrack < 0)
+            return S_OK;
+
+        url = m_subtitleTracks[m_subtitleTrack].uri;
+        nextSequence = m_subtitleNextSequence;
+    }
+
+    std::vector<BYTE> text;
+    IFR(DownloadToBuffer(url.c_str(), 0, 0, &text));
+
+    HlsMediaPlaylist playlist;
+    if (!Hls::ParseMediaPlaylist(std::string(text.begin(), text.end()), WideToUtf8(url), &playlist))
+        return MF_E_INVALID_FORMAT;
+
+    size_t appended = 0;
+    for (const HlsSegment& segment : playlist.segments)
+    {
+        if (segment.sequence < nextSequence)
+            continue;
+
+        std::vector<BYTE> data;
+        HRESULT hr = DownloadToBuffer(Utf8ToWide(segment.uri).c_str(), segment.byteOffset, segment.byteLength, &data);
+        LOG_RESULT_MSG(hr, L"AdaptiveStreamer - subtitle segment skipped");
+
+        // one segment at a time, its cues show up while the rest downloads
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (generation != m_subtitleGeneration)
+            return S_OK;
+
+        size_t added = 0;
+        if (SUCCEEDED(hr) && m_subtitleCues.Append(data.data(), data.size(), &added))
+        {
+            appended += added;
+        }
+        m_subtitleNextSequence = nextSequence = segment.sequence + 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_subtitleLock);
+        if (generation != m_subtitleGeneration)
+            return S_OK;
+
+        m_subtitleLive = !playlist.endList;
+        m_subtitleRefreshTime = GetClockSeconds() + (std::max)(playlist.targetDuration / 2.0, 1.0);
+    }
+
+    if (appended != 0)
+    {
+        Log(Log_Level_Info, L"AdaptiveStreamer - %zu subtitle cues loaded\n", appended);
+    }
+
     return S_OK;
 }
 
-HRESULT AdaptiveStreamer::Pause()
+void AdaptiveStreamer::ClearSubtitles()
 {
-    Log(Log_Level_Info, L"AdaptiveStreamer::Pause()");
+    std::lock_guard<std::mutex> lock(m_subtitleLock);
 
-    if (nullptr != m_mediaPlayer)
-    {
-        IFR(m_mediaPlayer->Pause());
-        return S_OK;
-    }
-    return E_ILLEGAL_METHOD_CALL;
+    m_subtitleTracks.clear();
+    m_subtitleTrack = -1;
+    m_subtitleCues.Clear();
+    m_subtitleCursor = WebVttCursor();
+    m_subtitleNextSequence = 0;
+    m_subtitleLive = false;
+    m_subtitleLoading = false;
+    m_subtitleGeneration++;
 }
 
 HRESULT AdaptiveStreamer::Stop()
@@ -145,14 +2379,6 @@ HRESULT AdaptiveStreamer::Stop()
     {
         fireStateChange = true;
 
-        ComPtr<IMediaPlayerSource2> spMediaPlayerSource;
-        m_mediaPlayer.As(&spMediaPlayerSource);
-
-        if (spMediaPlayerSource != nullptr)
-        {
-            spMediaPlayerSource->put_Source(nullptr);
-        }
-
         if (m_spAdaptiveMediaSource.Get() != nullptr)
         {
             m_spAdaptiveMediaSource.Reset();
@@ -166,7 +2392,37 @@ HRESULT AdaptiveStreamer::Stop()
         }
     }
 
-    m_subtitleTracks.clear();
+    ClearSubtitles();
+    ClearKeyframeIndex();
+    ResetTimedMetadataOrigin();
+    StopLowLatency();
+#ifdef QUEUE_MEDIA_EVENTS
+    LogMediaEventStats();
+#endif
+    if (m_downloadScheduler != nullptr)
+    {
+        m_downloadScheduler->LogStats();
+        m_downloadScheduler->ResetStats();
+    }
+#ifdef SHARE_DOWNLOADS_ACROSS_STREAMERS
+    // counts of the whole process, every streamer's stop logs them so far
+    SharedFetch::Instance().LogStats();
+#endif
+    {
+        std::lock_guard<std::mutex> lock(m_downloadLock);
+        m_audioPlaylists.clear();
+        m_audioSegmentKeys.clear();
+        m_scheduledSamples.clear();
+    }
+    if (m_decryptor != nullptr)
+    {
+        m_decryptor->Clear();
+    }
+    DetachTrickPlayer();
+    if (m_iFrameCache != nullptr)
+    {
+        m_iFrameCache->Clear();
+    }
 
     ReleaseMediaPlayer();
 
@@ -178,8 +2434,14 @@ HRESULT AdaptiveStreamer::Stop()
         ZeroMemory(&playbackState, sizeof(playbackState));
         playbackState.type = StateType::StateType_None;
         playbackState.state = PlaybackState::PlaybackState_None;
+        PublishPlaybackState(playbackState);
     }
 
+#ifdef QUEUE_MEDIA_EVENTS
+    // events of the player that went, its recycled successor may have the same address
+    m_mediaEvents.Drain([](const MediaEvent&) {});
+#endif
+
     m_bIgnoreEvents = false;
 
     return hr;
@@ -187,58 +2449,180 @@ HRESULT AdaptiveStreamer::Stop()
 
 HRESULT AdaptiveStreamer::CreateMediaPlayer()
 {
+    NULL_CHK_HR(m_playerPool.get(), E_ILLEGAL_METHOD_CALL);
+
+    std::unique_ptr<PooledMediaPlayer> entry;
+    IFR(m_playerPool->Acquire(&entry));
+
+    AttachMediaPlayer(std::move(entry));
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::CreatePooledMediaPlayer(std::unique_ptr<PooledMediaPlayer>* ppEntry)
+{
+    NULL_CHK(ppEntry);
+
+    auto entry = std::make_unique<PooledMediaPlayer>();
+
     // create media player
-    ComPtr<IMediaPlayer> spMediaPlayer;
     IFR(ActivateInstance(
         Wrappers::HStringReference(RuntimeClass_Windows_Media_Playback_MediaPlayer).Get(),
-        &spMediaPlayer));
+        &entry->mediaPlayer));
 
-    spMediaPlayer->put_AutoPlay(false);
+    entry->mediaPlayer->put_AutoPlay(false);
 
     // setup callbacks
-    EventRegistrationToken failedEventToken;
     auto mediaFailed = Microsoft::WRL::Callback<IFailedEventHandler>(this, &AdaptiveStreamer::OnFailed);
-    IFR(spMediaPlayer->add_MediaFailed(mediaFailed.Get(), &failedEventToken));
+    IFR(entry->mediaPlayer->add_MediaFailed(mediaFailed.Get(), &entry->failedEventToken));
 
     // frameserver mode is on the IMediaPlayer5 interface
-    ComPtr<IMediaPlayer5> spMediaPlayer5;
-    IFR(spMediaPlayer.As(&spMediaPlayer5));
+    IFR(entry->mediaPlayer.As(&entry->mediaPlayer5));
 
     // set frameserver mode
-    IFR(spMediaPlayer5->put_IsVideoFrameServerEnabled(true));
+    IFR(entry->mediaPlayer5->put_IsVideoFrameServerEnabled(true));
 
     // register for frame available callback
-    EventRegistrationToken videoFrameAvailableToken;
     auto videoFrameAvailableCallback = Microsoft::WRL::Callback<IMediaPlayerEventHandler>(this, &AdaptiveStreamer::OnVideoFrameAvailable);
-    IFR(spMediaPlayer5->add_VideoFrameAvailable(videoFrameAvailableCallback.Get(), &videoFrameAvailableToken));
+    IFR(entry->mediaPlayer5->add_VideoFrameAvailable(videoFrameAvailableCallback.Get(), &entry->videoFrameAvailableToken));
 
-    // store the player and token 
-    m_mediaPlayer = nullptr;
+    IFR(entry->mediaPlayer.As(&entry->mediaPlayer3));
+    IFR(entry->mediaPlayer3->get_PlaybackSession(&entry->mediaPlaybackSession));
 
-    m_mediaPlayer.Attach(spMediaPlayer.Detach());
-    m_failedEventToken = failedEventToken;
-    m_videoFrameAvailableToken = videoFrameAvailableToken;
+    IFR(AddStateChanged(entry.get()));
+
+#ifdef USE_AUDIOGRAPH
+    IFR(CreateAudioGraph(entry.get()));
+#endif
 
-    ComPtr<IMediaPlayer3> spMediaPlayer3;
-    IFR(m_mediaPlayer.As(&spMediaPlayer3));
-    m_mediaPlayer3.Attach(spMediaPlayer3.Detach());
+    *ppEntry = std::move(entry);
 
-    m_mediaPlayer5.Attach(spMediaPlayer5.Detach());
+    return S_OK;
+}
 
-    ComPtr<IMediaPlaybackSession> spSession;
-    IFR(m_mediaPlayer3->get_PlaybackSession(&spSession));
-    m_mediaPlaybackSession.Attach(spSession.Detach());
+HRESULT AdaptiveStreamer::ResetPooledMediaPlayer(PooledMediaPlayer* pEntry)
+{
+    NULL_CHK(pEntry);
 
-    IFR(AddStateChanged());
+    // drop the old content, this is the slow part of a switch and runs in the background
+    ComPtr<IMediaPlayerSource2> spMediaPlayerSource;
+    IFR(pEntry->mediaPlayer.As(&spMediaPlayerSource));
+    IFR(spMediaPlayerSource->put_Source(nullptr));
+    IFR(pEntry->mediaPlayer->put_Volume(1.0));
 
 #ifdef USE_AUDIOGRAPH
-    IFR(CreateAudioGraph());
+    // the input node belongs to the old content, the output node stays with the graph
+    if (pEntry->audioInNode)
+    {
+        ComPtr<ABI::Windows::Foundation::IClosable> spClosable;
+        if (SUCCEEDED(pEntry->audioInNode.As(&spClosable)))
+        {
+            spClosable->Close();
+        }
+        pEntry->audioInNode.Reset();
+    }
+
+    if (pEntry->audioGraph)
+    {
+        IFR(pEntry->audioGraph->ResetAllNodes());
+    }
 #endif
-    
+
     return S_OK;
 }
 
-HRESULT AdaptiveStreamer::CreateAudioGraph()
+void AdaptiveStreamer::DestroyPooledMediaPlayer(PooledMediaPlayer* pEntry)
+{
+    if (pEntry == nullptr)
+        return;
+
+    RemoveStateChanged(pEntry);
+    pEntry->mediaPlaybackSession.Reset();
+
+    if (nullptr != pEntry->mediaPlayer)
+    {
+        LOG_RESULT(pEntry->mediaPlayer->remove_MediaFailed(pEntry->failedEventToken));
+
+        // stop playback
+        ComPtr<IMediaPlayerSource2> spMediaPlayerSource;
+        pEntry->mediaPlayer.As(&spMediaPlayerSource);
+        if (spMediaPlayerSource != nullptr)
+            spMediaPlayerSource->put_Source(nullptr);
+    }
+
+    pEntry->audioInNode.Reset();
+    pEntry->audioOutNode.Reset();
+
+#ifdef USE_AUDIOGRAPH
+    ReleaseAudioGraph(pEntry);
+#endif
+
+    if (pEntry->mediaPlayer5)
+    {
+        LOG_RESULT(pEntry->mediaPlayer5->remove_VideoFrameAvailable(pEntry->videoFrameAvailableToken));
+        pEntry->mediaPlayer5.Reset();
+    }
+
+    pEntry->mediaPlayer3.Reset();
+    pEntry->mediaPlayer.Reset();
+}
+
+void AdaptiveStreamer::AttachMediaPlayer(std::unique_ptr<PooledMediaPlayer> entry)
+{
+    m_mediaPlayer = entry->mediaPlayer;
+    m_mediaPlayer3 = entry->mediaPlayer3;
+    m_mediaPlayer5 = entry->mediaPlayer5;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionLock);
+        m_mediaPlaybackSession = entry->mediaPlaybackSession;
+    }
+
+    m_audioGraph = entry->audioGraph;
+    m_audioInNode = entry->audioInNode;
+    m_audioOutNode = entry->audioOutNode;
+
+    m_audioBitrate = entry->audioBitrate;
+    m_audioBitsPerSamples = entry->audioBitsPerSample;
+    m_audioChannelCount = entry->audioChannelCount;
+    m_audioSamplingRate = entry->audioSamplingRate;
+
+    m_activeMediaPlayer = entry->mediaPlayer.Get();
+    m_activePlaybackSession = entry->mediaPlaybackSession.Get();
+    m_activeAudioGraph = entry->audioGraph.Get();
+
+    m_activePlayer = std::move(entry);
+}
+
+std::unique_ptr<PooledMediaPlayer> AdaptiveStreamer::DetachMediaPlayer()
+{
+    // callbacks stop matching before the members go
+    m_activeMediaPlayer = nullptr;
+    m_activePlaybackSession = nullptr;
+    m_activeAudioGraph = nullptr;
+
+    std::unique_ptr<PooledMediaPlayer> entry = std::move(m_activePlayer);
+    if (entry != nullptr)
+    {
+        // the input node was created for the current content after the entry was attached
+        entry->audioInNode = m_audioInNode;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sessionLock);
+        m_mediaPlaybackSession.Reset();
+    }
+    m_mediaPlayer5.Reset();
+    m_mediaPlayer3.Reset();
+    m_mediaPlayer.Reset();
+
+    m_audioInNode.Reset();
+    m_audioOutNode.Reset();
+    m_audioGraph.Reset();
+
+    return entry;
+}
+
+HRESULT AdaptiveStreamer::CreateAudioGraph(PooledMediaPlayer* pEntry)
 {
     // Create the audio graph
     ComPtr<IAudioGraphSettings> spAudioGraphSettings;
@@ -251,31 +2635,33 @@ HRESULT AdaptiveStreamer::CreateAudioGraph()
     IFR(spAudioGraph->get_SamplesPerQuantum(&quantumSize));
 
     // Add event handler to the audio graph
-    EventRegistrationToken quantumStartedToken;
     auto quantumStarted = Microsoft::WRL::Callback<IQuantumStartedEventHandler>(this, &AdaptiveStreamer::OnAudioGraphQuantumStarted);
-    IFR(spAudioGraph->add_QuantumStarted(quantumStarted.Get(), &quantumStartedToken));
-    m_quantumStartedEventToken = quantumStartedToken;
+    IFR(spAudioGraph->add_QuantumStarted(quantumStarted.Get(), &pEntry->quantumStartedEventToken));
     
     // Get the audio encoding specs
     ComPtr<MediaProperties::IAudioEncodingProperties> spEncodingProperties;
     IFR(spAudioGraph->get_EncodingProperties(&spEncodingProperties));
-    IFR(spEncodingProperties->get_Bitrate(&m_audioBitrate));
-    IFR(spEncodingProperties->get_BitsPerSample(&m_audioBitsPerSamples));
-    IFR(spEncodingProperties->get_ChannelCount(&m_audioChannelCount));
-    IFR(spEncodingProperties->get_SampleRate(&m_audioSamplingRate));
+    IFR(spEncodingProperties->get_Bitrate(&pEntry->audioBitrate));
+    IFR(spEncodingProperties->get_BitsPerSample(&pEntry->audioBitsPerSample));
+    IFR(spEncodingProperties->get_ChannelCount(&pEntry->audioChannelCount));
+    IFR(spEncodingProperties->get_SampleRate(&pEntry->audioSamplingRate));
+
+    // The output node does not depend on the content, create it up front so it is warm too
+    IFR(CreateOutputNode(spAudioGraph.Get(), &pEntry->audioOutNode));
 
-    m_audioGraph.Attach(spAudioGraph.Detach());
+    pEntry->audioGraph.Attach(spAudioGraph.Detach());
 
     return S_OK;
 }
 
-HRESULT AdaptiveStreamer::ReleaseAudioGraph()
+HRESULT AdaptiveStreamer::ReleaseAudioGraph(PooledMediaPlayer* pEntry)
 {
-    if (m_audioGraph)
+    if (pEntry->audioGraph)
     {
-        m_audioGraph->remove_QuantumStarted(m_quantumStartedEventToken);
-        m_audioGraph.Reset();
-        m_audioGraph = nullptr;
+        pEntry->audioGraph->Stop();
+        pEntry->audioGraph->remove_QuantumStarted(pEntry->quantumStartedEventToken);
+        pEntry->audioGraph.Reset();
+        pEntry->audioGraph = nullptr;
     }
 
     return S_OK;
@@ -288,6 +2674,13 @@ HRESULT AdaptiveStreamer::OnFailed(IMediaPlayer* sender, IMediaPlayerFailedEvent
     if (m_bIgnoreEvents)
         return S_OK;
 
+#ifndef QUEUE_MEDIA_EVENTS
+    // recycled players keep their registrations, only the active one is of interest
+    if (sender != m_activeMediaPlayer.load())
+        return S_OK;
+#endif
+
+    // the args do not outlive the callback, what the handler needs is taken now
     IFR(args->get_ExtendedErrorCode(&hr));
 
     SafeString errorMessage;
@@ -295,51 +2688,165 @@ HRESULT AdaptiveStreamer::OnFailed(IMediaPlayer* sender, IMediaPlayerFailedEvent
 
     LOG_RESULT_MSG(hr, errorMessage.c_str());
 
+#ifdef QUEUE_MEDIA_EVENTS
+    // every failure is handled, none is merged into another
+    m_mediaEvents.Post(MediaEventType::Failed, sender, hr, false);
+    return S_OK;
+#else
+    return HandleFailed(hr);
+#endif
+}
+
+HRESULT AdaptiveStreamer::HandleFailed(HRESULT hr)
+{
     PLAYBACK_STATE playbackState;
     ZeroMemory(&playbackState, sizeof(playbackState));
     playbackState.type = StateType::StateType_Failed;
     playbackState.state = PlaybackState::PlaybackState_None;
     playbackState.hresult = hr;
+    PublishPlaybackState(playbackState);
+    GetMetrics().failures.Add();
 
     return S_OK;
 }
 
 HRESULT AdaptiveStreamer::OnVideoFrameAvailable(IMediaPlayer* sender, IInspectable* arg)
 {
-    std::cout << "Video frame received!" << std::endl;
+    TRACE_SPAN("OnVideoFrameAvailable");
+
+    GetMetrics().framesAvailable.Add();
+
+#ifdef QUEUE_MEDIA_EVENTS
+    // frames that arrive before the owner drains are one copy, of the newest
+    m_mediaEvents.Post(MediaEventType::VideoFrameAvailable, sender);
+    return S_OK;
+#else
+    if (sender != m_activeMediaPlayer.load())
+        return S_OK;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return HandleVideoFrameAvailable(now.QuadPart);
+#endif
+}
+
+// frameTicks is when the player raised the event (QPC), the latencies end there and not when it was handled
+HRESULT AdaptiveStreamer::HandleVideoFrameAvailable(LONGLONG frameTicks)
+{
+    TRACE_SPAN("HandleVideoFrameAvailable");
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    // a queued record is stamped with its first frame, one from before the start ends at the newest frame, now at the latest
+    auto since = [&](LONGLONG start) { return ((frameTicks >= start) ? frameTicks : now.QuadPart) - start; };
+
+    LONGLONG loadStart = m_loadStart.exchange(0);
+    if (loadStart != 0)
+    {
+        m_lastTimeToFirstFrameMs = static_cast<UINT32>(since(loadStart) * 1000 / m_qpcFrequency.QuadPart);
+        GetMetrics().timeToFirstFrameMs.Record(m_lastTimeToFirstFrameMs);
+
+        Log(Log_Level_Info, L"AdaptiveStreamer - time to first frame %u ms (fast start %s)\n",
+            m_lastTimeToFirstFrameMs, m_fastStart ? L"on" : L"off");
+    }
+
+    LONGLONG seekStart = m_seekStart.exchange(0);
+    if (seekStart != 0)
+    {
+        m_lastSeekMs = static_cast<UINT32>(since(seekStart) * 1000 / m_qpcFrequency.QuadPart);
+        GetMetrics().seekMs.Record(m_lastSeekMs);
+
+        Log(m_lastSeekMs > SEEK_BUDGET_MS ? Log_Level_Warning : Log_Level_Info,
+            L"AdaptiveStreamer - seek took %u ms (budget %u ms)\n", m_lastSeekMs, SEEK_BUDGET_MS);
+    }
+
+    LONGLONG switchStart = m_channelChangeStart.exchange(0);
+    if (switchStart != 0)
+    {
+        m_lastChannelChangeMs = static_cast<UINT32>(since(switchStart) * 1000 / m_qpcFrequency.QuadPart);
+        GetMetrics().channelChangeMs.Record(m_lastChannelChangeMs);
+
+        Log(m_lastChannelChangeMs > CHANNEL_CHANGE_BUDGET_MS ? Log_Level_Warning : Log_Level_Info,
+            L"AdaptiveStreamer - channel change took %u ms (budget %u ms)\n",
+            m_lastChannelChangeMs, CHANNEL_CHANGE_BUDGET_MS);
+    }
 
     if (!m_readyForFrames || m_deviceNotReady)
         return S_OK;
 
     if (nullptr != m_primaryMediaSurface && m_mediaPlayer5)
     {
+        UINT64 cpuStart = CurrentThreadCpuTime();
+        LARGE_INTEGER copyStart;
+        QueryPerformanceCounter(&copyStart);
+
+        bool gpuTimed = m_copyTimer != nullptr && m_copyTimer->Begin();
         m_mediaPlayer5->CopyFrameToVideoSurface(m_primaryMediaSurface.Get());
+        if (gpuTimed)
+        {
+            m_copyTimer->End();
+        }
+
+        LARGE_INTEGER copyEnd;
+        QueryPerformanceCounter(&copyEnd);
+        LONGLONG ticks = copyEnd.QuadPart - copyStart.QuadPart;
+        m_frameCopies++;
+        m_frameCopyTicks += ticks;
+        LONGLONG maxTicks = m_frameCopyMaxTicks;
+        while (ticks > maxTicks && !m_frameCopyMaxTicks.compare_exchange_weak(maxTicks, ticks))
+        {
+        }
+
+        // the copies of earlier frames the GPU has finished by now, nothing waits on it
+        if (m_copyTimer != nullptr)
+        {
+            UINT64 gpuNs = 0;
+            UINT64 gpuMaxNs = m_frameCopyGpuMaxNs;
+            size_t timed = m_copyTimer->Collect(&gpuNs, &gpuMaxNs);
+            if (timed != 0)
+            {
+                m_frameCopiesGpuTimed += timed;
+                m_frameCopyGpuNs += gpuNs;
+                m_frameCopyGpuMaxNs = gpuMaxNs;
+            }
+        }
+        m_callbackCpuTime += CurrentThreadCpuTime() - cpuStart;
+
+        GetMetrics().framesCopied.Add();
+        GetMetrics().frameCopyUs.Record(static_cast<UINT64>(ticks) * 1000000 / m_qpcFrequency.QuadPart);
     }
 
     return S_OK;
 }
 
-HRESULT AdaptiveStreamer::AddStateChanged()
+// Thumbnails of the trick player take the place of the paused main player's frames
+void AdaptiveStreamer::OnTrickPlayFrame(TrickPlayer* pTrickPlayer)
+{
+    if (!m_readyForFrames || m_deviceNotReady)
+        return;
+
+    if (nullptr != m_primaryMediaSurface)
+    {
+        pTrickPlayer->CopyFrameToVideoSurface(m_primaryMediaSurface.Get());
+    }
+}
+
+HRESULT AdaptiveStreamer::AddStateChanged(PooledMediaPlayer* pEntry)
 {
-    if (m_mediaPlaybackSession)
+    if (pEntry->mediaPlaybackSession)
     {
-        EventRegistrationToken stateChangedToken;
         auto stateChanged = Microsoft::WRL::Callback<IMediaPlaybackSessionEventHandler>(
             this, &AdaptiveStreamer::OnStateChanged);
-        IFR(m_mediaPlaybackSession->add_PlaybackStateChanged(stateChanged.Get(), &stateChangedToken));
-        m_stateChangedEventToken = stateChangedToken;
+        IFR(pEntry->mediaPlaybackSession->add_PlaybackStateChanged(stateChanged.Get(), &pEntry->stateChangedEventToken));
 
-        EventRegistrationToken sizeChangedToken;
         auto sizeChanged = Microsoft::WRL::Callback<IMediaPlaybackSessionEventHandler>(
             this, &AdaptiveStreamer::OnSizeChanged);
-        IFR(m_mediaPlaybackSession->add_NaturalVideoSizeChanged(sizeChanged.Get(), &sizeChangedToken));
-        m_sizeChangedEventToken = sizeChangedToken;
+        IFR(pEntry->mediaPlaybackSession->add_NaturalVideoSizeChanged(sizeChanged.Get(), &pEntry->sizeChangedEventToken));
 
-        EventRegistrationToken durationChangedToken;
         auto durationChanged = Microsoft::WRL::Callback<IMediaPlaybackSessionEventHandler>(
             this, &AdaptiveStreamer::OnStateChanged);
-        IFR(m_mediaPlaybackSession->add_NaturalDurationChanged(durationChanged.Get(), &durationChangedToken));
-        m_durationChangedEventToken = durationChangedToken;
+        IFR(pEntry->mediaPlaybackSession->add_NaturalDurationChanged(durationChanged.Get(), &pEntry->durationChangedEventToken));
     }
 
     return S_OK;
@@ -350,9 +2857,23 @@ HRESULT AdaptiveStreamer::OnStateChanged(IMediaPlaybackSession* sender, IInspect
     if (m_bIgnoreEvents)
         return S_OK;
 
-    auto session = m_mediaPlaybackSession;
+#ifdef QUEUE_MEDIA_EVENTS
+    // the handler reads the session's state then, the newest one
+    m_mediaEvents.Post(MediaEventType::StateChanged, sender);
+    return S_OK;
+#else
+    if (sender != m_activePlaybackSession.load())
+        return S_OK;
+
+    return HandleStateChanged();
+#endif
+}
+
+HRESULT AdaptiveStreamer::HandleStateChanged()
+{
+    ComPtr<IMediaPlaybackSession> session = GetPlaybackSession();
     if (session == nullptr)
-        session = sender;
+        return S_OK; // detached meanwhile
 
     MediaPlaybackState state;
     IFR(session->get_PlaybackState(&state));
@@ -362,6 +2883,13 @@ HRESULT AdaptiveStreamer::OnStateChanged(IMediaPlaybackSession* sender, IInspect
     playbackState.type = StateType::StateType_StateChanged;
     playbackState.state = static_cast<PlaybackState>(state);
 
+    PLAYBACK_STATE previousState;
+    m_playbackState.Read(&previousState);
+    if (previousState.state == PlaybackState::PlaybackState_Playing && playbackState.state == PlaybackState::PlaybackState_Buffering)
+    {
+        GetMetrics().rebuffers.Add();
+    }
+
     if (state != MediaPlaybackState_None &&
         state != MediaPlaybackState_Opening)
     {
@@ -396,16 +2924,35 @@ HRESULT AdaptiveStreamer::OnStateChanged(IMediaPlaybackSession* sender, IInspect
         }
     }
 
+    PublishPlaybackState(playbackState);
+
+    return S_OK;
+}
+
+HRESULT AdaptiveStreamer::OnSizeChanged(IMediaPlaybackSession* sender, IInspectable*)
+{
+#ifdef QUEUE_MEDIA_EVENTS
+    m_mediaEvents.Post(MediaEventType::SizeChanged, sender);
     return S_OK;
+#else
+    if (sender != m_activePlaybackSession.load())
+        return S_OK;
+
+    return HandleSizeChanged();
+#endif
 }
 
-HRESULT AdaptiveStreamer::OnSizeChanged(IMediaPlaybackSession*, IInspectable*)
+HRESULT AdaptiveStreamer::HandleSizeChanged()
 {
+    ComPtr<IMediaPlaybackSession> spSession = GetPlaybackSession();
+    if (spSession == nullptr)
+        return S_OK; // detached meanwhile
+
     UINT32 width = 0;
     UINT32 height = 0;
 
-    m_mediaPlaybackSession->get_NaturalVideoWidth(&width);
-    m_mediaPlaybackSession->get_NaturalVideoHeight(&height);
+    spSession->get_NaturalVideoWidth(&width);
+    spSession->get_NaturalVideoHeight(&height);
 
     if (width && height)
     {
@@ -413,12 +2960,103 @@ HRESULT AdaptiveStreamer::OnSizeChanged(IMediaPlaybackSession*, IInspectable*)
 
         // Do not call CreatePlaybackTexures() here, it causes threading issues on Unity's D3D11 device
         // Instead, set m_createTextures to true, so next time we receive a rendering event (GL.IssuePluginEvent), we create textures 
-        m_createTextures = true;
+        // A shared device is multithread protected and nobody else renders on it, the textures are made now
+        if (m_sharedDevice)
+        {
+            LOG_RESULT(CreatePlaybackTextures());
+        }
+        else
+        {
+            m_createTextures = true;
+        }
     }
 
     return S_OK;
 }
 
+size_t AdaptiveStreamer::DispatchEvents()
+{
+    return m_mediaEvents.Drain([this](const MediaEvent& event)
+        {
+            if (m_bIgnoreEvents)
+                return;
+
+            // recycled players keep their registrations, only the active one is of interest
+            switch (event.type)
+            {
+            case MediaEventType::StateChanged:
+                if (event.source == m_activePlaybackSession.load())
+                {
+                    LOG_RESULT(HandleStateChanged());
+                }
+                break;
+            case MediaEventType::SizeChanged:
+                if (event.source == m_activePlaybackSession.load())
+                {
+                    LOG_RESULT(HandleSizeChanged());
+                }
+                break;
+            case MediaEventType::Failed:
+                if (event.source == m_activeMediaPlayer.load())
+                {
+                    LOG_RESULT(HandleFailed(event.value));
+                }
+                break;
+            case MediaEventType::VideoFrameAvailable:
+                if (event.source == m_activeMediaPlayer.load())
+                {
+                    // back to the QPC time the frame event was posted, the wait for the drain is not the player's
+                    LARGE_INTEGER now;
+                    QueryPerformanceCounter(&now);
+                    INT64 ageNs = (std::max)(static_cast<INT64>(0), MediaEventQueue::NowNs() - event.postedNs);
+                    LOG_RESULT(HandleVideoFrameAvailable(now.QuadPart - static_cast<LONGLONG>(ageNs * m_qpcFrequency.QuadPart / 1000000000)));
+                }
+                break;
+            default:
+                break;
+            }
+        });
+}
+
+UINT64 AdaptiveStreamer::GetPlaybackState(PLAYBACK_STATE* pState) const
+{
+    if (pState == nullptr)
+        return 0;
+
+    return m_playbackState.Read(pState);
+}
+
+// A new frame texture says nothing about playback, the playback state before it stays
+void AdaptiveStreamer::PublishPlaybackState(const PLAYBACK_STATE& playbackState)
+{
+    m_playbackState.Update([&playbackState](PLAYBACK_STATE* pCurrent)
+        {
+            PlaybackState state = pCurrent->state;
+            *pCurrent = playbackState;
+            if (playbackState.state == PlaybackState::PlaybackState_NA)
+            {
+                pCurrent->state = state;
+            }
+        });
+}
+
+void AdaptiveStreamer::LogMediaEventStats() const
+{
+    static const wchar_t* typeNames[] = { L"state", L"size", L"failed", L"frame" };
+
+    for (size_t type = 0; type < static_cast<size_t>(MediaEventType::Count); ++type)
+    {
+        MediaEventStats stats = m_mediaEvents.GetStats(static_cast<MediaEventType>(type));
+        if (stats.posted == 0)
+            continue;
+
+        Log(stats.dropped != 0 ? Log_Level_Warning : Log_Level_Info,
+            L"AdaptiveStreamer - %s events: %llu posted, %llu coalesced, %llu dropped, %llu handled %.2f ms mean %.2f ms max after the callback\n",
+            typeNames[type], stats.posted, stats.coalesced, stats.dropped, stats.handled,
+            stats.handled != 0 ? stats.latencySecondsTotal * 1000.0 / stats.handled : 0.0, stats.latencySecondsMax * 1000.0);
+    }
+}
+
 void AdaptiveStreamer::ReleaseTextures()
 {
     Log(Log_Level_Info, L"AdaptiveStreamer::ReleaseTextures()");
@@ -446,123 +3084,110 @@ void AdaptiveStreamer::ReleaseTextures()
 
 HRESULT AdaptiveStreamer::CreateAudioGraphNodes(_In_ IMediaSource2* pSource)
 {
+    return WaitForAsyncTask(CreateAudioGraphNodesAsync(pSource));
+}
+
+AsyncTask<HRESULT> AdaptiveStreamer::CreateAudioGraphNodesAsync(_In_ IMediaSource2* pSource)
+{
+    HRESULT hr = S_OK;
 #ifdef WAV_FILE_INPUT_NODE
     ComPtr<IAudioFileInputNode> spInputNode;
     ComPtr<IAudioGraph> spAudioGraph;
-    IFR(m_audioGraph.As(&spAudioGraph));
-    IFR(CreateInputNode(spAudioGraph.Get(), L"C:\\Windows\\Media\\Ring05.wav", &spInputNode, nullptr)); // WAV file is in the code's folder
+    CO_IFR(m_audioGraph.As(&spAudioGraph));
+    hr = co_await CreateInputNodeAsync(spAudioGraph.Get(), L"C:\\Windows\\Media\\Ring05.wav", &spInputNode, nullptr); // WAV file is in the code's folder
+    CO_IFR(hr);
 #else
     // Create the audio input node
     ComPtr<IMediaSourceAudioInputNode> spInputNode;
     ComPtr<IAudioGraph3> spAudioGraph3;
-    IFR(m_audioGraph.As(&spAudioGraph3));
+    CO_IFR(m_audioGraph.As(&spAudioGraph3));
     ComPtr<ICreateMediaSourceAudioInputNodeResult> spResult;
-    IFR(CreateInputNode(spAudioGraph3.Get(), pSource, &spInputNode, &spResult));
+    hr = co_await CreateInputNodeAsync(spAudioGraph3.Get(), pSource, &spInputNode, &spResult);
+    CO_IFR(hr);
     MediaSourceAudioInputNodeCreationStatus spStatus;
-    IFR(spResult->get_Status(&spStatus));
+    CO_IFR(spResult->get_Status(&spStatus));
 #endif
 
-#ifdef AUDIOGRAPH_SOUND_CARD_OUTPUT
-    ComPtr<IAudioDeviceOutputNode> spOutputNode;
-#else
-    ComPtr<IAudioFrameOutputNode> spOutputNode;
-#endif
-    IFR(CreateOutputNode(m_audioGraph.Get(), &spOutputNode));
+    // The output node is created together with the pooled graph
+    if (m_audioOutNode.Get() == nullptr)
+    {
+        co_return E_UNEXPECTED;
+    }
     ComPtr<IAudioNode> spAudioNodeOut;
-    IFR(spOutputNode.As(&spAudioNodeOut));
+    CO_IFR(m_audioOutNode.As(&spAudioNodeOut));
 
     // Link the input and output nodes
     ComPtr<IAudioInputNode> spAudioInputNode;
-    IFR(spInputNode.As(&spAudioInputNode));
-    IFR(spAudioInputNode->AddOutgoingConnection(spAudioNodeOut.Get()));
+    CO_IFR(spInputNode.As(&spAudioInputNode));
+    CO_IFR(spAudioInputNode->AddOutgoingConnection(spAudioNodeOut.Get()));
 
     m_audioInNode.Attach(spInputNode.Detach());
-    m_audioOutNode.Attach(spOutputNode.Detach());
 
-    return S_OK;
+    co_return S_OK;
 }
 
 void AdaptiveStreamer::ReleaseMediaPlayer()
 {
     Log(Log_Level_Info, L"AdaptiveStreamer::ReleaseMediaPlayer()");
 
-    m_subtitleTracks.clear();
-
-    RemoveStateChanged();
+    ClearSubtitles();
 
-    m_mediaPlaybackSession.Reset();
-    m_mediaPlaybackSession = nullptr;
+    StopForkedAudioInput();
+    WaitForAudioGraphNodes();
+    ReleasePlaylist();
+    RemoveAdaptiveSourceHandlers();
+    m_fastStartPending = false;
 
-    if (nullptr != m_mediaPlayer)
+    if (m_spAdaptiveMediaSource.Get() != nullptr)
     {
-        LOG_RESULT(m_mediaPlayer->remove_MediaFailed(m_failedEventToken));
-
-        // stop playback
-        ComPtr<IMediaPlayerSource2> spMediaPlayerSource;
-        m_mediaPlayer.As(&spMediaPlayerSource);
-        if (spMediaPlayerSource != nullptr)
-            spMediaPlayerSource->put_Source(nullptr);
-
-        if (m_spAdaptiveMediaSource.Get() != nullptr)
-        {
-            m_spAdaptiveMediaSource.Reset();
-            m_spAdaptiveMediaSource = nullptr;
-        }
+        m_spAdaptiveMediaSource.Reset();
+        m_spAdaptiveMediaSource = nullptr;
+    }
 
-        if (m_audioInNode)
-        {
-            m_audioInNode.Reset();
-            m_audioInNode = nullptr;
-        }
+    if (m_spPlaybackItem != nullptr)
+    {
+        m_spPlaybackItem.Reset();
+        m_spPlaybackItem = nullptr;
+    }
 
-        if (m_audioOutNode)
-        {
-            m_audioOutNode.Reset();
-            m_audioOutNode = nullptr;
-        }
+    std::unique_ptr<PooledMediaPlayer> entry = DetachMediaPlayer();
+    if (entry == nullptr)
+        return;
 
+    // silence it right away, the reset itself runs in the background
+    entry->mediaPlayer->Pause();
 #ifdef USE_AUDIOGRAPH
-        ReleaseAudioGraph();
+    if (entry->audioGraph)
+    {
+        entry->audioGraph->Stop();
+    }
 #endif
 
-        if (m_mediaPlayer5)
-        {
-            LOG_RESULT(m_mediaPlayer5->remove_VideoFrameAvailable(m_videoFrameAvailableToken));
-
-            m_mediaPlayer5.Reset();
-            m_mediaPlayer5 = nullptr;
-        }
-
-        if (m_mediaPlayer3)
-        {
-            m_mediaPlayer3.Reset();
-            m_mediaPlayer3 = nullptr;
-        }
-
-        if (m_spPlaybackItem != nullptr)
-        {
-            m_spPlaybackItem.Reset();
-            m_spPlaybackItem = nullptr;
-        }
-
-        m_mediaPlayer.Reset();
-        m_mediaPlayer = nullptr;
+    if (m_playerPool != nullptr)
+    {
+        m_playerPool->Recycle(std::move(entry));
+    }
+    else
+    {
+        DestroyPooledMediaPlayer(entry.get());
     }
 }
 
-void AdaptiveStreamer::RemoveStateChanged()
+void AdaptiveStreamer::RemoveStateChanged(PooledMediaPlayer* pEntry)
 {
     // remove playback session callbacks
-    if (nullptr != m_mediaPlaybackSession)
+    if (nullptr != pEntry->mediaPlaybackSession)
     {
-        LOG_RESULT(m_mediaPlaybackSession->remove_PlaybackStateChanged(m_stateChangedEventToken));
-        LOG_RESULT(m_mediaPlaybackSession->remove_NaturalVideoSizeChanged(m_sizeChangedEventToken));
-        LOG_RESULT(m_mediaPlaybackSession->remove_NaturalDurationChanged(m_durationChangedEventToken));
+        LOG_RESULT(pEntry->mediaPlaybackSession->remove_PlaybackStateChanged(pEntry->stateChangedEventToken));
+        LOG_RESULT(pEntry->mediaPlaybackSession->remove_NaturalVideoSizeChanged(pEntry->sizeChangedEventToken));
+        LOG_RESULT(pEntry->mediaPlaybackSession->remove_NaturalDurationChanged(pEntry->durationChangedEventToken));
     }
 }
 
 HRESULT AdaptiveStreamer::CreatePlaybackTextures()
 {
+    TRACE_SPAN("CreatePlaybackTextures");
+
     m_readyForFrames = false;
 
     ReleaseTextures();
@@ -652,6 +3277,7 @@ HRESULT AdaptiveStreamer::CreatePlaybackTextures()
     playbackState.description.canSeek = canSeek;
     playbackState.description.duration = duration.Duration;
     playbackState.description.isStereoscopic = 0;
+    PublishPlaybackState(playbackState);
     
     m_readyForFrames = true;
 
@@ -660,6 +3286,11 @@ HRESULT AdaptiveStreamer::CreatePlaybackTextures()
 
 HRESULT AdaptiveStreamer::OnAudioGraphQuantumStarted(_In_ IAudioGraph* sender, _In_ IInspectable* args)
 {
-    std::cout << "Audio graph quantum started" << std::endl;
+    TRACE_SPAN("OnAudioGraphQuantumStarted");
+
+    if (sender != m_activeAudioGraph.load())
+        return S_OK;
+
+    GetMetrics().audioQuanta.Add();
     return S_OK;
 }
\ No newline at end of file
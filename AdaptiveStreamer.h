@@ -1,11 +1,52 @@
 #pragma once
 #include "pch.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+
+#include "AbrController.h"
+#include "DownloadScheduler.h"
+#include "ForkedAudioInput.h"
+#include "GpuTimer.h"
+#include "Id3Metadata.h"
+#include "KeyframeIndex.h"
+#include "LowLatencyLoader.h"
+#include "LockFreeQueue.h"
+#include "MediaEventQueue.h"
+#include "Mp4BoxParser.h"
+#include "PlaylistPrefetcher.h"
+#include "PrewarmedPool.h"
+#include "Seqlock.h"
+#include "SegmentDecryptor.h"
+#include "ThreadPoolWorkQueue.h"
+#include "TrickPlayer.h"
+#include "TsDemuxer.h"
+#include "WebVtt.h"
 
 #define USE_AUDIOGRAPH // comment out to not use the audiograph and just let the media player play the audio
 #define AUDIOGRAPH_SOUND_CARD_OUTPUT // output to the soundcard vs to a frame node
 #define ONE_SINGLE_MEDIASOURCE // this causes the video callbacks not to be called and OnFailed to report a problem
+#define AUDIOGRAPH_FORKED_INPUT // without ONE_SINGLE_MEDIASOURCE, HLS audio reaches the graph from the audio fork, not a second media source
 //#define WAV_FILE_INPUT_NODE // comment out to use the HLS stream audio
+#define PLAYER_POOL_SIZE 1 // number of pre-warmed player/graph pairs kept ready for content switches
+#define CHANNEL_CHANGE_BUDGET_MS 300 // channel changes slower than this are reported as warnings
+#define USE_CUSTOM_ABR // comment out to leave bitrate selection to the AdaptiveMediaSource heuristics
+#define FAST_START_PREFETCH_SEGMENTS 2 // lowest-rung segments fetched while the manifest is resolved
+#define FAST_START_HEALTHY_BUFFER_SECONDS 8.0 // fast start holds the lowest rung until this much is buffered
+#define SEGMENT_CACHE_BYTE_BUDGET (64 * 1024 * 1024) // prefetched segments of all playlist items
+#define SEEK_BUDGET_MS 100 // seeks slower than this, call to first frame, are reported as warnings
+#define I_FRAME_CACHE_BYTE_BUDGET (8 * 1024 * 1024) // trick play I-frames, kept apart from the segment cache
+#define TIMED_METADATA_QUEUE_CAPACITY 256 // ID3 cues a subscriber can fall behind by, newer ones are dropped
+#define LOW_LATENCY_MAX_RELOAD_FAILURES 3 // blocking reloads failing in a row before the player reloads on its own again
+#define SCHEDULE_PLAYER_DOWNLOADS // comment out to schedule only the downloads the streamer makes itself, the rest stays with the AdaptiveMediaSource
+#define SCHEDULED_THROUGHPUT_SAMPLES 16 // scheduled player downloads whose DownloadCompleted has not arrived yet
+#define SHARE_DOWNLOADS_ACROSS_STREAMERS // streamers of the process on the same content join each other's downloads in flight
+#define QUEUE_MEDIA_EVENTS // comment out to handle player and session events on the threads that raise them instead of in DispatchEvents
+#define MEDIA_EVENT_QUEUE_CAPACITY 64 // event records waiting for DispatchEvents, a type waits in one record at most except failures
 
 enum class StateType : UINT32
 {
@@ -55,6 +96,24 @@ using SUBTITLE_TRACK = struct _SUBTITLE_TRACK
     std::wstring id;
     std::wstring title;
     std::wstring language;
+    std::wstring uri; // WebVTT media playlist of the rendition
+    bool isDefault;
+};
+
+// What one stream costs, for StreamerHost to compare its streams by
+using STREAMER_USAGE = struct _STREAMER_USAGE
+{
+    UINT64 cpuTime;             // 100 ns units, the streamer's own work; decoding inside the MediaPlayer is not counted
+    UINT64 frameCopies;
+    double frameCopyCallSeconds;    // wall time of the CopyFrameToVideoSurface calls, what the CPU spent submitting the copies
+    double frameCopyCallMaxSeconds;
+    UINT64 frameCopiesGpuTimed;     // copies whose GPU time is known, timestamp queries on the device's immediate context
+    double frameCopyGpuSeconds;     // of the timed copies
+    double frameCopyGpuMaxSeconds;
+    UINT64 cacheBytes;          // segment and I-frame caches
+    UINT64 textureBytes;
+    UINT64 memoryBudgetBytes;   // of the segment cache
+    UINT32 bandwidthBudgetBps;  // 0 when the ABR controller alone decides
 };
 
 using IMediaPlayerEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
@@ -66,15 +125,56 @@ using IMediaPlaybackSessionEventHandler = ABI::Windows::Foundation::ITypedEventH
 using IDownloadRequestedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
     ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSource*,
     ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceDownloadRequestedEventArgs*>;
+using IDownloadCompletedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
+    ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSource*,
+    ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceDownloadCompletedEventArgs*>;
 using ITracksChangedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
     ABI::Windows::Media::Playback::MediaPlaybackItem*, ABI::Windows::Foundation::Collections::IVectorChangedEventArgs*>;
 using IMediaCueEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
     ABI::Windows::Media::Core::TimedMetadataTrack*, ABI::Windows::Media::Core::MediaCueEventArgs*>;
 using IQuantumStartedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
     ABI::Windows::Media::Audio::AudioGraph*, IInspectable*>;
+using ICurrentItemChangedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
+    ABI::Windows::Media::Playback::MediaPlaybackList*, ABI::Windows::Media::Playback::CurrentMediaPlaybackItemChangedEventArgs*>;
 using IAudioGraphUnrecoverableErrorEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
     ABI::Windows::Media::Audio::AudioGraph*, ABI::Windows::Media::Audio::AudioGraphUnrecoverableErrorOccurredEventArgs*>;
 
+// A MediaPlayer with its session and AudioGraph, events registered once at creation.
+// Entries are swapped in and out of AdaptiveStreamer by PrewarmedPool, callbacks
+// ignore events whose sender is not the active entry.
+struct PooledMediaPlayer
+{
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlayer> mediaPlayer;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlayer3> mediaPlayer3;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlayer5> mediaPlayer5;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlaybackSession> mediaPlaybackSession;
+
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioGraph> audioGraph;
+#ifdef WAV_FILE_INPUT_NODE
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioFileInputNode> audioInNode;
+#else
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IMediaSourceAudioInputNode> audioInNode;
+#endif
+#ifdef AUDIOGRAPH_SOUND_CARD_OUTPUT
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioDeviceOutputNode> audioOutNode;
+#else
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioFrameOutputNode> audioOutNode;
+#endif
+
+    // the graph's encoding, read at creation on whatever thread created the entry
+    UINT32 audioBitrate = 0;
+    UINT32 audioBitsPerSample = 0;
+    UINT32 audioChannelCount = 0;
+    UINT32 audioSamplingRate = 0;
+
+    EventRegistrationToken failedEventToken;
+    EventRegistrationToken videoFrameAvailableToken;
+    EventRegistrationToken stateChangedEventToken;
+    EventRegistrationToken sizeChangedEventToken;
+    EventRegistrationToken durationChangedEventToken;
+    EventRegistrationToken quantumStartedEventToken;
+};
+
 class AdaptiveStreamer
 {
 public:
@@ -86,6 +186,92 @@ public:
     HRESULT Pause();
     HRESULT Stop();
 
+    // Plays the urls back to back. While one item plays, the next one's source, manifests
+    // and first segments are prefetched and it is appended to the MediaPlaybackList.
+    HRESULT LoadPlaylist(const std::vector<std::wstring>& urls);
+    void SetPrefetchSettings(const PREFETCH_SETTINGS& settings);
+
+    // Receives the audio PES packets of every MPEG-TS media segment the player downloads, on thread
+    // pool threads and ordered by PTS only within a segment. Setting it makes the streamer download
+    // segments itself so each one is fetched once for both paths. An empty callback turns it off.
+    using AudioForkCallback = std::function<void(const PesPacket&)>;
+    void SetAudioForkCallback(AudioForkCallback callback);
+
+    // ID3 timed metadata (stream type 0x15) of MPEG-TS segments, parsed off the media threads and
+    // pushed into one queue per subscriber, which drains it with TryPop on any thread. Cue times
+    // are on the playback clock, compare them with the session position. Subscribing makes the
+    // streamer download segments itself, like the audio fork.
+    using TimedMetadataQueue = LockFreeQueue<Id3Cue>;
+    std::shared_ptr<TimedMetadataQueue> SubscribeTimedMetadata(size_t capacity = TIMED_METADATA_QUEUE_CAPACITY);
+    void UnsubscribeTimedMetadata(const std::shared_ptr<TimedMetadataQueue>& queue);
+
+    // Replaces the bitrate controller, nullptr hands the choice back to the OS heuristics
+    void SetAbrController(std::unique_ptr<AbrController> controller);
+
+    // Time from LoadContent replacing playing content to the first frame of the new content
+    UINT32 GetLastChannelChangeTime() const { return m_lastChannelChangeMs; }
+
+    // Time from the last LoadContent/LoadPlaylist call to its first video frame
+    UINT32 GetLastTimeToFirstFrame() const { return m_lastTimeToFirstFrameMs; }
+
+    // Starts loads at the lowest rung with its first segments fetched alongside the manifest and
+    // the audio graph input node built in the background (when the graph has a media source of its own,
+    // with ONE_SINGLE_MEDIASOURCE it is built before put_Source), then steps up once the buffer is healthy
+    void SetFastStart(bool enable) { m_fastStart = enable; }
+
+    // Moves playback to the keyframe nearest to position (100 ns units, like the media duration).
+    // The target segment is fetched into the cache before the session position changes.
+    HRESULT Seek(INT64 position);
+
+    // Time from the last Seek call to the first frame at the new position
+    UINT32 GetLastSeekTime() const { return m_lastSeekMs; }
+
+    // Fast forward and rewind on the thumbnails of the content's I-frame playlist, speed is a
+    // multiple of normal playback and negative rewinds. The main player pauses meanwhile.
+    HRESULT StartTrickPlay(double speed);
+    HRESULT SetTrickPlaySpeed(double speed);
+
+    // Seeks the main player to the last thumbnail shown, then plays on if resume is set
+    HRESULT StopTrickPlay(bool resume);
+
+    // Subtitle renditions of the content, empty until its master playlist has been parsed
+    std::vector<SUBTITLE_TRACK> GetSubtitleTracks();
+
+    // Loads the cues of a track in the background, live tracks keep refreshing. -1 turns subtitles off.
+    HRESULT SelectSubtitleTrack(int index);
+
+    // Text of the cues active at the playback position, one entry per cue by start time.
+    // S_FALSE when they did not change since the last call.
+    HRESULT GetActiveSubtitles(_Out_ std::vector<std::wstring>* pCues);
+
+    // Renders into textures of this device, created as soon as the video size is known, instead of
+    // waiting for the rendering thread of an engine. Call before Initialize, StreamerHost gives
+    // all its streams the same device.
+    void SetSharedDevice(_In_ ID3D11Device* pDevice);
+
+    // Bytes the segment cache may hold and the bitrate the ABR controller may pick, 0 lifts the
+    // bitrate cap. The bitrate cap applies from the next segment on.
+    void SetResourceBudget(UINT64 memoryBytes, UINT32 bandwidthBps);
+
+    // Runs the CPU work of the streamer, demuxing and decrypting the segments the fork consumers
+    // get, on the pool instead of the WinRT thread pool. Work that waits on the network stays on
+    // the thread pool. StreamerHost gives all its streams its pool.
+    void SetTaskPool(std::shared_ptr<TaskPool> taskPool);
+
+    STREAMER_USAGE GetUsage() const;
+
+    // Handles the player and session events raised since the last call, on the calling thread.
+    // With QUEUE_MEDIA_EVENTS the thread that owns the streamer calls it often, once per
+    // rendered frame or message loop pass: frames are copied here. Returns the records handled.
+    size_t DispatchEvents();
+
+    // Copy of the newest playback state, lock free for a render loop polling every frame.
+    // Returns its version, which goes up with every change, 0 before the first one.
+    UINT64 GetPlaybackState(_Out_ PLAYBACK_STATE* pState) const;
+
+    // Version of the playback state alone, a reader skips the copy when it did not change
+    UINT64 GetPlaybackStateVersion() const { return m_playbackState.Version(); }
+
 private:
     // Callbacks - IMediaPlayer2
     HRESULT OnFailed(_In_ ABI::Windows::Media::Playback::IMediaPlayer* sender, _In_ ABI::Windows::Media::Playback::IMediaPlayerFailedEventArgs* args);
@@ -97,19 +283,100 @@ private:
     HRESULT OnStateChanged(_In_ ABI::Windows::Media::Playback::IMediaPlaybackSession* sender, _In_ IInspectable* args);
     HRESULT OnSizeChanged(_In_ ABI::Windows::Media::Playback::IMediaPlaybackSession* sender, _In_ IInspectable* args);
 
+    // What the callbacks above do for the active player, on the owner thread with QUEUE_MEDIA_EVENTS
+    HRESULT HandleFailed(HRESULT hr);
+    HRESULT HandleVideoFrameAvailable(LONGLONG frameTicks);
+    HRESULT HandleStateChanged();
+    HRESULT HandleSizeChanged();
+    void LogMediaEventStats() const;
+    void PublishPlaybackState(const PLAYBACK_STATE& playbackState);
+
     HRESULT OnAudioGraphQuantumStarted(_In_ ABI::Windows::Media::Audio::IAudioGraph* sender, _In_ IInspectable* args);
+
+    // Callbacks - IMediaPlaybackList
+    HRESULT OnCurrentItemChanged(_In_ ABI::Windows::Media::Playback::IMediaPlaybackList* sender, _In_ ABI::Windows::Media::Playback::ICurrentMediaPlaybackItemChangedEventArgs* args);
+
+    // Callbacks - IAdaptiveMediaSource, serves prefetched bytes from the segment cache
+    HRESULT OnDownloadRequested(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource* sender, _In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSourceDownloadRequestedEventArgs* args);
+
+    // Callbacks - IAdaptiveMediaSource, feeds segment throughput to the ABR controller
+    HRESULT OnDownloadCompleted(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource* sender, _In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSourceDownloadCompletedEventArgs* args);
     
     HRESULT CreateMediaPlayer();
     void ReleaseMediaPlayer();
-    HRESULT AddStateChanged();
-    void RemoveStateChanged();
-    HRESULT CreateAudioGraph();
-    HRESULT ReleaseAudioGraph();
+    HRESULT AddStateChanged(_In_ PooledMediaPlayer* pEntry);
+    void RemoveStateChanged(_In_ PooledMediaPlayer* pEntry);
+    HRESULT CreateAudioGraph(_In_ PooledMediaPlayer* pEntry);
+    HRESULT ReleaseAudioGraph(_In_ PooledMediaPlayer* pEntry);
     HRESULT PlayAudioGraph();
 
+    // PrewarmedPool callbacks, may run on thread pool threads
+    HRESULT CreatePooledMediaPlayer(_Out_ std::unique_ptr<PooledMediaPlayer>* ppEntry);
+    HRESULT ResetPooledMediaPlayer(_In_ PooledMediaPlayer* pEntry);
+    void DestroyPooledMediaPlayer(_In_ PooledMediaPlayer* pEntry);
+
+    void AttachMediaPlayer(_In_ std::unique_ptr<PooledMediaPlayer> entry);
+    std::unique_ptr<PooledMediaPlayer> DetachMediaPlayer();
+
+    // current is false for the sources of upcoming playlist items, the controller takes their ladder once they play
+    HRESULT AddAdaptiveSourceHandlers(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource* pSource, _In_ bool current);
+    void RemoveAdaptiveSourceHandlers();
+    HRESULT ApplyAbrLadder(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource* pSource);
+    HRESULT ApplyAbrLadder(_In_ ABI::Windows::Media::Playback::IMediaPlaybackItem* pItem);
+    double GetBufferedSeconds();
+    double GetClockSeconds() const;
+
+    // The active session with a reference of its own, for threads other than the owner's
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlaybackSession> GetPlaybackSession() const;
+
+    HRESULT BeginFastStart(const std::wstring& url);
+    HRESULT ApplyFastStartBitrate(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource* pSource);
+    HRESULT QueueAudioGraphNodes(_In_ ABI::Windows::Media::Core::IMediaSource2* pSource);
+    AsyncAction BuildAudioGraphNodes(Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaSource2> spSource);
+    void WaitForAudioGraphNodes();
+
+    DownloadPriority GetPlayerDownloadPriority(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSourceDownloadRequestedEventArgs* args,
+        ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceResourceType resourceType, const std::string& key);
+    bool TakeScheduledSample(_In_ ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSourceDownloadCompletedEventArgs* args, _Out_ UINT64* pBytes, _Out_ double* pSeconds);
+    void OnScheduledDownloadCompleted(const std::string& key, ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceResourceType resourceType, const DownloadResult& result);
+    bool HasSegmentConsumers();
+    void ForkSegment(const std::string& key, const SegmentBuffer& spEncrypted);
+    void PublishTimedMetadata(const std::string& key, std::vector<Id3Cue>& cues, int64_t segmentPts);
+    void ResetTimedMetadataOrigin();
+    HRESULT StartForkedAudioInput(const std::wstring& url);
+    void StopForkedAudioInput();
+    void ResetForkedAudioInput();
+    void FallBackFromForkedAudioInput(const std::wstring& url, UINT64 generation);
+    void ForkPackedAudio(const std::string& key, const SegmentBuffer& spSegment, const AudioForkCallback& callback);
+    void ForkFragmentedAudio(const std::vector<uint8_t>& segment, const Mp4MovieInfo& movie, const AudioForkCallback& callback);
+    HRESULT PrefetchNextPlaylistItem();
+
+    HRESULT BuildKeyframeIndex(const std::wstring& url);
+    HRESULT LoadKeyframeIndex(const std::wstring& url, UINT32 bitrate, UINT64 generation);
+    HRESULT ReloadKeyframeIndex(const std::wstring& url, UINT32 bitrate, UINT64 generation);
+    HRESULT IndexSeekPlaylist(const std::wstring& url, UINT64 generation, _Inout_ PrefetchedItem* pItem);
+    void ClearKeyframeIndex();
+    void ParseSegmentKeyframes(size_t segmentIndex, UINT64 indexVersion, const SegmentBuffer& spSegment);
+    HRESULT SeekToKeyframe(_In_ ABI::Windows::Media::Playback::IMediaPlaybackSession* pSession, double position, UINT32 bitrate, UINT64 seekId, bool allowFetch);
+    void ReleasePlaylist();
+
+    HRESULT BeginTrickPlay(const std::wstring& url, double position, UINT64 trickPlayId);
+    void OnTrickPlayFrame(_In_ TrickPlayer* pTrickPlayer);
+    std::unique_ptr<TrickPlayer> DetachTrickPlayer();
+
+    HRESULT LoadSubtitleTracks(const std::wstring& url, UINT64 generation);
+    HRESULT LoadSubtitleSegments(UINT64 generation);
+    HRESULT QueueSubtitleSegments();
+    void ClearSubtitles();
+
+    HRESULT FollowLowLatencyPlaylist(const std::string& playlistUri);
+    void QueueLowLatencyReload(UINT64 generation, UINT32 failures);
+    void StopLowLatency();
+
     HRESULT CreatePlaybackTextures();
     void ReleaseTextures();
     HRESULT CreateAudioGraphNodes(_In_ ABI::Windows::Media::Core::IMediaSource2* pSource);
+    AsyncTask<HRESULT> CreateAudioGraphNodesAsync(_In_ ABI::Windows::Media::Core::IMediaSource2* pSource);
 
 	Microsoft::WRL::ComPtr<ID3D11Device> m_d3dDevice;
 	Microsoft::WRL::ComPtr<ID3D11Device> m_mediaDevice;
@@ -136,10 +403,6 @@ private:
     Microsoft::WRL::ComPtr<ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource> m_spAdaptiveMediaSource;
     Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlaybackItem> m_spPlaybackItem;
 
-    EventRegistrationToken m_stateChangedEventToken;
-    EventRegistrationToken m_sizeChangedEventToken;
-    EventRegistrationToken m_durationChangedEventToken;
-
     CD3D11_TEXTURE2D_DESC m_textureDesc;
     Microsoft::WRL::ComPtr<ID3D11Texture2D> m_primaryTexture;
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_primaryTextureSRV;
@@ -147,12 +410,9 @@ private:
     HANDLE m_primarySharedHandle;
     Microsoft::WRL::ComPtr<ID3D11Texture2D> m_primaryMediaTexture;
     Microsoft::WRL::ComPtr<ABI::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface> m_primaryMediaSurface;
-    
-    EventRegistrationToken m_failedEventToken;
-    EventRegistrationToken m_videoFrameAvailableToken;
-    EventRegistrationToken m_quantumStartedEventToken;
 
-    bool m_bIgnoreEvents;
+
+    std::atomic<bool> m_bIgnoreEvents; // read by the callbacks on any thread
     bool m_readyForFrames;
     bool m_createTextures;
 
@@ -162,6 +422,145 @@ private:
     UINT32 m_audioSamplingRate; // typically 44.1kHz or 48kHz
 
     static bool m_deviceNotReady;
+    bool m_sharedDevice; // textures are created on the media thread, not on a rendering event
+
+    std::unique_ptr<PrewarmedPool<PooledMediaPlayer>> m_playerPool;
+    std::unique_ptr<PooledMediaPlayer> m_activePlayer; // owns the event tokens of the m_mediaPlayer/m_audioGraph members
+
+    // the active entry's objects, what callbacks on any thread compare their sender with while
+    // the owner reassigns the ComPtr members above
+    std::atomic<ABI::Windows::Media::Playback::IMediaPlayer*> m_activeMediaPlayer;
+    std::atomic<ABI::Windows::Media::Playback::IMediaPlaybackSession*> m_activePlaybackSession;
+    std::atomic<ABI::Windows::Media::Audio::IAudioGraph*> m_activeAudioGraph;
+    mutable std::mutex m_sessionLock; // m_mediaPlaybackSession is reassigned under it, other threads copy it under it
+    LARGE_INTEGER m_qpcFrequency;
+    std::atomic<LONGLONG> m_channelChangeStart; // QPC ticks, 0 when no switch is pending
+    UINT32 m_lastChannelChangeMs;
+    std::atomic<LONGLONG> m_loadStart; // QPC ticks, 0 once the first frame of the load arrived
+    UINT32 m_lastTimeToFirstFrameMs;
+
+    bool m_fastStart;
+    std::atomic<bool> m_fastStartPending; // lowest rung held until the buffer is healthy
+
+    // fast start builds the audio graph input node in the background, unless it shares the player's source
+    std::mutex m_audioNodesLock;
+    std::condition_variable m_audioNodesReady;
+    bool m_audioNodesPending;
+
+    std::shared_ptr<SegmentCache> m_segmentCache;
+    std::shared_ptr<DownloadScheduler> m_downloadScheduler; // orders every download, the player's too with SCHEDULE_PLAYER_DOWNLOADS
+    std::unique_ptr<PlaylistPrefetcher> m_prefetcher;
+    std::unique_ptr<PlaylistPrefetcher> m_seekFetcher; // the seek index and seek targets, canceled by the next seek
+    std::unique_ptr<SegmentDecryptor> m_decryptor; // AES-128 segments for the fork consumers, the player decrypts its own
+
+    // LL-HLS, the loader follows the media playlist the player is on with blocking reloads
+    std::unique_ptr<LowLatencyLoader> m_lowLatencyLoader;
+    std::mutex m_lowLatencyLock;
+    std::vector<std::string> m_lowLatencyVariants; // media playlists an ABR switch moves the loader to
+    std::atomic<UINT64> m_lowLatencyGeneration; // bumped on every follow and stop, older reload chains end
+    std::atomic<bool> m_lowLatencyOffsetApplied;
+
+    // guards the playlist members, prefetches complete on thread pool threads
+    std::mutex m_playlistLock;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlaybackList> m_spPlaybackList;
+    EventRegistrationToken m_currentItemChangedToken;
+    std::vector<std::wstring> m_playlistUrls;
+    size_t m_nextPrefetchIndex;
+    UINT64 m_playlistGeneration; // bumped on release, stale prefetches are dropped
+
+    struct AdaptiveSourceHooks
+    {
+        Microsoft::WRL::ComPtr<ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource> source;
+        EventRegistrationToken downloadRequestedToken;
+        EventRegistrationToken downloadCompletedToken;
+    };
+
+    std::mutex m_hooksLock;
+    std::vector<AdaptiveSourceHooks> m_adaptiveSourceHooks;
+
+    // download callbacks arrive on media foundation threads
+    std::mutex m_abrLock;
+    std::unique_ptr<AbrController> m_abrController;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource> m_spAbrSource; // the source that plays, the controller has its ladder
+    std::atomic<UINT32> m_bandwidthBudgetBps; // 0 when uncapped
+
+    // usage, updated on media and thread pool threads
+    std::atomic<UINT64> m_memoryBudgetBytes;
+    std::atomic<UINT64> m_callbackCpuTime; // 100 ns units, frame callbacks
+    std::atomic<UINT64> m_frameCopies;
+    std::atomic<LONGLONG> m_frameCopyTicks; // QPC
+    std::atomic<LONGLONG> m_frameCopyMaxTicks;
+    std::unique_ptr<GpuTimer> m_copyTimer; // frame callbacks only, nullptr without a shared device
+    std::atomic<UINT64> m_frameCopiesGpuTimed;
+    std::atomic<UINT64> m_frameCopyGpuNs;
+    std::atomic<UINT64> m_frameCopyGpuMaxNs;
+
+    // guards what the player's scheduled downloads need, their completions run on thread pool threads
+    std::mutex m_downloadLock;
+    std::vector<std::string> m_audioPlaylists; // EXT-X-MEDIA TYPE=AUDIO playlists of the content
+    std::map<std::string, std::unordered_set<std::string>> m_audioSegmentKeys; // cache keys by audio playlist, as last served
+
+    struct ThroughputSample
+    {
+        std::string key;
+        UINT64 bytes;
+        double seconds; // request to last byte
+    };
+    std::deque<ThroughputSample> m_scheduledSamples; // the AdaptiveMediaSource did not time these downloads
+
+    std::mutex m_audioForkLock;
+    AudioForkCallback m_audioForkCallback;
+    std::shared_ptr<ForkedAudioInput> m_forkedAudioInput; // the graph's input, fed next to the callback
+    UINT64 m_forkedAudioGeneration; // bumped per input, a stale fallback is dropped
+    Mp4MovieInfo m_fmp4Movie; // track table of the last fMP4 init segment
+    bool m_hasFmp4Movie;
+
+    // guards the metadata subscribers and the timeline origin, segments fork on thread pool threads
+    std::mutex m_metadataLock;
+    std::vector<std::shared_ptr<TimedMetadataQueue>> m_metadataQueues;
+    int64_t m_metadataOriginPts; // 90 kHz, first PTS of the last forked segment a playlist listed
+    double m_metadataOriginTime; // its playlist start time, seconds on the playback clock
+    bool m_hasMetadataOrigin;
+
+    // guards the seek index, built on the work queue and refined by every seek
+    std::mutex m_seekLock;
+    KeyframeIndex m_keyframeIndex;
+    HlsMediaPlaylist m_seekPlaylist; // the variant the index segments were taken from
+    Mp4MovieInfo m_seekMovie;
+    bool m_hasSeekMovie;
+    bool m_seekHasVariants;
+    std::wstring m_seekContentUrl;
+    UINT32 m_seekBitrate;
+    UINT64 m_seekIndexGeneration; // bumped when the content goes, stale index loads are dropped
+    UINT64 m_keyframeIndexVersion; // bumped whenever m_keyframeIndex is replaced or cleared, stale parses are dropped
+    std::atomic<UINT64> m_seekId; // newest Seek call, superseded queued seeks do nothing
+    std::atomic<LONGLONG> m_seekStart; // QPC ticks, 0 once the first frame after the seek arrived
+    UINT32 m_lastSeekMs;
+
+    // guards the trick player, it is built on the work queue
+    std::mutex m_trickPlayLock;
+    std::shared_ptr<SegmentCache> m_iFrameCache;
+    std::unique_ptr<TrickPlayer> m_trickPlayer;
+    double m_trickPlaySpeed;
+    UINT64 m_trickPlayId; // bumped when trick play ends, a player still being built is dropped
+
+    // guards the subtitle members, cues are loaded on the work queue and read every frame
+    std::mutex m_subtitleLock;
     std::vector<SUBTITLE_TRACK> m_subtitleTracks;
+    int m_subtitleTrack; // -1 when subtitles are off
+    WebVttCueIndex m_subtitleCues;
+    WebVttCursor m_subtitleCursor;
+    UINT64 m_subtitleGeneration; // bumped on track or content change, stale loads are dropped
+    UINT64 m_subtitleNextSequence; // first media sequence number not appended yet
+    bool m_subtitleLive;
+    bool m_subtitleLoading;
+    double m_subtitleRefreshTime; // clock seconds, live playlists are not reloaded before it
+
+    MediaEventQueue m_mediaEvents; // callbacks post, DispatchEvents drains
+    Seqlock<PLAYBACK_STATE> m_playbackState; // published by the handlers, read by anyone
+
+    ThreadPoolWorkQueue m_taskQueue; // CPU work, on the task pool when there is one
+
+    ThreadPoolWorkQueue m_workQueue; // last, drained in the destructor before anything else goes
 };
 
@@ -0,0 +1,379 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "Aes128.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define AES128_AESNI
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AES128_TARGET
+#else
+#include <cpuid.h>
+#define AES128_TARGET __attribute__((target("aes,sse2")))
+#endif
+#endif
+
+namespace
+{
+    uint32_t ReadU32(const uint8_t* p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    }
+
+    void WriteU32(uint32_t value, uint8_t* p)
+    {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+    uint32_t RotateRight(uint32_t value, int bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    uint8_t Multiply(uint8_t a, uint8_t b)
+    {
+        uint8_t product = 0;
+        while (b != 0)
+        {
+            if (b & 1)
+                product ^= a;
+            a = static_cast<uint8_t>((a << 1) ^ ((a & 0x80) ? 0x1B : 0));
+            b >>= 1;
+        }
+        return product;
+    }
+
+    // S-box and decryption tables, generated once instead of spelled out
+    struct Tables
+    {
+        uint8_t sbox[256];
+        uint8_t inverseSbox[256];
+        uint32_t decrypt[4][256];   // InvMixColumns of an inverse S-box output, one rotation per row
+
+        Tables()
+        {
+            // walks the multiplicative group with generator 3, p * q == 1 throughout
+            uint8_t p = 1;
+            uint8_t q = 1;
+            do
+            {
+                p = static_cast<uint8_t>(p ^ (p << 1) ^ ((p & 0x80) ? 0x1B : 0));
+                q ^= q << 1;
+                q ^= q << 2;
+                q ^= q << 4;
+                q ^= (q & 0x80) ? 0x09 : 0;
+
+                uint8_t affine = static_cast<uint8_t>(q ^ (q << 1 | q >> 7) ^ (q << 2 | q >> 6) ^ (q << 3 | q >> 5) ^ (q << 4 | q >> 4));
+                sbox[p] = affine ^ 0x63;
+            } while (p != 1);
+            sbox[0] = 0x63;
+
+            for (int i = 0; i < 256; ++i)
+            {
+                inverseSbox[sbox[i]] = static_cast<uint8_t>(i);
+            }
+
+            for (int i = 0; i < 256; ++i)
+            {
+                uint8_t s = inverseSbox[i];
+                uint32_t word = (uint32_t(Multiply(s, 0x0E)) << 24) | (uint32_t(Multiply(s, 0x09)) << 16)
+                    | (uint32_t(Multiply(s, 0x0D)) << 8) | Multiply(s, 0x0B);
+                decrypt[0][i] = word;
+                decrypt[1][i] = RotateRight(word, 8);
+                decrypt[2][i] = RotateRight(word, 16);
+                decrypt[3][i] = RotateRight(word, 24);
+            }
+        }
+    };
+
+    const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    void DecryptBlock(const Tables& t, const uint32_t* rk, const uint8_t* in, uint8_t* out)
+    {
+        uint32_t s0 = ReadU32(in) ^ rk[0];
+        uint32_t s1 = ReadU32(in + 4) ^ rk[1];
+        uint32_t s2 = ReadU32(in + 8) ^ rk[2];
+        uint32_t s3 = ReadU32(in + 12) ^ rk[3];
+
+        for (int round = 1; round < 10; ++round)
+        {
+            rk += 4;
+            uint32_t t0 = t.decrypt[0][s0 >> 24] ^ t.decrypt[1][(s3 >> 16) & 0xFF] ^ t.decrypt[2][(s2 >> 8) & 0xFF] ^ t.decrypt[3][s1 & 0xFF] ^ rk[0];
+            uint32_t t1 = t.decrypt[0][s1 >> 24] ^ t.decrypt[1][(s0 >> 16) & 0xFF] ^ t.decrypt[2][(s3 >> 8) & 0xFF] ^ t.decrypt[3][s2 & 0xFF] ^ rk[1];
+            uint32_t t2 = t.decrypt[0][s2 >> 24] ^ t.decrypt[1][(s1 >> 16) & 0xFF] ^ t.decrypt[2][(s0 >> 8) & 0xFF] ^ t.decrypt[3][s3 & 0xFF] ^ rk[2];
+            uint32_t t3 = t.decrypt[0][s3 >> 24] ^ t.decrypt[1][(s2 >> 16) & 0xFF] ^ t.decrypt[2][(s1 >> 8) & 0xFF] ^ t.decrypt[3][s0 & 0xFF] ^ rk[3];
+            s0 = t0;
+            s1 = t1;
+            s2 = t2;
+            s3 = t3;
+        }
+
+        rk += 4;
+        const uint8_t* si = t.inverseSbox;
+        WriteU32(((uint32_t(si[s0 >> 24]) << 24) | (uint32_t(si[(s3 >> 16) & 0xFF]) << 16) | (uint32_t(si[(s2 >> 8) & 0xFF]) << 8) | si[s1 & 0xFF]) ^ rk[0], out);
+        WriteU32(((uint32_t(si[s1 >> 24]) << 24) | (uint32_t(si[(s0 >> 16) & 0xFF]) << 16) | (uint32_t(si[(s3 >> 8) & 0xFF]) << 8) | si[s2 & 0xFF]) ^ rk[1], out + 4);
+        WriteU32(((uint32_t(si[s2 >> 24]) << 24) | (uint32_t(si[(s1 >> 16) & 0xFF]) << 16) | (uint32_t(si[(s0 >> 8) & 0xFF]) << 8) | si[s3 & 0xFF]) ^ rk[2], out + 8);
+        WriteU32(((uint32_t(si[s3 >> 24]) << 24) | (uint32_t(si[(s2 >> 16) & 0xFF]) << 16) | (uint32_t(si[(s1 >> 8) & 0xFF]) << 8) | si[s0 & 0xFF]) ^ rk[3], out + 12);
+    }
+
+    void DecryptCbcPortable(const uint32_t* roundWords, uint8_t* data, size_t blocks, uint8_t* chain)
+    {
+        const Tables& tables = GetTables();
+
+        uint8_t ciphertext[AES_BLOCK_SIZE];
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            uint8_t* block = data + i * AES_BLOCK_SIZE;
+            memcpy(ciphertext, block, AES_BLOCK_SIZE);
+            DecryptBlock(tables, roundWords, block, block);
+            for (size_t j = 0; j < AES_BLOCK_SIZE; ++j)
+            {
+                block[j] ^= chain[j];
+            }
+            memcpy(chain, ciphertext, AES_BLOCK_SIZE);
+        }
+    }
+
+#if defined(AES128_AESNI)
+    // CBC decryption has no dependency between blocks, eight of them keep the AES unit busy
+    AES128_TARGET void DecryptCbcAesNi(const uint8_t (*roundKeys)[16], uint8_t* data, size_t blocks, uint8_t* chain)
+    {
+        __m128i rk[11];
+        for (int i = 0; i < 11; ++i)
+        {
+            rk[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(roundKeys[i]));
+        }
+
+        __m128i previous = _mm_load_si128(reinterpret_cast<const __m128i*>(chain));
+        __m128i* blocksIn = reinterpret_cast<__m128i*>(data);
+
+        // eight named states stay in registers, arrays of them end up on the stack
+        size_t i = 0;
+        for (; i + 8 <= blocks; i += 8)
+        {
+            __m128i c0 = _mm_loadu_si128(blocksIn + i);
+            __m128i c1 = _mm_loadu_si128(blocksIn + i + 1);
+            __m128i c2 = _mm_loadu_si128(blocksIn + i + 2);
+            __m128i c3 = _mm_loadu_si128(blocksIn + i + 3);
+            __m128i c4 = _mm_loadu_si128(blocksIn + i + 4);
+            __m128i c5 = _mm_loadu_si128(blocksIn + i + 5);
+            __m128i c6 = _mm_loadu_si128(blocksIn + i + 6);
+            __m128i c7 = _mm_loadu_si128(blocksIn + i + 7);
+
+            __m128i s0 = _mm_xor_si128(c0, rk[0]);
+            __m128i s1 = _mm_xor_si128(c1, rk[0]);
+            __m128i s2 = _mm_xor_si128(c2, rk[0]);
+            __m128i s3 = _mm_xor_si128(c3, rk[0]);
+            __m128i s4 = _mm_xor_si128(c4, rk[0]);
+            __m128i s5 = _mm_xor_si128(c5, rk[0]);
+            __m128i s6 = _mm_xor_si128(c6, rk[0]);
+            __m128i s7 = _mm_xor_si128(c7, rk[0]);
+
+            for (int round = 1; round < 10; ++round)
+            {
+                __m128i k = rk[round];
+                s0 = _mm_aesdec_si128(s0, k);
+                s1 = _mm_aesdec_si128(s1, k);
+                s2 = _mm_aesdec_si128(s2, k);
+                s3 = _mm_aesdec_si128(s3, k);
+                s4 = _mm_aesdec_si128(s4, k);
+                s5 = _mm_aesdec_si128(s5, k);
+                s6 = _mm_aesdec_si128(s6, k);
+                s7 = _mm_aesdec_si128(s7, k);
+            }
+
+            _mm_storeu_si128(blocksIn + i, _mm_xor_si128(_mm_aesdeclast_si128(s0, rk[10]), previous));
+            _mm_storeu_si128(blocksIn + i + 1, _mm_xor_si128(_mm_aesdeclast_si128(s1, rk[10]), c0));
+            _mm_storeu_si128(blocksIn + i + 2, _mm_xor_si128(_mm_aesdeclast_si128(s2, rk[10]), c1));
+            _mm_storeu_si128(blocksIn + i + 3, _mm_xor_si128(_mm_aesdeclast_si128(s3, rk[10]), c2));
+            _mm_storeu_si128(blocksIn + i + 4, _mm_xor_si128(_mm_aesdeclast_si128(s4, rk[10]), c3));
+            _mm_storeu_si128(blocksIn + i + 5, _mm_xor_si128(_mm_aesdeclast_si128(s5, rk[10]), c4));
+            _mm_storeu_si128(blocksIn + i + 6, _mm_xor_si128(_mm_aesdeclast_si128(s6, rk[10]), c5));
+            _mm_storeu_si128(blocksIn + i + 7, _mm_xor_si128(_mm_aesdeclast_si128(s7, rk[10]), c6));
+            previous = c7;
+        }
+
+        for (; i < blocks; ++i)
+        {
+            __m128i ciphertext = _mm_loadu_si128(blocksIn + i);
+            __m128i state = _mm_xor_si128(ciphertext, rk[0]);
+            for (int round = 1; round < 10; ++round)
+            {
+                state = _mm_aesdec_si128(state, rk[round]);
+            }
+            state = _mm_aesdeclast_si128(state, rk[10]);
+            _mm_storeu_si128(blocksIn + i, _mm_xor_si128(state, previous));
+            previous = ciphertext;
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(chain), previous);
+    }
+#endif
+
+    int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+}
+
+Aes128CbcDecryptor::Aes128CbcDecryptor(const uint8_t key[16], const uint8_t iv[16])
+    : m_aesNi(IsAesNiSupported())
+{
+    const Tables& tables = GetTables();
+
+    // FIPS-197 key expansion
+    uint32_t w[44];
+    for (int i = 0; i < 4; ++i)
+    {
+        w[i] = ReadU32(key + i * 4);
+    }
+
+    uint8_t rcon = 1;
+    for (int i = 4; i < 44; ++i)
+    {
+        uint32_t temp = w[i - 1];
+        if (i % 4 == 0)
+        {
+            temp = (uint32_t(tables.sbox[(temp >> 16) & 0xFF]) << 24) | (uint32_t(tables.sbox[(temp >> 8) & 0xFF]) << 16)
+                | (uint32_t(tables.sbox[temp & 0xFF]) << 8) | tables.sbox[temp >> 24];
+            temp ^= uint32_t(rcon) << 24;
+            rcon = Multiply(rcon, 2);
+        }
+        w[i] = w[i - 4] ^ temp;
+    }
+
+    // reversed, InvMixColumns on the middle rounds. The decryption tables already include the
+    // inverse S-box, going through the S-box first leaves InvMixColumns alone.
+    for (int round = 0; round < 11; ++round)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            uint32_t word = w[(10 - round) * 4 + j];
+            if (round != 0 && round != 10)
+            {
+                word = tables.decrypt[0][tables.sbox[word >> 24]] ^ tables.decrypt[1][tables.sbox[(word >> 16) & 0xFF]]
+                    ^ tables.decrypt[2][tables.sbox[(word >> 8) & 0xFF]] ^ tables.decrypt[3][tables.sbox[word & 0xFF]];
+            }
+            m_roundWords[round * 4 + j] = word;
+            WriteU32(word, m_roundKeys[round] + j * 4);
+        }
+    }
+
+    memcpy(m_chain, iv, AES_BLOCK_SIZE);
+}
+
+bool Aes128CbcDecryptor::Decrypt(uint8_t* data, size_t size)
+{
+    if (size % AES_BLOCK_SIZE != 0 || (data == nullptr && size != 0))
+        return false;
+
+    size_t blocks = size / AES_BLOCK_SIZE;
+
+#if defined(AES128_AESNI)
+    if (m_aesNi)
+    {
+        DecryptCbcAesNi(m_roundKeys, data, blocks, m_chain);
+        return true;
+    }
+#endif
+
+    DecryptCbcPortable(m_roundWords, data, blocks, m_chain);
+    return true;
+}
+
+bool Aes128CbcDecryptor::IsAesNiSupported()
+{
+#if defined(AES128_AESNI)
+    static const bool supported = []()
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 25)) != 0 && (info[3] & (1 << 26)) != 0;
+#else
+            unsigned int eax, ebx, ecx, edx;
+            return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) != 0 && (edx & bit_SSE2) != 0;
+#endif
+        }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool Aes128::ParseIv(const std::string& text, uint8_t iv[16])
+{
+    if (text.size() < 3 || text[0] != '0' || (text[1] != 'x' && text[1] != 'X'))
+        return false;
+
+    size_t digits = text.size() - 2;
+    if (digits > 32)
+        return false;
+
+    // right aligned, shorter values have leading zeros dropped
+    memset(iv, 0, AES_BLOCK_SIZE);
+    for (size_t i = 0; i < digits; ++i)
+    {
+        int value = HexValue(text[text.size() - 1 - i]);
+        if (value < 0)
+            return false;
+
+        iv[15 - i / 2] |= static_cast<uint8_t>((i % 2 == 0) ? value : value << 4);
+    }
+
+    return true;
+}
+
+void Aes128::SequenceIv(uint64_t sequence, uint8_t iv[16])
+{
+    memset(iv, 0, 8);
+    for (int i = 0; i < 8; ++i)
+    {
+        iv[15 - i] = static_cast<uint8_t>(sequence >> (i * 8));
+    }
+}
+
+bool Aes128::RemovePadding(const uint8_t* data, size_t size, size_t* pSize)
+{
+    if (data == nullptr || pSize == nullptr || size == 0 || size % AES_BLOCK_SIZE != 0)
+        return false;
+
+    uint8_t padding = data[size - 1];
+    if (padding == 0 || padding > AES_BLOCK_SIZE)
+        return false;
+
+    for (size_t i = size - padding; i < size; ++i)
+    {
+        if (data[i] != padding)
+            return false;
+    }
+
+    *pSize = size - padding;
+    return true;
+}
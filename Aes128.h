@@ -0,0 +1,59 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable AES-128-CBC decryption for HLS segments encrypted with METHOD=AES-128. Uses AES-NI
+// when the CPU has it, eight blocks in flight to hide the instruction latency, and lookup
+// tables otherwise. No Windows dependencies.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define AES_BLOCK_SIZE 16
+
+class Aes128CbcDecryptor
+{
+public:
+    Aes128CbcDecryptor(const uint8_t key[16], const uint8_t iv[16]);
+
+    // Decrypts size bytes in place, size must be a multiple of the block size. The chaining
+    // value carries over between calls so a segment can be decrypted piece by piece.
+    bool Decrypt(uint8_t* data, size_t size);
+
+    bool UsesAesNi() const { return m_aesNi; }
+
+    // Lookup tables even when AES-NI is available, for comparisons
+    void DisableAesNi() { m_aesNi = false; }
+
+    static bool IsAesNiSupported();
+
+private:
+    // equivalent inverse cipher schedule, shared by both paths: the last encryption round key
+    // first and InvMixColumns applied to the middle ones
+    alignas(16) uint8_t m_roundKeys[11][16];
+    uint32_t m_roundWords[44];
+    alignas(16) uint8_t m_chain[16];
+    bool m_aesNi;
+};
+
+namespace Aes128
+{
+    // EXT-X-KEY IV attribute, 0x followed by up to 32 hex digits
+    bool ParseIv(const std::string& text, uint8_t iv[16]);
+
+    // IV of a segment whose key has none: its media sequence number as a big endian 128-bit value
+    void SequenceIv(uint64_t sequence, uint8_t iv[16]);
+
+    // Size of the plaintext once PKCS7 padding is removed, false if the padding is not valid
+    bool RemovePadding(const uint8_t* data, size_t size, size_t* pSize);
+}
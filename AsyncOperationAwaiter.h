@@ -0,0 +1,476 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable awaiter for asynchronous operations that report completion through a callback.
+// This header must not depend on Windows headers, the WinRT binding lives in MediaHelpers.h.
+// tools/AwaiterStress.cpp checks the completion, timeout and cancellation races on Linux, and
+// AsyncTask, the coroutine type the co_await forms of the WinRT helpers return.
+//
+// An operation type is adapted through a traits class:
+//
+//  struct Traits
+//  {
+//      using OperationPtr = ...; // owning, copyable pointer to the operation
+//      static bool Subscribe(const OperationPtr& op, std::function<void(AsyncOutcome)> onCompleted);
+//      static void Cancel(const OperationPtr& op);
+//  };
+//
+// Subscribe may invoke onCompleted synchronously if the operation is already done.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class AsyncOutcome : uint32_t
+{
+    AsyncOutcome_Pending = 0,
+    AsyncOutcome_Completed,
+    AsyncOutcome_Error,
+    AsyncOutcome_Canceled,
+    AsyncOutcome_TimedOut
+};
+
+// Cancellation source shared between the owner and any number of awaiters.
+class AsyncCancellation
+{
+public:
+    AsyncCancellation() : m_canceled(false), m_nextCookie(1)
+    {
+    }
+
+    bool IsCanceled() const
+    {
+        return m_canceled.load(std::memory_order_acquire);
+    }
+
+    void Cancel()
+    {
+        std::vector<std::pair<uint64_t, std::function<void()>>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_canceled.exchange(true, std::memory_order_acq_rel))
+                return;
+            callbacks.swap(m_callbacks);
+        }
+
+        // run outside the lock, a callback may unregister or register others
+        for (auto& callback : callbacks)
+        {
+            callback.second();
+        }
+    }
+
+    // Returns 0 and runs the callback inline if cancellation already happened.
+    uint64_t Register(std::function<void()> callback)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_canceled.load(std::memory_order_acquire))
+            {
+                uint64_t cookie = m_nextCookie++;
+                m_callbacks.emplace_back(cookie, std::move(callback));
+                return cookie;
+            }
+        }
+
+        callback();
+        return 0;
+    }
+
+    void Unregister(uint64_t cookie)
+    {
+        if (cookie == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it)
+        {
+            if (it->first == cookie)
+            {
+                m_callbacks.erase(it);
+                break;
+            }
+        }
+    }
+
+private:
+    std::mutex m_lock;
+    std::atomic<bool> m_canceled;
+    uint64_t m_nextCookie;
+    std::vector<std::pair<uint64_t, std::function<void()>>> m_callbacks;
+};
+
+// One process-wide thread servicing awaiter deadlines, so a timeout does not cost a
+// timer object or a parked thread per call. Entries are dropped lazily when they expire.
+class AsyncTimeoutQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static AsyncTimeoutQueue& Instance()
+    {
+        static AsyncTimeoutQueue s_instance;
+        return s_instance;
+    }
+
+    void Schedule(Clock::time_point deadline, std::function<void()> onExpired)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread([this]() { Run(); });
+        }
+
+        m_entries.push_back({ deadline, std::move(onExpired) });
+        m_wake.notify_one();
+    }
+
+    ~AsyncTimeoutQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shutdown = true;
+            m_wake.notify_one();
+        }
+
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Clock::time_point deadline;
+        std::function<void()> onExpired;
+    };
+
+    AsyncTimeoutQueue() : m_shutdown(false)
+    {
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (!m_shutdown)
+        {
+            auto now = Clock::now();
+            auto next = Clock::time_point::max();
+            std::vector<std::function<void()>> expired;
+
+            for (size_t i = 0; i < m_entries.size();)
+            {
+                if (m_entries[i].deadline <= now)
+                {
+                    expired.push_back(std::move(m_entries[i].onExpired));
+                    m_entries[i] = std::move(m_entries.back());
+                    m_entries.pop_back();
+                }
+                else
+                {
+                    next = (std::min)(next, m_entries[i].deadline);
+                    ++i;
+                }
+            }
+
+            if (!expired.empty())
+            {
+                lock.unlock();
+                for (auto& onExpired : expired)
+                {
+                    onExpired();
+                }
+                lock.lock();
+                continue;
+            }
+
+            if (next == Clock::time_point::max())
+                m_wake.wait(lock);
+            else
+                m_wake.wait_until(lock, next);
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::vector<Entry> m_entries;
+    std::thread m_thread;
+    bool m_shutdown;
+};
+
+// Awaits a callback-completed operation either with co_await or with a blocking Wait()
+// on the calling thread. Whichever of completion, timeout or cancellation comes first wins,
+// the losers are ignored. On timeout or cancellation the operation itself is canceled.
+template <typename TTraits>
+class AsyncOperationAwaiter
+{
+public:
+    using OperationPtr = typename TTraits::OperationPtr;
+
+    static constexpr std::chrono::milliseconds Infinite = std::chrono::milliseconds::max();
+
+    explicit AsyncOperationAwaiter(
+        OperationPtr op,
+        std::chrono::milliseconds timeout = Infinite,
+        std::shared_ptr<AsyncCancellation> cancellation = nullptr)
+        : m_op(op)
+        , m_state(std::make_shared<State>())
+    {
+        m_state->op = op;
+        Start(timeout, std::move(cancellation));
+    }
+
+    AsyncOperationAwaiter(const AsyncOperationAwaiter&) = delete;
+    AsyncOperationAwaiter& operator=(const AsyncOperationAwaiter&) = delete;
+
+    ~AsyncOperationAwaiter()
+    {
+        if (m_state->cancellation)
+        {
+            m_state->cancellation->Unregister(m_state->cancellationCookie);
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return Outcome() != AsyncOutcome::AsyncOutcome_Pending;
+    }
+
+    bool await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        m_state->continuation = continuation;
+
+        // if completion already ran it will not resume us, so do not suspend
+        return !m_state->handoff.exchange(true, std::memory_order_acq_rel);
+    }
+
+    AsyncOutcome await_resume() const noexcept
+    {
+        return Outcome();
+    }
+
+    // Blocks the calling thread on the outcome word, no kernel event is created.
+    AsyncOutcome Wait() const
+    {
+        m_state->outcome.wait(static_cast<uint32_t>(AsyncOutcome::AsyncOutcome_Pending), std::memory_order_acquire);
+        return Outcome();
+    }
+
+    AsyncOutcome Outcome() const noexcept
+    {
+        return static_cast<AsyncOutcome>(m_state->outcome.load(std::memory_order_acquire));
+    }
+
+    const OperationPtr& Operation() const
+    {
+        return m_op;
+    }
+
+private:
+    struct State
+    {
+        std::atomic<uint32_t> outcome{ static_cast<uint32_t>(AsyncOutcome::AsyncOutcome_Pending) };
+        std::atomic<bool> handoff{ false };
+        std::coroutine_handle<> continuation;
+        OperationPtr op;
+        std::shared_ptr<AsyncCancellation> cancellation;
+        uint64_t cancellationCookie = 0;
+
+        bool Complete(AsyncOutcome result)
+        {
+            uint32_t expected = static_cast<uint32_t>(AsyncOutcome::AsyncOutcome_Pending);
+            if (!outcome.compare_exchange_strong(expected, static_cast<uint32_t>(result), std::memory_order_acq_rel))
+                return false;
+
+            // only the winner touches op
+            OperationPtr completedOp = std::move(op);
+            op = OperationPtr();
+            if (result == AsyncOutcome::AsyncOutcome_Canceled || result == AsyncOutcome::AsyncOutcome_TimedOut)
+            {
+                TTraits::Cancel(completedOp);
+            }
+
+            outcome.notify_all();
+
+            if (handoff.exchange(true, std::memory_order_acq_rel) && continuation)
+            {
+                continuation.resume();
+            }
+
+            return true;
+        }
+    };
+
+    void Start(std::chrono::milliseconds timeout, std::shared_ptr<AsyncCancellation> cancellation)
+    {
+        std::weak_ptr<State> weakState = m_state;
+
+        if (cancellation)
+        {
+            m_state->cancellation = cancellation;
+            m_state->cancellationCookie = cancellation->Register([weakState]()
+                {
+                    if (auto state = weakState.lock())
+                        state->Complete(AsyncOutcome::AsyncOutcome_Canceled);
+                });
+
+            if (Outcome() != AsyncOutcome::AsyncOutcome_Pending)
+                return;
+        }
+
+        // the operation keeps its handler until it completes, a strong state there would keep the
+        // state, and through it the operation, alive for good once the awaiter is gone
+        if (!TTraits::Subscribe(m_op, [weakState](AsyncOutcome result)
+            {
+                if (auto state = weakState.lock())
+                    state->Complete(result);
+            }))
+        {
+            m_state->Complete(AsyncOutcome::AsyncOutcome_Error);
+            return;
+        }
+
+        if (timeout != Infinite && Outcome() == AsyncOutcome::AsyncOutcome_Pending)
+        {
+            AsyncTimeoutQueue::Instance().Schedule(AsyncTimeoutQueue::Clock::now() + timeout, [weakState]()
+                {
+                    if (auto state = weakState.lock())
+                        state->Complete(AsyncOutcome::AsyncOutcome_TimedOut);
+                });
+        }
+    }
+
+    OperationPtr m_op;
+    std::shared_ptr<State> m_state;
+};
+
+// Minimal eagerly started coroutine for fire-and-forget background work,
+// e.g. work that co_awaits an AsyncOperationAwaiter and reports through a callback.
+struct AsyncAction
+{
+    struct promise_type
+    {
+        AsyncAction get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Coroutine with a result for another coroutine to co_await. It starts when awaited and resumes
+// its awaiter on whatever thread it finishes, the task object owns the frame. Awaited once.
+template <typename T>
+class AsyncTask
+{
+public:
+    struct promise_type
+    {
+        T value{};
+        std::coroutine_handle<> continuation;
+
+        AsyncTask get_return_object() noexcept
+        {
+            return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // hands the thread straight to the awaiter, the frame stays until the task object goes
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(T result) { value = std::move(result); }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    AsyncTask(AsyncTask&& other) noexcept : m_handle(std::exchange(other.m_handle, {}))
+    {
+    }
+
+    AsyncTask(const AsyncTask&) = delete;
+    AsyncTask& operator=(const AsyncTask&) = delete;
+
+    ~AsyncTask()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        m_handle.promise().continuation = continuation;
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        return std::move(m_handle.promise().value);
+    }
+
+private:
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Synchronous form for callers that are not coroutines: runs the task and blocks the calling
+// thread on an atomic word until it finishes.
+template <typename T>
+T WaitForAsyncTask(AsyncTask<T> task)
+{
+    struct Result
+    {
+        std::atomic<bool> done{ false };
+        T value{};
+    };
+
+    // the driver may still be notifying when the wait returns, it keeps its own reference
+    auto result = std::make_shared<Result>();
+    [](AsyncTask<T>& awaited, std::shared_ptr<Result> pResult) -> AsyncAction
+        {
+            pResult->value = co_await awaited;
+            pResult->done.store(true, std::memory_order_release);
+            pResult->done.notify_all();
+        }(task, result);
+
+    result->done.wait(false, std::memory_order_acquire);
+    return std::move(result->value);
+}
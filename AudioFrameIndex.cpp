@@ -0,0 +1,463 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "AudioFrameIndex.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_SYNC_SSE2
+#elif defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_SYNC_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // bytes ParseHeader looks at
+    const size_t MaxHeaderProbe = 8;
+
+    const uint32_t AdtsSampleRates[] =
+    {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+    };
+
+    const uint32_t Ac3SampleRates[] = { 48000, 44100, 32000 };
+    const uint32_t Eac3ReducedSampleRates[] = { 24000, 22050, 16000 };
+
+    // AC-3 bit rates in kbps by frmsizecod / 2
+    const uint16_t Ac3BitRates[] =
+    {
+        32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 576, 640
+    };
+
+    // full bandwidth channels by acmod
+    const uint8_t Ac3Channels[] = { 2, 1, 2, 3, 3, 4, 4, 5 };
+
+    const uint8_t Eac3Blocks[] = { 1, 2, 3, 6 };
+
+    const char TransportStreamTimestampOwner[] = "com.apple.streaming.transportStreamTimestamp";
+
+    // slice-by-4 tables, entries[k] advances a byte that is followed by k more
+    struct Crc16Table
+    {
+        uint16_t entries[4][256];
+
+        Crc16Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint16_t crc = static_cast<uint16_t>(i << 8);
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x8005) : static_cast<uint16_t>(crc << 1);
+                }
+                entries[0][i] = crc;
+            }
+
+            for (uint32_t k = 1; k < 4; ++k)
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint16_t previous = entries[k - 1][i];
+                    entries[k][i] = static_cast<uint16_t>((previous << 8) ^ entries[0][previous >> 8]);
+                }
+            }
+        }
+    };
+
+    uint32_t CountTrailingZeros(uint32_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+#else
+        return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+    }
+
+    uint32_t ReadSyncSafe(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0] & 0x7F) << 21) | (static_cast<uint32_t>(p[1] & 0x7F) << 14)
+            | (static_cast<uint32_t>(p[2] & 0x7F) << 7) | static_cast<uint32_t>(p[3] & 0x7F);
+    }
+
+    uint32_t ReadU32(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+            | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+    }
+
+    bool IsSyncAt(const uint8_t* p)
+    {
+        return (p[0] == 0xFF && (p[1] & 0xF6) == 0xF0) || (p[0] == 0x0B && p[1] == 0x77);
+    }
+
+    bool ParseAdts(const uint8_t* p, size_t size, AudioFrameHeader* pHeader)
+    {
+        if (size < 7)
+            return false;
+
+        uint32_t sampleRateIndex = (p[2] >> 2) & 0x0F;
+        uint32_t channelConfig = ((p[2] & 0x01) << 2) | (p[3] >> 6);
+        uint32_t frameLength = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+        uint32_t rawDataBlocks = (p[6] & 0x03) + 1;
+        bool hasCrc = (p[1] & 0x01) == 0;
+        uint8_t headerSize = hasCrc ? 9 : 7;
+
+        if (sampleRateIndex >= sizeof(AdtsSampleRates) / sizeof(AdtsSampleRates[0]) || frameLength <= headerSize)
+            return false;
+
+        pHeader->codec = AudioCodec::AudioCodec_Aac;
+        pHeader->size = frameLength;
+        pHeader->sampleRate = AdtsSampleRates[sampleRateIndex];
+        pHeader->samples = static_cast<uint16_t>(1024 * rawDataBlocks);
+        pHeader->channels = static_cast<uint8_t>(channelConfig == 7 ? 8 : channelConfig);
+        pHeader->headerSize = headerSize;
+        pHeader->hasCrc = hasCrc;
+        pHeader->dependent = false;
+        return true;
+    }
+
+    // Skips the optional mix levels that sit between acmod and lfeon in an AC-3 bsi
+    uint32_t Ac3LfeBit(uint32_t acmod)
+    {
+        uint32_t bit = 0;
+        if ((acmod & 0x01) && acmod != 1)
+            bit += 2; // cmixlev
+        if (acmod & 0x04)
+            bit += 2; // surmixlev
+        if (acmod == 2)
+            bit += 2; // dsurmod
+        return bit;
+    }
+
+    bool ParseAc3(const uint8_t* p, size_t size, AudioFrameHeader* pHeader)
+    {
+        if (size < MaxHeaderProbe)
+            return false;
+
+        uint32_t bsid = p[5] >> 3;
+        if (bsid <= 10)
+        {
+            uint32_t fscod = p[4] >> 6;
+            uint32_t frmsizecod = p[4] & 0x3F;
+            if (fscod == 3 || frmsizecod >= 38)
+                return false;
+
+            // frame size in 16 bit words, 44.1 kHz frames alternate to keep the bit rate
+            uint32_t kbps = Ac3BitRates[frmsizecod >> 1];
+            uint32_t words = (fscod == 0) ? kbps * 2
+                : (fscod == 2) ? kbps * 3
+                : (kbps * 1000 * 1536 / 44100 / 16) + (frmsizecod & 1);
+
+            // acmod starts after bsid (5) and bsmod (3), lfeon follows the mix levels
+            uint32_t acmod = p[6] >> 5;
+            uint32_t lfeBit = 3 + Ac3LfeBit(acmod);
+            uint32_t lfeon = (((static_cast<uint32_t>(p[6]) << 8) | p[7]) >> (15 - lfeBit)) & 0x01;
+
+            pHeader->codec = AudioCodec::AudioCodec_Ac3;
+            pHeader->size = words * 2;
+            pHeader->sampleRate = Ac3SampleRates[fscod] >> (bsid > 8 ? bsid - 8 : 0);
+            pHeader->samples = 1536;
+            pHeader->channels = static_cast<uint8_t>(Ac3Channels[acmod] + lfeon);
+            pHeader->headerSize = 7;
+            pHeader->hasCrc = true;
+            pHeader->dependent = false;
+            return true;
+        }
+
+        if (bsid > 16)
+            return false;
+
+        uint32_t streamType = p[2] >> 6;
+        uint32_t substreamId = (p[2] >> 3) & 0x07;
+        uint32_t frameSize = ((((p[2] & 0x07) << 8) | p[3]) + 1) * 2;
+        uint32_t fscod = p[4] >> 6;
+        uint32_t fscod2 = (p[4] >> 4) & 0x03;
+        uint32_t acmod = (p[4] >> 1) & 0x07;
+        uint32_t lfeon = p[4] & 0x01;
+
+        if (streamType == 3 || (fscod == 3 && fscod2 == 3) || frameSize < MaxHeaderProbe)
+            return false;
+
+        pHeader->codec = AudioCodec::AudioCodec_Eac3;
+        pHeader->size = frameSize;
+        pHeader->sampleRate = (fscod == 3) ? Eac3ReducedSampleRates[fscod2] : Ac3SampleRates[fscod];
+        pHeader->samples = static_cast<uint16_t>(256 * ((fscod == 3) ? 6 : Eac3Blocks[fscod2]));
+        pHeader->channels = static_cast<uint8_t>(Ac3Channels[acmod] + lfeon);
+        pHeader->headerSize = 6;
+        pHeader->hasCrc = true;
+        pHeader->dependent = streamType == 1 || substreamId != 0;
+        return true;
+    }
+}
+
+int64_t AudioFrameIndex::Duration() const
+{
+    if (frames.empty())
+        return 0;
+
+    const AudioFrame& last = frames.back();
+    return last.pts + static_cast<int64_t>(last.samples) * 90000 / last.sampleRate - frames.front().pts;
+}
+
+size_t AudioFrames::FindSync(const uint8_t* data, size_t size, size_t start)
+{
+    size_t pos = start;
+
+#if defined(AUDIO_SYNC_SSE2)
+    const __m128i ff = _mm_set1_epi8(static_cast<char>(0xFF));
+    const __m128i adtsMask = _mm_set1_epi8(static_cast<char>(0xF6));
+    const __m128i adtsSecond = _mm_set1_epi8(static_cast<char>(0xF0));
+    const __m128i ac3First = _mm_set1_epi8(0x0B);
+    const __m128i ac3Second = _mm_set1_epi8(0x77);
+
+    // compares 16 candidate first bytes against their successors in one go
+    for (; pos + 17 <= size; pos += 16)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + 1));
+
+        __m128i adts = _mm_and_si128(_mm_cmpeq_epi8(first, ff),
+            _mm_cmpeq_epi8(_mm_and_si128(second, adtsMask), adtsSecond));
+        __m128i ac3 = _mm_and_si128(_mm_cmpeq_epi8(first, ac3First), _mm_cmpeq_epi8(second, ac3Second));
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(adts, ac3)));
+        if (mask != 0)
+            return pos + CountTrailingZeros(mask);
+    }
+#elif defined(AUDIO_SYNC_NEON)
+    const uint8x16_t ff = vdupq_n_u8(0xFF);
+    const uint8x16_t adtsMask = vdupq_n_u8(0xF6);
+    const uint8x16_t adtsSecond = vdupq_n_u8(0xF0);
+    const uint8x16_t ac3First = vdupq_n_u8(0x0B);
+    const uint8x16_t ac3Second = vdupq_n_u8(0x77);
+
+    for (; pos + 17 <= size; pos += 16)
+    {
+        uint8x16_t first = vld1q_u8(data + pos);
+        uint8x16_t second = vld1q_u8(data + pos + 1);
+
+        uint8x16_t adts = vandq_u8(vceqq_u8(first, ff), vceqq_u8(vandq_u8(second, adtsMask), adtsSecond));
+        uint8x16_t ac3 = vandq_u8(vceqq_u8(first, ac3First), vceqq_u8(second, ac3Second));
+
+        // narrows each byte lane to a nibble, lane n ends up in bits 4n..4n+3
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(vorrq_u8(adts, ac3)), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask != 0)
+        {
+            uint32_t low = static_cast<uint32_t>(mask);
+            uint32_t bit = (low != 0) ? CountTrailingZeros(low) : 32 + CountTrailingZeros(static_cast<uint32_t>(mask >> 32));
+            return pos + bit / 4;
+        }
+    }
+#endif
+
+    for (; pos + 1 < size; ++pos)
+    {
+        if (IsSyncAt(data + pos))
+            return pos;
+    }
+
+    return size;
+}
+
+bool AudioFrames::ParseHeader(const uint8_t* data, size_t size, AudioFrameHeader* pHeader)
+{
+    if (data == nullptr || pHeader == nullptr || size < 2 || !IsSyncAt(data))
+        return false;
+
+    return (data[0] == 0xFF) ? ParseAdts(data, size, pHeader) : ParseAc3(data, size, pHeader);
+}
+
+uint16_t AudioFrames::Crc16(const uint8_t* data, size_t size, uint16_t crc)
+{
+    static const Crc16Table table;
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        uint32_t top = crc ^ ((static_cast<uint32_t>(data[i]) << 8) | data[i + 1]);
+        crc = static_cast<uint16_t>(table.entries[3][top >> 8] ^ table.entries[2][top & 0xFF]
+            ^ table.entries[1][data[i + 2]] ^ table.entries[0][data[i + 3]]);
+    }
+
+    for (; i < size; ++i)
+    {
+        crc = static_cast<uint16_t>((crc << 8) ^ table.entries[0][((crc >> 8) ^ data[i]) & 0xFF]);
+    }
+    return crc;
+}
+
+size_t AudioFrames::GetId3TagSize(const uint8_t* data, size_t size)
+{
+    if (size < 10 || memcmp(data, "ID3", 3) != 0 || data[3] == 0xFF || data[4] == 0xFF)
+        return 0;
+
+    // header, syncsafe body size, optional footer
+    size_t tagSize = 10 + ReadSyncSafe(data + 6) + ((data[5] & 0x10) ? 10 : 0);
+    return (tagSize <= size) ? tagSize : 0;
+}
+
+bool AudioFrames::GetTransportStreamTimestamp(const uint8_t* data, size_t size, int64_t* pTimestamp)
+{
+    size_t tagSize = GetId3TagSize(data, size);
+    if (tagSize == 0 || pTimestamp == nullptr)
+        return false;
+
+    uint8_t version = data[3];
+    size_t pos = 10;
+    if (data[5] & 0x40)
+    {
+        // extended header, syncsafe and self inclusive in v2.4
+        if (pos + 4 > tagSize)
+            return false;
+        pos += (version >= 4) ? ReadSyncSafe(data + pos) : 4 + ReadU32(data + pos);
+    }
+
+    const size_t ownerLength = sizeof(TransportStreamTimestampOwner); // terminator included
+    while (pos + 10 <= tagSize && data[pos] != 0)
+    {
+        uint32_t frameSize = (version >= 4) ? ReadSyncSafe(data + pos + 4) : ReadU32(data + pos + 4);
+        const uint8_t* body = data + pos + 10;
+        if (frameSize > tagSize - pos - 10)
+            return false;
+
+        if (memcmp(data + pos, "PRIV", 4) == 0 && frameSize == ownerLength + 8
+            && memcmp(body, TransportStreamTimestampOwner, ownerLength) == 0)
+        {
+            const uint8_t* value = body + ownerLength;
+            *pTimestamp = static_cast<int64_t>(((static_cast<uint64_t>(ReadU32(value)) << 32) | ReadU32(value + 4))
+                & 0x1FFFFFFFFull);
+            return true;
+        }
+
+        pos += 10 + frameSize;
+    }
+
+    return false;
+}
+
+bool AudioFrames::IndexElementaryStream(const uint8_t* data, size_t size, int64_t basePts, AudioFrameIndex* pIndex)
+{
+    if (data == nullptr || pIndex == nullptr)
+        return false;
+
+    size_t found = pIndex->frames.size();
+
+    int64_t timestamp;
+    if (GetTransportStreamTimestamp(data, size, &timestamp))
+    {
+        basePts = timestamp;
+    }
+
+    // timestamps come from a sample count at the current rate so they do not drift
+    uint64_t samples = 0;
+    uint64_t pendingSamples = 0; // of the last independent frame, counted when the next one starts
+    uint32_t sampleRate = 0;
+
+    size_t pos = GetId3TagSize(data, size);
+    bool synced = false;
+
+    while (pos < size)
+    {
+        AudioFrameHeader header;
+        bool valid = ParseHeader(data + pos, size - pos, &header) && header.size <= size - pos;
+
+        if (valid && !synced)
+        {
+            // a sync word alone is weak evidence, the next frame has to line up too
+            size_t next = pos + header.size;
+            AudioFrameHeader nextHeader;
+            valid = size - next < MaxHeaderProbe
+                || (ParseHeader(data + next, size - next, &nextHeader) && nextHeader.codec == header.codec);
+        }
+
+        if (!valid)
+        {
+            size_t next = FindSync(data, size, pos + 1);
+            if (synced)
+            {
+                pIndex->resyncs++;
+            }
+
+            pIndex->bytesSkipped += next - pos;
+            synced = false;
+            pos = next;
+            continue;
+        }
+
+        // dependent and additional E-AC-3 substreams share the time of their independent frame
+        if (!header.dependent)
+        {
+            samples += pendingSamples;
+            pendingSamples = header.samples;
+        }
+
+        if (header.sampleRate != sampleRate)
+        {
+            if (sampleRate != 0)
+            {
+                basePts += static_cast<int64_t>(samples * 90000 / sampleRate);
+            }
+            sampleRate = header.sampleRate;
+            samples = 0;
+        }
+
+        if (pIndex->frames.size() == found)
+        {
+            // frame sizes barely vary within a stream, one reservation covers the segment
+            pIndex->frames.reserve(found + (size - pos) / header.size + 1);
+        }
+
+        AudioFrame frame = {};
+        frame.pts = basePts + static_cast<int64_t>(samples * 90000 / sampleRate);
+        frame.offset = static_cast<uint32_t>(pos);
+        frame.sampleRate = header.sampleRate;
+        frame.size = static_cast<uint16_t>(header.size);
+        frame.samples = header.samples;
+        frame.codec = header.codec;
+        frame.channels = header.channels;
+
+        if (!header.hasCrc)
+        {
+            frame.crc = AudioFrameCrc::AudioFrameCrc_None;
+        }
+        else if (header.codec == AudioCodec::AudioCodec_Aac)
+        {
+            frame.crc = AudioFrameCrc::AudioFrameCrc_NotChecked;
+        }
+        else
+        {
+            // crc2 closes the frame, the CRC over everything after the sync word is 0
+            bool ok = Crc16(data + pos + 2, header.size - 2) == 0;
+            frame.crc = ok ? AudioFrameCrc::AudioFrameCrc_Ok : AudioFrameCrc::AudioFrameCrc_Failed;
+            if (!ok)
+            {
+                pIndex->crcErrors++;
+            }
+        }
+
+        pIndex->frames.push_back(frame);
+
+        synced = true;
+        pos += header.size;
+    }
+
+    return pIndex->frames.size() > found;
+}
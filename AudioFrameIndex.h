@@ -0,0 +1,96 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable frame indexer for ADTS/AAC, AC-3 and E-AC-3 elementary streams: packed audio
+// segments of audio-only renditions or the payload of audio PES packets. Finds frame
+// boundaries with a vectorized sync word search, records sample rate and channel count per
+// frame, verifies AC-3/E-AC-3 CRCs and timestamps every frame in 90 kHz units.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class AudioCodec : uint8_t
+{
+    AudioCodec_Unknown = 0,
+    AudioCodec_Aac,
+    AudioCodec_Ac3,
+    AudioCodec_Eac3
+};
+
+enum class AudioFrameCrc : uint8_t
+{
+    AudioFrameCrc_None = 0,     // the frame carries no CRC
+    AudioFrameCrc_NotChecked,   // ADTS, its CRC zones need the raw data blocks decoded
+    AudioFrameCrc_Ok,
+    AudioFrameCrc_Failed
+};
+
+struct AudioFrameHeader
+{
+    AudioCodec codec;
+    uint32_t size;              // whole frame, header included
+    uint32_t sampleRate;
+    uint16_t samples;           // per channel
+    uint8_t channels;           // LFE included, 0 when signalled in-band (ADTS channel config 0)
+    uint8_t headerSize;
+    bool hasCrc;
+    bool dependent;             // E-AC-3 dependent or additional substream, adds no time
+};
+
+// 24 bytes, an hour of 48 kHz AAC is about 4 MB of index
+struct AudioFrame
+{
+    int64_t pts;                // 90 kHz
+    uint32_t offset;            // in the indexed buffer
+    uint32_t sampleRate;
+    uint16_t size;
+    uint16_t samples;
+    AudioCodec codec;
+    uint8_t channels;
+    AudioFrameCrc crc;
+    uint8_t reserved;
+};
+
+struct AudioFrameIndex
+{
+    std::vector<AudioFrame> frames;
+    uint64_t bytesSkipped = 0;  // junk between frames and truncated trailing frames
+    uint32_t crcErrors = 0;
+    uint32_t resyncs = 0;
+
+    size_t SizeBytes() const { return sizeof(*this) + frames.capacity() * sizeof(AudioFrame); }
+    int64_t Duration() const;   // 90 kHz
+};
+
+namespace AudioFrames
+{
+    // Offset of the first ADTS (0xFFF) or AC-3 (0x0B77) sync word candidate at or after
+    // start, size if there is none. Candidates still need their header validated.
+    size_t FindSync(const uint8_t* data, size_t size, size_t start);
+
+    // Parses the frame header at data, false if it is not a valid ADTS or AC-3/E-AC-3 header
+    bool ParseHeader(const uint8_t* data, size_t size, AudioFrameHeader* pHeader);
+
+    // CRC-16 with polynomial 0x8005 and initial value 0, as used by AC-3
+    uint16_t Crc16(const uint8_t* data, size_t size, uint16_t crc = 0);
+
+    // Length of a leading ID3v2 tag, 0 if there is none. Packed audio segments start with one
+    // carrying the segment timestamp in a com.apple.streaming.transportStreamTimestamp frame.
+    size_t GetId3TagSize(const uint8_t* data, size_t size);
+    bool GetTransportStreamTimestamp(const uint8_t* data, size_t size, int64_t* pTimestamp);
+
+    // Appends the frames of an elementary stream to the index. The first frame is stamped
+    // with basePts, a leading ID3 timestamp overrides it. Returns false if no frame was found.
+    bool IndexElementaryStream(const uint8_t* data, size_t size, int64_t basePts, AudioFrameIndex* pIndex);
+}
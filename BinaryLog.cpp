@@ -0,0 +1,536 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "BinaryLog.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+namespace BinaryLog
+{
+    namespace
+    {
+        // One writer, the thread it belongs to, and one reader, the drain
+        class Ring
+        {
+        public:
+            explicit Ring(size_t capacity)
+                : m_bytes(new uint8_t[capacity])
+                , m_capacity(capacity)
+                , m_head(0)
+                , m_tail(0)
+                , m_dropped(0)
+                , m_closed(false)
+            {
+            }
+
+            // the thread's side
+            void Write(const uint8_t* pRecord, size_t size)
+            {
+                uint64_t head = m_head.load(std::memory_order_relaxed);
+                uint64_t tail = m_tail.load(std::memory_order_acquire);
+                if (m_capacity - static_cast<size_t>(head - tail) < size)
+                {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+
+                Copy(head, pRecord, size);
+                m_head.store(head + size, std::memory_order_release);
+            }
+
+            // the drain's side, false when there is no record
+            bool Read(std::vector<uint8_t>* pRecord)
+            {
+                uint64_t tail = m_tail.load(std::memory_order_relaxed);
+                uint64_t head = m_head.load(std::memory_order_acquire);
+                if (head == tail)
+                    return false;
+
+                uint32_t size = 0;
+                Take(tail, reinterpret_cast<uint8_t*>(&size), sizeof(size));
+                pRecord->resize(size);
+                Take(tail, pRecord->data(), size);
+                m_tail.store(tail + size, std::memory_order_release);
+                return true;
+            }
+
+            uint64_t TakeDropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+            void Close() { m_closed = true; }
+            bool IsClosed() const { return m_closed; }
+
+        private:
+            void Copy(uint64_t position, const uint8_t* pSource, size_t size)
+            {
+                size_t offset = static_cast<size_t>(position % m_capacity);
+                size_t first = (std::min)(size, m_capacity - offset);
+                memcpy(m_bytes.get() + offset, pSource, first);
+                memcpy(m_bytes.get(), pSource + first, size - first);
+            }
+
+            void Take(uint64_t position, uint8_t* pTarget, size_t size) const
+            {
+                size_t offset = static_cast<size_t>(position % m_capacity);
+                size_t first = (std::min)(size, m_capacity - offset);
+                memcpy(pTarget, m_bytes.get() + offset, first);
+                memcpy(pTarget + first, m_bytes.get(), size - first);
+            }
+
+            std::unique_ptr<uint8_t[]> m_bytes;
+            size_t m_capacity;
+            alignas(64) std::atomic<uint64_t> m_head;
+            alignas(64) std::atomic<uint64_t> m_tail;
+            std::atomic<uint64_t> m_dropped;
+            std::atomic<bool> m_closed; // the thread exited, the ring goes once it is empty
+        };
+
+        void DefaultSink(int, const wchar_t* text)
+        {
+#ifdef _WIN32
+            OutputDebugStringW(text);
+#else
+            fputws(text, stderr);
+#endif
+        }
+
+        std::wstring SystemMessage(int32_t hr)
+        {
+            std::wstring message;
+#ifdef _WIN32
+            LPWSTR pszMessage = nullptr;
+            FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                nullptr, static_cast<DWORD>(hr), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), reinterpret_cast<LPWSTR>(&pszMessage), 0, nullptr);
+            if (pszMessage != nullptr)
+            {
+                message = pszMessage;
+                LocalFree(pszMessage);
+            }
+#else
+            (void)hr;
+#endif
+            while (!message.empty() && (message.back() == L'\n' || message.back() == L'\r'))
+            {
+                message.pop_back();
+            }
+            return message;
+        }
+
+        struct Line
+        {
+            int64_t timeNs;
+            int level;
+            std::wstring text;
+        };
+
+        class Logger
+        {
+        public:
+            static Logger& Instance()
+            {
+                static Logger s_instance;
+                return s_instance;
+            }
+
+            ~Logger()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    m_stopping = true;
+                }
+                m_wake.notify_all();
+                if (m_thread.joinable())
+                {
+                    m_thread.join();
+                }
+                Flush();
+            }
+
+            std::shared_ptr<Ring> AddThread()
+            {
+                auto ring = std::make_shared<Ring>(BINARY_LOG_RING_BYTES);
+
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_rings.push_back(ring);
+                m_threads++;
+                if (!m_thread.joinable() && !m_stopping)
+                {
+                    m_thread = std::thread([this]() { Run(); });
+                }
+                return ring;
+            }
+
+            void SetSink(Sink sink)
+            {
+                std::lock_guard<std::mutex> lock(m_drainLock);
+                m_sink = sink;
+            }
+
+            Stats GetStats()
+            {
+                Stats stats;
+                {
+                    std::lock_guard<std::mutex> lock(m_drainLock);
+                    stats.records = m_records;
+                    stats.dropped = m_dropped;
+                }
+                std::lock_guard<std::mutex> lock(m_lock);
+                stats.threads = m_threads;
+                return stats;
+            }
+
+            // One drain at a time, the lines of all rings are handed out in time order
+            void Flush()
+            {
+                std::vector<std::shared_ptr<Ring>> rings;
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    rings = m_rings;
+                }
+
+                std::lock_guard<std::mutex> drainLock(m_drainLock);
+                std::vector<Line> lines;
+                uint64_t dropped = 0;
+                bool closedRings = false;
+                for (const std::shared_ptr<Ring>& ring : rings)
+                {
+                    // closed before the reads, a record written before the close is read
+                    bool closed = ring->IsClosed();
+                    while (ring->Read(&m_record))
+                    {
+                        Line line;
+                        Format(m_record, &line);
+                        lines.push_back(std::move(line));
+                    }
+                    dropped += ring->TakeDropped();
+                    closedRings = closedRings || closed;
+                }
+
+                std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.timeNs < b.timeNs; });
+                for (const Line& line : lines)
+                {
+                    if (m_sink != nullptr)
+                    {
+                        m_sink(line.level, line.text.c_str());
+                    }
+                }
+                m_records += lines.size();
+
+                if (dropped != 0)
+                {
+                    m_dropped += dropped;
+                    if (m_sink != nullptr)
+                    {
+                        wchar_t text[96];
+                        swprintf(text, sizeof(text) / sizeof(text[0]), L"BinaryLog - %llu records dropped, a ring was full\n", static_cast<unsigned long long>(dropped));
+                        m_sink(1, text);
+                    }
+                }
+
+                if (closedRings)
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(), [](const std::shared_ptr<Ring>& ring)
+                        {
+                            std::vector<uint8_t> record;
+                            return ring->IsClosed() && !ring->Read(&record);
+                        }), m_rings.end());
+                }
+            }
+
+        private:
+            Logger()
+                : m_stopping(false)
+                , m_threads(0)
+                , m_sink(DefaultSink)
+                , m_records(0)
+                , m_dropped(0)
+            {
+            }
+
+            void Run()
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                while (!m_stopping)
+                {
+                    m_wake.wait_for(lock, std::chrono::milliseconds(BINARY_LOG_DRAIN_MS));
+                    lock.unlock();
+                    Flush();
+                    lock.lock();
+                }
+            }
+
+            // printf style, each conversion takes the next argument whatever type it was stored as
+            void Format(const std::vector<uint8_t>& record, Line* pLine)
+            {
+                Record::Header header;
+                memcpy(&header, record.data(), sizeof(header));
+                pLine->timeNs = header.timeNs;
+                pLine->level = header.level;
+
+                std::wstring& text = pLine->text;
+                const uint8_t* arg = record.data() + sizeof(header);
+                const uint8_t* end = record.data() + record.size();
+
+                for (const wchar_t* p = header.format; *p != L'\0'; ++p)
+                {
+                    if (*p != L'%')
+                    {
+                        text += *p;
+                        continue;
+                    }
+
+                    // %[flags][width][.precision][length]conversion, the length is the stored one
+                    std::wstring spec = L"%";
+                    bool leftAlign = false;
+                    size_t width = 0;
+                    size_t precision = SIZE_MAX;
+                    const wchar_t* q = p + 1;
+                    while (*q != L'\0' && wcschr(L"-+ #0", *q) != nullptr)
+                    {
+                        leftAlign = leftAlign || *q == L'-';
+                        spec += *q++;
+                    }
+                    while (*q >= L'0' && *q <= L'9')
+                    {
+                        width = width * 10 + (*q - L'0');
+                        spec += *q++;
+                    }
+                    if (*q == L'.')
+                    {
+                        precision = 0;
+                        spec += *q++;
+                        while (*q >= L'0' && *q <= L'9')
+                        {
+                            precision = precision * 10 + (*q - L'0');
+                            spec += *q++;
+                        }
+                    }
+                    while (*q != L'\0' && wcschr(L"hlLzjtIq", *q) != nullptr)
+                    {
+                        q++;
+                        while (*q >= L'0' && *q <= L'9' && q[-1] == L'I')
+                        {
+                            q++; // I64, I32
+                        }
+                    }
+
+                    wchar_t conversion = *q;
+                    if (conversion == L'\0')
+                        break;
+                    p = q;
+
+                    if (conversion == L'%')
+                    {
+                        text += L'%';
+                        continue;
+                    }
+
+                    if (arg >= end)
+                    {
+                        text += L"(missing)";
+                        continue;
+                    }
+
+                    ArgType type = static_cast<ArgType>(*arg++);
+                    if (type == ArgType::WideString || type == ArgType::String)
+                    {
+                        uint32_t count = 0;
+                        memcpy(&count, arg, sizeof(count));
+                        arg += sizeof(count);
+                        size_t charSize = (type == ArgType::WideString) ? sizeof(wchar_t) : sizeof(char);
+                        std::wstring value;
+                        value.reserve(count);
+                        for (uint32_t i = 0; i < count; ++i)
+                        {
+                            if (type == ArgType::WideString)
+                            {
+                                wchar_t c;
+                                memcpy(&c, arg + i * charSize, sizeof(c));
+                                value += c;
+                            }
+                            else
+                            {
+                                value += static_cast<wchar_t>(static_cast<unsigned char>(arg[i]));
+                            }
+                        }
+                        arg += count * charSize;
+
+                        // the precision cuts, the width pads
+                        if (value.size() > precision)
+                        {
+                            value.resize(precision);
+                        }
+                        std::wstring padding(width > value.size() ? width - value.size() : 0, L' ');
+                        text += leftAlign ? value + padding : padding + value;
+                        continue;
+                    }
+
+                    uint64_t value = 0;
+                    memcpy(&value, arg, sizeof(value));
+                    arg += sizeof(value);
+
+                    if (type == ArgType::ErrorMessage)
+                    {
+                        text += ErrorMessage(static_cast<int32_t>(value));
+                        continue;
+                    }
+
+                    double number = 0.0;
+                    if (type == ArgType::Double)
+                    {
+                        memcpy(&number, &value, sizeof(number));
+                    }
+                    else if (type == ArgType::Int)
+                    {
+                        number = static_cast<double>(static_cast<int64_t>(value));
+                    }
+                    else
+                    {
+                        number = static_cast<double>(value);
+                    }
+
+                    wchar_t formatted[128];
+                    int written = -1;
+                    switch (conversion)
+                    {
+                    case L'd':
+                    case L'i':
+                        spec += L"lld";
+                        written = swprintf(formatted, 128, spec.c_str(), type == ArgType::Double ? static_cast<long long>(number) : static_cast<long long>(value));
+                        break;
+                    case L'u':
+                    case L'x':
+                    case L'X':
+                    case L'o':
+                        spec += L"ll";
+                        spec += conversion;
+                        written = swprintf(formatted, 128, spec.c_str(), type == ArgType::Double ? static_cast<unsigned long long>(number) : static_cast<unsigned long long>(value));
+                        break;
+                    case L'c':
+                        spec += L"lc";
+                        written = swprintf(formatted, 128, spec.c_str(), static_cast<wint_t>(value));
+                        break;
+                    case L'p':
+                        spec += L'p';
+                        written = swprintf(formatted, 128, spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(value)));
+                        break;
+                    case L'f':
+                    case L'F':
+                    case L'e':
+                    case L'E':
+                    case L'g':
+                    case L'G':
+                    case L'a':
+                    case L'A':
+                        spec += conversion;
+                        written = swprintf(formatted, 128, spec.c_str(), number);
+                        break;
+                    default:
+                        break;
+                    }
+
+                    if (written >= 0)
+                    {
+                        text.append(formatted, static_cast<size_t>(written));
+                    }
+                    else
+                    {
+                        text += L"(bad format)";
+                    }
+                }
+            }
+
+            // FormatMessage once per code, under m_drainLock
+            const std::wstring& ErrorMessage(int32_t hr)
+            {
+                auto it = m_errorMessages.find(hr);
+                if (it == m_errorMessages.end())
+                {
+                    it = m_errorMessages.emplace(hr, SystemMessage(hr)).first;
+                }
+                return it->second;
+            }
+
+            std::mutex m_lock; // the rings and the thread
+            std::condition_variable m_wake;
+            std::vector<std::shared_ptr<Ring>> m_rings;
+            std::thread m_thread;
+            bool m_stopping;
+            uint64_t m_threads;
+
+            std::mutex m_drainLock; // the sink, the counts and the message table
+            Sink m_sink;
+            std::vector<uint8_t> m_record;
+            std::unordered_map<int32_t, std::wstring> m_errorMessages;
+            uint64_t m_records;
+            uint64_t m_dropped;
+        };
+
+        // The ring goes with the thread, its records stay for the drain
+        struct ThreadRing
+        {
+            std::shared_ptr<Ring> ring;
+
+            ~ThreadRing()
+            {
+                if (ring != nullptr)
+                {
+                    ring->Close();
+                }
+            }
+        };
+    }
+
+    void Commit(Record& record)
+    {
+        thread_local ThreadRing t_ring;
+        if (t_ring.ring == nullptr)
+        {
+            t_ring.ring = Logger::Instance().AddThread();
+        }
+
+        int64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const uint8_t* pBytes = record.Finish(timeNs);
+        t_ring.ring->Write(pBytes, record.Size());
+    }
+
+    void SetSink(Sink sink)
+    {
+        Logger::Instance().SetSink(sink);
+    }
+
+    void Flush()
+    {
+        Logger::Instance().Flush();
+    }
+
+    Stats GetStats()
+    {
+        return Logger::Instance().GetStats();
+    }
+}
@@ -0,0 +1,190 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable deferred logger. A call stores its level, the address of its format string and its
+// raw arguments in a ring of the calling thread, strings are copied, nothing is formatted. A
+// drain thread takes the records of all rings every BINARY_LOG_DRAIN_MS, formats them printf
+// style in time order and hands the lines to the sink. A full ring drops the record and counts
+// it, a call never blocks and never allocates once its thread has a ring. HRESULT messages are
+// looked up by the drain thread, once per code. No Windows dependencies outside BinaryLog.cpp's
+// default sink.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <type_traits>
+
+#define BINARY_LOG_RING_BYTES (64 * 1024) // per thread that logs, records beyond it are dropped until the drain catches up
+#define BINARY_LOG_MAX_RECORD_BYTES 2048 // a record's arguments together, longer strings are cut
+#define BINARY_LOG_DRAIN_MS 10 // records wait at most about this long to be formatted
+
+namespace BinaryLog
+{
+    // Receives each formatted line on the drain thread
+    using Sink = void (*)(int level, const wchar_t* text);
+
+    // nullptr drops the lines, the default is OutputDebugStringW on Windows and stderr elsewhere
+    void SetSink(Sink sink);
+
+    // Formats what all threads logged so far and hands it to the sink, on the calling thread
+    void Flush();
+
+    struct Stats
+    {
+        uint64_t records;   // formatted
+        uint64_t dropped;   // a ring was full
+        uint64_t threads;   // that have logged
+    };
+    Stats GetStats();
+
+    // An argument formatted by %s as the system message of the HRESULT
+    struct ErrorCode
+    {
+        int32_t value;
+    };
+    inline ErrorCode MessageOf(int32_t hr) { return { hr }; }
+
+    enum class ArgType : uint8_t
+    {
+        Int = 0,
+        UInt,
+        Double,
+        Pointer,
+        WideString,
+        String,
+        ErrorMessage,
+    };
+
+    // A record is built on the stack of the call, then copied into the ring in one piece
+    class Record
+    {
+    public:
+        struct Header
+        {
+            uint32_t size;          // of the record, header included
+            int32_t level;
+            int64_t timeNs;         // steady clock, orders the records of all threads
+            const wchar_t* format;  // a literal, lives as long as the process
+        };
+
+        Record(int level, const wchar_t* format)
+            : m_size(sizeof(Header))
+        {
+            Header header = { 0, level, 0, format };
+            memcpy(m_bytes, &header, sizeof(header));
+        }
+
+        template <typename T>
+        void Add(const T& value)
+        {
+            using U = std::decay_t<T>;
+            if constexpr (std::is_same<U, ErrorCode>::value)
+            {
+                AddValue(ArgType::ErrorMessage, static_cast<uint64_t>(static_cast<int64_t>(value.value)));
+            }
+            else if constexpr (std::is_same<U, const wchar_t*>::value || std::is_same<U, wchar_t*>::value)
+            {
+                const wchar_t* text = value;
+                AddText(ArgType::WideString, text, text != nullptr ? wcslen(text) : 0, sizeof(wchar_t));
+            }
+            else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value)
+            {
+                const char* text = value;
+                AddText(ArgType::String, text, text != nullptr ? strlen(text) : 0, sizeof(char));
+            }
+            else if constexpr (std::is_floating_point<U>::value)
+            {
+                double number = static_cast<double>(value);
+                uint64_t bits;
+                memcpy(&bits, &number, sizeof(bits));
+                AddValue(ArgType::Double, bits);
+            }
+            else if constexpr (std::is_pointer<U>::value || std::is_null_pointer<U>::value)
+            {
+                AddValue(ArgType::Pointer, reinterpret_cast<uintptr_t>(static_cast<const void*>(value)));
+            }
+            else if constexpr (std::is_enum<U>::value)
+            {
+                AddValue(ArgType::UInt, static_cast<uint64_t>(value));
+            }
+            else if constexpr (std::is_integral<U>::value && std::is_signed<U>::value)
+            {
+                AddValue(ArgType::Int, static_cast<uint64_t>(static_cast<int64_t>(value)));
+            }
+            else if constexpr (std::is_integral<U>::value)
+            {
+                AddValue(ArgType::UInt, static_cast<uint64_t>(value));
+            }
+            else
+            {
+                static_assert(std::is_integral<U>::value, "BinaryLog stores numbers, pointers and C strings");
+            }
+        }
+
+        // stamps the header, the size is final
+        const uint8_t* Finish(int64_t timeNs)
+        {
+            Header header;
+            memcpy(&header, m_bytes, sizeof(header));
+            header.size = static_cast<uint32_t>(m_size);
+            header.timeNs = timeNs;
+            memcpy(m_bytes, &header, sizeof(header));
+            return m_bytes;
+        }
+
+        size_t Size() const { return m_size; }
+
+    private:
+        void AddValue(ArgType type, uint64_t value)
+        {
+            if (m_size + 1 + sizeof(value) > sizeof(m_bytes))
+                return;
+
+            m_bytes[m_size] = static_cast<uint8_t>(type);
+            memcpy(m_bytes + m_size + 1, &value, sizeof(value));
+            m_size += 1 + sizeof(value);
+        }
+
+        // a nullptr is stored as an empty string, cut strings keep what fits
+        void AddText(ArgType type, const void* text, size_t length, size_t charSize)
+        {
+            if (m_size + 1 + sizeof(uint32_t) > sizeof(m_bytes))
+                return;
+
+            size_t room = (sizeof(m_bytes) - m_size - 1 - sizeof(uint32_t)) / charSize;
+            uint32_t count = static_cast<uint32_t>(length < room ? length : room);
+            m_bytes[m_size] = static_cast<uint8_t>(type);
+            memcpy(m_bytes + m_size + 1, &count, sizeof(count));
+            if (count != 0)
+            {
+                memcpy(m_bytes + m_size + 1 + sizeof(count), text, count * charSize);
+            }
+            m_size += 1 + sizeof(count) + count * charSize;
+        }
+
+        uint8_t m_bytes[BINARY_LOG_MAX_RECORD_BYTES];
+        size_t m_size;
+    };
+
+    // Copies the record into the calling thread's ring
+    void Commit(Record& record);
+
+    template <typename... TArgs>
+    void Write(int level, const wchar_t* format, const TArgs&... args)
+    {
+        Record record(level, format);
+        (record.Add(args), ...);
+        Commit(record);
+    }
+}
@@ -0,0 +1,355 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "DownloadScheduler.h"
+#include "MediaHelpers.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cwctype>
+
+using namespace Microsoft::WRL;
+
+DownloadScheduler::DownloadScheduler(size_t maxPerHost, SharedFetch* pSharedFetch)
+    : m_maxPerHost((std::max)(maxPerHost, size_t(1)))
+    , m_pSharedFetch(pSharedFetch)
+    , m_stats()
+    , m_closed(false)
+{
+}
+
+DownloadScheduler::~DownloadScheduler()
+{
+    Close();
+}
+
+HRESULT DownloadScheduler::Schedule(DownloadRequest request, Completion completion)
+{
+    NULL_CHK_HR(completion, E_INVALIDARG);
+
+    auto job = std::make_shared<Job>();
+    job->host = HostOf(request.url);
+    job->cancellation = std::make_shared<AsyncCancellation>();
+    job->queued = Clock::now();
+
+    if (request.cancellation != nullptr)
+    {
+        std::shared_ptr<AsyncCancellation> cancellation = job->cancellation;
+        job->ownerCookie = request.cancellation->Register([cancellation]() { cancellation->Cancel(); });
+    }
+
+    job->request = std::move(request);
+    job->completion = std::move(completion);
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_closed)
+        {
+            m_queues[static_cast<size_t>(job->request.priority)].push_back(job);
+            job = nullptr;
+        }
+    }
+
+    if (job != nullptr)
+    {
+        if (job->request.cancellation != nullptr)
+        {
+            job->request.cancellation->Unregister(job->ownerCookie);
+        }
+        return E_ILLEGAL_METHOD_CALL;
+    }
+
+    Dispatch();
+
+    return S_OK;
+}
+
+HRESULT DownloadScheduler::Fetch(DownloadRequest request, SegmentBuffer* pData)
+{
+    NULL_CHK(pData);
+    *pData = nullptr;
+
+    struct Waiter
+    {
+        std::mutex lock;
+        std::condition_variable done;
+        bool finished = false;
+        DownloadResult result;
+    };
+
+    auto waiter = std::make_shared<Waiter>();
+    HRESULT hr = Schedule(std::move(request), [waiter](const DownloadResult& result)
+        {
+            std::lock_guard<std::mutex> lock(waiter->lock);
+            waiter->result = result;
+            waiter->finished = true;
+            waiter->done.notify_all();
+        });
+    IFR(hr);
+
+    std::unique_lock<std::mutex> lock(waiter->lock);
+    waiter->done.wait(lock, [&waiter]() { return waiter->finished; });
+
+    IFR(waiter->result.hr);
+    *pData = waiter->result.data;
+
+    return S_OK;
+}
+
+size_t DownloadScheduler::Cancel(const std::function<bool(const DownloadRequest&)>& isStale)
+{
+    std::vector<std::shared_ptr<Job>> dropped;
+    std::vector<std::shared_ptr<AsyncCancellation>> running;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto& queue : m_queues)
+        {
+            auto stale = std::stable_partition(queue.begin(), queue.end(), [&](const std::shared_ptr<Job>& job) { return !isStale(job->request); });
+            dropped.insert(dropped.end(), stale, queue.end());
+            queue.erase(stale, queue.end());
+        }
+
+        for (const std::shared_ptr<Job>& job : m_running)
+        {
+            if (isStale(job->request))
+            {
+                running.push_back(job->cancellation);
+            }
+        }
+    }
+
+    // a running download returns E_ABORT on its own pool thread and finishes there
+    for (const std::shared_ptr<AsyncCancellation>& cancellation : running)
+    {
+        cancellation->Cancel();
+    }
+
+    for (const std::shared_ptr<Job>& job : dropped)
+    {
+        job->cancellation->Cancel();
+        Finish(job, DownloadResult(), false);
+    }
+
+    return dropped.size() + running.size();
+}
+
+void DownloadScheduler::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closed = true;
+    }
+
+    Cancel([](const DownloadRequest&) { return true; });
+    m_workQueue.Drain();
+}
+
+DOWNLOAD_PRIORITY_STATS DownloadScheduler::GetStats(DownloadPriority priority) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats[static_cast<size_t>(priority)];
+}
+
+void DownloadScheduler::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (DOWNLOAD_PRIORITY_STATS& stats : m_stats)
+    {
+        stats = DOWNLOAD_PRIORITY_STATS();
+    }
+}
+
+void DownloadScheduler::LogStats() const
+{
+    static const wchar_t* Names[] = { L"playlist", L"audio near", L"video near", L"audio ahead", L"video ahead" };
+
+    for (size_t i = 0; i < static_cast<size_t>(DownloadPriority::Count); ++i)
+    {
+        DOWNLOAD_PRIORITY_STATS stats = GetStats(static_cast<DownloadPriority>(i));
+        UINT64 finished = stats.completed + stats.failed;
+        if (finished + stats.canceled == 0)
+            continue;
+
+        Log(Log_Level_Info, L"DownloadScheduler - %s: %llu done, %llu failed, %llu canceled, %llu bytes, %llu wasted, queued %.1f ms mean %.1f ms max\n",
+            Names[i], stats.completed, stats.failed, stats.canceled, stats.bytes, stats.wastedBytes,
+            finished != 0 ? stats.queueSecondsTotal * 1000.0 / finished : 0.0, stats.queueSecondsMax * 1000.0);
+    }
+}
+
+// scheme://host:port, lower case, the key connections are pooled and limited by
+std::wstring DownloadScheduler::HostOf(const std::wstring& url)
+{
+    size_t start = url.find(L"://");
+    start = (start == std::wstring::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of(L"/?#", start);
+
+    std::wstring host = url.substr(0, end);
+    std::transform(host.begin(), host.end(), host.begin(), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+    return host;
+}
+
+// The first job in priority order whose host has a free slot, or a canceled one to drop
+std::shared_ptr<DownloadScheduler::Job> DownloadScheduler::NextJobLocked()
+{
+    for (auto& queue : m_queues)
+    {
+        for (auto it = queue.begin(); it != queue.end(); ++it)
+        {
+            std::shared_ptr<Job> job = *it;
+            if (job->cancellation->IsCanceled() || m_hosts[job->host].running < m_maxPerHost)
+            {
+                queue.erase(it);
+                return job;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+void DownloadScheduler::Dispatch()
+{
+    for (;;)
+    {
+        std::shared_ptr<Job> job;
+        ComPtr<ABI::Windows::Web::Http::IHttpClient> spClient;
+        bool canceled = false;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            job = NextJobLocked();
+            if (job == nullptr)
+                return;
+
+            job->queueSeconds = std::chrono::duration<double>(Clock::now() - job->queued).count();
+            canceled = job->cancellation->IsCanceled();
+            if (!canceled)
+            {
+                Host& host = m_hosts[job->host];
+                if (host.client == nullptr)
+                {
+                    LOG_RESULT(CreateHttpClient(&host.client));
+                }
+
+                host.running++;
+                spClient = host.client;
+                m_running.push_back(job);
+            }
+        }
+
+        if (canceled)
+        {
+            Finish(job, DownloadResult(), false);
+            continue;
+        }
+
+        HRESULT hr = m_workQueue.Queue([this, job, spClient]()
+            {
+                Run(job, spClient);
+            });
+        if (FAILED(hr))
+        {
+            DownloadResult result;
+            result.hr = hr;
+            Finish(job, result, true);
+        }
+    }
+}
+
+void DownloadScheduler::Run(const std::shared_ptr<Job>& job, const ComPtr<ABI::Windows::Web::Http::IHttpClient>& spClient)
+{
+    const DownloadRequest& request = job->request;
+
+    DownloadResult result;
+    if (m_pSharedFetch != nullptr)
+    {
+        // a joined download is timed from its start, what the network took is what ABR needs. The
+        // download may outlive this job, it holds copies of what it uses
+        result.hr = m_pSharedFetch->Fetch(SegmentCache::MakeKey(WideToUtf8(request.url), request.offset, request.length), request.timeoutMs, job->cancellation,
+            [request, spClient, bytesReceived = job->bytesReceived](const std::shared_ptr<AsyncCancellation>& cancellation, std::vector<uint8_t>* pData)
+            {
+                return DownloadToBuffer(request.url.c_str(), request.offset, request.length, pData, request.timeoutMs, cancellation, spClient.Get(), bytesReceived);
+            },
+            &result.data, &result.downloadSeconds);
+    }
+    else
+    {
+        Clock::time_point start = Clock::now();
+        auto spData = std::make_shared<std::vector<uint8_t>>();
+        result.hr = DownloadToBuffer(request.url.c_str(), request.offset, request.length, spData.get(), request.timeoutMs, job->cancellation, spClient.Get(), job->bytesReceived);
+        result.downloadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        result.data = spData;
+    }
+
+    Finish(job, std::move(result), true);
+}
+
+void DownloadScheduler::Finish(const std::shared_ptr<Job>& job, DownloadResult result, bool started)
+{
+    result.queueSeconds = started ? job->queueSeconds : std::chrono::duration<double>(Clock::now() - job->queued).count();
+
+    // what arrived before the cancel is thrown away, all of it when the cancel came after the last byte.
+    // A download joined through SharedFetch counts for the request that started it
+    UINT64 wastedBytes = 0;
+    if (job->cancellation->IsCanceled())
+    {
+        wastedBytes = *job->bytesReceived;
+        if (SUCCEEDED(result.hr) && result.data != nullptr)
+        {
+            wastedBytes = (std::max)(wastedBytes, static_cast<UINT64>(result.data->size()));
+        }
+        result.hr = E_ABORT;
+        result.data = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (started)
+        {
+            m_hosts[job->host].running--;
+            m_running.erase(std::remove(m_running.begin(), m_running.end(), job), m_running.end());
+        }
+
+        DOWNLOAD_PRIORITY_STATS& stats = m_stats[static_cast<size_t>(job->request.priority)];
+        if (result.hr == E_ABORT)
+        {
+            stats.canceled++;
+            stats.wastedBytes += wastedBytes;
+        }
+        else
+        {
+            if (FAILED(result.hr))
+            {
+                stats.failed++;
+            }
+            else
+            {
+                stats.completed++;
+                stats.bytes += result.data->size();
+            }
+            stats.queueSecondsTotal += result.queueSeconds;
+            stats.queueSecondsMax = (std::max)(stats.queueSecondsMax, result.queueSeconds);
+        }
+    }
+
+    if (job->request.cancellation != nullptr)
+    {
+        job->request.cancellation->Unregister(job->ownerCookie);
+    }
+
+    // the slot goes to the next download before this completion runs
+    if (started)
+    {
+        Dispatch();
+    }
+
+    job->completion(result);
+}
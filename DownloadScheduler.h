@@ -0,0 +1,158 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AsyncOperationAwaiter.h"
+#include "SegmentCache.h"
+#include "SharedFetch.h"
+#include "ThreadPoolWorkQueue.h"
+
+#define DOWNLOAD_SCHEDULER_MAX_PER_HOST 4 // downloads in flight per origin, each one holds a connection
+#define DOWNLOAD_NEAR_PLAYHEAD_SECONDS 10.0 // segments starting closer than this to the position are needed first
+
+// Served in this order, first in first out within a priority
+enum class DownloadPriority : UINT32
+{
+    Playlist = 0,       // playlist reloads and keys, the segments wait on them
+    AudioNearPlayhead,
+    VideoNearPlayhead,
+    AudioLookahead,
+    VideoLookahead,
+    Count
+};
+
+// Who asked, stale work is picked by it when the playhead or the bitrate moves
+enum class DownloadOrigin : UINT32
+{
+    Player,     // DownloadRequested of the AdaptiveMediaSource
+    Prefetch,   // the next playlist item
+    Seek,       // keyframe index and seek targets
+    TrickPlay,
+    LowLatency, // LL-HLS reloads and parts
+};
+
+struct DownloadRequest
+{
+    std::wstring url;
+    UINT64 offset = 0;
+    UINT64 length = 0;  // 0 is the whole resource
+    DownloadPriority priority = DownloadPriority::VideoLookahead;
+    DownloadOrigin origin = DownloadOrigin::Prefetch;
+    UINT32 bitrate = 0; // bandwidth of the variant the segment is from, 0 when unknown
+    DWORD timeoutMs = INFINITE;
+    std::shared_ptr<AsyncCancellation> cancellation; // the owner's, canceling it cancels the download too
+};
+
+struct DownloadResult
+{
+    HRESULT hr = E_ABORT; // E_ABORT when it was canceled
+    SegmentBuffer data;
+    double queueSeconds = 0.0;      // scheduled to started
+    double downloadSeconds = 0.0;   // started to the last byte
+};
+
+using DOWNLOAD_PRIORITY_STATS = struct _DOWNLOAD_PRIORITY_STATS
+{
+    UINT64 completed;
+    UINT64 failed;
+    UINT64 canceled;        // dropped from the queue or aborted in flight
+    UINT64 bytes;           // delivered
+    UINT64 wastedBytes;     // received by canceled downloads, in flight or already complete
+    double queueSecondsTotal;
+    double queueSecondsMax;
+};
+
+// Orders all segment, playlist and key downloads by priority and runs at most
+// DOWNLOAD_SCHEDULER_MAX_PER_HOST of them per origin, each origin with one HttpClient so its
+// connections are reused. A host at its limit does not hold back the downloads of others.
+// Completions run on thread pool threads. With a SharedFetch, a download another scheduler of the
+// process has in flight is joined instead of started again.
+class DownloadScheduler
+{
+public:
+    using Completion = std::function<void(const DownloadResult& result)>;
+
+    explicit DownloadScheduler(_In_ size_t maxPerHost = DOWNLOAD_SCHEDULER_MAX_PER_HOST, _In_opt_ SharedFetch* pSharedFetch = nullptr);
+    ~DownloadScheduler();
+
+    // The completion runs exactly once, with E_ABORT when the download is canceled. When
+    // Schedule fails the download was not queued and the completion does not run.
+    HRESULT Schedule(_In_ DownloadRequest request, _In_ Completion completion);
+
+    // Schedules and waits for the result, for work that already runs in the background
+    HRESULT Fetch(_In_ DownloadRequest request, _Out_ SegmentBuffer* pData);
+
+    // Cancels the queued and running downloads the predicate picks, returns how many
+    size_t Cancel(_In_ const std::function<bool(const DownloadRequest&)>& isStale);
+
+    // Cancels everything and waits for the completions, Schedule fails from then on
+    void Close();
+
+    DOWNLOAD_PRIORITY_STATS GetStats(_In_ DownloadPriority priority) const;
+    void ResetStats();
+    void LogStats() const;
+
+    // CPU time of the downloads and their completions, 100 ns units
+    UINT64 CpuTime() const { return m_workQueue.CpuTime(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job
+    {
+        DownloadRequest request;
+        Completion completion;
+        std::wstring host;
+        std::shared_ptr<AsyncCancellation> cancellation; // its own, the owner's only chains into it
+        uint64_t ownerCookie = 0;
+        Clock::time_point queued;
+        double queueSeconds = 0.0;
+        std::shared_ptr<std::atomic<UINT64>> bytesReceived = std::make_shared<std::atomic<UINT64>>(0); // so far, wasted when it is canceled
+    };
+
+    struct Host
+    {
+        size_t running = 0;
+        Microsoft::WRL::ComPtr<ABI::Windows::Web::Http::IHttpClient> client;
+    };
+
+    static std::wstring HostOf(_In_ const std::wstring& url);
+
+    std::shared_ptr<Job> NextJobLocked();
+    void Dispatch();
+    void Run(_In_ const std::shared_ptr<Job>& job, _In_ const Microsoft::WRL::ComPtr<ABI::Windows::Web::Http::IHttpClient>& spClient);
+    void Finish(_In_ const std::shared_ptr<Job>& job, _In_ DownloadResult result, _In_ bool started);
+
+    const size_t m_maxPerHost;
+    SharedFetch* const m_pSharedFetch; // process wide, nullptr downloads every request itself
+
+    mutable std::mutex m_lock;
+    std::deque<std::shared_ptr<Job>> m_queues[static_cast<size_t>(DownloadPriority::Count)];
+    std::vector<std::shared_ptr<Job>> m_running;
+    std::map<std::wstring, Host> m_hosts;
+    DOWNLOAD_PRIORITY_STATS m_stats[static_cast<size_t>(DownloadPriority::Count)];
+    bool m_closed;
+
+    ThreadPoolWorkQueue m_workQueue; // last, drained before the rest goes
+};
@@ -0,0 +1,618 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "ForkedAudioInput.h"
+
+#include <windows.media.mediaproperties.h>
+#include <MemoryBuffer.h>
+
+#include <algorithm>
+
+using namespace Microsoft::WRL;
+using namespace Microsoft::WRL::Wrappers;
+using namespace ABI::Windows::Media;
+using namespace ABI::Windows::Media::Audio;
+using namespace ABI::Windows::Media::MediaProperties;
+
+namespace
+{
+    // 33-bit PTS to the value closest to the reference
+    int64_t UnwrapPts(int64_t pts, int64_t reference)
+    {
+        const int64_t wrap = 1LL << 33;
+        int64_t value = (reference & ~(wrap - 1)) | (pts & (wrap - 1));
+        if (value - reference > wrap / 2)
+        {
+            value -= wrap;
+        }
+        else if (reference - value > wrap / 2)
+        {
+            value += wrap;
+        }
+        return value;
+    }
+}
+
+HRESULT ForkedAudioInput::Create(
+    IAudioGraph* pAudioGraph,
+    IAudioNode* pOutputNode,
+    UnsupportedCallback onUnsupported,
+    std::shared_ptr<ForkedAudioInput>* pInput)
+{
+    NULL_CHK(pAudioGraph);
+    NULL_CHK(pOutputNode);
+    NULL_CHK(pInput);
+
+    auto input = std::make_shared<ForkedAudioInput>();
+    input->m_audioGraph = pAudioGraph;
+    input->m_outputNode = pOutputNode;
+    input->m_onUnsupported = std::move(onUnsupported);
+
+    // the process does not otherwise start media foundation, the samples and buffers need it
+    IFR(MFStartup(MF_VERSION, MFSTARTUP_LITE));
+    input->m_mfStarted = true;
+
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_AudioFrame).Get(),
+        &input->m_frameFactory));
+    IFR(input->CreateDecoder());
+
+    *pInput = std::move(input);
+
+    return S_OK;
+}
+
+ForkedAudioInput::ForkedAudioInput()
+    : m_quantumStartedToken()
+    , m_pid(0)
+    , m_streamSampleRate(0)
+    , m_streamChannels(0)
+    , m_nodeSampleRate(0)
+    , m_nodeChannels(0)
+    , m_unsupportedPackets(0)
+    , m_closed(false)
+    , m_unsupported(false)
+    , m_mfStarted(false)
+    , m_referencePts(0)
+    , m_playedPts(0)
+    , m_hasReferencePts(false)
+    , m_hasPlayedPts(false)
+    , m_flushPending(false)
+    , m_outputSubtype(GUID_NULL)
+    , m_sampleRate(0)
+    , m_channels(0)
+{
+}
+
+ForkedAudioInput::~ForkedAudioInput()
+{
+    Close();
+    m_decoder.Reset();
+
+    if (m_mfStarted)
+    {
+        MFShutdown();
+    }
+}
+
+void ForkedAudioInput::Push(const PesPacket& packet)
+{
+    if (packet.streamType != static_cast<uint8_t>(TsStreamType::TsStreamType_AacAdts) || !packet.hasPts)
+    {
+        OnUnsupportedPacket();
+        return;
+    }
+
+    // a PES carries several ADTS frames, each is stamped from the PTS of the first
+    std::vector<std::pair<int64_t, std::vector<uint8_t>>> frames;
+    int64_t pts = packet.pts;
+    size_t offset = 0;
+    while (offset < packet.size)
+    {
+        AudioFrameHeader header;
+        if (!AudioFrames::ParseHeader(packet.data + offset, packet.size - offset, &header)
+            || header.codec != AudioCodec::AudioCodec_Aac
+            || header.size > packet.size - offset)
+            break;
+
+        // channel configuration 0 needs the program config element the decoder is not given
+        if (header.channels == 0)
+        {
+            OnUnsupportedPacket();
+            return;
+        }
+
+        bool decoded = false;
+        if (!EnsureInputNode(packet, header, packet.data + offset, pts, &decoded))
+            return;
+
+        if (packet.pid != m_pid)
+            return; // another language or rendition, the node plays the first one
+
+        // the frame that created the node is decoded already
+        if (!decoded)
+        {
+            if (header.sampleRate == m_streamSampleRate && header.channels == m_streamChannels)
+            {
+                frames.emplace_back(pts, std::vector<uint8_t>(packet.data + offset, packet.data + offset + header.size));
+            }
+            else
+            {
+                Log(Log_Level_Warning, L"ForkedAudioInput - %u Hz %u channel frame dropped, the node plays %u Hz %u channels\n",
+                    header.sampleRate, header.channels, m_streamSampleRate, m_streamChannels);
+            }
+        }
+
+        offset += header.size;
+        pts += static_cast<int64_t>(header.samples) * 90000 / header.sampleRate;
+    }
+
+    if (frames.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    int64_t first = m_hasReferencePts ? UnwrapPts(packet.pts, m_referencePts) : packet.pts;
+    m_referencePts = first;
+    m_hasReferencePts = true;
+
+    for (auto& frame : frames)
+    {
+        int64_t framePts = first + (frame.first - packet.pts);
+
+        // the node played past it, a segment that came in late
+        if (m_hasPlayedPts && framePts < m_playedPts)
+            continue;
+
+        m_pending[framePts] = std::move(frame.second);
+    }
+
+    while (m_pending.size() > FORKED_AUDIO_PENDING_LIMIT)
+    {
+        m_pending.erase(m_pending.begin());
+    }
+}
+
+void ForkedAudioInput::Reset()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_pending.clear();
+    m_hasReferencePts = false;
+    m_hasPlayedPts = false;
+
+    // the decoder belongs to the graph's thread, it flushes there
+    m_flushPending = true;
+}
+
+void ForkedAudioInput::Close()
+{
+    std::lock_guard<std::mutex> lock(m_nodeLock);
+    m_closed = true;
+
+    if (m_inputNode != nullptr)
+    {
+        LOG_RESULT(m_inputNode->remove_QuantumStarted(m_quantumStartedToken));
+
+        // closing takes the node out of the graph, which may be recycled for other content
+        ComPtr<ABI::Windows::Foundation::IClosable> spClosable;
+        if (SUCCEEDED(m_inputNode.As(&spClosable)))
+        {
+            LOG_RESULT(spClosable->Close());
+        }
+        m_inputNode.Reset();
+    }
+}
+
+// Other codecs next to an ADTS stream are ignored, only a fork without one gives up
+void ForkedAudioInput::OnUnsupportedPacket()
+{
+    UnsupportedCallback onUnsupported;
+    {
+        std::lock_guard<std::mutex> lock(m_nodeLock);
+        if (m_closed || m_unsupported || m_inputNode != nullptr)
+            return;
+
+        if (++m_unsupportedPackets < FORKED_AUDIO_UNSUPPORTED_PACKETS)
+            return;
+
+        m_unsupported = true;
+        onUnsupported = m_onUnsupported;
+    }
+
+    Log(Log_Level_Warning, L"ForkedAudioInput - the forked audio is not ADTS/AAC, it cannot be played\n");
+    if (onUnsupported)
+    {
+        onUnsupported();
+    }
+}
+
+// The AAC decoder MFT of the system, the first one the enumeration ranks
+HRESULT ForkedAudioInput::CreateDecoder()
+{
+    MFT_REGISTER_TYPE_INFO inputType = { MFMediaType_Audio, MFAudioFormat_AAC };
+    IMFActivate** ppActivate = nullptr;
+    UINT32 count = 0;
+    IFR(MFTEnumEx(MFT_CATEGORY_AUDIO_DECODER, MFT_ENUM_FLAG_SYNCMFT | MFT_ENUM_FLAG_LOCALMFT | MFT_ENUM_FLAG_SORTANDFILTER,
+        &inputType, nullptr, &ppActivate, &count));
+
+    HRESULT hr = (count == 0) ? MF_E_TOPO_CODEC_NOT_FOUND : ppActivate[0]->ActivateObject(IID_PPV_ARGS(&m_decoder));
+
+    for (UINT32 i = 0; i < count; ++i)
+    {
+        ppActivate[i]->Release();
+    }
+    CoTaskMemFree(ppActivate);
+
+    IFR(hr);
+
+    return S_OK;
+}
+
+HRESULT ForkedAudioInput::SetDecoderTypes(UINT32 sampleRate, UINT32 channels)
+{
+    ComPtr<IMFMediaType> spInputType;
+    IFR(MFCreateMediaType(&spInputType));
+    IFR(spInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
+    IFR(spInputType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_AAC));
+    IFR(spInputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate));
+    IFR(spInputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, channels));
+    IFR(spInputType->SetUINT32(MF_MT_AAC_PAYLOAD_TYPE, 1)); // ADTS
+
+    // HEAACWAVEINFO past its WAVEFORMATEX: payload type 1, profile level 0xFE (not specified) and
+    // no AudioSpecificConfig after it, ADTS carries the configuration in every frame
+    const UINT8 userData[12] = { 0x01, 0x00, 0xFE, 0x00 };
+    IFR(spInputType->SetBlob(MF_MT_USER_DATA, userData, sizeof(userData)));
+    IFR(m_decoder->SetInputType(0, spInputType.Get(), 0));
+
+    IFR(SetDecoderOutputType());
+    IFR(m_decoder->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0));
+
+    return S_OK;
+}
+
+// Float output when the decoder offers it, which saves a conversion, 16 bit PCM otherwise
+HRESULT ForkedAudioInput::SetDecoderOutputType()
+{
+    ComPtr<IMFMediaType> spChosen;
+    GUID chosenSubtype = GUID_NULL;
+    for (DWORD i = 0;; ++i)
+    {
+        ComPtr<IMFMediaType> spType;
+        HRESULT hr = m_decoder->GetOutputAvailableType(0, i, &spType);
+        if (hr == MF_E_NO_MORE_TYPES)
+            break;
+        IFR(hr);
+
+        GUID subtype = GUID_NULL;
+        UINT32 bitsPerSample = 0;
+        spType->GetGUID(MF_MT_SUBTYPE, &subtype);
+        spType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &bitsPerSample);
+
+        if (subtype == MFAudioFormat_Float)
+        {
+            spChosen = spType;
+            chosenSubtype = subtype;
+            break;
+        }
+
+        if (subtype == MFAudioFormat_PCM && bitsPerSample == 16 && spChosen == nullptr)
+        {
+            spChosen = spType;
+            chosenSubtype = subtype;
+        }
+    }
+
+    NULL_CHK_HR(spChosen.Get(), MF_E_INVALIDMEDIATYPE);
+    IFR(m_decoder->SetOutputType(0, spChosen.Get(), 0));
+
+    // HE-AAC decodes to twice the rate of its ADTS header
+    IFR(spChosen->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &m_sampleRate));
+    IFR(spChosen->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &m_channels));
+    m_outputSubtype = chosenSubtype;
+
+    return S_OK;
+}
+
+HRESULT ForkedAudioInput::CreateInputNode()
+{
+    ComPtr<IAudioEncodingPropertiesStatics> spStatics;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_MediaProperties_AudioEncodingProperties).Get(),
+        &spStatics));
+
+    ComPtr<IAudioEncodingProperties> spProperties;
+    IFR(spStatics->CreatePcm(m_sampleRate, m_channels, 32, &spProperties));
+
+    ComPtr<IMediaEncodingProperties> spMediaProperties;
+    IFR(spProperties.As(&spMediaProperties));
+    IFR(spMediaProperties->put_Subtype(HStringReference(L"Float").Get()));
+
+    ComPtr<IAudioFrameInputNode> spNode;
+    IFR(m_audioGraph->CreateFrameInputNodeWithFormat(spProperties.Get(), &spNode));
+
+    ComPtr<IAudioInputNode> spInputNode;
+    IFR(spNode.As(&spInputNode));
+    IFR(spInputNode->AddOutgoingConnection(m_outputNode.Get()));
+
+    m_nodeSampleRate = m_sampleRate;
+    m_nodeChannels = m_channels;
+
+    // the decoder is set up, from here on it belongs to the graph's thread. Removing the handler
+    // does not wait for a quantum in flight, the handler holds the input only while it runs
+    std::weak_ptr<ForkedAudioInput> weakThis = GetWeakPtr<ForkedAudioInput>();
+    auto quantumStarted = Callback<IFrameInputNodeQuantumStartedEventHandler>(
+        [weakThis](IAudioFrameInputNode* sender, IFrameInputNodeQuantumStartedEventArgs* args) -> HRESULT
+        {
+            std::shared_ptr<ForkedAudioInput> input = weakThis.lock();
+            return (input != nullptr) ? input->OnQuantumStarted(sender, args) : S_OK;
+        });
+    IFR(spNode->add_QuantumStarted(quantumStarted.Get(), &m_quantumStartedToken));
+
+    m_inputNode = spNode;
+
+    return S_OK;
+}
+
+// Decodes the first frame to learn the decoded format and creates the node in it, false when
+// there is no node to feed. pDecoded tells the caller the frame is in m_pcm already. A node that
+// cannot be created counts as unsupported audio.
+bool ForkedAudioInput::EnsureInputNode(const PesPacket& packet, const AudioFrameHeader& header, const uint8_t* pFrame, int64_t pts, bool* pDecoded)
+{
+    *pDecoded = false;
+
+    UnsupportedCallback onUnsupported;
+    {
+        std::lock_guard<std::mutex> lock(m_nodeLock);
+        if (m_closed || m_unsupported)
+            return false;
+
+        if (m_inputNode != nullptr)
+            return true;
+
+        HRESULT hr = SetDecoderTypes(header.sampleRate, header.channels);
+        if (SUCCEEDED(hr))
+        {
+            hr = Decode(pFrame, header.size, pts);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = CreateInputNode();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            m_pid = packet.pid;
+            m_streamSampleRate = header.sampleRate;
+            m_streamChannels = header.channels;
+            *pDecoded = true;
+
+            // the node plays on from this frame
+            std::lock_guard<std::mutex> pendingLock(m_lock);
+            m_referencePts = pts;
+            m_playedPts = pts;
+            m_hasReferencePts = true;
+            m_hasPlayedPts = true;
+
+            return true;
+        }
+
+        LOG_RESULT_MSG(hr, L"ForkedAudioInput - no frame input node, the forked audio is not played");
+        m_unsupported = true;
+        onUnsupported = m_onUnsupported;
+    }
+
+    if (onUnsupported)
+    {
+        onUnsupported();
+    }
+
+    return false;
+}
+
+// The graph's thread. Decodes queued frames in PTS order until the quantum is covered, the node
+// plays silence for what is missing until the fork catches up.
+HRESULT ForkedAudioInput::OnQuantumStarted(IAudioFrameInputNode* sender, IFrameInputNodeQuantumStartedEventArgs* args)
+{
+    INT32 requiredSamples = 0;
+    IFR(args->get_RequiredSamples(&requiredSamples));
+
+    bool flush = false;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        flush = m_flushPending;
+        m_flushPending = false;
+    }
+
+    if (flush)
+    {
+        LOG_RESULT(m_decoder->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0));
+        m_pcm.clear();
+    }
+
+    if (requiredSamples <= 0)
+        return S_OK;
+
+    size_t required = static_cast<size_t>(requiredSamples) * m_nodeChannels;
+    while (m_pcm.size() < required)
+    {
+        std::vector<uint8_t> frame;
+        int64_t pts = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_pending.empty())
+                break;
+
+            auto next = m_pending.begin();
+            pts = next->first;
+            frame = std::move(next->second);
+            m_pending.erase(next);
+
+            m_playedPts = pts;
+            m_hasPlayedPts = true;
+        }
+
+        // a frame that does not decode is skipped, the next one may
+        LOG_RESULT(Decode(frame.data(), frame.size(), pts));
+    }
+
+    size_t count = (std::min)(m_pcm.size(), required);
+    if (count == 0)
+        return S_OK;
+
+    ComPtr<IAudioFrame> spFrame;
+    IFR(CreateFrame(count, &spFrame));
+    m_pcm.erase(m_pcm.begin(), m_pcm.begin() + count);
+
+    IFR(sender->AddFrame(spFrame.Get()));
+
+    return S_OK;
+}
+
+HRESULT ForkedAudioInput::Decode(const uint8_t* pFrame, size_t size, int64_t pts)
+{
+    ComPtr<IMFMediaBuffer> spBuffer;
+    IFR(MFCreateMemoryBuffer(static_cast<DWORD>(size), &spBuffer));
+
+    BYTE* pData = nullptr;
+    IFR(spBuffer->Lock(&pData, nullptr, nullptr));
+    memcpy(pData, pFrame, size);
+    IFR(spBuffer->Unlock());
+    IFR(spBuffer->SetCurrentLength(static_cast<DWORD>(size)));
+
+    ComPtr<IMFSample> spSample;
+    IFR(MFCreateSample(&spSample));
+    IFR(spSample->AddBuffer(spBuffer.Get()));
+    IFR(spSample->SetSampleTime(pts * 1000 / 9)); // 90 kHz to 100 ns
+
+    // a synchronous decoder drained after every frame always takes the next one
+    IFR(m_decoder->ProcessInput(0, spSample.Get(), 0));
+
+    return DrainDecoder();
+}
+
+// Appends what the decoder has to m_pcm, as float
+HRESULT ForkedAudioInput::DrainDecoder()
+{
+    for (;;)
+    {
+        MFT_OUTPUT_STREAM_INFO info = {};
+        IFR(m_decoder->GetOutputStreamInfo(0, &info));
+
+        MFT_OUTPUT_DATA_BUFFER output = {};
+        ComPtr<IMFSample> spSample;
+        bool providesSamples = (info.dwFlags & (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES | MFT_OUTPUT_STREAM_CAN_PROVIDE_SAMPLES)) != 0;
+        if (!providesSamples)
+        {
+            // 2048 samples a channel covers a HE-AAC frame
+            DWORD size = (std::max)(info.cbSize, static_cast<DWORD>(2048 * m_channels * sizeof(float)));
+            ComPtr<IMFMediaBuffer> spBuffer;
+            IFR(MFCreateMemoryBuffer(size, &spBuffer));
+            IFR(MFCreateSample(&spSample));
+            IFR(spSample->AddBuffer(spBuffer.Get()));
+            output.pSample = spSample.Get();
+        }
+
+        DWORD status = 0;
+        HRESULT hr = m_decoder->ProcessOutput(0, 1, &output, &status);
+        if (output.pEvents != nullptr)
+        {
+            output.pEvents->Release();
+        }
+        if (providesSamples && output.pSample != nullptr)
+        {
+            spSample.Attach(output.pSample);
+        }
+
+        if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+            return S_OK;
+
+        // the first frames tell the decoder about SBR and PS, before the node exists that is fine
+        if (hr == MF_E_TRANSFORM_STREAM_CHANGE)
+        {
+            IFR(SetDecoderOutputType());
+            continue;
+        }
+        IFR(hr);
+
+        // output the node was not created for would play at the wrong rate or mix channels up
+        if (m_nodeChannels != 0 && (m_sampleRate != m_nodeSampleRate || m_channels != m_nodeChannels))
+        {
+            Log(Log_Level_Warning, L"ForkedAudioInput - %u Hz %u channels decoded, the node plays %u Hz %u channels\n",
+                m_sampleRate, m_channels, m_nodeSampleRate, m_nodeChannels);
+            continue;
+        }
+
+        ComPtr<IMFMediaBuffer> spBuffer;
+        IFR(spSample->ConvertToContiguousBuffer(&spBuffer));
+
+        BYTE* pData = nullptr;
+        DWORD length = 0;
+        IFR(spBuffer->Lock(&pData, nullptr, &length));
+        if (m_outputSubtype == MFAudioFormat_Float)
+        {
+            const float* pSamples = reinterpret_cast<const float*>(pData);
+            m_pcm.insert(m_pcm.end(), pSamples, pSamples + length / sizeof(float));
+        }
+        else
+        {
+            const int16_t* pSamples = reinterpret_cast<const int16_t*>(pData);
+            for (DWORD i = 0; i < length / sizeof(int16_t); ++i)
+            {
+                m_pcm.push_back(pSamples[i] / 32768.0f);
+            }
+        }
+        IFR(spBuffer->Unlock());
+    }
+}
+
+// An AudioFrame holding the first sampleCount samples of m_pcm
+HRESULT ForkedAudioInput::CreateFrame(size_t sampleCount, IAudioFrame** ppFrame)
+{
+    NULL_CHK(ppFrame);
+    *ppFrame = nullptr;
+
+    UINT32 bytes = static_cast<UINT32>(sampleCount * sizeof(float));
+
+    ComPtr<IAudioFrame> spFrame;
+    IFR(m_frameFactory->Create(bytes, &spFrame));
+
+    {
+        ComPtr<IAudioBuffer> spBuffer;
+        IFR(spFrame->LockBuffer(AudioBufferAccessMode_Write, &spBuffer));
+
+        ComPtr<ABI::Windows::Foundation::IMemoryBuffer> spMemoryBuffer;
+        IFR(spBuffer.As(&spMemoryBuffer));
+
+        ComPtr<ABI::Windows::Foundation::IMemoryBufferReference> spReference;
+        IFR(spMemoryBuffer->CreateReference(&spReference));
+
+        ComPtr<Windows::Foundation::IMemoryBufferByteAccess> spByteAccess;
+        IFR(spReference.As(&spByteAccess));
+
+        BYTE* pData = nullptr;
+        UINT32 capacity = 0;
+        IFR(spByteAccess->GetBuffer(&pData, &capacity));
+        memcpy(pData, m_pcm.data(), (std::min)(bytes, capacity));
+        IFR(spBuffer->put_Length((std::min)(bytes, capacity)));
+
+        // the frame stays locked until both are closed
+        ComPtr<ABI::Windows::Foundation::IClosable> spClosable;
+        IFR(spReference.As(&spClosable));
+        IFR(spClosable->Close());
+        IFR(spBuffer.As(&spClosable));
+        IFR(spClosable->Close());
+    }
+
+    *ppFrame = spFrame.Detach();
+
+    return S_OK;
+}
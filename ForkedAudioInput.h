@@ -0,0 +1,114 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <windows.media.h>
+#include <windows.media.audio.h>
+#include <mftransform.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AudioFrameIndex.h"
+#include "TsDemuxer.h"
+
+#define FORKED_AUDIO_PENDING_LIMIT 4096 // ADTS frames waiting to play, about 90 s of 48 kHz AAC
+#define FORKED_AUDIO_UNSUPPORTED_PACKETS 32 // other audio packets before the first ADTS one that make the fork give up
+
+using IFrameInputNodeQuantumStartedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
+    ABI::Windows::Media::Audio::AudioFrameInputNode*, ABI::Windows::Media::Audio::FrameInputNodeQuantumStartedEventArgs*>;
+
+// Plays the audio fork of AdaptiveStreamer through an AudioGraph frame input node, so the graph
+// needs neither a media source of its own nor a second download of every segment. The ADTS/AAC
+// frames of the forked PES packets are queued by PTS on the fork's threads, segments may come in
+// any order, and decoded by the Media Foundation AAC decoder on the graph's thread when the node
+// asks for samples. The first frame is decoded as it comes to learn the decoded format, HE-AAC
+// doubles the rate of its header, and the node is created in it, the graph converts it. Only the
+// first ADTS stream is played. AC-3 and the raw access units of fMP4 tracks are not decoded, when
+// they come without any ADTS, or the node cannot be created, onUnsupported runs once so the owner
+// can fall back to a media source input node.
+class ForkedAudioInput : public SharedFromThis
+{
+public:
+    using UnsupportedCallback = std::function<void()>;
+
+    static HRESULT Create(
+        _In_ ABI::Windows::Media::Audio::IAudioGraph* pAudioGraph,
+        _In_ ABI::Windows::Media::Audio::IAudioNode* pOutputNode,
+        _In_ UnsupportedCallback onUnsupported,
+        _Out_ std::shared_ptr<ForkedAudioInput>* pInput);
+
+    ForkedAudioInput();
+    ~ForkedAudioInput();
+
+    // The audio fork callback, any thread
+    void Push(_In_ const PesPacket& packet);
+
+    // Drops what is queued and starts over at the next PTS pushed, for a seek
+    void Reset();
+
+    // Disconnects the node from the graph, later packets are ignored
+    void Close();
+
+private:
+    HRESULT CreateDecoder();
+    HRESULT SetDecoderTypes(UINT32 sampleRate, UINT32 channels);
+    HRESULT SetDecoderOutputType();
+    HRESULT CreateInputNode();
+    bool EnsureInputNode(_In_ const PesPacket& packet, _In_ const AudioFrameHeader& header, _In_ const uint8_t* pFrame, int64_t pts, _Out_ bool* pDecoded);
+    void OnUnsupportedPacket();
+
+    HRESULT OnQuantumStarted(_In_ ABI::Windows::Media::Audio::IAudioFrameInputNode* sender, _In_ ABI::Windows::Media::Audio::IFrameInputNodeQuantumStartedEventArgs* args);
+    HRESULT Decode(_In_reads_(size) const uint8_t* pFrame, size_t size, int64_t pts);
+    HRESULT DrainDecoder();
+    HRESULT CreateFrame(size_t sampleCount, _COM_Outptr_ ABI::Windows::Media::IAudioFrame** ppFrame);
+
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioGraph> m_audioGraph;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioNode> m_outputNode;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::IAudioFrameFactory> m_frameFactory;
+    UnsupportedCallback m_onUnsupported;
+
+    // guards the node and its format, created by the first push and closed by the owner
+    std::mutex m_nodeLock;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Audio::IAudioFrameInputNode> m_inputNode;
+    EventRegistrationToken m_quantumStartedToken;
+    uint16_t m_pid; // of the stream the node plays
+    UINT32 m_streamSampleRate; // of its ADTS headers
+    UINT32 m_streamChannels;
+    UINT32 m_nodeSampleRate; // decoded, the node's format
+    UINT32 m_nodeChannels;
+    UINT32 m_unsupportedPackets;
+    bool m_closed;
+    bool m_unsupported;
+    bool m_mfStarted; // MFStartup succeeded, shut down with the input
+
+    // guards the frames between the fork and the graph's thread
+    std::mutex m_lock;
+    std::map<int64_t, std::vector<uint8_t>> m_pending; // ADTS frames by unwrapped 90 kHz PTS
+    int64_t m_referencePts; // last pushed, 33-bit PTS are unwrapped around it
+    int64_t m_playedPts; // frames before it came too late and are dropped
+    bool m_hasReferencePts;
+    bool m_hasPlayedPts;
+    bool m_flushPending;
+
+    // set up before the node exists, then the graph's thread only
+    Microsoft::WRL::ComPtr<IMFTransform> m_decoder;
+    GUID m_outputSubtype; // float, or 16 bit PCM converted here
+    UINT32 m_sampleRate; // of the decoder's output
+    UINT32 m_channels;
+    std::vector<float> m_pcm; // decoded and interleaved in the node's format, not handed to it yet
+};
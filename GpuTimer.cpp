@@ -0,0 +1,104 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+
+#include "pch.h"
+#include "GpuTimer.h"
+
+using namespace Microsoft::WRL;
+
+GpuTimer::GpuTimer()
+    : m_first(0)
+    , m_pending(0)
+    , m_open(false)
+{
+}
+
+HRESULT GpuTimer::Initialize(ID3D11Device* pDevice)
+{
+    NULL_CHK(pDevice);
+
+    D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+    D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+    for (QuerySet& set : m_sets)
+    {
+        IFR(pDevice->CreateQuery(&disjointDesc, &set.disjoint));
+        IFR(pDevice->CreateQuery(&timestampDesc, &set.start));
+        IFR(pDevice->CreateQuery(&timestampDesc, &set.end));
+    }
+
+    // only once every set exists, Begin refuses to time until then
+    pDevice->GetImmediateContext(&m_context);
+
+    return S_OK;
+}
+
+bool GpuTimer::Begin()
+{
+    if (m_context == nullptr || m_open || m_pending == GPU_TIMER_QUERIES)
+        return false;
+
+    QuerySet& set = m_sets[(m_first + m_pending) % GPU_TIMER_QUERIES];
+    m_context->Begin(set.disjoint.Get());
+    m_context->End(set.start.Get());
+    m_open = true;
+
+    return true;
+}
+
+void GpuTimer::End()
+{
+    if (!m_open)
+        return;
+
+    QuerySet& set = m_sets[(m_first + m_pending) % GPU_TIMER_QUERIES];
+    m_context->End(set.end.Get());
+    m_context->End(set.disjoint.Get());
+    m_pending++;
+    m_open = false;
+}
+
+size_t GpuTimer::Collect(UINT64* pTotalNs, UINT64* pMaxNs)
+{
+    size_t collected = 0;
+    while (m_pending != 0)
+    {
+        QuerySet& set = m_sets[m_first];
+
+        // the disjoint query ends last, once it is done the timestamps are too
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        HRESULT hr = m_context->GetData(set.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+        if (hr == S_FALSE)
+            break;
+
+        UINT64 start = 0;
+        UINT64 end = 0;
+        if (SUCCEEDED(hr)
+            && m_context->GetData(set.start.Get(), &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK
+            && m_context->GetData(set.end.Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK
+            && !disjoint.Disjoint && disjoint.Frequency != 0 && end >= start)
+        {
+            UINT64 ns = (end - start) * 1000000000ull / disjoint.Frequency;
+            *pTotalNs += ns;
+            if (ns > *pMaxNs)
+            {
+                *pMaxNs = ns;
+            }
+            collected++;
+        }
+
+        // a failed read, a removed device included, gives the set up
+        m_first = (m_first + 1) % GPU_TIMER_QUERIES;
+        m_pending--;
+    }
+
+    return collected;
+}
@@ -0,0 +1,51 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+
+#pragma once
+
+#include "pch.h"
+
+#define GPU_TIMER_QUERIES 8 // intervals in flight at once, work is not timed while all are waiting on the GPU
+
+// Times GPU work submitted on a device's immediate context with timestamp queries. Begin and End
+// bracket the work, Collect picks up the intervals the GPU has finished without waiting or
+// flushing. The timestamps are taken on the context, so work other threads submit on the same
+// context in between is counted too. Begin, End and Collect belong to one thread.
+class GpuTimer
+{
+public:
+    GpuTimer();
+
+    HRESULT Initialize(_In_ ID3D11Device* pDevice);
+
+    // False when the timer has no context or every query set is still in flight
+    bool Begin();
+    void End();
+
+    // Adds the finished intervals to *pTotalNs, raises *pMaxNs and returns their count. Intervals
+    // the GPU reported as disjoint are dropped.
+    size_t Collect(_Inout_ UINT64* pTotalNs, _Inout_ UINT64* pMaxNs);
+
+private:
+    struct QuerySet
+    {
+        Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+        Microsoft::WRL::ComPtr<ID3D11Query> start;
+        Microsoft::WRL::ComPtr<ID3D11Query> end;
+    };
+
+    Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_context;
+    QuerySet m_sets[GPU_TIMER_QUERIES];
+    size_t m_first;     // oldest set in flight
+    size_t m_pending;   // sets in flight
+    bool m_open;        // Begin without End yet
+};
@@ -0,0 +1,662 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "HlsPlaylist.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    bool StartsWith(const std::string& str, const char* prefix, std::string* pRemainder = nullptr)
+    {
+        size_t len = strlen(prefix);
+        if (str.compare(0, len, prefix) != 0)
+            return false;
+
+        if (pRemainder != nullptr)
+            *pRemainder = str.substr(len);
+
+        return true;
+    }
+
+    // Calls onLine for every non-empty line with trailing whitespace removed
+    template <typename TCallback>
+    void ForEachLine(const std::string& text, TCallback onLine)
+    {
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            size_t end = text.find('\n', pos);
+            if (end == std::string::npos)
+                end = text.size();
+
+            size_t last = end;
+            while (last > pos && (text[last - 1] == '\r' || text[last - 1] == ' ' || text[last - 1] == '\t'))
+                last--;
+
+            size_t first = pos;
+            while (first < last && (text[first] == ' ' || text[first] == '\t'))
+                first++;
+
+            if (last > first)
+                onLine(text.substr(first, last - first));
+
+            pos = end + 1;
+        }
+    }
+
+    uint64_t ToUInt64(const std::string& value)
+    {
+        return strtoull(value.c_str(), nullptr, 10);
+    }
+
+    // "length[@offset]", offset defaults to the end of the previous range
+    void ParseByteRange(const std::string& value, uint64_t defaultOffset, uint64_t* pOffset, uint64_t* pLength)
+    {
+        size_t at = value.find('@');
+        *pLength = ToUInt64(value.substr(0, at));
+        *pOffset = (at == std::string::npos) ? defaultOffset : ToUInt64(value.substr(at + 1));
+    }
+
+    bool HasScheme(const std::string& uri)
+    {
+        for (size_t i = 0; i < uri.size(); ++i)
+        {
+            char c = uri[i];
+            if (c == ':')
+                return i > 0;
+            if (!(isalnum(static_cast<unsigned char>(c)) || c == '+' || c == '-' || c == '.'))
+                return false;
+        }
+        return false;
+    }
+
+    // Removes "." and ".." segments from the path part of an absolute URI
+    std::string RemoveDotSegments(const std::string& uri)
+    {
+        size_t schemeEnd = uri.find("://");
+        size_t pathStart = (schemeEnd == std::string::npos) ? 0 : uri.find('/', schemeEnd + 3);
+        if (pathStart == std::string::npos)
+            return uri;
+
+        size_t queryStart = uri.find_first_of("?#", pathStart);
+        std::string path = uri.substr(pathStart, queryStart == std::string::npos ? std::string::npos : queryStart - pathStart);
+        std::string suffix = (queryStart == std::string::npos) ? std::string() : uri.substr(queryStart);
+
+        std::vector<std::string> parts;
+        size_t pos = 1;
+        while (pos <= path.size())
+        {
+            size_t slash = path.find('/', pos);
+            if (slash == std::string::npos)
+                slash = path.size();
+
+            std::string part = path.substr(pos, slash - pos);
+            if (part == "..")
+            {
+                if (!parts.empty())
+                    parts.pop_back();
+                if (slash == path.size())
+                    parts.push_back(std::string());
+            }
+            else if (part != ".")
+            {
+                parts.push_back(part);
+            }
+            else if (slash == path.size())
+            {
+                parts.push_back(std::string());
+            }
+
+            pos = slash + 1;
+        }
+
+        std::string result = uri.substr(0, pathStart);
+        for (const auto& part : parts)
+        {
+            result += '/';
+            result += part;
+        }
+
+        return result + suffix;
+    }
+}
+
+std::map<std::string, std::string> Hls::ParseAttributeList(const std::string& attributes)
+{
+    std::map<std::string, std::string> result;
+
+    size_t pos = 0;
+    while (pos < attributes.size())
+    {
+        size_t equals = attributes.find('=', pos);
+        if (equals == std::string::npos)
+            break;
+
+        std::string key = attributes.substr(pos, equals - pos);
+        key.erase(0, key.find_first_not_of(' '));
+
+        std::string value;
+        size_t next;
+        if (equals + 1 < attributes.size() && attributes[equals + 1] == '"')
+        {
+            size_t close = attributes.find('"', equals + 2);
+            if (close == std::string::npos)
+                close = attributes.size();
+            value = attributes.substr(equals + 2, close - equals - 2);
+            next = attributes.find(',', close);
+        }
+        else
+        {
+            next = attributes.find(',', equals + 1);
+            value = attributes.substr(equals + 1, next == std::string::npos ? std::string::npos : next - equals - 1);
+        }
+
+        result[key] = value;
+
+        if (next == std::string::npos)
+            break;
+        pos = next + 1;
+    }
+
+    return result;
+}
+
+std::string Hls::ResolveUri(const std::string& baseUri, const std::string& uri)
+{
+    if (uri.empty() || HasScheme(uri) || baseUri.empty())
+        return uri;
+
+    size_t schemeEnd = baseUri.find("://");
+    if (schemeEnd == std::string::npos)
+        return uri;
+
+    if (StartsWith(uri, "//"))
+        return baseUri.substr(0, schemeEnd + 1) + uri;
+
+    if (uri[0] == '/')
+    {
+        size_t hostEnd = baseUri.find('/', schemeEnd + 3);
+        return RemoveDotSegments(baseUri.substr(0, hostEnd) + uri);
+    }
+
+    // drop query and last path segment of the base
+    std::string base = baseUri.substr(0, baseUri.find_first_of("?#"));
+    size_t lastSlash = base.rfind('/');
+    if (lastSlash == std::string::npos || lastSlash < schemeEnd + 3)
+        base += '/';
+    else
+        base.erase(lastSlash + 1);
+
+    return RemoveDotSegments(base + uri);
+}
+
+bool Hls::IsMasterPlaylist(const std::string& text)
+{
+    return text.find("#EXT-X-STREAM-INF") != std::string::npos;
+}
+
+bool Hls::ParseMasterPlaylist(const std::string& text, const std::string& baseUri, HlsMasterPlaylist* pPlaylist)
+{
+    if (pPlaylist == nullptr || text.find("#EXTM3U") == std::string::npos)
+        return false;
+
+    HlsMasterPlaylist playlist;
+    playlist.uri = baseUri;
+
+    bool pendingVariant = false;
+    HlsVariant variant;
+
+    auto parseVariant = [](std::map<std::string, std::string>& attributes)
+        {
+            HlsVariant parsed;
+            parsed.bandwidth = static_cast<uint32_t>(ToUInt64(attributes["BANDWIDTH"]));
+            parsed.averageBandwidth = static_cast<uint32_t>(ToUInt64(attributes["AVERAGE-BANDWIDTH"]));
+            parsed.codecs = attributes["CODECS"];
+            parsed.audioGroup = attributes["AUDIO"];
+            parsed.frameRate = atof(attributes["FRAME-RATE"].c_str());
+
+            const std::string& resolution = attributes["RESOLUTION"];
+            size_t x = resolution.find('x');
+            if (x != std::string::npos)
+            {
+                parsed.width = static_cast<uint32_t>(ToUInt64(resolution.substr(0, x)));
+                parsed.height = static_cast<uint32_t>(ToUInt64(resolution.substr(x + 1)));
+            }
+
+            return parsed;
+        };
+
+    ForEachLine(text, [&](const std::string& line)
+        {
+            std::string value;
+            if (StartsWith(line, "#EXT-X-STREAM-INF:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                variant = parseVariant(attributes);
+                pendingVariant = true;
+            }
+            else if (StartsWith(line, "#EXT-X-I-FRAME-STREAM-INF:", &value))
+            {
+                // the playlist URI is an attribute, no URI line follows
+                auto attributes = ParseAttributeList(value);
+                HlsVariant iFrameVariant = parseVariant(attributes);
+                iFrameVariant.uri = ResolveUri(baseUri, attributes["URI"]);
+                if (!attributes["URI"].empty())
+                {
+                    playlist.iFrameVariants.push_back(iFrameVariant);
+                }
+            }
+            else if (StartsWith(line, "#EXT-X-MEDIA:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                const std::string& type = attributes["TYPE"];
+                if ((type == "SUBTITLES" || type == "AUDIO") && !attributes["URI"].empty())
+                {
+                    HlsRendition rendition;
+                    rendition.uri = ResolveUri(baseUri, attributes["URI"]);
+                    rendition.groupId = attributes["GROUP-ID"];
+                    rendition.name = attributes["NAME"];
+                    rendition.language = attributes["LANGUAGE"];
+                    rendition.isDefault = attributes["DEFAULT"] == "YES";
+                    rendition.autoSelect = attributes["AUTOSELECT"] == "YES";
+                    rendition.forced = attributes["FORCED"] == "YES";
+                    (type == "AUDIO" ? playlist.audio : playlist.subtitles).push_back(rendition);
+                }
+            }
+            else if (line[0] != '#' && pendingVariant)
+            {
+                variant.uri = ResolveUri(baseUri, line);
+                playlist.variants.push_back(variant);
+                pendingVariant = false;
+            }
+        });
+
+    auto byBandwidth = [](const HlsVariant& a, const HlsVariant& b) { return a.bandwidth < b.bandwidth; };
+    std::stable_sort(playlist.variants.begin(), playlist.variants.end(), byBandwidth);
+    std::stable_sort(playlist.iFrameVariants.begin(), playlist.iFrameVariants.end(), byBandwidth);
+
+    *pPlaylist = std::move(playlist);
+
+    return !pPlaylist->variants.empty();
+}
+
+bool Hls::ParseMediaPlaylist(const std::string& text, const std::string& baseUri, HlsMediaPlaylist* pPlaylist)
+{
+    if (pPlaylist == nullptr || text.find("#EXTM3U") == std::string::npos)
+        return false;
+
+    HlsMediaPlaylist playlist;
+    playlist.uri = baseUri;
+
+    HlsSegment pending;
+    bool hasInf = false;
+    bool discontinuity = false;
+    double startTime = 0.0;
+    uint64_t sequence = 0;
+    bool sequenceSet = false;
+    uint64_t lastRangeEnd = 0;
+    HlsKey key;
+    std::vector<HlsPartialSegment> parts;
+    uint64_t lastPartRangeEnd = 0;
+
+    ForEachLine(text, [&](const std::string& line)
+        {
+            std::string value;
+            if (StartsWith(line, "#EXTINF:", &value))
+            {
+                pending.duration = atof(value.c_str());
+                hasInf = true;
+            }
+            else if (StartsWith(line, "#EXT-X-BYTERANGE:", &value))
+            {
+                ParseByteRange(value, lastRangeEnd, &pending.byteOffset, &pending.byteLength);
+            }
+            else if (StartsWith(line, "#EXT-X-TARGETDURATION:", &value))
+            {
+                playlist.targetDuration = atof(value.c_str());
+            }
+            else if (StartsWith(line, "#EXT-X-MEDIA-SEQUENCE:", &value))
+            {
+                playlist.mediaSequence = ToUInt64(value);
+                if (!sequenceSet)
+                {
+                    sequence = playlist.mediaSequence;
+                    sequenceSet = true;
+                }
+            }
+            else if (StartsWith(line, "#EXT-X-DISCONTINUITY") && !StartsWith(line, "#EXT-X-DISCONTINUITY-SEQUENCE"))
+            {
+                discontinuity = true;
+            }
+            else if (StartsWith(line, "#EXT-X-ENDLIST"))
+            {
+                playlist.endList = true;
+            }
+            else if (StartsWith(line, "#EXT-X-I-FRAMES-ONLY"))
+            {
+                playlist.iFramesOnly = true;
+            }
+            else if (StartsWith(line, "#EXT-X-PART-INF:", &value))
+            {
+                playlist.partTargetDuration = atof(ParseAttributeList(value)["PART-TARGET"].c_str());
+            }
+            else if (StartsWith(line, "#EXT-X-SERVER-CONTROL:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                playlist.serverControl.canBlockReload = attributes["CAN-BLOCK-RELOAD"] == "YES";
+                playlist.serverControl.canSkipUntil = atof(attributes["CAN-SKIP-UNTIL"].c_str());
+                playlist.serverControl.canSkipDateRanges = attributes["CAN-SKIP-DATERANGES"] == "YES";
+                playlist.serverControl.holdBack = atof(attributes["HOLD-BACK"].c_str());
+                playlist.serverControl.partHoldBack = atof(attributes["PART-HOLD-BACK"].c_str());
+            }
+            else if (StartsWith(line, "#EXT-X-PART:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                HlsPartialSegment part;
+                part.uri = ResolveUri(baseUri, attributes["URI"]);
+                part.duration = atof(attributes["DURATION"].c_str());
+                part.independent = attributes["INDEPENDENT"] == "YES";
+                part.gap = attributes["GAP"] == "YES";
+                if (!attributes["BYTERANGE"].empty())
+                {
+                    // without an offset a part follows the previous part of the same resource
+                    bool sameResource = !parts.empty() && parts.back().uri == part.uri;
+                    ParseByteRange(attributes["BYTERANGE"], sameResource ? lastPartRangeEnd : 0, &part.byteOffset, &part.byteLength);
+                    lastPartRangeEnd = part.byteOffset + part.byteLength;
+                }
+                parts.push_back(std::move(part));
+            }
+            else if (StartsWith(line, "#EXT-X-PRELOAD-HINT:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                playlist.preloadHint.type = attributes["TYPE"];
+                playlist.preloadHint.uri = ResolveUri(baseUri, attributes["URI"]);
+                playlist.preloadHint.byteOffset = ToUInt64(attributes["BYTERANGE-START"]);
+                playlist.preloadHint.byteLength = ToUInt64(attributes["BYTERANGE-LENGTH"]);
+            }
+            else if (StartsWith(line, "#EXT-X-SKIP:", &value))
+            {
+                // the skipped segments are the oldest ones, the rest keep their numbers
+                playlist.skippedSegments = ToUInt64(ParseAttributeList(value)["SKIPPED-SEGMENTS"]);
+                sequence += playlist.skippedSegments;
+            }
+            else if (StartsWith(line, "#EXT-X-KEY:", &value))
+            {
+                // keys for other systems (FairPlay, Widevine, ...) sit next to the identity one
+                auto attributes = ParseAttributeList(value);
+                if (!attributes["KEYFORMAT"].empty() && attributes["KEYFORMAT"] != "identity")
+                    return;
+
+                key = HlsKey();
+                if (attributes["METHOD"] != "NONE")
+                {
+                    key.method = attributes["METHOD"];
+                    key.uri = ResolveUri(baseUri, attributes["URI"]);
+                    key.iv = attributes["IV"];
+                }
+            }
+            else if (StartsWith(line, "#EXT-X-MAP:", &value))
+            {
+                auto attributes = ParseAttributeList(value);
+                playlist.initSegment = HlsSegment();
+                playlist.initSegment.uri = ResolveUri(baseUri, attributes["URI"]);
+                playlist.initSegment.key = key;
+                if (!attributes["BYTERANGE"].empty())
+                {
+                    ParseByteRange(attributes["BYTERANGE"], 0,
+                        &playlist.initSegment.byteOffset, &playlist.initSegment.byteLength);
+                }
+            }
+            else if (line[0] != '#' && hasInf)
+            {
+                pending.uri = ResolveUri(baseUri, line);
+                pending.startTime = startTime;
+                pending.sequence = sequence++;
+                pending.discontinuity = discontinuity;
+                pending.key = key;
+                pending.parts = std::move(parts);
+
+                if (pending.byteLength != 0)
+                {
+                    lastRangeEnd = pending.byteOffset + pending.byteLength;
+                }
+
+                startTime += pending.duration;
+                playlist.segments.push_back(pending);
+
+                pending = HlsSegment();
+                parts.clear();
+                hasInf = false;
+                discontinuity = false;
+            }
+        });
+
+    playlist.pendingParts = std::move(parts);
+    *pPlaylist = std::move(playlist);
+
+    return true;
+}
+
+int Hls::SelectVariant(const HlsMasterPlaylist& playlist, uint32_t maxBitrate)
+{
+    if (playlist.variants.empty())
+        return -1;
+
+    int selected = 0;
+    for (size_t i = 0; i < playlist.variants.size(); ++i)
+    {
+        if (playlist.variants[i].bandwidth <= maxBitrate)
+            selected = static_cast<int>(i);
+    }
+
+    return selected;
+}
+
+std::string Hls::WriteMediaPlaylist(const HlsMediaPlaylist& playlist, bool lowLatency)
+{
+    auto number = [](double value)
+        {
+            char text[32];
+            snprintf(text, sizeof(text), "%.5g", value);
+            return std::string(text);
+        };
+
+    auto byteRange = [](uint64_t offset, uint64_t length)
+        {
+            return std::to_string(length) + "@" + std::to_string(offset);
+        };
+
+    auto partLine = [&](const HlsPartialSegment& part)
+        {
+            std::string line = "#EXT-X-PART:DURATION=" + number(part.duration) + ",URI=\"" + part.uri + "\"";
+            if (part.byteLength != 0)
+                line += ",BYTERANGE=\"" + byteRange(part.byteOffset, part.byteLength) + "\"";
+            if (part.independent)
+                line += ",INDEPENDENT=YES";
+            if (part.gap)
+                line += ",GAP=YES";
+            return line + "\n";
+        };
+
+    bool parts = lowLatency && playlist.partTargetDuration > 0.0;
+
+    std::string text = "#EXTM3U\n";
+    text += parts ? "#EXT-X-VERSION:9\n" : "#EXT-X-VERSION:6\n";
+    text += "#EXT-X-TARGETDURATION:" + std::to_string(static_cast<uint64_t>(playlist.targetDuration + 0.5)) + "\n";
+
+    if (parts)
+    {
+        const HlsServerControl& control = playlist.serverControl;
+        std::string line = "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=" + std::string(control.canBlockReload ? "YES" : "NO");
+        if (control.canSkipUntil > 0.0)
+            line += ",CAN-SKIP-UNTIL=" + number(control.canSkipUntil);
+        if (control.canSkipDateRanges)
+            line += ",CAN-SKIP-DATERANGES=YES";
+        if (control.holdBack > 0.0)
+            line += ",HOLD-BACK=" + number(control.holdBack);
+        if (control.partHoldBack > 0.0)
+            line += ",PART-HOLD-BACK=" + number(control.partHoldBack);
+        text += line + "\n";
+        text += "#EXT-X-PART-INF:PART-TARGET=" + number(playlist.partTargetDuration) + "\n";
+    }
+
+    text += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(playlist.mediaSequence) + "\n";
+    if (playlist.iFramesOnly)
+        text += "#EXT-X-I-FRAMES-ONLY\n";
+    if (playlist.skippedSegments != 0)
+        text += "#EXT-X-SKIP:SKIPPED-SEGMENTS=" + std::to_string(playlist.skippedSegments) + "\n";
+
+    HlsKey key;
+    auto keyLine = [&](const HlsKey& segmentKey)
+        {
+            if (segmentKey.method == key.method && segmentKey.uri == key.uri && segmentKey.iv == key.iv)
+                return;
+
+            key = segmentKey;
+            if (!key.IsEncrypted())
+            {
+                text += "#EXT-X-KEY:METHOD=NONE\n";
+                return;
+            }
+
+            text += "#EXT-X-KEY:METHOD=" + key.method + ",URI=\"" + key.uri + "\"";
+            if (!key.iv.empty())
+                text += ",IV=" + key.iv;
+            text += "\n";
+        };
+
+    if (!playlist.initSegment.uri.empty())
+    {
+        keyLine(playlist.initSegment.key);
+        text += "#EXT-X-MAP:URI=\"" + playlist.initSegment.uri + "\"";
+        if (playlist.initSegment.byteLength != 0)
+            text += ",BYTERANGE=\"" + byteRange(playlist.initSegment.byteOffset, playlist.initSegment.byteLength) + "\"";
+        text += "\n";
+    }
+
+    for (const HlsSegment& segment : playlist.segments)
+    {
+        keyLine(segment.key);
+        if (segment.discontinuity)
+            text += "#EXT-X-DISCONTINUITY\n";
+
+        if (parts)
+        {
+            for (const HlsPartialSegment& part : segment.parts)
+            {
+                text += partLine(part);
+            }
+        }
+
+        text += "#EXTINF:" + number(segment.duration) + ",\n";
+        if (segment.byteLength != 0)
+            text += "#EXT-X-BYTERANGE:" + byteRange(segment.byteOffset, segment.byteLength) + "\n";
+        text += segment.uri + "\n";
+    }
+
+    if (parts)
+    {
+        for (const HlsPartialSegment& part : playlist.pendingParts)
+        {
+            text += partLine(part);
+        }
+
+        const HlsPreloadHint& hint = playlist.preloadHint;
+        if (!hint.uri.empty())
+        {
+            text += "#EXT-X-PRELOAD-HINT:TYPE=" + hint.type + ",URI=\"" + hint.uri + "\"";
+            if (hint.byteOffset != 0)
+                text += ",BYTERANGE-START=" + std::to_string(hint.byteOffset);
+            if (hint.byteLength != 0)
+                text += ",BYTERANGE-LENGTH=" + std::to_string(hint.byteLength);
+            text += "\n";
+        }
+    }
+
+    if (playlist.endList)
+        text += "#EXT-X-ENDLIST\n";
+
+    return text;
+}
+
+bool Hls::MergeDeltaPlaylist(const HlsMediaPlaylist& previous, HlsMediaPlaylist* pDelta)
+{
+    if (pDelta == nullptr)
+        return false;
+
+    HlsMediaPlaylist& delta = *pDelta;
+    if (delta.skippedSegments == 0)
+        return true;
+
+    uint64_t first = delta.mediaSequence;
+    uint64_t end = first + delta.skippedSegments;
+    if (previous.segments.empty() || previous.segments.front().sequence > first || previous.NextSequence() < end)
+        return false;
+
+    std::vector<HlsSegment> segments;
+    segments.reserve(delta.skippedSegments + delta.segments.size());
+    for (const HlsSegment& segment : previous.segments)
+    {
+        if (segment.sequence >= first && segment.sequence < end)
+            segments.push_back(segment);
+    }
+
+    // the delta timed its segments from the skip, the merged playlist from its first segment
+    double startTime = 0.0;
+    for (HlsSegment& segment : delta.segments)
+    {
+        segments.push_back(std::move(segment));
+    }
+    for (HlsSegment& segment : segments)
+    {
+        segment.startTime = startTime;
+        startTime += segment.duration;
+    }
+
+    if (delta.initSegment.uri.empty())
+    {
+        delta.initSegment = previous.initSegment;
+    }
+
+    delta.segments = std::move(segments);
+    delta.skippedSegments = 0;
+
+    return true;
+}
+
+std::string Hls::MakeBlockingReloadUri(const HlsMediaPlaylist& playlist, bool skip)
+{
+    // the part after the last one listed, in the segment in progress
+    std::string query = "_HLS_msn=" + std::to_string(playlist.NextSequence());
+    if (playlist.partTargetDuration > 0.0)
+    {
+        query += "&_HLS_part=" + std::to_string(playlist.pendingParts.size());
+    }
+
+    if (skip && playlist.serverControl.canSkipUntil > 0.0)
+    {
+        query += "&_HLS_skip=YES";
+    }
+
+    std::string uri = playlist.uri;
+    size_t fragment = uri.find('#');
+    if (fragment != std::string::npos)
+    {
+        uri.erase(fragment);
+    }
+
+    return uri + ((uri.find('?') == std::string::npos) ? "?" : "&") + query;
+}
@@ -0,0 +1,187 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable HLS playlist model and parser (RFC 8216). No Windows dependencies,
+// manifests are handled as UTF-8 and all URIs are resolved to absolute form.
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// EXT-X-KEY in effect for a segment, only the identity key format is kept
+struct HlsKey
+{
+    std::string method;         // "AES-128", "SAMPLE-AES", empty when the segment is clear
+    std::string uri;
+    std::string iv;             // hex as written, empty when the media sequence number is the IV
+
+    bool IsEncrypted() const { return !method.empty(); }
+};
+
+// EXT-X-PART, a piece of a segment published before the whole segment is complete
+struct HlsPartialSegment
+{
+    std::string uri;
+    double duration = 0.0;
+    uint64_t byteOffset = 0;
+    uint64_t byteLength = 0;    // 0 when the whole resource is the part
+    bool independent = false;   // starts with an independent frame
+    bool gap = false;
+};
+
+// EXT-X-SERVER-CONTROL
+struct HlsServerControl
+{
+    bool canBlockReload = false;    // _HLS_msn/_HLS_part requests are held until the part exists
+    double canSkipUntil = 0.0;      // seconds, 0 when the server offers no delta updates
+    bool canSkipDateRanges = false;
+    double holdBack = 0.0;          // seconds from the end the player should stay behind
+    double partHoldBack = 0.0;      // the same when playing parts
+};
+
+// EXT-X-PRELOAD-HINT
+struct HlsPreloadHint
+{
+    std::string type;           // "PART" or "MAP"
+    std::string uri;            // empty without a hint
+    uint64_t byteOffset = 0;
+    uint64_t byteLength = 0;    // 0 up to the end of the resource
+};
+
+struct HlsSegment
+{
+    std::string uri;
+    double duration = 0.0;      // seconds, EXTINF
+    double startTime = 0.0;     // seconds from the start of the playlist
+    uint64_t sequence = 0;      // media sequence number
+    uint64_t byteOffset = 0;    // EXT-X-BYTERANGE
+    uint64_t byteLength = 0;    // 0 when the whole resource is the segment
+    bool discontinuity = false;
+    HlsKey key;
+    std::vector<HlsPartialSegment> parts; // LL-HLS, empty once the server stops listing them
+};
+
+struct HlsMediaPlaylist
+{
+    std::string uri;
+    double targetDuration = 0.0;
+    uint64_t mediaSequence = 0;
+    bool endList = false;
+    bool iFramesOnly = false;
+    HlsSegment initSegment;     // EXT-X-MAP, uri is empty when absent
+    std::vector<HlsSegment> segments;
+
+    // LL-HLS
+    double partTargetDuration = 0.0; // EXT-X-PART-INF, 0 when the playlist has no parts
+    HlsServerControl serverControl;
+    std::vector<HlsPartialSegment> pendingParts; // parts of the segment after the last complete one
+    HlsPreloadHint preloadHint;
+    uint64_t skippedSegments = 0;   // EXT-X-SKIP of a delta update, 0 once merged
+
+    double Duration() const
+    {
+        return segments.empty() ? 0.0 : segments.back().startTime + segments.back().duration;
+    }
+
+    // Segment a player starts on, the first one for VOD. Live starts HOLD-BACK, or three target
+    // durations without it, behind the end of the playlist.
+    size_t StartIndex() const
+    {
+        if (endList || segments.empty())
+            return 0;
+
+        double holdBackSeconds = serverControl.holdBack > 0.0 ? serverControl.holdBack : 3.0 * targetDuration;
+        double start = Duration() - holdBackSeconds;
+        size_t index = 0;
+        while (index + 1 < segments.size() && segments[index + 1].startTime <= start)
+        {
+            ++index;
+        }
+        return index;
+    }
+
+    // Sequence number of the segment after the last complete one
+    uint64_t NextSequence() const
+    {
+        return segments.empty() ? mediaSequence + skippedSegments : segments.back().sequence + 1;
+    }
+};
+
+struct HlsVariant
+{
+    std::string uri;
+    uint32_t bandwidth = 0;         // bits per second, peak
+    uint32_t averageBandwidth = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double frameRate = 0.0;
+    std::string codecs;
+    std::string audioGroup;
+};
+
+// EXT-X-MEDIA
+struct HlsRendition
+{
+    std::string uri;            // empty when the rendition is muxed into the variants
+    std::string groupId;
+    std::string name;
+    std::string language;
+    bool isDefault = false;
+    bool autoSelect = false;
+    bool forced = false;
+};
+
+struct HlsMasterPlaylist
+{
+    std::string uri;
+    std::vector<HlsVariant> variants; // ascending bandwidth
+    std::vector<HlsVariant> iFrameVariants; // EXT-X-I-FRAME-STREAM-INF, ascending bandwidth
+    std::vector<HlsRendition> subtitles; // EXT-X-MEDIA TYPE=SUBTITLES, playlist order
+    std::vector<HlsRendition> audio; // EXT-X-MEDIA TYPE=AUDIO with their own playlist, playlist order
+};
+
+namespace Hls
+{
+    // Splits an attribute list (KEY=VALUE,KEY="quoted,value") into a map, quotes removed.
+    std::map<std::string, std::string> ParseAttributeList(const std::string& attributes);
+
+    std::string ResolveUri(const std::string& baseUri, const std::string& uri);
+
+    bool IsMasterPlaylist(const std::string& text);
+
+    bool ParseMasterPlaylist(
+        const std::string& text,
+        const std::string& baseUri,
+        HlsMasterPlaylist* pPlaylist);
+
+    bool ParseMediaPlaylist(
+        const std::string& text,
+        const std::string& baseUri,
+        HlsMediaPlaylist* pPlaylist);
+
+    // Highest variant not above maxBitrate, the lowest one if none fits. -1 if there are no variants.
+    int SelectVariant(const HlsMasterPlaylist& playlist, uint32_t maxBitrate);
+
+    // Text of a media playlist. Without lowLatency the LL-HLS tags are left out, for players
+    // that only know whole segments.
+    std::string WriteMediaPlaylist(const HlsMediaPlaylist& playlist, bool lowLatency);
+
+    // Puts the segments a delta update skipped back in from the previous playlist. Returns
+    // false if the previous playlist does not hold all of them, a full reload is needed then.
+    bool MergeDeltaPlaylist(const HlsMediaPlaylist& previous, HlsMediaPlaylist* pDelta);
+
+    // URI of a blocking reload for the part after the last one in the playlist, or the next
+    // segment if it has no parts. skip asks for a delta update when the server offers them.
+    std::string MakeBlockingReloadUri(const HlsMediaPlaylist& playlist, bool skip);
+}
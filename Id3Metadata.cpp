@@ -0,0 +1,295 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "Id3Metadata.h"
+
+#include <cstring>
+
+namespace
+{
+    const size_t Id3HeaderSize = 10;
+
+    uint32_t ReadSyncSafe(const uint8_t* data)
+    {
+        return (uint32_t(data[0] & 0x7F) << 21) | (uint32_t(data[1] & 0x7F) << 14) | (uint32_t(data[2] & 0x7F) << 7) | (data[3] & 0x7F);
+    }
+
+    uint32_t ReadUInt32(const uint8_t* data)
+    {
+        return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+    }
+
+    // FF 00 -> FF
+    std::vector<uint8_t> RemoveUnsynchronisation(const uint8_t* data, size_t size)
+    {
+        std::vector<uint8_t> out;
+        out.reserve(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            out.push_back(data[i]);
+            if (data[i] == 0xFF && i + 1 < size && data[i + 1] == 0x00)
+            {
+                i++;
+            }
+        }
+        return out;
+    }
+
+    void AppendUtf8(uint32_t codePoint, std::string* pText)
+    {
+        if (codePoint < 0x80)
+        {
+            pText->push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+            pText->push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+            pText->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            pText->push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+            pText->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            pText->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            pText->push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+            pText->push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            pText->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            pText->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+
+    void DecodeFrame(const char* id, const uint8_t* body, size_t size, Id3Frame* pFrame)
+    {
+        pFrame->id.assign(id, 4);
+
+        if (strncmp(id, "PRIV", 4) == 0)
+        {
+            size_t used = Id3::DecodeText(0, body, size, &pFrame->description);
+            pFrame->data.assign(body + used, body + size);
+        }
+        else if (id[0] == 'T' && size != 0)
+        {
+            size_t used = 1;
+            if (strncmp(id, "TXXX", 4) == 0)
+            {
+                used += Id3::DecodeText(body[0], body + used, size - used, &pFrame->description);
+            }
+
+            // v2.4 lists several values separated by terminators, they stay '\0' separated
+            while (used < size)
+            {
+                std::string value;
+                used += Id3::DecodeText(body[0], body + used, size - used, &value);
+                if (value.empty())
+                    continue;
+
+                if (!pFrame->text.empty())
+                {
+                    pFrame->text.push_back('\0');
+                }
+                pFrame->text += value;
+            }
+        }
+        else if (strncmp(id, "WXXX", 4) == 0 && size != 0)
+        {
+            size_t used = 1 + Id3::DecodeText(body[0], body + 1, size - 1, &pFrame->description);
+            Id3::DecodeText(0, body + used, size - used, &pFrame->text);
+        }
+        else if (id[0] == 'W')
+        {
+            Id3::DecodeText(0, body, size, &pFrame->text);
+        }
+        else
+        {
+            pFrame->data.assign(body, body + size);
+        }
+    }
+
+    // One tag at data, returns its size, 0 if it is not valid
+    size_t ParseTag(const uint8_t* data, size_t size, std::vector<Id3Frame>* pFrames)
+    {
+        if (size < Id3HeaderSize || memcmp(data, "ID3", 3) != 0)
+            return 0;
+
+        uint8_t majorVersion = data[3];
+        uint8_t flags = data[5];
+        if (majorVersion < 3 || majorVersion > 4 || data[4] == 0xFF || (data[6] | data[7] | data[8] | data[9]) & 0x80)
+            return 0;
+
+        size_t tagSize = Id3HeaderSize + ReadSyncSafe(data + 6) + ((flags & 0x10) ? Id3HeaderSize : 0);
+        if (tagSize > size)
+            return 0;
+
+        const uint8_t* body = data + Id3HeaderSize;
+        size_t bodySize = ReadSyncSafe(data + 6);
+
+        // v2.3 unsynchronises the whole tag, v2.4 each frame
+        std::vector<uint8_t> resynchronised;
+        if (majorVersion == 3 && (flags & 0x80))
+        {
+            resynchronised = RemoveUnsynchronisation(body, bodySize);
+            body = resynchronised.data();
+            bodySize = resynchronised.size();
+        }
+
+        size_t pos = 0;
+        if (flags & 0x40)
+        {
+            if (bodySize < 4)
+                return tagSize;
+
+            // v2.3 counts the extended header without its size field, v2.4 with it
+            size_t extendedSize = (majorVersion == 3) ? ReadUInt32(body) + 4 : ReadSyncSafe(body);
+            pos = extendedSize;
+        }
+
+        while (pos + Id3HeaderSize <= bodySize)
+        {
+            const uint8_t* frame = body + pos;
+            if (frame[0] == 0)
+                break; // padding
+
+            char id[4];
+            for (size_t i = 0; i < 4; ++i)
+            {
+                id[i] = static_cast<char>(frame[i]);
+                if (!((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9')))
+                    return tagSize;
+            }
+
+            size_t frameSize = (majorVersion == 4) ? ReadSyncSafe(frame + 4) : ReadUInt32(frame + 4);
+            uint8_t formatFlags = frame[9];
+            pos += Id3HeaderSize;
+            if (frameSize > bodySize - pos)
+                break;
+
+            const uint8_t* frameBody = body + pos;
+            size_t frameBodySize = frameSize;
+            pos += frameSize;
+
+            // compressed and encrypted frames are skipped
+            // v2.3: 0x80 compressed, 0x40 encrypted, 0x20 grouped
+            // v2.4: 0x08 compressed, 0x04 encrypted, 0x40 grouped, 0x02 unsynchronised, 0x01 data length
+            bool opaque = (majorVersion == 3) ? (formatFlags & 0xC0) != 0 : (formatFlags & 0x0C) != 0;
+            bool grouped = (majorVersion == 3) ? (formatFlags & 0x20) != 0 : (formatFlags & 0x40) != 0;
+            size_t skip = (grouped ? 1 : 0) + ((majorVersion == 4 && (formatFlags & 0x01)) ? 4 : 0);
+            if (opaque || skip > frameBodySize)
+                continue;
+
+            frameBody += skip;
+            frameBodySize -= skip;
+
+            std::vector<uint8_t> frameResynchronised;
+            if (majorVersion == 4 && (formatFlags & 0x02))
+            {
+                frameResynchronised = RemoveUnsynchronisation(frameBody, frameBodySize);
+                frameBody = frameResynchronised.data();
+                frameBodySize = frameResynchronised.size();
+            }
+
+            Id3Frame parsed;
+            DecodeFrame(id, frameBody, frameBodySize, &parsed);
+            pFrames->push_back(std::move(parsed));
+        }
+
+        return tagSize;
+    }
+}
+
+size_t Id3::DecodeText(uint8_t encoding, const uint8_t* data, size_t size, std::string* pText)
+{
+    pText->clear();
+
+    if (encoding == 0 || encoding == 3)
+    {
+        size_t end = 0;
+        while (end < size && data[end] != 0)
+        {
+            end++;
+        }
+
+        if (encoding == 3)
+        {
+            pText->assign(reinterpret_cast<const char*>(data), end);
+        }
+        else
+        {
+            for (size_t i = 0; i < end; ++i)
+            {
+                AppendUtf8(data[i], pText);
+            }
+        }
+
+        return (end < size) ? end + 1 : end;
+    }
+
+    if (encoding != 1 && encoding != 2)
+        return size;
+
+    // UTF-16, big endian unless a BOM says otherwise
+    bool bigEndian = true;
+    size_t pos = 0;
+    if (encoding == 1 && size >= 2)
+    {
+        if (data[0] == 0xFF && data[1] == 0xFE)
+        {
+            bigEndian = false;
+            pos = 2;
+        }
+        else if (data[0] == 0xFE && data[1] == 0xFF)
+        {
+            pos = 2;
+        }
+    }
+
+    while (pos + 1 < size)
+    {
+        uint32_t unit = bigEndian ? (uint32_t(data[pos]) << 8 | data[pos + 1]) : (uint32_t(data[pos + 1]) << 8 | data[pos]);
+        pos += 2;
+        if (unit == 0)
+            return pos;
+
+        if (unit >= 0xD800 && unit < 0xDC00 && pos + 1 < size)
+        {
+            uint32_t low = bigEndian ? (uint32_t(data[pos]) << 8 | data[pos + 1]) : (uint32_t(data[pos + 1]) << 8 | data[pos]);
+            if (low >= 0xDC00 && low < 0xE000)
+            {
+                pos += 2;
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            }
+        }
+
+        AppendUtf8(unit, pText);
+    }
+
+    return size;
+}
+
+bool Id3::ParseTags(const uint8_t* data, size_t size, std::vector<Id3Frame>* pFrames)
+{
+    if (data == nullptr || pFrames == nullptr)
+        return false;
+
+    size_t pos = 0;
+    while (pos < size)
+    {
+        size_t tagSize = ParseTag(data + pos, size - pos, pFrames);
+        if (tagSize == 0)
+            break;
+
+        pos += tagSize;
+    }
+
+    return pos != 0;
+}
@@ -0,0 +1,47 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable ID3v2.3/2.4 tag parser for HLS timed metadata, the PES payloads of stream type 0x15
+// in MPEG-TS segments. Text, URL and PRIV frames are decoded, other frames keep their body.
+// No Windows dependencies.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Id3Frame
+{
+    std::string id;             // four characters, "TXXX", "PRIV", ...
+    std::string description;    // TXXX/WXXX description, PRIV owner
+    std::string text;           // T*** and W*** value as UTF-8
+    std::vector<uint8_t> data;  // PRIV payload, the whole body of frames not decoded
+};
+
+struct Id3Cue
+{
+    int64_t pts = 0;            // 90 kHz, of the PES packet that carried the tags
+    double time = 0.0;          // seconds on the playback clock, set by whoever knows its origin
+    std::vector<Id3Frame> frames;
+};
+
+namespace Id3
+{
+    // Parses the ID3 tags at data, back to back as in a PES payload, and appends their frames.
+    // Returns false if there is no valid tag at the start.
+    bool ParseTags(const uint8_t* data, size_t size, std::vector<Id3Frame>* pFrames);
+
+    // Text of an encoded string (ISO-8859-1, UTF-16 with BOM, UTF-16BE, UTF-8) as UTF-8, up to
+    // its terminator. Returns the bytes consumed, terminator included.
+    size_t DecodeText(uint8_t encoding, const uint8_t* data, size_t size, std::string* pText);
+}
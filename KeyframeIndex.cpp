@@ -0,0 +1,274 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "KeyframeIndex.h"
+
+#include "TsDemuxer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+    // Type of the first VCL NAL unit of an access unit tells whether it is a random access point,
+    // the scan stops there instead of walking the whole picture
+    bool IsRandomAccessPoint(const uint8_t* data, size_t size, bool hevc)
+    {
+        for (size_t i = 0; i + 3 < size; ++i)
+        {
+            if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+                continue;
+
+            uint8_t header = data[i + 3];
+            if (hevc)
+            {
+                uint8_t type = (header >> 1) & 0x3F;
+                if (type < 32)
+                    return type >= 16 && type <= 21; // BLA, IDR, CRA
+            }
+            else
+            {
+                uint8_t type = header & 0x1F;
+                if (type >= 1 && type <= 5)
+                    return type == 5;
+            }
+
+            i += 3;
+        }
+
+        return false;
+    }
+
+    void ToOffsets(const std::vector<int64_t>& times, int64_t earliest, double timescale, std::vector<double>* pOffsets)
+    {
+        pOffsets->clear();
+        for (int64_t time : times)
+        {
+            pOffsets->push_back(static_cast<double>(time - earliest) / timescale);
+        }
+        std::sort(pOffsets->begin(), pOffsets->end());
+    }
+}
+
+KeyframeIndex::KeyframeIndex()
+{
+}
+
+void KeyframeIndex::Reset(const HlsMediaPlaylist& playlist)
+{
+    m_segments.clear();
+    m_segments.reserve(playlist.segments.size());
+
+    for (const HlsSegment& segment : playlist.segments)
+    {
+        m_segments.push_back({ segment.startTime, segment.duration, { segment.startTime }, false });
+    }
+}
+
+void KeyframeIndex::Clear()
+{
+    m_segments.clear();
+}
+
+bool KeyframeIndex::IsParsed(size_t segmentIndex) const
+{
+    return segmentIndex < m_segments.size() && m_segments[segmentIndex].parsed;
+}
+
+void KeyframeIndex::SetSegmentKeyframes(size_t segmentIndex, const std::vector<double>& offsets)
+{
+    if (segmentIndex >= m_segments.size())
+        return;
+
+    Segment& segment = m_segments[segmentIndex];
+    segment.parsed = true;
+
+    if (offsets.empty())
+        return;
+
+    segment.keyframes.clear();
+    for (double offset : offsets)
+    {
+        // timestamps past the EXTINF duration belong to the next segment's timeline
+        if (offset >= 0.0 && offset < segment.duration)
+        {
+            segment.keyframes.push_back(segment.start + offset);
+        }
+    }
+
+    if (segment.keyframes.empty())
+    {
+        segment.keyframes.push_back(segment.start);
+    }
+}
+
+int KeyframeIndex::FindSegment(double position) const
+{
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), position,
+        [](double value, const Segment& segment) { return value < segment.start; });
+
+    if (it == m_segments.begin())
+        return -1;
+
+    --it;
+    if (position >= it->start + it->duration && it + 1 == m_segments.end())
+        return -1;
+
+    return static_cast<int>(it - m_segments.begin());
+}
+
+bool KeyframeIndex::Lookup(double position, SeekTarget* pTarget) const
+{
+    if (pTarget == nullptr || m_segments.empty())
+        return false;
+
+    int found = FindSegment(position);
+    if (found < 0)
+    {
+        found = (position < m_segments.front().start) ? 0 : static_cast<int>(m_segments.size()) - 1;
+    }
+
+    size_t index = static_cast<size_t>(found);
+
+    // closest keyframe at or before the position, in this segment or an earlier one
+    bool hasBefore = false;
+    SeekTarget before = {};
+    for (size_t i = index + 1; i-- > 0 && !hasBefore;)
+    {
+        const std::vector<double>& keyframes = m_segments[i].keyframes;
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), position);
+        if (it != keyframes.begin())
+        {
+            before = { i, *(it - 1), m_segments[i].parsed };
+            hasBefore = true;
+        }
+    }
+
+    // and the closest one after it
+    bool hasAfter = false;
+    SeekTarget after = {};
+    for (size_t i = index; i < m_segments.size() && !hasAfter; ++i)
+    {
+        const std::vector<double>& keyframes = m_segments[i].keyframes;
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), position);
+        if (it != keyframes.end())
+        {
+            after = { i, *it, m_segments[i].parsed };
+            hasAfter = true;
+        }
+    }
+
+    if (hasBefore && (!hasAfter || position - before.keyframeTime <= after.keyframeTime - position))
+    {
+        *pTarget = before;
+    }
+    else
+    {
+        *pTarget = after;
+    }
+
+    return hasBefore || hasAfter;
+}
+
+bool Keyframes::FindInTransportStream(const uint8_t* data, size_t size, std::vector<double>* pOffsets)
+{
+    if (pOffsets == nullptr)
+        return false;
+
+    int videoPid = -1;
+    bool hevc = false;
+    bool hasEarliest = false;
+    int64_t earliest = 0;
+    std::vector<int64_t> keyframes;
+
+    TsDemuxer demuxer([&](const PesPacket& packet)
+        {
+            TsElementaryStream stream = { packet.pid, packet.streamType };
+            if (!stream.IsVideo() || !packet.hasPts)
+                return;
+
+            if (videoPid < 0)
+            {
+                videoPid = packet.pid;
+                hevc = packet.streamType == static_cast<uint8_t>(TsStreamType::TsStreamType_Hevc);
+            }
+
+            if (packet.pid != videoPid)
+                return;
+
+            if (!hasEarliest || packet.pts < earliest)
+            {
+                earliest = packet.pts;
+                hasEarliest = true;
+            }
+
+            if (IsRandomAccessPoint(packet.data, packet.size, hevc))
+            {
+                keyframes.push_back(packet.pts);
+            }
+        });
+
+    demuxer.Push(data, size);
+    demuxer.Flush();
+
+    ToOffsets(keyframes, earliest, 90000.0, pOffsets);
+
+    return hasEarliest;
+}
+
+bool Keyframes::FindInFragments(const uint8_t* data, size_t size, const Mp4MovieInfo& movie, std::vector<double>* pOffsets)
+{
+    if (pOffsets == nullptr)
+        return false;
+
+    int videoTrack = -1;
+    for (uint32_t i = 0; i < movie.trackCount && videoTrack < 0; ++i)
+    {
+        if (movie.tracks[i].handler == Mp4FourCC("vide") && movie.tracks[i].timescale != 0)
+        {
+            videoTrack = static_cast<int>(i);
+        }
+    }
+
+    Mp4FragmentStats stats;
+    if (videoTrack < 0 || !Mp4::IndexFragments(data, size, movie, nullptr, 0, &stats) || stats.sampleCount == 0)
+        return false;
+
+    std::vector<Mp4Sample> samples(stats.sampleCount);
+    if (!Mp4::IndexFragments(data, size, movie, samples.data(), samples.size(), &stats))
+        return false;
+
+    bool hasEarliest = false;
+    int64_t earliest = 0;
+    std::vector<int64_t> keyframes;
+
+    for (const Mp4Sample& sample : samples)
+    {
+        if (sample.trackIndex != videoTrack)
+            continue;
+
+        int64_t presentation = static_cast<int64_t>(sample.decodeTime) + sample.compositionOffset;
+        if (!hasEarliest || presentation < earliest)
+        {
+            earliest = presentation;
+            hasEarliest = true;
+        }
+
+        if (sample.keyframe)
+        {
+            keyframes.push_back(presentation);
+        }
+    }
+
+    ToOffsets(keyframes, earliest, movie.tracks[videoTrack].timescale, pOffsets);
+
+    return hasEarliest;
+}
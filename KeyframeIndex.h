@@ -0,0 +1,75 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable seek index over an HLS media playlist. Every segment start is taken as a keyframe
+// until the segment's bytes have been parsed, then the IDR/IRAP frames found inside it replace
+// the assumption. Lookups snap a position to the nearest known keyframe.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "HlsPlaylist.h"
+#include "Mp4BoxParser.h"
+
+struct SeekTarget
+{
+    size_t segmentIndex;        // segment holding the keyframe
+    double keyframeTime;        // seconds on the playlist timeline
+    bool parsed;                // found in the segment bytes rather than assumed at its start
+};
+
+class KeyframeIndex
+{
+public:
+    KeyframeIndex();
+
+    // Starts over with the timeline of the playlist, no segment parsed
+    void Reset(const HlsMediaPlaylist& playlist);
+    void Clear();
+
+    size_t SegmentCount() const { return m_segments.size(); }
+    bool IsParsed(size_t segmentIndex) const;
+
+    // Replaces the assumed keyframe of a segment with the ones found in it, in seconds from the
+    // segment start. An empty list keeps the segment start.
+    void SetSegmentKeyframes(size_t segmentIndex, const std::vector<double>& offsets);
+
+    // Segment containing the position, -1 before the first or after the last segment
+    int FindSegment(double position) const;
+
+    // Nearest keyframe to the position, ties go to the earlier one
+    bool Lookup(double position, SeekTarget* pTarget) const;
+
+private:
+    struct Segment
+    {
+        double start;
+        double duration;
+        std::vector<double> keyframes; // absolute, ascending, never empty
+        bool parsed;
+    };
+
+    std::vector<Segment> m_segments;
+};
+
+namespace Keyframes
+{
+    // IDR (H.264) and IRAP (HEVC) presentation times of the first video stream of a transport
+    // stream segment, in seconds from its earliest video timestamp
+    bool FindInTransportStream(const uint8_t* data, size_t size, std::vector<double>* pOffsets);
+
+    // Sync sample presentation times of the first video track of an fMP4 media segment, in
+    // seconds from its earliest video sample
+    bool FindInFragments(const uint8_t* data, size_t size, const Mp4MovieInfo& movie, std::vector<double>* pOffsets);
+}
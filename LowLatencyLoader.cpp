@@ -0,0 +1,292 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "LowLatencyLoader.h"
+#include "MediaHelpers.h"
+
+#include <algorithm>
+
+LowLatencyLoader::LowLatencyLoader(std::shared_ptr<SegmentCache> cache, std::shared_ptr<DownloadScheduler> scheduler)
+    : m_cache(std::move(cache))
+    , m_scheduler(std::move(scheduler))
+    , m_fetchSequence(0)
+    , m_reloads(0)
+    , m_deltaReloads(0)
+{
+}
+
+HRESULT LowLatencyLoader::Start(const std::string& playlistUri)
+{
+    Stop();
+
+    // registered before the first request so a Stop meanwhile cancels it
+    auto cancellation = std::make_shared<AsyncCancellation>();
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_cancellation = cancellation;
+    }
+
+    HlsMediaPlaylist playlist;
+    IFR(LoadPlaylist(playlistUri, playlistUri, INFINITE, cancellation, &playlist));
+
+    if (playlist.partTargetDuration <= 0.0 || playlist.endList || !playlist.serverControl.canBlockReload)
+        return S_FALSE;
+
+    double partTarget = playlist.partTargetDuration;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_cancellation != cancellation || cancellation->IsCanceled())
+            return S_FALSE;
+
+        m_playlistUri = playlistUri;
+        m_playlist = std::move(playlist);
+        m_fetchSequence = m_playlist.NextSequence();
+        m_reloads = 0;
+        m_deltaReloads = 0;
+    }
+
+    Log(Log_Level_Info, L"LowLatencyLoader::Start() - %S: %.3f s parts, %.3f s behind the live edge\n",
+        playlistUri.c_str(), partTarget, LiveOffset());
+
+    return S_OK;
+}
+
+HRESULT LowLatencyLoader::Reload()
+{
+    std::string playlistUri;
+    HlsMediaPlaylist previous;
+    uint64_t fetchSequence = 0;
+    std::shared_ptr<AsyncCancellation> cancellation;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_playlistUri.empty() || m_cancellation == nullptr || m_cancellation->IsCanceled())
+            return S_FALSE;
+
+        playlistUri = m_playlistUri;
+        previous = m_playlist;
+        fetchSequence = m_fetchSequence;
+        cancellation = m_cancellation;
+    }
+
+    DWORD timeoutMs = static_cast<DWORD>(previous.targetDuration * 3000.0) + LOW_LATENCY_RELOAD_SLACK_MS;
+
+    // the hinted part is requested before it exists, the origin answers once it is complete and
+    // the reload that follows returns right away
+    const HlsPreloadHint& hint = previous.preloadHint;
+    if (hint.type == "PART" && !hint.uri.empty())
+    {
+        LOG_RESULT(FetchPart(hint.uri, hint.byteOffset, hint.byteLength, timeoutMs, cancellation));
+    }
+
+    if (cancellation->IsCanceled())
+        return S_FALSE;
+
+    HlsMediaPlaylist playlist;
+    IFR(LoadPlaylist(Hls::MakeBlockingReloadUri(previous, true), playlistUri, timeoutMs, cancellation, &playlist));
+
+    bool delta = playlist.skippedSegments != 0;
+    if (delta && !Hls::MergeDeltaPlaylist(previous, &playlist))
+    {
+        // it skipped segments older than the ones known, the whole playlist is needed
+        IFR(LoadPlaylist(Hls::MakeBlockingReloadUri(previous, false), playlistUri, timeoutMs, cancellation, &playlist));
+        delta = false;
+    }
+
+    // parts of the segments completed since the last reload and of the one in progress, the
+    // ones fetched while they were pending are still cached
+    std::vector<const HlsPartialSegment*> parts;
+    for (const HlsSegment& segment : playlist.segments)
+    {
+        if (segment.sequence < fetchSequence)
+            continue;
+
+        for (const HlsPartialSegment& part : segment.parts)
+        {
+            parts.push_back(&part);
+        }
+    }
+    for (const HlsPartialSegment& part : playlist.pendingParts)
+    {
+        parts.push_back(&part);
+    }
+
+    for (const HlsPartialSegment* pPart : parts)
+    {
+        if (pPart->gap)
+            continue;
+
+        HRESULT hr = FetchPart(pPart->uri, pPart->byteOffset, pPart->byteLength, timeoutMs, cancellation);
+        if (cancellation->IsCanceled())
+            return S_FALSE;
+
+        LOG_RESULT_MSG(hr, L"LowLatencyLoader - part not fetched, its segment is downloaded whole");
+    }
+
+    bool ended = playlist.endList;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_cancellation != cancellation)
+            return S_FALSE;
+
+        m_playlist = std::move(playlist);
+        m_fetchSequence = m_playlist.NextSequence();
+        m_reloads++;
+        m_deltaReloads += delta ? 1 : 0;
+    }
+
+    return ended ? S_FALSE : S_OK;
+}
+
+void LowLatencyLoader::Stop()
+{
+    std::shared_ptr<AsyncCancellation> cancellation;
+    UINT64 reloads = 0;
+    UINT64 deltaReloads = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        cancellation.swap(m_cancellation);
+        reloads = m_reloads;
+        deltaReloads = m_deltaReloads;
+        m_playlistUri.clear();
+        m_playlist = HlsMediaPlaylist();
+        m_reloads = 0;
+        m_deltaReloads = 0;
+    }
+
+    if (cancellation != nullptr)
+    {
+        cancellation->Cancel();
+    }
+
+    if (reloads != 0)
+    {
+        Log(Log_Level_Info, L"LowLatencyLoader::Stop() - %llu blocking reloads, %llu of them delta updates\n", reloads, deltaReloads);
+    }
+}
+
+std::string LowLatencyLoader::PlaylistUri() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_playlistUri;
+}
+
+bool LowLatencyLoader::GetPlayerPlaylist(const std::string& playlistUri, std::string* pText) const
+{
+    if (pText == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_playlistUri.empty() || playlistUri != m_playlistUri)
+        return false;
+
+    *pText = Hls::WriteMediaPlaylist(m_playlist, false);
+    return true;
+}
+
+SegmentBuffer LowLatencyLoader::AssembleSegment(const std::string& cacheKey) const
+{
+    std::vector<HlsPartialSegment> parts;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        // requests are for segments near the live edge, the end of the playlist
+        auto it = std::find_if(m_playlist.segments.rbegin(), m_playlist.segments.rend(), [&](const HlsSegment& segment)
+            {
+                return SegmentCache::MakeKey(segment.uri, segment.byteOffset, segment.byteLength) == cacheKey;
+            });
+        if (it == m_playlist.segments.rend())
+            return nullptr;
+
+        parts = it->parts;
+    }
+
+    if (parts.empty())
+        return nullptr;
+
+    std::vector<SegmentBuffer> buffers;
+    size_t size = 0;
+    for (const HlsPartialSegment& part : parts)
+    {
+        SegmentBuffer spPart = part.gap ? nullptr : m_cache->Find(SegmentCache::MakeKey(part.uri, part.byteOffset, part.byteLength));
+        if (spPart == nullptr)
+            return nullptr;
+
+        size += spPart->size();
+        buffers.push_back(std::move(spPart));
+    }
+
+    // the parts of a segment are its bytes in order
+    auto spSegment = std::make_shared<std::vector<uint8_t>>();
+    spSegment->reserve(size);
+    for (const SegmentBuffer& spPart : buffers)
+    {
+        spSegment->insert(spSegment->end(), spPart->begin(), spPart->end());
+    }
+
+    return spSegment;
+}
+
+double LowLatencyLoader::LiveOffset() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // a player of whole segments can come no closer than the newest complete one
+    return (std::max)(m_playlist.serverControl.partHoldBack, m_playlist.targetDuration);
+}
+
+HRESULT LowLatencyLoader::LoadPlaylist(const std::string& requestUri, const std::string& playlistUri, DWORD timeoutMs, const std::shared_ptr<AsyncCancellation>& cancellation, HlsMediaPlaylist* pPlaylist)
+{
+    SegmentBuffer spText;
+    IFR(Download(requestUri, 0, 0, DownloadPriority::Playlist, timeoutMs, cancellation, &spText));
+
+    // parsed against the plain URI, a blocking reload is built from it again
+    if (!Hls::ParseMediaPlaylist(std::string(spText->begin(), spText->end()), playlistUri, pPlaylist))
+        return MF_E_INVALID_FORMAT;
+
+    return S_OK;
+}
+
+HRESULT LowLatencyLoader::FetchPart(const std::string& uri, UINT64 offset, UINT64 length, DWORD timeoutMs, const std::shared_ptr<AsyncCancellation>& cancellation)
+{
+    std::string key = SegmentCache::MakeKey(uri, offset, length);
+    if (m_cache->Contains(key))
+        return S_FALSE;
+
+    SegmentBuffer spData;
+    IFR(Download(uri, offset, length, DownloadPriority::VideoNearPlayhead, timeoutMs, cancellation, &spData));
+
+    m_cache->Insert(key, spData);
+
+    return S_OK;
+}
+
+HRESULT LowLatencyLoader::Download(const std::string& uri, UINT64 offset, UINT64 length, DownloadPriority priority, DWORD timeoutMs, const std::shared_ptr<AsyncCancellation>& cancellation, SegmentBuffer* pData)
+{
+    if (m_scheduler != nullptr)
+    {
+        DownloadRequest request;
+        request.url = Utf8ToWide(uri);
+        request.offset = offset;
+        request.length = length;
+        request.priority = priority;
+        request.origin = DownloadOrigin::LowLatency;
+        request.timeoutMs = timeoutMs;
+        request.cancellation = cancellation;
+        return m_scheduler->Fetch(std::move(request), pData);
+    }
+
+    auto spData = std::make_shared<std::vector<uint8_t>>();
+    IFR(DownloadToBuffer(Utf8ToWide(uri).c_str(), offset, length, spData.get(), timeoutMs, cancellation));
+    *pData = spData;
+
+    return S_OK;
+}
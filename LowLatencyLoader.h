@@ -0,0 +1,77 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "AsyncOperationAwaiter.h"
+#include "DownloadScheduler.h"
+#include "HlsPlaylist.h"
+#include "SegmentCache.h"
+
+#define LOW_LATENCY_RELOAD_SLACK_MS 2000 // on top of the three target durations a server may hold a blocking reload
+
+// Follows the live edge of an LL-HLS media playlist. Every reload is a blocking _HLS_msn/_HLS_part
+// request for the next part, delta updates (_HLS_skip) are merged into the full playlist, and the
+// announced parts and the preload hint are pulled into the SegmentCache as soon as they exist.
+// The player only knows whole segments: it gets the followed playlist without the LL-HLS tags,
+// up to date without a round trip, and a segment whose parts are all cached is assembled from
+// them instead of being downloaded again. Reloads go through the scheduler at playlist priority,
+// parts at the priority of segments near the playhead.
+class LowLatencyLoader
+{
+public:
+    LowLatencyLoader(_In_ std::shared_ptr<SegmentCache> cache, _In_opt_ std::shared_ptr<DownloadScheduler> scheduler = nullptr);
+
+    // Loads the media playlist and follows it. S_FALSE when it is not a live LL-HLS playlist
+    // with blocking reloads, the loader stays idle then. Blocks on network I/O.
+    HRESULT Start(_In_ const std::string& playlistUri);
+
+    // Waits for the next part with a blocking reload and fetches what it announced. S_FALSE
+    // once the playlist ended or after Stop. Blocks on network I/O, call it again until then.
+    HRESULT Reload();
+
+    // Cancels a reload in flight, the loader is idle until the next Start
+    void Stop();
+
+    // Media playlist followed, empty when idle
+    std::string PlaylistUri() const;
+
+    // The followed playlist as a player without LL-HLS support should see it
+    bool GetPlayerPlaylist(_In_ const std::string& playlistUri, _Out_ std::string* pText) const;
+
+    // Whole segment at the cache key built from its cached parts, nullptr if one is missing
+    SegmentBuffer AssembleSegment(_In_ const std::string& cacheKey) const;
+
+    // Seconds to stay behind the live edge when only whole segments are played
+    double LiveOffset() const;
+
+private:
+    HRESULT LoadPlaylist(_In_ const std::string& requestUri, _In_ const std::string& playlistUri, _In_ DWORD timeoutMs, _In_ const std::shared_ptr<AsyncCancellation>& cancellation, _Out_ HlsMediaPlaylist* pPlaylist);
+    HRESULT FetchPart(_In_ const std::string& uri, _In_ UINT64 offset, _In_ UINT64 length, _In_ DWORD timeoutMs, _In_ const std::shared_ptr<AsyncCancellation>& cancellation);
+    HRESULT Download(_In_ const std::string& uri, _In_ UINT64 offset, _In_ UINT64 length, _In_ DownloadPriority priority, _In_ DWORD timeoutMs, _In_ const std::shared_ptr<AsyncCancellation>& cancellation, _Out_ SegmentBuffer* pData);
+
+    std::shared_ptr<SegmentCache> m_cache;
+    std::shared_ptr<DownloadScheduler> m_scheduler; // nullptr downloads directly
+
+    mutable std::mutex m_lock;
+    std::string m_playlistUri; // empty when idle
+    HlsMediaPlaylist m_playlist; // delta updates merged
+    uint64_t m_fetchSequence; // parts of this segment and later ones are fetched
+    std::shared_ptr<AsyncCancellation> m_cancellation;
+    UINT64 m_reloads;
+    UINT64 m_deltaReloads;
+};
@@ -0,0 +1,184 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable hand-off of media callbacks to the thread that owns the player. Callbacks on any
+// thread post small typed records into a bounded LockFreeQueue, the owner drains them at a
+// point of its choosing and handles them in order. A coalesced type has at most one record
+// waiting: events posted while it waits are counted into it and it is handled with the newest
+// source and value. Posting never blocks and never allocates. No Windows dependencies.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "LockFreeQueue.h"
+
+enum class MediaEventType : uint32_t
+{
+    StateChanged = 0,
+    SizeChanged,
+    Failed,
+    VideoFrameAvailable,
+    Count
+};
+
+struct MediaEvent
+{
+    MediaEventType type = MediaEventType::Count;
+    const void* source = nullptr;   // sender of the callback, compared with the active player when handled
+    int32_t value = 0;              // HRESULT of a failure
+    uint32_t count = 1;             // events of a coalesced record, 1 for the others
+    int64_t postedNs = 0;           // steady clock, the first event of a coalesced record
+    bool coalesced = false;
+};
+
+struct MediaEventStats
+{
+    uint64_t posted;
+    uint64_t coalesced;     // merged into a waiting record
+    uint64_t dropped;       // the queue was full
+    uint64_t handled;       // records
+    double latencySecondsTotal;  // posted to handled, of the records
+    double latencySecondsMax;
+};
+
+class MediaEventQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit MediaEventQueue(size_t capacity)
+        : m_queue(capacity)
+    {
+    }
+
+    MediaEventQueue(const MediaEventQueue&) = delete;
+    MediaEventQueue& operator=(const MediaEventQueue&) = delete;
+
+    // Any thread. False when the queue was full and the event was dropped.
+    bool Post(MediaEventType type, const void* source, int32_t value = 0, bool coalesce = true)
+    {
+        TypeState& state = m_types[static_cast<size_t>(type)];
+        state.posted.fetch_add(1, std::memory_order_relaxed);
+
+        if (coalesce)
+        {
+            // stored before the flag is looked at, the record handled after the flag is cleared sees them
+            state.latestSource.store(source);
+            state.latestValue.store(value);
+            if (state.pending.exchange(true))
+            {
+                state.merged.fetch_add(1);
+                state.coalesced.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        MediaEvent event;
+        event.type = type;
+        event.source = source;
+        event.value = value;
+        event.postedNs = NowNs();
+        event.coalesced = coalesce;
+        if (!m_queue.TryPush(std::move(event)))
+        {
+            if (coalesce)
+            {
+                state.pending.store(false);
+            }
+            state.dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        return true;
+    }
+
+    // The owner thread only. Hands the records posted so far to handler(const MediaEvent&) in
+    // order, at most a queue's worth so producers cannot keep it here. Returns how many.
+    template <typename THandler>
+    size_t Drain(THandler&& handler)
+    {
+        size_t handled = 0;
+        MediaEvent event;
+        while (handled < m_queue.Capacity() && m_queue.TryPop(&event))
+        {
+            TypeState& state = m_types[static_cast<size_t>(event.type)];
+            if (event.coalesced)
+            {
+                // cleared first, an event from now on posts a record of its own
+                state.pending.store(false);
+                event.source = state.latestSource.load();
+                event.value = state.latestValue.load();
+                event.count = 1 + static_cast<uint32_t>(state.merged.exchange(0));
+            }
+
+            int64_t latencyNs = NowNs() - event.postedNs;
+            state.handled.fetch_add(1, std::memory_order_relaxed);
+            state.latencyNsTotal.fetch_add(latencyNs, std::memory_order_relaxed);
+            if (latencyNs > state.latencyNsMax.load(std::memory_order_relaxed))
+            {
+                state.latencyNsMax.store(latencyNs, std::memory_order_relaxed);
+            }
+
+            handler(static_cast<const MediaEvent&>(event));
+            handled++;
+        }
+
+        return handled;
+    }
+
+    MediaEventStats GetStats(MediaEventType type) const
+    {
+        const TypeState& state = m_types[static_cast<size_t>(type)];
+
+        MediaEventStats stats;
+        stats.posted = state.posted.load(std::memory_order_relaxed);
+        stats.coalesced = state.coalesced.load(std::memory_order_relaxed);
+        stats.dropped = state.dropped.load(std::memory_order_relaxed);
+        stats.handled = state.handled.load(std::memory_order_relaxed);
+        stats.latencySecondsTotal = state.latencyNsTotal.load(std::memory_order_relaxed) / 1e9;
+        stats.latencySecondsMax = state.latencyNsMax.load(std::memory_order_relaxed) / 1e9;
+        return stats;
+    }
+
+    size_t Capacity() const { return m_queue.Capacity(); }
+
+    // The clock of MediaEvent::postedNs
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Approximate while callbacks are posting
+    size_t Size() const { return m_queue.Size(); }
+
+private:
+    // a type per cache line, callbacks of different types do not contend
+    struct alignas(64) TypeState
+    {
+        std::atomic<bool> pending{ false };     // a coalesced record of the type waits
+        std::atomic<const void*> latestSource{ nullptr };
+        std::atomic<int32_t> latestValue{ 0 };
+        std::atomic<uint64_t> merged{ 0 };      // into the waiting record
+
+        std::atomic<uint64_t> posted{ 0 };
+        std::atomic<uint64_t> coalesced{ 0 };
+        std::atomic<uint64_t> dropped{ 0 };
+        std::atomic<uint64_t> handled{ 0 };     // written by the owner only
+        std::atomic<int64_t> latencyNsTotal{ 0 };
+        std::atomic<int64_t> latencyNsMax{ 0 };
+    };
+
+    LockFreeQueue<MediaEvent> m_queue;
+    TypeState m_types[static_cast<size_t>(MediaEventType::Count)];
+};
@@ -13,7 +13,10 @@
 
 #include "pch.h"
 #include "MediaHelpers.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <windows.storage.accesscache.h>
+#include <robuffer.h>
 
 using namespace ABI::Windows::Graphics::DirectX::Direct3D11;
 using namespace ABI::Windows::Media::Core;
@@ -23,6 +26,30 @@ using namespace ABI::Windows::Media::Audio;
 
 using namespace Microsoft::WRL;
 
+namespace
+{
+    // Registered once, every download of the process records into them
+    struct DownloadMetrics
+    {
+        Metrics::Counter& requests;
+        Metrics::Counter& failures;
+        Metrics::Counter& bytes;
+        Metrics::Histogram& durationUs;
+    };
+
+    DownloadMetrics& GetDownloadMetrics()
+    {
+        Metrics::Registry& registry = Metrics::Registry::Instance();
+        static DownloadMetrics s_metrics = {
+            registry.GetCounter("download_requests_total", "DownloadToBuffer calls"),
+            registry.GetCounter("download_failures_total", "DownloadToBuffer calls that got no content"),
+            registry.GetCounter("download_bytes_total", "Bytes DownloadToBuffer returned"),
+            registry.GetHistogram("download_duration_us", "Request to last byte of a successful download in microseconds"),
+        };
+        return s_metrics;
+    }
+}
+
 #if defined(_DEBUG)
 // Check for SDK Layer support.
 inline bool SdkLayersAvailable()
@@ -48,9 +75,6 @@ using namespace ABI::Windows::Media::Streaming::Adaptive;
 using namespace ABI::Windows::Foundation;
 using namespace Wrappers;
 
-#include <ppl.h>
-#include <ppltasks.h>
-
 void CreateAdaptiveMediaSourceFromUri(
     _In_ PCWSTR szManifestUri,
     _Outptr_opt_ IAdaptiveMediaSource** ppAdaptiveMediaSource,
@@ -87,48 +111,14 @@ void CreateAdaptiveMediaSourceFromUri(
     );
 
     ComPtr<ICreateAdaptiveMediaSourceOperation> spCreateOperation;
-    Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-
-    HRESULT hrStatus = S_OK;
     ComPtr<IAdaptiveMediaSourceCreationResult> spResult;
 
-    auto callback = Callback<IAsyncOperationCompletedHandler<AdaptiveMediaSourceCreationResult*>>(
-        [&operationCompleted, &hrStatus, &spResult](
-        ICreateAdaptiveMediaSourceOperation* pOp,
-        AsyncStatus status
-    ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatus = pOp->GetResults(&spResult);
-            }
-            else
-            {
-                hrStatus = E_FAIL;
-            }
-
-            SetEvent(operationCompleted.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
+    hr = spMediaSourceStatics->CreateFromUriAsync(spUri.Get(), &spCreateOperation);
+    if (SUCCEEDED(hr))
     {
-        spMediaSourceStatics->CreateFromUriAsync(
-            spUri.Get(),
-            &spCreateOperation
-        );
-        if (spCreateOperation)
-        {
-            spCreateOperation->put_Completed(callback.Get());
-        }
-        else
-        {
-            SetEvent(operationCompleted.Get());
-        }
-    });
-
-
-    DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
+        hr = WaitForAsyncResults(spCreateOperation.Get(), spResult.ReleaseAndGetAddressOf());
+    }
+    LOG_RESULT(hr);
 
     AdaptiveMediaSourceCreationStatus creationStatus = AdaptiveMediaSourceCreationStatus_UnknownFailure;
     if (spResult)
@@ -157,6 +147,8 @@ HRESULT CreateMediaSource(
     LPCWSTR pszUrl,
     IMediaSource2** ppMediaSource)
 {
+    TRACE_SPAN("CreateMediaSource");
+
     NULL_CHK(pszUrl);
     NULL_CHK(ppMediaSource);
 
@@ -206,43 +198,12 @@ HRESULT CreateMediaSource(
 		{
 			ComPtr<IAsyncOperation<ABI::Windows::Storage::StorageFile*>> fileOp;
 			ComPtr<ABI::Windows::Storage::IStorageFile> file;
-			Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-			HRESULT hrResult = S_OK;
-
-			auto callback = Callback<ABI::Windows::Foundation::IAsyncOperationCompletedHandler<ABI::Windows::Storage::StorageFile*>>(
-				[&operationCompleted, &file, &hrResult](
-					IAsyncOperation<ABI::Windows::Storage::StorageFile*>* pOper, 
-					AsyncStatus status
-					) -> HRESULT
+
+			HRESULT hrResult = accList->GetFileAsync(token.Get(), fileOp.GetAddressOf());
+			if (SUCCEEDED(hrResult))
 			{
-				if (status == AsyncStatus::Completed)
-				{
-					ABI::Windows::Storage::IStorageFile* pFile = nullptr;
-					hrResult = pOper->GetResults(&pFile);
-					file.Attach(pFile);
-				}
-				else
-				{
-					hrResult = E_FAIL;
-				}
-
-				SetEvent(operationCompleted.Get());
-				return S_OK;
-			});
-
-			concurrency::create_task([&]() {
-				hrResult = accList->GetFileAsync(token.Get(), fileOp.GetAddressOf());
-				if (fileOp)
-				{
-					fileOp->put_Completed(callback.Get());
-				}
-				else
-				{
-					SetEvent(operationCompleted.Get());
-				}
-			});
-
-			DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
+				hrResult = WaitForAsyncResults(fileOp.Get(), file.ReleaseAndGetAddressOf());
+			}
 
 			if (file.Get())
 			{
@@ -324,6 +285,313 @@ HRESULT CreateAdaptiveMediaSource(
     return S_OK;
 }
 
+// DownloadToBuffer without the metrics
+static HRESULT DownloadToBufferInternal(
+    LPCWSTR pszUrl,
+    UINT64 offset,
+    UINT64 length,
+    std::vector<BYTE>* pData,
+    DWORD timeoutMs,
+    std::shared_ptr<AsyncCancellation> cancellation,
+    ABI::Windows::Web::Http::IHttpClient* pClient,
+    std::shared_ptr<std::atomic<UINT64>> bytesReceived)
+{
+    NULL_CHK(pszUrl);
+    NULL_CHK(pData);
+
+    pData->clear();
+
+    ComPtr<IUriRuntimeClassFactory> spUriFactory;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Foundation_Uri).Get(),
+        &spUriFactory));
+
+    ComPtr<IUriRuntimeClass> spUri;
+    IFR(spUriFactory->CreateUri(HStringReference(pszUrl).Get(), &spUri));
+
+    ComPtr<ABI::Windows::Web::Http::IHttpClient> spClient(pClient);
+    if (spClient == nullptr)
+    {
+        IFR(CreateHttpClient(&spClient));
+    }
+
+    ComPtr<ABI::Windows::Web::Http::IHttpMethodStatics> spMethodStatics;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Web_Http_HttpMethod).Get(),
+        &spMethodStatics));
+
+    ComPtr<ABI::Windows::Web::Http::IHttpMethod> spGet;
+    IFR(spMethodStatics->get_Get(&spGet));
+
+    ComPtr<ABI::Windows::Web::Http::IHttpRequestMessageFactory> spRequestFactory;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Web_Http_HttpRequestMessage).Get(),
+        &spRequestFactory));
+
+    ComPtr<ABI::Windows::Web::Http::IHttpRequestMessage> spRequest;
+    IFR(spRequestFactory->Create(spGet.Get(), spUri.Get(), &spRequest));
+
+    if (length != 0)
+    {
+        wchar_t szRange[64];
+        IFR(StringCchPrintf(szRange, _countof(szRange), L"bytes=%llu-%llu", offset, offset + length - 1));
+
+        ComPtr<ABI::Windows::Web::Http::Headers::IHttpRequestHeaderCollection> spHeaders;
+        IFR(spRequest->get_Headers(&spHeaders));
+
+        boolean appended = false;
+        IFR(spHeaders->TryAppendWithoutValidation(HStringReference(L"Range").Get(), HStringReference(szRange).Get(), &appended));
+    }
+
+    ComPtr<IAsyncOperationWithProgress<ABI::Windows::Web::Http::HttpResponseMessage*, ABI::Windows::Web::Http::HttpProgress>> spSendOperation;
+    IFR(spClient->SendRequestAsync(spRequest.Get(), &spSendOperation));
+
+    // the body is read before the send completes, its progress is what a cancel throws away
+    if (bytesReceived != nullptr)
+    {
+        auto progress = Callback<IAsyncOperationProgressHandler<ABI::Windows::Web::Http::HttpResponseMessage*, ABI::Windows::Web::Http::HttpProgress>>(
+            [bytesReceived](IAsyncOperationWithProgress<ABI::Windows::Web::Http::HttpResponseMessage*, ABI::Windows::Web::Http::HttpProgress>*,
+                ABI::Windows::Web::Http::HttpProgress value) -> HRESULT
+            {
+                *bytesReceived = value.BytesReceived;
+                return S_OK;
+            });
+        LOG_RESULT(spSendOperation->put_Progress(progress.Get()));
+    }
+
+    ComPtr<ABI::Windows::Web::Http::IHttpResponseMessage> spResponse;
+    IFR(WaitForAsyncResults(spSendOperation.Get(), spResponse.ReleaseAndGetAddressOf(), timeoutMs, cancellation));
+
+    boolean isSuccess = false;
+    IFR(spResponse->get_IsSuccessStatusCode(&isSuccess));
+    ABI::Windows::Web::Http::HttpStatusCode statusCode = ABI::Windows::Web::Http::HttpStatusCode_None;
+    IFR(spResponse->get_StatusCode(&statusCode));
+    if (!isSuccess)
+    {
+        Log(Log_Level_Warning, L"DownloadToBuffer() - HTTP %d for %s\n", statusCode, pszUrl);
+        return HTTP_E_STATUS_UNEXPECTED;
+    }
+
+    // a range goes into the cache under its byte range key, anything but those bytes would be served as them
+    if (length != 0 && statusCode != ABI::Windows::Web::Http::HttpStatusCode_PartialContent && statusCode != ABI::Windows::Web::Http::HttpStatusCode_Ok)
+    {
+        Log(Log_Level_Warning, L"DownloadToBuffer() - HTTP %d for the range %llu-%llu of %s\n", statusCode, offset, offset + length - 1, pszUrl);
+        return HTTP_E_STATUS_UNEXPECTED;
+    }
+
+    ComPtr<ABI::Windows::Web::Http::IHttpContent> spContent;
+    IFR(spResponse->get_Content(&spContent));
+
+    ComPtr<IAsyncOperationWithProgress<ABI::Windows::Storage::Streams::IBuffer*, UINT64>> spReadOperation;
+    IFR(spContent->ReadAsBufferAsync(&spReadOperation));
+
+    ComPtr<ABI::Windows::Storage::Streams::IBuffer> spBuffer;
+    IFR(WaitForAsyncResults(spReadOperation.Get(), spBuffer.ReleaseAndGetAddressOf(), timeoutMs, cancellation));
+
+    UINT32 bufferLength = 0;
+    IFR(spBuffer->get_Length(&bufferLength));
+
+    ComPtr<Windows::Storage::Streams::IBufferByteAccess> spByteAccess;
+    IFR(spBuffer.As(&spByteAccess));
+
+    BYTE* pBytes = nullptr;
+    IFR(spByteAccess->Buffer(&pBytes));
+
+    if (length == 0)
+    {
+        pData->assign(pBytes, pBytes + bufferLength);
+    }
+    else if (statusCode == ABI::Windows::Web::Http::HttpStatusCode_PartialContent)
+    {
+        if (bufferLength != length)
+        {
+            Log(Log_Level_Warning, L"DownloadToBuffer() - %u bytes for the %llu byte range at %llu of %s\n", bufferLength, length, offset, pszUrl);
+            return HTTP_E_STATUS_UNEXPECTED;
+        }
+        pData->assign(pBytes, pBytes + bufferLength);
+    }
+    else
+    {
+        // the origin ignored the Range header and sent the whole resource, the range is cut out of it
+        if (offset + length > bufferLength)
+        {
+            Log(Log_Level_Warning, L"DownloadToBuffer() - range %llu-%llu beyond the %u bytes of %s\n", offset, offset + length - 1, bufferLength, pszUrl);
+            return HTTP_E_STATUS_UNEXPECTED;
+        }
+        Log(Log_Level_Info, L"DownloadToBuffer() - %s ignored the range, %u bytes for %llu\n", pszUrl, bufferLength, length);
+        pData->assign(pBytes + offset, pBytes + offset + length);
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+
+HRESULT DownloadToBuffer(
+    LPCWSTR pszUrl,
+    UINT64 offset,
+    UINT64 length,
+    std::vector<BYTE>* pData,
+    DWORD timeoutMs,
+    std::shared_ptr<AsyncCancellation> cancellation,
+    ABI::Windows::Web::Http::IHttpClient* pClient,
+    std::shared_ptr<std::atomic<UINT64>> bytesReceived)
+{
+    DownloadMetrics& metrics = GetDownloadMetrics();
+    metrics.requests.Add();
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    HRESULT hr = DownloadToBufferInternal(pszUrl, offset, length, pData, timeoutMs, cancellation, pClient, bytesReceived);
+    if (FAILED(hr))
+    {
+        metrics.failures.Add();
+        return hr;
+    }
+
+    LARGE_INTEGER end;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&end);
+    QueryPerformanceFrequency(&frequency);
+    metrics.bytes.Add(pData->size());
+    metrics.durationUs.Record(static_cast<UINT64>(end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart);
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+
+HRESULT CreateHttpClient(
+    ABI::Windows::Web::Http::IHttpClient** ppClient)
+{
+    NULL_CHK(ppClient);
+
+    *ppClient = nullptr;
+
+    ComPtr<ABI::Windows::Web::Http::IHttpClient> spClient;
+    IFR(Windows::Foundation::ActivateInstance(
+        HStringReference(RuntimeClass_Windows_Web_Http_HttpClient).Get(),
+        &spClient));
+
+    *ppClient = spClient.Detach();
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+
+HRESULT CreateBufferFromBytes(
+    const BYTE* pData,
+    UINT32 size,
+    ABI::Windows::Storage::Streams::IBuffer** ppBuffer)
+{
+    NULL_CHK(ppBuffer);
+
+    *ppBuffer = nullptr;
+
+    ComPtr<ABI::Windows::Storage::Streams::IBufferFactory> spBufferFactory;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Storage_Streams_Buffer).Get(),
+        &spBufferFactory));
+
+    ComPtr<ABI::Windows::Storage::Streams::IBuffer> spBuffer;
+    IFR(spBufferFactory->Create(size, &spBuffer));
+
+    ComPtr<Windows::Storage::Streams::IBufferByteAccess> spByteAccess;
+    IFR(spBuffer.As(&spByteAccess));
+
+    BYTE* pBytes = nullptr;
+    IFR(spByteAccess->Buffer(&pBytes));
+
+    if (size != 0)
+    {
+        NULL_CHK(pData);
+        memcpy(pBytes, pData, size);
+    }
+    IFR(spBuffer->put_Length(size));
+
+    *ppBuffer = spBuffer.Detach();
+
+    return S_OK;
+}
+
+namespace
+{
+    // IBuffer over bytes shared with others, they stay alive as long as the buffer does
+    class SharedBytesBuffer : public RuntimeClass<RuntimeClassFlags<WinRtClassicComMix>,
+        ABI::Windows::Storage::Streams::IBuffer, Windows::Storage::Streams::IBufferByteAccess>
+    {
+        InspectableClass(L"WindowsProject1.SharedBytesBuffer", BaseTrust)
+
+    public:
+        HRESULT RuntimeClassInitialize(std::shared_ptr<const std::vector<BYTE>> spData)
+        {
+            NULL_CHK(spData.get());
+
+            m_spData = std::move(spData);
+            m_length = static_cast<UINT32>(m_spData->size());
+            return S_OK;
+        }
+
+        IFACEMETHODIMP get_Capacity(UINT32* pValue) override
+        {
+            NULL_CHK(pValue);
+            *pValue = static_cast<UINT32>(m_spData->size());
+            return S_OK;
+        }
+
+        IFACEMETHODIMP get_Length(UINT32* pValue) override
+        {
+            NULL_CHK(pValue);
+            *pValue = m_length;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP put_Length(UINT32 value) override
+        {
+            if (value > m_spData->size())
+                return E_INVALIDARG;
+
+            m_length = value;
+            return S_OK;
+        }
+
+        // the bytes are read by the media source, never written
+        IFACEMETHODIMP Buffer(BYTE** ppValue) override
+        {
+            NULL_CHK(ppValue);
+            *ppValue = const_cast<BYTE*>(m_spData->data());
+            return S_OK;
+        }
+
+    private:
+        std::shared_ptr<const std::vector<BYTE>> m_spData;
+        UINT32 m_length = 0;
+    };
+}
+
+_Use_decl_annotations_
+
+HRESULT CreateBufferOverBytes(
+    std::shared_ptr<const std::vector<BYTE>> spData,
+    ABI::Windows::Storage::Streams::IBuffer** ppBuffer)
+{
+    NULL_CHK(ppBuffer);
+    *ppBuffer = nullptr;
+
+    NULL_CHK(spData.get());
+    if (spData->size() > UINT32_MAX)
+        return E_INVALIDARG;
+
+    ComPtr<SharedBytesBuffer> spBuffer;
+    IFR(MakeAndInitialize<SharedBytesBuffer>(&spBuffer, std::move(spData)));
+
+    *ppBuffer = spBuffer.Detach();
+
+    return S_OK;
+}
+
 _Use_decl_annotations_
 
 HRESULT CreateMediaPlaybackItem(
@@ -385,6 +653,29 @@ HRESULT CreatePlaylistSource(
 
 _Use_decl_annotations_
 
+HRESULT AppendPlaylistItem(
+    IMediaPlaybackList* pPlaylist,
+    IMediaSource2* pSource)
+{
+    NULL_CHK(pPlaylist);
+    NULL_CHK(pSource);
+
+    ComPtr<Collections::IObservableVector<MediaPlaybackItem*>> spItems;
+    IFR(pPlaylist->get_Items(&spItems));
+
+    ComPtr<Collections::IVector<MediaPlaybackItem*>> spItemsVector;
+    IFR(spItems.As(&spItemsVector));
+
+    ComPtr<IMediaPlaybackItem> spItem;
+    IFR(CreateMediaPlaybackItem(pSource, &spItem));
+
+    IFR(spItemsVector->Append(spItem.Get()));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+
 HRESULT GetSurfaceFromTexture(
     ID3D11Texture2D* pTexture,
     IDirect3DSurface** ppSurface)
@@ -523,6 +814,16 @@ HRESULT CreateAudioGraphFromSettings(_Outptr_opt_ IAudioGraph** pp,
     _In_ IAudioGraphSettings* pSettings,
     _Outptr_opt_ ICreateAudioGraphResult** ppResult
 )
+{
+    TRACE_SPAN("CreateAudioGraphFromSettings");
+
+    return WaitForAsyncTask(CreateAudioGraphFromSettingsAsync(pp, pSettings, ppResult));
+}
+
+AsyncTask<HRESULT> CreateAudioGraphFromSettingsAsync(_Outptr_opt_ IAudioGraph** pp,
+    _In_ IAudioGraphSettings* pSettings,
+    _Outptr_opt_ ICreateAudioGraphResult** ppResult
+)
 {
     ComPtr<IAudioGraphStatics> spStatics;
     Windows::Foundation::GetActivationFactory(
@@ -530,50 +831,14 @@ HRESULT CreateAudioGraphFromSettings(_Outptr_opt_ IAudioGraph** pp,
         &spStatics
     );
 
-    ComPtr<IAsyncOperation<CreateAudioGraphResult*>> spCreateOperation;
-    Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-
-    HRESULT hrStatus = S_OK;
+    ComPtr<ICreateAudioGraphOperation> spCreateOperation;
     ComPtr<ICreateAudioGraphResult> spResult;
+    CO_IFR(spStatics->CreateAsync(pSettings, &spCreateOperation));
 
-    auto callback = Callback<IAsyncOperationCompletedHandler<CreateAudioGraphResult*>>(
-        [&operationCompleted, &hrStatus, &spResult](
-            ICreateAudioGraphOperation* pOp,
-            AsyncStatus status
-            ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatus = pOp->GetResults(&spResult);
-            }
-            else
-            {
-                hrStatus = E_FAIL;
-            }
+    WinRTAsyncAwaiter<ICreateAudioGraphOperation> awaiter(spCreateOperation);
+    HRESULT hr = GetAsyncResults(awaiter, co_await awaiter, spResult.ReleaseAndGetAddressOf());
+    CO_IFR(hr);
 
-            SetEvent(operationCompleted.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
-        {
-            spStatics->CreateAsync(
-                pSettings,
-                &spCreateOperation
-            );
-            if (spCreateOperation)
-            {
-                spCreateOperation->put_Completed(callback.Get());
-            }
-            else
-            {
-                SetEvent(operationCompleted.Get());
-            }
-        });
-
-
-    DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
-    
     AudioGraphCreationStatus creationStatus = AudioGraphCreationStatus::AudioGraphCreationStatus_UnknownFailure;
     if (spResult)
         spResult->get_Status(&creationStatus);
@@ -594,7 +859,7 @@ HRESULT CreateAudioGraphFromSettings(_Outptr_opt_ IAudioGraph** pp,
         *ppResult = spResult.Detach();
     }
 
-    return S_OK;
+    co_return S_OK;
 }
 
 HRESULT CreateAudioGraphSettings(_COM_Outptr_ IAudioGraphSettings** pp)
@@ -620,46 +885,20 @@ HRESULT CreateAudioGraphSettings(_COM_Outptr_ IAudioGraphSettings** pp)
 
 HRESULT CreateInputNode(_In_ IAudioGraph3* pAudioGraph, _In_ IMediaSource2* pSource, _COM_Outptr_ IMediaSourceAudioInputNode** pp, _Outptr_opt_ ICreateMediaSourceAudioInputNodeResult** ppResult)
 {
-    ComPtr<IAsyncOperation<CreateMediaSourceAudioInputNodeResult*>> spCreateOperation;
-    Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-
-    HRESULT hrStatus = S_OK;
-    ComPtr<ICreateMediaSourceAudioInputNodeResult> spResult;
+    TRACE_SPAN("CreateInputNode");
 
-    auto callback = Callback<IAsyncOperationCompletedHandler<CreateMediaSourceAudioInputNodeResult*>>(
-        [&operationCompleted, &hrStatus, &spResult](
-            ICreateMediaSourceAudioInputNodeOperation* pOp,
-            AsyncStatus status
-            ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatus = pOp->GetResults(&spResult);
-            }
-            else
-            {
-                hrStatus = E_FAIL;
-            }
-
-            SetEvent(operationCompleted.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
-        {
-            pAudioGraph->CreateMediaSourceAudioInputNodeAsync(pSource, &spCreateOperation);
-            if (spCreateOperation)
-            {
-                spCreateOperation->put_Completed(callback.Get());
-            }
-            else
-            {
-                SetEvent(operationCompleted.Get());
-            }
-        });
+    return WaitForAsyncTask(CreateInputNodeAsync(pAudioGraph, pSource, pp, ppResult));
+}
 
+AsyncTask<HRESULT> CreateInputNodeAsync(_In_ IAudioGraph3* pAudioGraph, _In_ IMediaSource2* pSource, _COM_Outptr_ IMediaSourceAudioInputNode** pp, _Outptr_opt_ ICreateMediaSourceAudioInputNodeResult** ppResult)
+{
+    ComPtr<ICreateMediaSourceAudioInputNodeOperation> spCreateOperation;
+    ComPtr<ICreateMediaSourceAudioInputNodeResult> spResult;
+    CO_IFR(pAudioGraph->CreateMediaSourceAudioInputNodeAsync(pSource, &spCreateOperation));
 
-    DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
+    WinRTAsyncAwaiter<ICreateMediaSourceAudioInputNodeOperation> awaiter(spCreateOperation);
+    HRESULT hr = GetAsyncResults(awaiter, co_await awaiter, spResult.ReleaseAndGetAddressOf());
+    CO_IFR(hr);
 
     MediaSourceAudioInputNodeCreationStatus creationStatus = MediaSourceAudioInputNodeCreationStatus::MediaSourceAudioInputNodeCreationStatus_UnknownFailure;
     if (spResult)
@@ -678,7 +917,7 @@ HRESULT CreateInputNode(_In_ IAudioGraph3* pAudioGraph, _In_ IMediaSource2* pSou
     else 
     {
         Log(Log_Level_Error, L"Audio input node creation failed.");
-        return E_FAIL;
+        co_return E_FAIL;
     }
 
     if (ppResult != nullptr)
@@ -686,7 +925,7 @@ HRESULT CreateInputNode(_In_ IAudioGraph3* pAudioGraph, _In_ IMediaSource2* pSou
         *ppResult = spResult.Detach();
     }
 
-    return S_OK;
+    co_return S_OK;
 }
 
 /// <summary>
@@ -702,6 +941,17 @@ HRESULT CreateInputNode(_In_ IAudioGraph* pAudioGraph,
     _COM_Outptr_ IAudioFileInputNode** pp,
     _Outptr_opt_ ICreateAudioFileInputNodeResult** ppResult
 )
+{
+    TRACE_SPAN("CreateInputNode");
+
+    return WaitForAsyncTask(CreateInputNodeAsync(pAudioGraph, path, pp, ppResult));
+}
+
+AsyncTask<HRESULT> CreateInputNodeAsync(_In_ IAudioGraph* pAudioGraph,
+    _In_ LPCWSTR path,
+    _COM_Outptr_ IAudioFileInputNode** pp,
+    _Outptr_opt_ ICreateAudioFileInputNodeResult** ppResult
+)
 {
     // Create the file from the path
     ComPtr<ABI::Windows::Storage::IStorageFileStatics> spStorageStatics;
@@ -710,86 +960,22 @@ HRESULT CreateInputNode(_In_ IAudioGraph* pAudioGraph,
         &spStorageStatics
     );
 
-    ComPtr<IAsyncOperation<ABI::Windows::Storage::StorageFile*>> spFileStorageOperation;
-    Event operationCompletedFileStorage(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-    HRESULT hrStatusFileStorage = S_OK;
+    ComPtr<IOpenStorageFileOperation> spFileStorageOperation;
     ComPtr<ABI::Windows::Storage::IStorageFile> spResultFileStorage;
+    CO_IFR(spStorageStatics->GetFileFromPathAsync(HStringReference(path).Get(), &spFileStorageOperation));
 
-    auto callbackFileStorage = Callback<IAsyncOperationCompletedHandler<ABI::Windows::Storage::StorageFile*>>(
-        [&operationCompletedFileStorage, &hrStatusFileStorage, &spResultFileStorage](
-            IOpenStorageFileOperation* pOp,
-            AsyncStatus status
-            ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatusFileStorage = pOp->GetResults(&spResultFileStorage);
-            }
-            else
-            {
-                hrStatusFileStorage = E_FAIL;
-            }
-
-            SetEvent(operationCompletedFileStorage.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
-        {
-            spStorageStatics->GetFileFromPathAsync(HStringReference(path).Get(), &spFileStorageOperation);
-            if (spFileStorageOperation)
-            {
-                spFileStorageOperation->put_Completed(callbackFileStorage.Get());
-            }
-            else
-            {
-                SetEvent(operationCompletedFileStorage.Get());
-            }
-        });
-
-    DWORD resultFileStorage = WaitForSingleObject(operationCompletedFileStorage.Get(), INFINITE);
+    WinRTAsyncAwaiter<IOpenStorageFileOperation> fileAwaiter(spFileStorageOperation);
+    HRESULT hr = GetAsyncResults(fileAwaiter, co_await fileAwaiter, spResultFileStorage.ReleaseAndGetAddressOf());
+    CO_IFR(hr);
 
     // Create the input node
-    ComPtr<IAsyncOperation<CreateAudioFileInputNodeResult*>> spCreateOperation;
-    Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-
-    HRESULT hrStatus = S_OK;
+    ComPtr<ICreateAudioFileInputNodeOperation> spCreateOperation;
     ComPtr<ICreateAudioFileInputNodeResult> spResult;
+    CO_IFR(pAudioGraph->CreateFileInputNodeAsync(spResultFileStorage.Get(), &spCreateOperation));
 
-    auto callback = Callback<IAsyncOperationCompletedHandler<CreateAudioFileInputNodeResult*>>(
-        [&operationCompleted, &hrStatus, &spResult](
-            ICreateAudioFileInputNodeOperation* pOp,
-            AsyncStatus status
-            ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatus = pOp->GetResults(&spResult);
-            }
-            else
-            {
-                hrStatus = E_FAIL;
-            }
-
-            SetEvent(operationCompleted.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
-        {
-            pAudioGraph->CreateFileInputNodeAsync(spResultFileStorage.Get(), &spCreateOperation);
-            if (spCreateOperation)
-            {
-                spCreateOperation->put_Completed(callback.Get());
-            }
-            else
-            {
-                SetEvent(operationCompleted.Get());
-            }
-        });
-
-
-    DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
+    WinRTAsyncAwaiter<ICreateAudioFileInputNodeOperation> nodeAwaiter(spCreateOperation);
+    hr = GetAsyncResults(nodeAwaiter, co_await nodeAwaiter, spResult.ReleaseAndGetAddressOf());
+    CO_IFR(hr);
 
     AudioFileNodeCreationStatus creationStatus = AudioFileNodeCreationStatus::AudioFileNodeCreationStatus_UnknownFailure;
     if (spResult)
@@ -808,7 +994,7 @@ HRESULT CreateInputNode(_In_ IAudioGraph* pAudioGraph,
     else 
     {
         Log(Log_Level_Error, L"Audio input node creation failed.");
-        return E_FAIL;
+        co_return E_FAIL;
     }
 
     if (ppResult != nullptr)
@@ -816,7 +1002,7 @@ HRESULT CreateInputNode(_In_ IAudioGraph* pAudioGraph,
         *ppResult = spResult.Detach();
     }
 
-    return S_OK;
+    co_return S_OK;
 }
 
 /// <summary>
@@ -840,49 +1026,21 @@ HRESULT CreateOutputNode(_In_ IAudioGraph* pAudioGraph, _COM_Outptr_ IAudioFrame
 /// <returns></returns>
 HRESULT CreateOutputNode(_In_ IAudioGraph* pAudioGraph, _COM_Outptr_ IAudioDeviceOutputNode** pp)
 {
-    Event operationCompleted(CreateEvent(nullptr, TRUE, FALSE, nullptr));
-    HRESULT hrStatus = S_OK;
-    ComPtr<ICreateAudioDeviceOutputNodeResult> spResult;
-    ComPtr<IAsyncOperation<CreateAudioDeviceOutputNodeResult*>> spCreateOperation;
-
-    auto callback = Callback<IAsyncOperationCompletedHandler<CreateAudioDeviceOutputNodeResult*>>(
-        [&operationCompleted, &hrStatus, &spResult](
-            IAsyncOperation<CreateAudioDeviceOutputNodeResult*>* pOp,
-            AsyncStatus status
-            ) -> HRESULT
-        {
-            if (status == AsyncStatus::Completed)
-            {
-                hrStatus = pOp->GetResults(&spResult);
-            }
-            else
-            {
-                hrStatus = E_FAIL;
-            }
-
-            SetEvent(operationCompleted.Get());
-            return S_OK;
-        });
-
-    concurrency::create_task([&]()
-        {
-            pAudioGraph->CreateDeviceOutputNodeAsync(&spCreateOperation);
-            if (spCreateOperation)
-            {
-                spCreateOperation->put_Completed(callback.Get());
-            }
-            else
-            {
-                SetEvent(operationCompleted.Get());
-            }
-        });
+    return WaitForAsyncTask(CreateOutputNodeAsync(pAudioGraph, pp));
+}
 
+AsyncTask<HRESULT> CreateOutputNodeAsync(_In_ IAudioGraph* pAudioGraph, _COM_Outptr_ IAudioDeviceOutputNode** pp)
+{
+    ComPtr<IAsyncOperation<CreateAudioDeviceOutputNodeResult*>> spCreateOperation;
+    ComPtr<ICreateAudioDeviceOutputNodeResult> spResult;
+    CO_IFR(pAudioGraph->CreateDeviceOutputNodeAsync(&spCreateOperation));
 
-    DWORD result = WaitForSingleObject(operationCompleted.Get(), INFINITE);
-    if (result != S_OK)
+    WinRTAsyncAwaiter<IAsyncOperation<CreateAudioDeviceOutputNodeResult*>> awaiter(spCreateOperation);
+    HRESULT hr = GetAsyncResults(awaiter, co_await awaiter, spResult.ReleaseAndGetAddressOf());
+    if (FAILED(hr))
     {
         Log(Log_Level_Error, L"Async audio output node creation failed.");
-        return E_FAIL;
+        co_return hr;
     }
 
     AudioDeviceNodeCreationStatus creationStatus = AudioDeviceNodeCreationStatus::AudioDeviceNodeCreationStatus_UnknownFailure;
@@ -902,8 +1060,8 @@ HRESULT CreateOutputNode(_In_ IAudioGraph* pAudioGraph, _COM_Outptr_ IAudioDevic
     else
     {
         Log(Log_Level_Error, L"Audio output node creation failed.");
-        return E_FAIL;
+        co_return E_FAIL;
     }
 
-    return S_OK;
+    co_return S_OK;
 }
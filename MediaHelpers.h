@@ -19,10 +19,16 @@
 #include <windows.media.playback.h>
 #include <windows.media.streaming.adaptive.h>
 #include <windows.graphics.directx.direct3d11.interop.h>
+#include <windows.web.http.h>
 
 #include <wrl.h>
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "AsyncOperationAwaiter.h"
 
 __inline void replaceAll(std::wstring& str, const std::wstring& from, const std::wstring& to)
 {
@@ -36,6 +42,28 @@ __inline void replaceAll(std::wstring& str, const std::wstring& from, const std:
     }
 }
 
+__inline std::string WideToUtf8(const std::wstring& str)
+{
+    if (str.empty())
+        return std::string();
+
+    int size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), static_cast<int>(str.size()), nullptr, 0, nullptr, nullptr);
+    std::string result(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, str.c_str(), static_cast<int>(str.size()), &result[0], size, nullptr, nullptr);
+    return result;
+}
+
+__inline std::wstring Utf8ToWide(const std::string& str)
+{
+    if (str.empty())
+        return std::wstring();
+
+    int size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.size()), nullptr, 0);
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.size()), &result[0], size);
+    return result;
+}
+
 using ICreateAdaptiveMediaSourceOperation = ABI::Windows::Foundation::IAsyncOperation<
     ABI::Windows::Media::Streaming::Adaptive::AdaptiveMediaSourceCreationResult*>;
 using ICreateAdaptiveMediaSourceResultHandler = ABI::Windows::Foundation::IAsyncOperationCompletedHandler<
@@ -51,6 +79,117 @@ using IOpenFileOperation = ABI::Windows::Foundation::IAsyncOperation<
 using IOpenStorageFileOperation = ABI::Windows::Foundation::IAsyncOperation<
     ABI::Windows::Storage::StorageFile*>;
 
+// WinRT binding for AsyncOperationAwaiter, works for IAsyncOperation and IAsyncOperationWithProgress
+template <typename TOperation>
+struct AsyncCompletedHandlerOf;
+
+template <typename TResult>
+struct AsyncCompletedHandlerOf<ABI::Windows::Foundation::IAsyncOperation<TResult>>
+{
+    using Type = ABI::Windows::Foundation::IAsyncOperationCompletedHandler<TResult>;
+};
+
+template <typename TResult, typename TProgress>
+struct AsyncCompletedHandlerOf<ABI::Windows::Foundation::IAsyncOperationWithProgress<TResult, TProgress>>
+{
+    using Type = ABI::Windows::Foundation::IAsyncOperationWithProgressCompletedHandler<TResult, TProgress>;
+};
+
+template <typename TOperation>
+struct WinRTAsyncOperationTraits
+{
+    using OperationPtr = Microsoft::WRL::ComPtr<TOperation>;
+    using Handler = typename AsyncCompletedHandlerOf<TOperation>::Type;
+
+    static bool Subscribe(const OperationPtr& op, std::function<void(AsyncOutcome)> onCompleted)
+    {
+        if (op == nullptr)
+            return false;
+
+        auto handler = Microsoft::WRL::Callback<Handler>(
+            [onCompleted](_In_ TOperation*, _In_ AsyncStatus status) -> HRESULT
+            {
+                switch (status)
+                {
+                case AsyncStatus::Completed:
+                    onCompleted(AsyncOutcome::AsyncOutcome_Completed);
+                    break;
+                case AsyncStatus::Canceled:
+                    onCompleted(AsyncOutcome::AsyncOutcome_Canceled);
+                    break;
+                default:
+                    onCompleted(AsyncOutcome::AsyncOutcome_Error);
+                    break;
+                }
+                return S_OK;
+            });
+
+        return handler != nullptr && SUCCEEDED(op->put_Completed(handler.Get()));
+    }
+
+    static void Cancel(const OperationPtr& op)
+    {
+        Microsoft::WRL::ComPtr<ABI::Windows::Foundation::IAsyncInfo> spInfo;
+        if (op != nullptr && SUCCEEDED(op.As(&spInfo)))
+        {
+            spInfo->Cancel();
+        }
+    }
+};
+
+template <typename TOperation>
+using WinRTAsyncAwaiter = AsyncOperationAwaiter<WinRTAsyncOperationTraits<TOperation>>;
+
+__inline std::chrono::milliseconds AsyncTimeoutFromMilliseconds(DWORD timeoutMs)
+{
+    return (timeoutMs == INFINITE) ? std::chrono::milliseconds::max() : std::chrono::milliseconds(timeoutMs);
+}
+
+// Maps the awaited outcome to an HRESULT and fetches the results on success.
+// Use after co_await awaiter or awaiter.Wait().
+template <typename TOperation, typename TResult>
+HRESULT GetAsyncResults(
+    _In_ WinRTAsyncAwaiter<TOperation>& awaiter,
+    _In_ AsyncOutcome outcome,
+    _Out_ TResult* pResults)
+{
+    switch (outcome)
+    {
+    case AsyncOutcome::AsyncOutcome_Completed:
+        return awaiter.Operation()->GetResults(pResults);
+    case AsyncOutcome::AsyncOutcome_Canceled:
+        return E_ABORT;
+    case AsyncOutcome::AsyncOutcome_TimedOut:
+        return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    default:
+        break;
+    }
+
+    HRESULT hr = E_FAIL;
+    Microsoft::WRL::ComPtr<ABI::Windows::Foundation::IAsyncInfo> spInfo;
+    if (awaiter.Operation() != nullptr && SUCCEEDED(awaiter.Operation().As(&spInfo)))
+    {
+        spInfo->get_ErrorCode(&hr);
+    }
+    return FAILED(hr) ? hr : E_FAIL;
+}
+
+// Synchronous form for callers that are not coroutines: waits on the calling thread
+// for the completion callback, no thread-pool task and no kernel event are used.
+template <typename TOperation, typename TResult>
+HRESULT WaitForAsyncResults(
+    _In_ TOperation* pOperation,
+    _Out_ TResult* pResults,
+    _In_ DWORD timeoutMs = INFINITE,
+    _In_opt_ std::shared_ptr<AsyncCancellation> cancellation = nullptr)
+{
+    if (pOperation == nullptr || pResults == nullptr)
+        return E_INVALIDARG;
+
+    WinRTAsyncAwaiter<TOperation> awaiter(pOperation, AsyncTimeoutFromMilliseconds(timeoutMs), cancellation);
+    return GetAsyncResults(awaiter, awaiter.Wait(), pResults);
+}
+
 DECLARE_INTERFACE_IID_(IAdaptiveMediaSourceCompletedCallback, IUnknown, "e25c01d3-35d4-4551-bf6c-7d4be0498949")
 {
     STDMETHOD(OnAdaptiveMediaSourceCreated)(ICreateAdaptiveMediaSourceOperation* pOp, AsyncStatus status) PURE;
@@ -64,6 +203,35 @@ HRESULT CreateAdaptiveMediaSource(
     _In_ LPCWSTR pszManifestLocation,
     _In_ IAdaptiveMediaSourceCompletedCallback* pCallback);
 
+// Downloads a resource, or a byte range of it when length is not 0, into pData.
+// Blocks the calling thread until the body is read, call from background work.
+// Requests made through the same pClient share its connections, nullptr uses a new client.
+// bytesReceived follows the bytes of the response as they arrive.
+HRESULT DownloadToBuffer(
+    _In_ LPCWSTR pszUrl,
+    _In_ UINT64 offset,
+    _In_ UINT64 length,
+    _Out_ std::vector<BYTE>* pData,
+    _In_ DWORD timeoutMs = INFINITE,
+    _In_opt_ std::shared_ptr<AsyncCancellation> cancellation = nullptr,
+    _In_opt_ ABI::Windows::Web::Http::IHttpClient* pClient = nullptr,
+    _In_opt_ std::shared_ptr<std::atomic<UINT64>> bytesReceived = nullptr);
+
+// HttpClient for DownloadToBuffer, one per origin keeps its connections alive between requests
+HRESULT CreateHttpClient(
+    _COM_Outptr_ ABI::Windows::Web::Http::IHttpClient** ppClient);
+
+HRESULT CreateBufferFromBytes(
+    _In_reads_bytes_(size) const BYTE* pData,
+    _In_ UINT32 size,
+    _COM_Outptr_ ABI::Windows::Storage::Streams::IBuffer** ppBuffer);
+
+// No copy, the buffer holds a reference to spData. For readers only, the bytes may be shared
+// with the segment cache and other consumers.
+HRESULT CreateBufferOverBytes(
+    _In_ std::shared_ptr<const std::vector<BYTE>> spData,
+    _COM_Outptr_ ABI::Windows::Storage::Streams::IBuffer** ppBuffer);
+
 HRESULT CreateMediaPlaybackItem(
     _In_ ABI::Windows::Media::Core::IMediaSource2* pMediaSource,
     _COM_Outptr_ ABI::Windows::Media::Playback::IMediaPlaybackItem** ppMediaPlaybackItem);
@@ -72,6 +240,10 @@ HRESULT CreatePlaylistSource(
     _In_ ABI::Windows::Media::Core::IMediaSource2* pSource,
     _COM_Outptr_ ABI::Windows::Media::Playback::IMediaPlaybackSource** ppMediaPlaybackSource);
 
+HRESULT AppendPlaylistItem(
+    _In_ ABI::Windows::Media::Playback::IMediaPlaybackList* pPlaylist,
+    _In_ ABI::Windows::Media::Core::IMediaSource2* pSource);
+
 HRESULT GetSurfaceFromTexture(
     _In_ ID3D11Texture2D* pTexture,
     _COM_Outptr_ ABI::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface** ppSurface);
@@ -128,3 +300,24 @@ HRESULT CreateOutputNode(_In_ ABI::Windows::Media::Audio::IAudioGraph* pAudioGra
 
 HRESULT CreateOutputNode(_In_ ABI::Windows::Media::Audio::IAudioGraph* pAudioGraph,
     _COM_Outptr_ ABI::Windows::Media::Audio::IAudioDeviceOutputNode** pp);
+
+// co_await forms of the helpers above that wait for an operation, the ones above block the calling
+// thread on them. The coroutine resumes on the thread that completes the operation. co_await the
+// task right away, its arguments are used when it runs.
+AsyncTask<HRESULT> CreateAudioGraphFromSettingsAsync(
+    _COM_Outptr_ ABI::Windows::Media::Audio::IAudioGraph** ppAudioGraph,
+    _In_ ABI::Windows::Media::Audio::IAudioGraphSettings* pSettings,
+    _Outptr_opt_ ABI::Windows::Media::Audio::ICreateAudioGraphResult** ppResult);
+
+AsyncTask<HRESULT> CreateInputNodeAsync(_In_ ABI::Windows::Media::Audio::IAudioGraph3* pAudioGraph,
+    _In_ ABI::Windows::Media::Core::IMediaSource2* pSource,
+    _COM_Outptr_ ABI::Windows::Media::Audio::IMediaSourceAudioInputNode** pp,
+    _Outptr_opt_ ABI::Windows::Media::Audio::ICreateMediaSourceAudioInputNodeResult** ppResult);
+
+AsyncTask<HRESULT> CreateInputNodeAsync(_In_ ABI::Windows::Media::Audio::IAudioGraph* pAudioGraph,
+    _In_ LPCWSTR path,
+    _COM_Outptr_ ABI::Windows::Media::Audio::IAudioFileInputNode** pp,
+    _Outptr_opt_ ABI::Windows::Media::Audio::ICreateAudioFileInputNodeResult** ppResult);
+
+AsyncTask<HRESULT> CreateOutputNodeAsync(_In_ ABI::Windows::Media::Audio::IAudioGraph* pAudioGraph,
+    _COM_Outptr_ ABI::Windows::Media::Audio::IAudioDeviceOutputNode** pp);
@@ -0,0 +1,320 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "Metrics.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+namespace Metrics
+{
+    namespace
+    {
+        void AppendLine(std::string* pText, const char* format, ...)
+        {
+            char line[512];
+            va_list args;
+            va_start(args, format);
+            int written = vsnprintf(line, sizeof(line), format, args);
+            va_end(args);
+
+            if (written > 0)
+            {
+                pText->append(line, static_cast<size_t>(written) < sizeof(line) ? static_cast<size_t>(written) : sizeof(line) - 1);
+            }
+        }
+
+        bool MoveOver(const std::string& from, const char* to)
+        {
+#ifdef _WIN32
+            return MoveFileExA(from.c_str(), to, MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+            return std::rename(from.c_str(), to) == 0;
+#endif
+        }
+    }
+
+    Counter::Counter()
+    {
+        for (Shard& shard : m_shards)
+        {
+            shard.value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Counter::Value() const
+    {
+        uint64_t value = 0;
+        for (const Shard& shard : m_shards)
+        {
+            value += shard.value.load(std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    // Threads take the shards in turn as they first count, whatever counter it is
+    size_t Counter::NextShard()
+    {
+        static std::atomic<size_t> s_nextShard(0);
+        return s_nextShard.fetch_add(1, std::memory_order_relaxed) % METRICS_COUNTER_SHARDS;
+    }
+
+    uint64_t HistogramSnapshot::Quantile(double q) const
+    {
+        if (count == 0)
+            return 0;
+
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count) + 0.5);
+        rank = (rank == 0) ? 1 : (rank > count ? count : rank);
+
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+        {
+            seen += buckets[bucket];
+            if (seen >= rank)
+            {
+                uint64_t value = Histogram::HighestValueOf(bucket);
+                return value < max ? value : max;
+            }
+        }
+        return max;
+    }
+
+    Histogram::Histogram()
+        : m_buckets(new std::atomic<uint64_t>[BucketCount])
+    {
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Histogram::LowestValueOf(size_t bucket)
+    {
+        if (bucket < SubBuckets)
+            return bucket;
+
+        size_t shift = bucket / SubBuckets - 1;
+        return static_cast<uint64_t>(SubBuckets + bucket % SubBuckets) << shift;
+    }
+
+    uint64_t Histogram::HighestValueOf(size_t bucket)
+    {
+        if (bucket < SubBuckets)
+            return bucket;
+
+        size_t shift = bucket / SubBuckets - 1;
+        return LowestValueOf(bucket) + ((uint64_t(1) << shift) - 1);
+    }
+
+    HistogramSnapshot Histogram::Snapshot() const
+    {
+        HistogramSnapshot snapshot;
+        snapshot.count = 0;
+        snapshot.sum = 0;
+        snapshot.max = 0;
+        snapshot.buckets.resize(BucketCount);
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            uint64_t count = m_buckets[i].load(std::memory_order_relaxed);
+            snapshot.buckets[i] = count;
+            if (count == 0)
+                continue;
+
+            uint64_t lowest = LowestValueOf(i);
+            snapshot.count += count;
+            snapshot.sum += count * (lowest + (HighestValueOf(i) - lowest) / 2);
+            snapshot.max = HighestValueOf(i);
+        }
+        return snapshot;
+    }
+
+    Registry& Registry::Instance()
+    {
+        static Registry s_instance;
+        return s_instance;
+    }
+
+    Registry::~Registry()
+    {
+        StopSnapshots();
+    }
+
+    Counter& Registry::GetCounter(const char* name, const char* help)
+    {
+        return *GetEntry(name, help, Type::Counter).counter;
+    }
+
+    Gauge& Registry::GetGauge(const char* name, const char* help)
+    {
+        return *GetEntry(name, help, Type::Gauge).gauge;
+    }
+
+    Histogram& Registry::GetHistogram(const char* name, const char* help)
+    {
+        return *GetEntry(name, help, Type::Histogram).histogram;
+    }
+
+    // A name keeps the type it was first registered with, a second type gets a name of its own
+    Registry::Entry& Registry::GetEntry(const char* name, const char* help, Type type)
+    {
+        std::string key = name;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (;;)
+        {
+            Entry* pFound = nullptr;
+            for (const std::unique_ptr<Entry>& entry : m_entries)
+            {
+                if (entry->name == key)
+                {
+                    pFound = entry.get();
+                    break;
+                }
+            }
+
+            if (pFound == nullptr)
+                break;
+            if (pFound->type == type)
+                return *pFound;
+
+            key += "_";
+        }
+
+        auto entry = std::make_unique<Entry>();
+        entry->name = key;
+        entry->help = help != nullptr ? help : "";
+        entry->type = type;
+        switch (type)
+        {
+        case Type::Counter:
+            entry->counter = std::make_unique<Counter>();
+            break;
+        case Type::Gauge:
+            entry->gauge = std::make_unique<Gauge>();
+            break;
+        case Type::Histogram:
+            entry->histogram = std::make_unique<Histogram>();
+            break;
+        }
+
+        m_entries.push_back(std::move(entry));
+        return *m_entries.back();
+    }
+
+    std::string Registry::Exposition() const
+    {
+        static const double s_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+        std::string text;
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (const std::unique_ptr<Entry>& entry : m_entries)
+        {
+            const char* name = entry->name.c_str();
+            AppendLine(&text, "# HELP %s %s\n", name, entry->help.c_str());
+            switch (entry->type)
+            {
+            case Type::Counter:
+                AppendLine(&text, "# TYPE %s counter\n%s %llu\n", name, name, static_cast<unsigned long long>(entry->counter->Value()));
+                break;
+            case Type::Gauge:
+                AppendLine(&text, "# TYPE %s gauge\n%s %lld\n", name, name, static_cast<long long>(entry->gauge->Value()));
+                break;
+            case Type::Histogram:
+            {
+                HistogramSnapshot snapshot = entry->histogram->Snapshot();
+                AppendLine(&text, "# TYPE %s summary\n", name);
+                for (double q : s_quantiles)
+                {
+                    AppendLine(&text, "%s{quantile=\"%g\"} %llu\n", name, q, static_cast<unsigned long long>(snapshot.Quantile(q)));
+                }
+                AppendLine(&text, "%s_sum %llu\n%s_count %llu\n", name, static_cast<unsigned long long>(snapshot.sum),
+                    name, static_cast<unsigned long long>(snapshot.count));
+                AppendLine(&text, "# TYPE %s_max gauge\n%s_max %llu\n", name, name, static_cast<unsigned long long>(snapshot.max));
+                break;
+            }
+            }
+        }
+        return text;
+    }
+
+    bool Registry::WriteFile(const char* path) const
+    {
+        if (path == nullptr)
+            return false;
+
+        std::string text = Exposition();
+        std::string temporary = std::string(path) + ".tmp";
+
+        FILE* pFile = fopen(temporary.c_str(), "wb");
+        if (pFile == nullptr)
+            return false;
+
+        bool written = fwrite(text.data(), 1, text.size(), pFile) == text.size();
+        written = (fclose(pFile) == 0) && written;
+        if (!written)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+        return MoveOver(temporary, path);
+    }
+
+    void Registry::StartSnapshots(const char* path, uint32_t intervalMs)
+    {
+        StopSnapshots();
+
+        std::string target = path != nullptr ? path : "";
+        {
+            std::lock_guard<std::mutex> lock(m_snapshotLock);
+            m_stopSnapshots = false;
+            m_snapshotPath = target;
+        }
+
+        m_snapshotThread = std::thread([this, target, intervalMs]()
+            {
+                std::unique_lock<std::mutex> lock(m_snapshotLock);
+                while (!m_stopSnapshots)
+                {
+                    lock.unlock();
+                    WriteFile(target.c_str());
+                    lock.lock();
+                    m_snapshotWake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return m_stopSnapshots; });
+                }
+            });
+    }
+
+    // The file is written once more, it ends with the final numbers
+    void Registry::StopSnapshots()
+    {
+        if (!m_snapshotThread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_snapshotLock);
+            m_stopSnapshots = true;
+        }
+        m_snapshotWake.notify_all();
+        m_snapshotThread.join();
+
+        WriteFile(m_snapshotPath.c_str());
+    }
+}
@@ -0,0 +1,209 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable process-wide metrics for the hot paths. A subsystem registers its metrics by name
+// once and keeps the references, recording is then a single relaxed atomic add and never takes
+// a lock. Counters are sharded by thread so threads counting the same event do not fight over
+// a cache line. Histograms keep log-linear buckets, HdrHistogram style, with
+// METRICS_HISTOGRAM_SUB_BUCKET_BITS of precision, and nothing else: their sum and max are taken
+// from the buckets when read. A snapshot thread writes all metrics in the
+// Prometheus text format to a file every METRICS_SNAPSHOT_MS, replacing it whole, for an agent
+// to scrape. No Windows dependencies outside Metrics.cpp's file replacement.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define METRICS_COUNTER_SHARDS 16 // cache lines a counter is spread over, threads beyond it share them
+#define METRICS_HISTOGRAM_SUB_BUCKET_BITS 5 // 32 buckets per power of two, a recorded value is off by 3% at most
+#define METRICS_SNAPSHOT_MS 1000 // how often the exposition file is written
+
+namespace Metrics
+{
+    // Only goes up, Add from any thread
+    class Counter
+    {
+    public:
+        Counter();
+
+        void Add(uint64_t n = 1)
+        {
+            m_shards[ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t Value() const;
+
+    private:
+        // The thread's shard, constant initialized so reading it needs no initialization check
+        static inline thread_local size_t t_shard = SIZE_MAX;
+
+        static size_t ShardIndex()
+        {
+            size_t shard = t_shard;
+            if (shard == SIZE_MAX)
+            {
+                shard = t_shard = NextShard();
+            }
+            return shard;
+        }
+
+        static size_t NextShard();
+
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> value;
+        };
+        Shard m_shards[METRICS_COUNTER_SHARDS];
+    };
+
+    // The last value set, a bitrate or a depth
+    class Gauge
+    {
+    public:
+        Gauge() : m_value(0) {}
+
+        void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+        void Add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+        int64_t Value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> m_value;
+    };
+
+    struct HistogramSnapshot
+    {
+        uint64_t count;
+        uint64_t sum;   // of the bucket midpoints, off by half a bucket's width at most
+        uint64_t max;   // the highest value of the highest bucket recorded into
+        std::vector<uint64_t> buckets;
+
+        // the highest value of the bucket the quantile falls in, 0 when nothing was recorded
+        uint64_t Quantile(double q) const;
+    };
+
+    // Distribution of non-negative values in the unit the name says, microseconds or bytes
+    class Histogram
+    {
+    public:
+        static constexpr size_t SubBuckets = size_t(1) << METRICS_HISTOGRAM_SUB_BUCKET_BITS;
+        static constexpr size_t BucketCount = (64 - METRICS_HISTOGRAM_SUB_BUCKET_BITS + 1) * SubBuckets;
+
+        Histogram();
+
+        // One add to the value's bucket. A sum or max kept here would be a line every recording
+        // thread writes, whatever the values
+        void Record(uint64_t value)
+        {
+            m_buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Values below SubBuckets have a bucket each, above it a power of two is split in
+        // SubBuckets buckets of equal width
+        static size_t BucketOf(uint64_t value)
+        {
+            if (value < SubBuckets)
+                return static_cast<size_t>(value);
+
+            size_t exponent = HighestBit(value);
+            size_t shift = exponent - METRICS_HISTOGRAM_SUB_BUCKET_BITS;
+            return (shift + 1) * SubBuckets + static_cast<size_t>((value >> shift) - SubBuckets);
+        }
+
+        static uint64_t LowestValueOf(size_t bucket);
+        static uint64_t HighestValueOf(size_t bucket);
+
+        // Buckets are read one by one while others record, a snapshot taken meanwhile may miss
+        // the newest values, its count is the sum of its buckets
+        HistogramSnapshot Snapshot() const;
+
+    private:
+        static size_t HighestBit(uint64_t value)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanReverse64(&index, value);
+            return index;
+#else
+            return 63 - static_cast<size_t>(__builtin_clzll(value));
+#endif
+        }
+
+        std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+    };
+
+    // Metrics of the process by name. A name registered twice gives the same metric, streamers
+    // of one process add up. The references live as long as the process.
+    class Registry
+    {
+    public:
+        static Registry& Instance();
+
+        Counter& GetCounter(const char* name, const char* help);
+        Gauge& GetGauge(const char* name, const char* help);
+        Histogram& GetHistogram(const char* name, const char* help);
+
+        // Prometheus text exposition of all metrics, histograms as summaries
+        std::string Exposition() const;
+
+        // Writes the exposition next to the file and moves it over the file, a reader never
+        // sees half of it
+        bool WriteFile(const char* path) const;
+
+        // A thread writes the file every intervalMs until StopSnapshots, which writes it a last
+        // time
+        void StartSnapshots(const char* path, uint32_t intervalMs = METRICS_SNAPSHOT_MS);
+        void StopSnapshots();
+
+    private:
+        Registry() = default;
+        ~Registry();
+
+        enum class Type
+        {
+            Counter,
+            Gauge,
+            Histogram,
+        };
+
+        struct Entry
+        {
+            std::string name;
+            std::string help;
+            Type type;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+        };
+
+        Entry& GetEntry(const char* name, const char* help, Type type);
+
+        mutable std::mutex m_lock;
+        std::vector<std::unique_ptr<Entry>> m_entries;
+
+        std::mutex m_snapshotLock;
+        std::condition_variable m_snapshotWake;
+        std::thread m_snapshotThread;
+        std::string m_snapshotPath;
+        bool m_stopSnapshots = false;
+    };
+}
@@ -0,0 +1,587 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "Mp4BoxParser.h"
+
+namespace
+{
+    const uint32_t BoxMoov = Mp4FourCC("moov");
+    const uint32_t BoxTrak = Mp4FourCC("trak");
+    const uint32_t BoxTkhd = Mp4FourCC("tkhd");
+    const uint32_t BoxMdia = Mp4FourCC("mdia");
+    const uint32_t BoxMdhd = Mp4FourCC("mdhd");
+    const uint32_t BoxHdlr = Mp4FourCC("hdlr");
+    const uint32_t BoxMvex = Mp4FourCC("mvex");
+    const uint32_t BoxTrex = Mp4FourCC("trex");
+    const uint32_t BoxMoof = Mp4FourCC("moof");
+    const uint32_t BoxTraf = Mp4FourCC("traf");
+    const uint32_t BoxTfhd = Mp4FourCC("tfhd");
+    const uint32_t BoxTfdt = Mp4FourCC("tfdt");
+    const uint32_t BoxTrun = Mp4FourCC("trun");
+    const uint32_t BoxSidx = Mp4FourCC("sidx");
+    const uint32_t BoxUuid = Mp4FourCC("uuid");
+
+    // tfhd flags
+    const uint32_t TfhdBaseDataOffset = 0x000001;
+    const uint32_t TfhdSampleDescriptionIndex = 0x000002;
+    const uint32_t TfhdDefaultSampleDuration = 0x000008;
+    const uint32_t TfhdDefaultSampleSize = 0x000010;
+    const uint32_t TfhdDefaultSampleFlags = 0x000020;
+
+    // trun flags
+    const uint32_t TrunDataOffset = 0x000001;
+    const uint32_t TrunFirstSampleFlags = 0x000004;
+    const uint32_t TrunSampleDuration = 0x000100;
+    const uint32_t TrunSampleSize = 0x000200;
+    const uint32_t TrunSampleFlags = 0x000400;
+    const uint32_t TrunSampleCompositionOffset = 0x000800;
+
+    const uint32_t SampleIsNonSync = 0x00010000;
+
+    // Bounds-checked big-endian cursor over a box payload
+    class ByteReader
+    {
+    public:
+        ByteReader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_position(0), m_ok(true) {}
+
+        uint8_t U8() { return Has(1) ? m_data[m_position++] : Fail8(); }
+
+        uint16_t U16()
+        {
+            if (!Has(2))
+                return Fail8();
+            uint16_t value = static_cast<uint16_t>((m_data[m_position] << 8) | m_data[m_position + 1]);
+            m_position += 2;
+            return value;
+        }
+
+        uint32_t U32()
+        {
+            if (!Has(4))
+                return Fail8();
+            const uint8_t* p = m_data + m_position;
+            m_position += 4;
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+                | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        }
+
+        uint64_t U64()
+        {
+            uint64_t high = U32();
+            return (high << 32) | U32();
+        }
+
+        void Skip(size_t count)
+        {
+            if (Has(count))
+                m_position += count;
+            else
+                Fail8();
+        }
+
+        bool Ok() const { return m_ok; }
+
+    private:
+        bool Has(size_t count) const { return m_ok && count <= m_size - m_position; }
+        uint8_t Fail8() { m_ok = false; return 0; }
+
+        const uint8_t* m_data;
+        size_t m_size;
+        size_t m_position;
+        bool m_ok;
+    };
+
+    int FindTrackIndex(const Mp4MovieInfo& movie, uint32_t trackId)
+    {
+        for (uint32_t i = 0; i < movie.trackCount && i < MP4_MAX_TRACKS; ++i)
+        {
+            if (movie.tracks[i].trackId == trackId)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    bool ParseTrack(const Mp4Box& trak, Mp4TrackInfo* pTrack)
+    {
+        Mp4BoxReader children(trak);
+        Mp4Box box;
+
+        if (!children.Find(BoxTkhd, &box))
+            return false;
+
+        ByteReader tkhd(box.payload, box.payloadSize);
+        uint8_t version = tkhd.U8();
+        tkhd.Skip(3);
+        tkhd.Skip(version == 1 ? 16 : 8); // creation and modification time
+        pTrack->trackId = tkhd.U32();
+        if (!tkhd.Ok())
+            return false;
+
+        Mp4BoxReader trakChildren(trak);
+        if (!trakChildren.Find(BoxMdia, &box))
+            return true;
+
+        Mp4Box mdia = box;
+        Mp4BoxReader mdiaChildren(mdia);
+        while (mdiaChildren.Next(&box))
+        {
+            if (box.type == BoxMdhd)
+            {
+                ByteReader mdhd(box.payload, box.payloadSize);
+                uint8_t mdhdVersion = mdhd.U8();
+                mdhd.Skip(3);
+                mdhd.Skip(mdhdVersion == 1 ? 16 : 8);
+                pTrack->timescale = mdhd.U32();
+            }
+            else if (box.type == BoxHdlr)
+            {
+                ByteReader hdlr(box.payload, box.payloadSize);
+                hdlr.Skip(8); // version, flags, pre_defined
+                pTrack->handler = hdlr.U32();
+            }
+        }
+
+        return true;
+    }
+
+    struct TrackFragment
+    {
+        int trackIndex;
+        uint32_t trackId;
+        uint64_t baseDataOffset;
+        uint32_t defaultSampleDuration;
+        uint32_t defaultSampleSize;
+        uint32_t defaultSampleFlags;
+        uint64_t decodeTime;
+    };
+
+    bool ParseTfhd(const Mp4Box& box, const Mp4MovieInfo& movie, size_t moofOffset, TrackFragment* pFragment)
+    {
+        ByteReader tfhd(box.payload, box.payloadSize);
+        tfhd.U8();
+        uint32_t flags = (static_cast<uint32_t>(tfhd.U8()) << 16) | tfhd.U16();
+
+        pFragment->trackId = tfhd.U32();
+        pFragment->trackIndex = FindTrackIndex(movie, pFragment->trackId);
+
+        const Mp4TrackInfo* pTrack = (pFragment->trackIndex >= 0) ? &movie.tracks[pFragment->trackIndex] : nullptr;
+        pFragment->defaultSampleDuration = pTrack ? pTrack->defaultSampleDuration : 0;
+        pFragment->defaultSampleSize = pTrack ? pTrack->defaultSampleSize : 0;
+        pFragment->defaultSampleFlags = pTrack ? pTrack->defaultSampleFlags : 0;
+
+        // without an explicit base, offsets count from the moof (default-base-is-moof, CMAF)
+        pFragment->baseDataOffset = moofOffset;
+        if (flags & TfhdBaseDataOffset)
+            pFragment->baseDataOffset = tfhd.U64();
+        if (flags & TfhdSampleDescriptionIndex)
+            tfhd.U32();
+        if (flags & TfhdDefaultSampleDuration)
+            pFragment->defaultSampleDuration = tfhd.U32();
+        if (flags & TfhdDefaultSampleSize)
+            pFragment->defaultSampleSize = tfhd.U32();
+        if (flags & TfhdDefaultSampleFlags)
+            pFragment->defaultSampleFlags = tfhd.U32();
+
+        return tfhd.Ok();
+    }
+
+    bool ParseTfdt(const Mp4Box& box, uint64_t* pTime)
+    {
+        ByteReader tfdt(box.payload, box.payloadSize);
+        uint8_t version = tfdt.U8();
+        tfdt.Skip(3);
+        *pTime = (version == 1) ? tfdt.U64() : tfdt.U32();
+        return tfdt.Ok();
+    }
+
+    bool ParseTrun(
+        const Mp4Box& box,
+        TrackFragment* pFragment,
+        uint64_t* pNextDataOffset,
+        size_t bufferSize,
+        Mp4Sample* pSamples,
+        size_t capacity,
+        Mp4FragmentStats* pStats)
+    {
+        ByteReader trun(box.payload, box.payloadSize);
+        uint8_t version = trun.U8();
+        uint32_t flags = (static_cast<uint32_t>(trun.U8()) << 16) | trun.U16();
+        uint32_t sampleCount = trun.U32();
+
+        uint64_t dataOffset = *pNextDataOffset;
+        if (flags & TrunDataOffset)
+        {
+            int32_t relative = static_cast<int32_t>(trun.U32());
+            dataOffset = pFragment->baseDataOffset + relative;
+        }
+
+        uint32_t firstSampleFlags = pFragment->defaultSampleFlags;
+        bool hasFirstSampleFlags = (flags & TrunFirstSampleFlags) != 0;
+        if (hasFirstSampleFlags)
+            firstSampleFlags = trun.U32();
+
+        if (!trun.Ok())
+            return false;
+
+        // each sample takes at least this many bytes of the box, rejects absurd counts early
+        size_t perSample = ((flags & TrunSampleDuration) ? 4 : 0) + ((flags & TrunSampleSize) ? 4 : 0)
+            + ((flags & TrunSampleFlags) ? 4 : 0) + ((flags & TrunSampleCompositionOffset) ? 4 : 0);
+        if (perSample != 0 && sampleCount > box.payloadSize / perSample)
+            return false;
+
+        for (uint32_t i = 0; i < sampleCount; ++i)
+        {
+            uint32_t duration = (flags & TrunSampleDuration) ? trun.U32() : pFragment->defaultSampleDuration;
+            uint32_t size = (flags & TrunSampleSize) ? trun.U32() : pFragment->defaultSampleSize;
+            uint32_t sampleFlags = (flags & TrunSampleFlags) ? trun.U32()
+                : (i == 0 && hasFirstSampleFlags) ? firstSampleFlags : pFragment->defaultSampleFlags;
+            int32_t compositionOffset = 0;
+            if (flags & TrunSampleCompositionOffset)
+            {
+                uint32_t raw = trun.U32();
+                compositionOffset = (version == 0) ? static_cast<int32_t>(raw & 0x7FFFFFFF) : static_cast<int32_t>(raw);
+            }
+
+            if (!trun.Ok() || dataOffset > bufferSize || size > bufferSize - dataOffset)
+                return false;
+
+            if (pStats->sampleCount < capacity)
+            {
+                Mp4Sample& sample = pSamples[pStats->sampleCount];
+                sample.offset = dataOffset;
+                sample.decodeTime = pFragment->decodeTime;
+                sample.size = size;
+                sample.duration = duration;
+                sample.compositionOffset = compositionOffset;
+                sample.trackIndex = static_cast<uint16_t>(pFragment->trackIndex < 0 ? 0xFFFF : pFragment->trackIndex);
+                sample.keyframe = (sampleFlags & SampleIsNonSync) ? 0 : 1;
+                sample.reserved = 0;
+            }
+            else
+            {
+                pStats->overflow = true;
+            }
+
+            pStats->sampleCount++;
+            dataOffset += size;
+            pFragment->decodeTime += duration;
+        }
+
+        *pNextDataOffset = dataOffset;
+        return true;
+    }
+}
+
+Mp4BoxReader::Mp4BoxReader(const uint8_t* data, size_t size, size_t baseOffset)
+    : m_data(data)
+    , m_size(data != nullptr ? size : 0)
+    , m_baseOffset(baseOffset)
+    , m_position(0)
+    , m_truncated(false)
+{
+}
+
+Mp4BoxReader::Mp4BoxReader(const Mp4Box& container)
+    : Mp4BoxReader(container.payload, container.payloadSize, container.offset + (container.size - container.payloadSize))
+{
+}
+
+bool Mp4BoxReader::Next(Mp4Box* pBox)
+{
+    size_t left = m_size - m_position;
+    if (left == 0)
+        return false;
+
+    if (left < 8)
+    {
+        m_truncated = true;
+        return false;
+    }
+
+    const uint8_t* p = m_data + m_position;
+    uint64_t size = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+        | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    uint32_t type = (static_cast<uint32_t>(p[4]) << 24) | (static_cast<uint32_t>(p[5]) << 16)
+        | (static_cast<uint32_t>(p[6]) << 8) | p[7];
+    size_t header = 8;
+
+    if (size == 1)
+    {
+        if (left < 16)
+        {
+            m_truncated = true;
+            return false;
+        }
+        size = 0;
+        for (int i = 8; i < 16; ++i)
+        {
+            size = (size << 8) | p[i];
+        }
+        header = 16;
+    }
+    else if (size == 0)
+    {
+        size = left; // extends to the end
+    }
+
+    if (type == BoxUuid)
+        header += 16;
+
+    if (size < header || size > left)
+    {
+        m_truncated = true;
+        return false;
+    }
+
+    pBox->type = type;
+    pBox->offset = m_baseOffset + m_position;
+    pBox->size = static_cast<size_t>(size);
+    pBox->payload = p + header;
+    pBox->payloadSize = static_cast<size_t>(size) - header;
+
+    m_position += static_cast<size_t>(size);
+    return true;
+}
+
+bool Mp4BoxReader::Find(uint32_t type, Mp4Box* pBox)
+{
+    while (Next(pBox))
+    {
+        if (pBox->type == type)
+            return true;
+    }
+    return false;
+}
+
+const Mp4TrackInfo* Mp4MovieInfo::FindTrack(uint32_t trackId) const
+{
+    int index = FindTrackIndex(*this, trackId);
+    return index < 0 ? nullptr : &tracks[index];
+}
+
+bool Mp4::ParseMovie(const uint8_t* data, size_t size, Mp4MovieInfo* pMovie)
+{
+    if (pMovie == nullptr)
+        return false;
+
+    *pMovie = Mp4MovieInfo();
+
+    Mp4BoxReader top(data, size);
+    Mp4Box moov;
+    if (!top.Find(BoxMoov, &moov))
+        return false;
+
+    Mp4BoxReader children(moov);
+    Mp4Box box;
+    while (children.Next(&box))
+    {
+        if (box.type == BoxTrak && pMovie->trackCount < MP4_MAX_TRACKS)
+        {
+            Mp4TrackInfo track = {};
+            if (ParseTrack(box, &track))
+            {
+                pMovie->tracks[pMovie->trackCount++] = track;
+            }
+        }
+    }
+
+    // trex defaults, mvex may come before or after the tracks
+    Mp4BoxReader again(moov);
+    Mp4Box mvex;
+    if (again.Find(BoxMvex, &mvex))
+    {
+        Mp4BoxReader mvexChildren(mvex);
+        while (mvexChildren.Next(&box))
+        {
+            if (box.type != BoxTrex)
+                continue;
+
+            ByteReader trex(box.payload, box.payloadSize);
+            trex.Skip(4);
+            uint32_t trackId = trex.U32();
+            trex.U32(); // default_sample_description_index
+            uint32_t duration = trex.U32();
+            uint32_t sampleSize = trex.U32();
+            uint32_t flags = trex.U32();
+
+            int index = FindTrackIndex(*pMovie, trackId);
+            if (trex.Ok() && index >= 0)
+            {
+                pMovie->tracks[index].defaultSampleDuration = duration;
+                pMovie->tracks[index].defaultSampleSize = sampleSize;
+                pMovie->tracks[index].defaultSampleFlags = flags;
+            }
+        }
+    }
+
+    return pMovie->trackCount > 0 && !children.Truncated();
+}
+
+bool Mp4::IndexFragments(
+    const uint8_t* data,
+    size_t size,
+    const Mp4MovieInfo& movie,
+    Mp4Sample* pSamples,
+    size_t capacity,
+    Mp4FragmentStats* pStats)
+{
+    if (pStats == nullptr || (pSamples == nullptr && capacity != 0))
+        return false;
+
+    *pStats = Mp4FragmentStats();
+
+    Mp4BoxReader top(data, size);
+    Mp4Box moof;
+    while (top.Next(&moof))
+    {
+        if (moof.type != BoxMoof)
+            continue;
+
+        pStats->fragmentCount++;
+
+        Mp4BoxReader trafs(moof);
+        Mp4Box traf;
+        while (trafs.Next(&traf))
+        {
+            if (traf.type != BoxTraf)
+                continue;
+
+            TrackFragment fragment = {};
+            fragment.trackIndex = -1;
+            bool hasTfhd = false;
+            uint64_t nextDataOffset = 0;
+
+            Mp4BoxReader children(traf);
+            Mp4Box box;
+            while (children.Next(&box))
+            {
+                if (box.type == BoxTfhd)
+                {
+                    if (!ParseTfhd(box, movie, moof.offset, &fragment))
+                        return false;
+                    hasTfhd = true;
+                    nextDataOffset = fragment.baseDataOffset;
+                }
+                else if (box.type == BoxTfdt)
+                {
+                    if (!ParseTfdt(box, &fragment.decodeTime))
+                        return false;
+                }
+                else if (box.type == BoxTrun)
+                {
+                    if (!hasTfhd
+                        || !ParseTrun(box, &fragment, &nextDataOffset, size, pSamples, capacity, pStats))
+                        return false;
+                }
+            }
+
+            if (children.Truncated())
+                return false;
+        }
+
+        if (trafs.Truncated())
+            return false;
+    }
+
+    return !top.Truncated();
+}
+
+bool Mp4::ParseSegmentIndex(
+    const uint8_t* data,
+    size_t size,
+    uint32_t* pTimescale,
+    Mp4SegmentReference* pReferences,
+    size_t capacity,
+    size_t* pCount)
+{
+    if (pTimescale == nullptr || pCount == nullptr || (pReferences == nullptr && capacity != 0))
+        return false;
+
+    *pCount = 0;
+
+    Mp4BoxReader top(data, size);
+    Mp4Box sidx;
+    if (!top.Find(BoxSidx, &sidx))
+        return false;
+
+    ByteReader reader(sidx.payload, sidx.payloadSize);
+    uint8_t version = reader.U8();
+    reader.Skip(3);
+    reader.U32(); // reference_ID
+    *pTimescale = reader.U32();
+    uint64_t earliest = (version == 0) ? reader.U32() : reader.U64();
+    uint64_t firstOffset = (version == 0) ? reader.U32() : reader.U64();
+    reader.U16(); // reserved
+    uint16_t referenceCount = reader.U16();
+
+    uint64_t offset = firstOffset;
+    for (uint16_t i = 0; i < referenceCount && reader.Ok(); ++i)
+    {
+        uint32_t typeAndSize = reader.U32();
+        uint32_t duration = reader.U32();
+        uint32_t sap = reader.U32();
+        if (!reader.Ok())
+            break;
+
+        if (*pCount < capacity)
+        {
+            Mp4SegmentReference& reference = pReferences[*pCount];
+            reference.isIndex = (typeAndSize & 0x80000000) != 0;
+            reference.size = typeAndSize & 0x7FFFFFFF;
+            reference.offset = offset;
+            reference.duration = duration;
+            reference.earliestPresentationTime = earliest;
+            reference.startsWithSap = (sap & 0x80000000) != 0;
+            (*pCount)++;
+        }
+
+        offset += typeAndSize & 0x7FFFFFFF;
+        earliest += duration;
+    }
+
+    return reader.Ok();
+}
+
+bool Mp4::GetBaseMediaDecodeTime(const uint8_t* data, size_t size, uint32_t trackId, uint64_t* pTime)
+{
+    if (pTime == nullptr)
+        return false;
+
+    Mp4MovieInfo noMovie = {};
+
+    Mp4BoxReader top(data, size);
+    Mp4Box moof;
+    while (top.Find(BoxMoof, &moof))
+    {
+        Mp4BoxReader trafs(moof);
+        Mp4Box traf;
+        while (trafs.Find(BoxTraf, &traf))
+        {
+            TrackFragment fragment = {};
+            Mp4BoxReader children(traf);
+            Mp4Box box;
+            bool matches = false;
+            while (children.Next(&box))
+            {
+                if (box.type == BoxTfhd)
+                {
+                    matches = ParseTfhd(box, noMovie, moof.offset, &fragment) && fragment.trackId == trackId;
+                }
+                else if (box.type == BoxTfdt && matches)
+                {
+                    return ParseTfdt(box, pTime);
+                }
+            }
+        }
+    }
+
+    return false;
+}
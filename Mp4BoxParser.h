@@ -0,0 +1,137 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable ISO-BMFF (fMP4/CMAF) box walker and fragment sample indexer. No Windows dependencies
+// and no allocations: boxes are views into the caller's buffer (a cached segment or a mapped
+// file) and sample indexes are written to caller-provided storage. Every read is bounds checked,
+// malformed input makes the parse functions return false.
+
+#include <cstddef>
+#include <cstdint>
+
+#define MP4_MAX_TRACKS 8
+
+constexpr uint32_t Mp4FourCC(const char (&code)[5])
+{
+    return (static_cast<uint32_t>(static_cast<uint8_t>(code[0])) << 24)
+        | (static_cast<uint32_t>(static_cast<uint8_t>(code[1])) << 16)
+        | (static_cast<uint32_t>(static_cast<uint8_t>(code[2])) << 8)
+        | static_cast<uint32_t>(static_cast<uint8_t>(code[3]));
+}
+
+struct Mp4Box
+{
+    uint32_t type;
+    size_t offset;          // of the box header in the walked buffer
+    size_t size;            // header included
+    const uint8_t* payload; // after the header
+    size_t payloadSize;
+};
+
+// Iterates sibling boxes of a buffer or of a container box payload
+class Mp4BoxReader
+{
+public:
+    Mp4BoxReader(const uint8_t* data, size_t size, size_t baseOffset = 0);
+    explicit Mp4BoxReader(const Mp4Box& container);
+
+    // false at the end or on a box that does not fit, see Truncated()
+    bool Next(Mp4Box* pBox);
+
+    // Finds the first sibling of the type after the current position
+    bool Find(uint32_t type, Mp4Box* pBox);
+
+    bool Truncated() const { return m_truncated; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_baseOffset;
+    size_t m_position;
+    bool m_truncated;
+};
+
+struct Mp4TrackInfo
+{
+    uint32_t trackId;
+    uint32_t handler;       // 'vide', 'soun', ...
+    uint32_t timescale;
+    uint32_t defaultSampleDuration;
+    uint32_t defaultSampleSize;
+    uint32_t defaultSampleFlags;
+};
+
+struct Mp4MovieInfo
+{
+    uint32_t trackCount;
+    Mp4TrackInfo tracks[MP4_MAX_TRACKS];
+
+    const Mp4TrackInfo* FindTrack(uint32_t trackId) const;
+};
+
+struct Mp4Sample
+{
+    uint64_t offset;            // in the indexed buffer
+    uint64_t decodeTime;        // track timescale
+    uint32_t size;
+    uint32_t duration;
+    int32_t compositionOffset;
+    uint16_t trackIndex;        // into Mp4MovieInfo::tracks
+    uint8_t keyframe;
+    uint8_t reserved;
+};
+
+struct Mp4FragmentStats
+{
+    uint32_t fragmentCount;
+    size_t sampleCount;         // all samples, may exceed the capacity given to the indexer
+    bool overflow;              // samples beyond the capacity were counted but not stored
+};
+
+struct Mp4SegmentReference
+{
+    uint64_t offset;            // from the first byte after the sidx box
+    uint32_t size;
+    uint32_t duration;          // sidx timescale
+    uint64_t earliestPresentationTime;
+    bool startsWithSap;
+    bool isIndex;               // points at another sidx
+};
+
+namespace Mp4
+{
+    // Reads the track ids, handlers, timescales and trex defaults of an init segment (moov)
+    bool ParseMovie(const uint8_t* data, size_t size, Mp4MovieInfo* pMovie);
+
+    // Indexes every moof/mdat pair of a media segment. Samples of tracks missing from the movie
+    // use tfhd values only. Returns false on malformed boxes, samples indexed so far are kept.
+    bool IndexFragments(
+        const uint8_t* data,
+        size_t size,
+        const Mp4MovieInfo& movie,
+        Mp4Sample* pSamples,
+        size_t capacity,
+        Mp4FragmentStats* pStats);
+
+    // Reads the references of the first sidx box, returns the number stored
+    bool ParseSegmentIndex(
+        const uint8_t* data,
+        size_t size,
+        uint32_t* pTimescale,
+        Mp4SegmentReference* pReferences,
+        size_t capacity,
+        size_t* pCount);
+
+    // Decode time of the first fragment of a track, from tfdt, without indexing samples
+    bool GetBaseMediaDecodeTime(const uint8_t* data, size_t size, uint32_t trackId, uint64_t* pTime);
+}
@@ -0,0 +1,185 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "PlaylistPrefetcher.h"
+#include "MediaHelpers.h"
+
+#include <algorithm>
+
+using namespace Microsoft::WRL;
+using namespace ABI::Windows::Media::Core;
+using namespace ABI::Windows::Media::Streaming::Adaptive;
+
+PlaylistPrefetcher::PlaylistPrefetcher(std::shared_ptr<SegmentCache> cache, const PREFETCH_SETTINGS& settings,
+    std::shared_ptr<DownloadScheduler> scheduler, DownloadOrigin origin)
+    : m_cache(std::move(cache))
+    , m_settings(settings)
+    , m_scheduler(std::move(scheduler))
+    , m_origin(origin)
+{
+}
+
+PREFETCH_SETTINGS PlaylistPrefetcher::DefaultSettings()
+{
+    PREFETCH_SETTINGS settings;
+    settings.segmentCount = PREFETCH_DEFAULT_SEGMENT_COUNT;
+    settings.byteBudget = PREFETCH_DEFAULT_BYTE_BUDGET;
+    return settings;
+}
+
+void PlaylistPrefetcher::SetSettings(const PREFETCH_SETTINGS& settings)
+{
+    m_settings = settings;
+}
+
+HRESULT PlaylistPrefetcher::Download(const std::string& uri, UINT64 offset, UINT64 length, DownloadPriority priority, UINT32 bitrate, SegmentBuffer* pBuffer)
+{
+    if (m_scheduler != nullptr)
+    {
+        DownloadRequest request;
+        request.url = Utf8ToWide(uri);
+        request.offset = offset;
+        request.length = length;
+        request.priority = priority;
+        request.origin = m_origin;
+        request.bitrate = bitrate;
+        IFR(m_scheduler->Fetch(std::move(request), pBuffer));
+    }
+    else
+    {
+        auto spData = std::make_shared<std::vector<uint8_t>>();
+        IFR(DownloadToBuffer(Utf8ToWide(uri).c_str(), offset, length, spData.get()));
+        *pBuffer = spData;
+    }
+
+    return S_OK;
+}
+
+HRESULT PlaylistPrefetcher::FetchToCache(const std::string& uri, UINT64 offset, UINT64 length, SegmentBuffer* pBuffer, DownloadPriority priority, UINT32 bitrate)
+{
+    NULL_CHK(pBuffer);
+
+    std::string key = SegmentCache::MakeKey(uri, offset, length);
+    *pBuffer = m_cache->Find(key);
+    if (*pBuffer != nullptr)
+        return S_OK;
+
+    IFR(Download(uri, offset, length, priority, bitrate, pBuffer));
+
+    m_cache->Insert(key, *pBuffer);
+
+    return S_OK;
+}
+
+HRESULT PlaylistPrefetcher::FetchPlaylist(const std::string& uri, SegmentBuffer* pBuffer)
+{
+    NULL_CHK(pBuffer);
+
+    return Download(uri, 0, 0, DownloadPriority::Playlist, 0, pBuffer);
+}
+
+HRESULT PlaylistPrefetcher::FetchText(const std::string& uri, std::string* pText)
+{
+    SegmentBuffer spBuffer;
+    IFR(FetchPlaylist(uri, &spBuffer));
+
+    pText->assign(spBuffer->begin(), spBuffer->end());
+
+    return S_OK;
+}
+
+HRESULT PlaylistPrefetcher::Prefetch(const std::wstring& url, UINT32 maxInitialBitrate, PrefetchedItem* pItem)
+{
+    NULL_CHK(pItem);
+
+    // segments first, the OS source opens faster when they are already local
+    IFR(PrefetchSegments(url, maxInitialBitrate, m_settings.segmentCount, pItem));
+
+    IFR(CreateMediaSource(url.c_str(), &pItem->mediaSource));
+
+    ComPtr<IMediaSource4> spMediaSource4;
+    if (SUCCEEDED(pItem->mediaSource.As(&spMediaSource4)))
+    {
+        spMediaSource4->get_AdaptiveMediaSource(&pItem->adaptiveMediaSource);
+    }
+
+    // start on the variant that was prefetched so the first requests hit the cache
+    if (pItem->adaptiveMediaSource != nullptr && pItem->selectedBitrate != 0)
+    {
+        LOG_RESULT(pItem->adaptiveMediaSource->put_InitialBitrate(pItem->selectedBitrate));
+    }
+
+    return S_OK;
+}
+
+HRESULT PlaylistPrefetcher::PrefetchSegments(const std::wstring& url, UINT32 maxInitialBitrate, UINT32 segmentCount, PrefetchedItem* pItem)
+{
+    NULL_CHK(pItem);
+
+    *pItem = PrefetchedItem();
+    pItem->url = url;
+
+    std::string uri = WideToUtf8(url);
+    std::string text;
+    HRESULT hr = FetchText(uri, &text);
+    if (SUCCEEDED(hr) && Hls::IsMasterPlaylist(text))
+    {
+        if (Hls::ParseMasterPlaylist(text, uri, &pItem->masterPlaylist))
+        {
+            int index = Hls::SelectVariant(pItem->masterPlaylist, maxInitialBitrate);
+            const HlsVariant& variant = pItem->masterPlaylist.variants[index];
+            pItem->selectedBitrate = variant.bandwidth;
+            uri = variant.uri;
+            hr = FetchText(uri, &text);
+        }
+    }
+
+    if (SUCCEEDED(hr) && Hls::ParseMediaPlaylist(text, uri, &pItem->mediaPlaylist))
+    {
+        std::vector<const HlsSegment*> segments;
+        if (!pItem->mediaPlaylist.initSegment.uri.empty())
+        {
+            segments.push_back(&pItem->mediaPlaylist.initSegment);
+        }
+
+        // a live player starts near the edge, the oldest segments of the window are never asked for
+        size_t first = pItem->mediaPlaylist.StartIndex();
+        size_t count = (std::min)(static_cast<size_t>(segmentCount), pItem->mediaPlaylist.segments.size() - first);
+        for (size_t i = first; i < first + count; ++i)
+        {
+            segments.push_back(&pItem->mediaPlaylist.segments[i]);
+        }
+
+        for (const HlsSegment* pSegment : segments)
+        {
+            if (pItem->prefetchedBytes >= m_settings.byteBudget)
+                break;
+
+            SegmentBuffer spBuffer;
+            if (FAILED(FetchToCache(pSegment->uri, pSegment->byteOffset, pSegment->byteLength, &spBuffer, DownloadPriority::VideoLookahead, pItem->selectedBitrate)))
+                break;
+
+            pItem->prefetchedBytes += spBuffer->size();
+            pItem->prefetchedSegments++;
+        }
+    }
+    else if (FAILED(hr))
+    {
+        // not fatal, the media source fetches on its own
+        Log(Log_Level_Warning, L"PlaylistPrefetcher::PrefetchSegments() - manifest fetch failed 0x%08x\n", hr);
+    }
+
+    Log(Log_Level_Info, L"PlaylistPrefetcher::PrefetchSegments() - %s: %u segments, %llu bytes at %u bps\n",
+        url.c_str(), pItem->prefetchedSegments, pItem->prefetchedBytes, pItem->selectedBitrate);
+
+    return S_OK;
+}
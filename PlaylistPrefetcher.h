@@ -0,0 +1,88 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <windows.media.core.h>
+#include <windows.media.streaming.adaptive.h>
+
+#include <memory>
+#include <string>
+
+#include "DownloadScheduler.h"
+#include "HlsPlaylist.h"
+#include "SegmentCache.h"
+
+#define PREFETCH_DEFAULT_SEGMENT_COUNT 3
+#define PREFETCH_DEFAULT_BYTE_BUDGET (16 * 1024 * 1024)
+
+using PREFETCH_SETTINGS = struct _PREFETCH_SETTINGS
+{
+    UINT32 segmentCount;   // media segments fetched ahead per item, 0 only resolves the source
+    UINT64 byteBudget;     // bytes one item may put into the cache
+};
+
+// Everything resolved for a playlist item before it becomes current
+struct PrefetchedItem
+{
+    std::wstring url;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaSource2> mediaSource;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Streaming::Adaptive::IAdaptiveMediaSource> adaptiveMediaSource;
+    HlsMasterPlaylist masterPlaylist;
+    HlsMediaPlaylist mediaPlaylist;
+    UINT32 selectedBitrate = 0;
+    UINT64 prefetchedBytes = 0;
+    UINT32 prefetchedSegments = 0;
+};
+
+// Resolves the source of an upcoming item and pulls its first segments into a SegmentCache,
+// which the DownloadRequested handler of the AdaptiveMediaSource serves from. Manifests are read
+// but never cached, a live playlist changes under the same URI. Downloads go through the
+// scheduler when there is one, manifests at playlist priority.
+// Prefetch blocks on network I/O, run it from background work.
+class PlaylistPrefetcher
+{
+public:
+    PlaylistPrefetcher(_In_ std::shared_ptr<SegmentCache> cache, _In_ const PREFETCH_SETTINGS& settings,
+        _In_opt_ std::shared_ptr<DownloadScheduler> scheduler = nullptr, _In_ DownloadOrigin origin = DownloadOrigin::Prefetch);
+
+    static PREFETCH_SETTINGS DefaultSettings();
+
+    void SetSettings(_In_ const PREFETCH_SETTINGS& settings);
+    PREFETCH_SETTINGS GetSettings() const { return m_settings; }
+
+    // maxInitialBitrate picks the HLS variant that is prefetched and played first, 0 picks the lowest
+    HRESULT Prefetch(_In_ const std::wstring& url, _In_ UINT32 maxInitialBitrate, _Out_ PrefetchedItem* pItem);
+
+    // Reads the manifests and caches only the first segmentCount segments, no source is created
+    HRESULT PrefetchSegments(_In_ const std::wstring& url, _In_ UINT32 maxInitialBitrate, _In_ UINT32 segmentCount, _Out_ PrefetchedItem* pItem);
+
+    // Returns the cached bytes or downloads and caches them, bitrate is the variant's if known
+    HRESULT FetchToCache(_In_ const std::string& uri, _In_ UINT64 offset, _In_ UINT64 length, _Out_ SegmentBuffer* pBuffer,
+        _In_ DownloadPriority priority = DownloadPriority::VideoLookahead, _In_ UINT32 bitrate = 0);
+
+    // Downloads a playlist at playlist priority, always from the network and never into the cache
+    HRESULT FetchPlaylist(_In_ const std::string& uri, _Out_ SegmentBuffer* pBuffer);
+
+    std::shared_ptr<DownloadScheduler> Scheduler() const { return m_scheduler; }
+
+private:
+    HRESULT Download(_In_ const std::string& uri, _In_ UINT64 offset, _In_ UINT64 length, _In_ DownloadPriority priority,
+        _In_ UINT32 bitrate, _Out_ SegmentBuffer* pBuffer);
+    HRESULT FetchText(_In_ const std::string& uri, _Out_ std::string* pText);
+
+    std::shared_ptr<SegmentCache> m_cache;
+    PREFETCH_SETTINGS m_settings;
+    std::shared_ptr<DownloadScheduler> m_scheduler; // nullptr downloads directly
+    DownloadOrigin m_origin;
+};
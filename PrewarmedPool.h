@@ -0,0 +1,212 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ThreadPoolWorkQueue.h"
+
+// Keeps a number of expensive objects ready to use. Creation of replacements and reset of
+// returned objects run on the thread pool so they stay off the caller's critical path.
+// Entries are destroyed outside the pool's lock, a slow destroy never holds up Acquire.
+template <typename T>
+class PrewarmedPool
+{
+public:
+    using CreateFn = std::function<HRESULT(std::unique_ptr<T>*)>;
+    using ResetFn = std::function<HRESULT(T*)>;
+    using DestroyFn = std::function<void(T*)>;
+
+    PrewarmedPool(size_t warmCount, CreateFn create, ResetFn reset, DestroyFn destroy)
+        : m_warmCount(warmCount)
+        , m_create(std::move(create))
+        , m_reset(std::move(reset))
+        , m_destroy(std::move(destroy))
+        , m_creating(0)
+        , m_shutdown(false)
+    {
+    }
+
+    ~PrewarmedPool()
+    {
+        Shutdown();
+    }
+
+    // Hands out a warm entry, or creates one inline when the pool is empty.
+    HRESULT Acquire(_Out_ std::unique_ptr<T>* ppEntry)
+    {
+        NULL_CHK(ppEntry);
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_shutdown)
+                return E_ILLEGAL_METHOD_CALL;
+
+            if (!m_ready.empty())
+            {
+                *ppEntry = std::move(m_ready.back());
+                m_ready.pop_back();
+            }
+        }
+
+        if (*ppEntry == nullptr)
+        {
+            Log(Log_Level_Info, L"PrewarmedPool::Acquire() - pool empty, creating inline\n");
+            IFR(m_create(ppEntry));
+        }
+
+        Prewarm();
+
+        return S_OK;
+    }
+
+    // Takes an entry back. It is reset in the background and kept if the pool is short,
+    // otherwise it is destroyed.
+    void Recycle(_In_ std::unique_ptr<T> entry)
+    {
+        if (entry == nullptr)
+            return;
+
+        bool shutdown = false;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            shutdown = m_shutdown;
+        }
+
+        if (shutdown)
+        {
+            m_destroy(entry.get());
+            return;
+        }
+
+        // std::function needs a copyable callable, so the entry travels in a shared holder
+        auto spHolder = std::make_shared<std::unique_ptr<T>>(std::move(entry));
+        HRESULT hr = m_workQueue.Queue([this, spHolder]()
+            {
+                std::unique_ptr<T> recycled = std::move(*spHolder);
+                if (FAILED(m_reset(recycled.get())))
+                {
+                    m_destroy(recycled.get());
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    if (!m_shutdown && m_ready.size() < m_warmCount)
+                    {
+                        m_ready.push_back(std::move(recycled));
+                        return;
+                    }
+                }
+
+                m_destroy(recycled.get());
+            });
+
+        if (FAILED(hr))
+        {
+            m_destroy(spHolder->get());
+        }
+    }
+
+    // Tops the pool up to the warm count in the background.
+    void Prewarm()
+    {
+        size_t missing = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_shutdown)
+                return;
+
+            size_t available = m_ready.size() + m_creating;
+            missing = (available < m_warmCount) ? m_warmCount - available : 0;
+            m_creating += missing;
+        }
+
+        for (size_t i = 0; i < missing; ++i)
+        {
+            HRESULT hr = m_workQueue.Queue([this]()
+                {
+                    std::unique_ptr<T> created;
+                    HRESULT hrCreate = m_create(&created);
+                    LOG_RESULT_MSG(hrCreate, L"PrewarmedPool - background create failed");
+
+                    {
+                        std::lock_guard<std::mutex> lock(m_lock);
+                        m_creating--;
+                        if (FAILED(hrCreate) || created == nullptr)
+                            return;
+
+                        if (!m_shutdown)
+                        {
+                            m_ready.push_back(std::move(created));
+                            return;
+                        }
+                    }
+
+                    m_destroy(created.get());
+                });
+
+            if (FAILED(hr))
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_creating--;
+            }
+        }
+    }
+
+    // Waits for background work and destroys the warm entries.
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shutdown = true;
+        }
+
+        // work still running sees m_shutdown and destroys what it holds itself
+        m_workQueue.Drain();
+
+        std::vector<std::unique_ptr<T>> ready;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            ready.swap(m_ready);
+        }
+
+        for (auto& entry : ready)
+        {
+            m_destroy(entry.get());
+        }
+    }
+
+    size_t ReadyCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_ready.size();
+    }
+
+private:
+    const size_t m_warmCount;
+    CreateFn m_create;
+    ResetFn m_reset;
+    DestroyFn m_destroy;
+
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<T>> m_ready;
+    size_t m_creating;
+    bool m_shutdown;
+
+    ThreadPoolWorkQueue m_workQueue; // last, drained before the rest goes
+};
@@ -0,0 +1,171 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "SegmentCache.h"
+
+SegmentCache::SegmentCache(size_t byteBudget)
+    : m_byteBudget(byteBudget)
+    , m_sizeBytes(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+}
+
+std::string SegmentCache::MakeKey(const std::string& uri, uint64_t offset, uint64_t length)
+{
+    if (length == 0)
+        return uri;
+
+    return uri + "#" + std::to_string(offset) + "-" + std::to_string(length);
+}
+
+bool SegmentCache::Insert(const std::string& key, SegmentBuffer buffer)
+{
+    if (buffer == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (buffer->size() > m_byteBudget)
+        return false;
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        m_sizeBytes -= EntrySize(it->second);
+        m_lru.erase(it->second.lruPosition);
+        m_entries.erase(it);
+    }
+
+    m_lru.push_front(key);
+    m_entries[key] = { buffer, nullptr, m_lru.begin() };
+    m_sizeBytes += buffer->size();
+
+    EvictLocked();
+
+    return true;
+}
+
+SegmentBuffer SegmentCache::Find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+    {
+        m_misses++;
+        return nullptr;
+    }
+
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lruPosition);
+
+    return it->second.buffer;
+}
+
+bool SegmentCache::SetAudioIndex(const std::string& key, SegmentAudioIndex index)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return false;
+
+    m_sizeBytes -= EntrySize(it->second);
+    it->second.audioIndex = std::move(index);
+    m_sizeBytes += EntrySize(it->second);
+
+    EvictLocked();
+
+    return true;
+}
+
+SegmentAudioIndex SegmentCache::FindAudioIndex(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_entries.find(key);
+    return (it != m_entries.end()) ? it->second.audioIndex : nullptr;
+}
+
+bool SegmentCache::Contains(const std::string& key) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_entries.find(key) != m_entries.end();
+}
+
+void SegmentCache::Remove(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        m_sizeBytes -= EntrySize(it->second);
+        m_lru.erase(it->second.lruPosition);
+        m_entries.erase(it);
+    }
+}
+
+void SegmentCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.clear();
+    m_lru.clear();
+    m_sizeBytes = 0;
+}
+
+void SegmentCache::SetByteBudget(size_t byteBudget)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_byteBudget = byteBudget;
+    EvictLocked();
+}
+
+size_t SegmentCache::ByteBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_byteBudget;
+}
+
+size_t SegmentCache::SizeBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_sizeBytes;
+}
+
+uint64_t SegmentCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_hits;
+}
+
+uint64_t SegmentCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_misses;
+}
+
+size_t SegmentCache::EntrySize(const Entry& entry)
+{
+    return entry.buffer->size() + (entry.audioIndex != nullptr ? entry.audioIndex->SizeBytes() : 0);
+}
+
+void SegmentCache::EvictLocked()
+{
+    while (m_sizeBytes > m_byteBudget && !m_lru.empty())
+    {
+        auto it = m_entries.find(m_lru.back());
+        m_sizeBytes -= EntrySize(it->second);
+        m_entries.erase(it);
+        m_lru.pop_back();
+    }
+}
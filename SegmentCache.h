@@ -0,0 +1,79 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable, thread-safe LRU cache of downloaded playlist and segment bytes bounded by a byte budget.
+// Buffers are immutable once inserted and shared with readers, eviction never invalidates
+// a buffer somebody still holds. An entry can carry the audio frame index built from it, the
+// index counts against the budget and goes with the entry.
+
+#include "AudioFrameIndex.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using SegmentBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+using SegmentAudioIndex = std::shared_ptr<const AudioFrameIndex>;
+
+class SegmentCache
+{
+public:
+    explicit SegmentCache(size_t byteBudget);
+
+    // Key for a resource or a byte range of it, length 0 is the whole resource
+    static std::string MakeKey(const std::string& uri, uint64_t offset = 0, uint64_t length = 0);
+
+    // Replaces an existing entry. Returns false if the buffer alone exceeds the budget.
+    bool Insert(const std::string& key, SegmentBuffer buffer);
+
+    // Returns nullptr on a miss, a hit becomes the most recently used entry
+    SegmentBuffer Find(const std::string& key);
+
+    // Attaches an index to a cached entry, false if the entry is gone
+    bool SetAudioIndex(const std::string& key, SegmentAudioIndex index);
+    SegmentAudioIndex FindAudioIndex(const std::string& key) const;
+
+    bool Contains(const std::string& key) const;
+    void Remove(const std::string& key);
+    void Clear();
+
+    void SetByteBudget(size_t byteBudget);
+    size_t ByteBudget() const;
+    size_t SizeBytes() const;
+
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+
+private:
+    struct Entry
+    {
+        SegmentBuffer buffer;
+        SegmentAudioIndex audioIndex;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    static size_t EntrySize(const Entry& entry);
+    void EvictLocked();
+
+    mutable std::mutex m_lock;
+    size_t m_byteBudget;
+    size_t m_sizeBytes;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    std::list<std::string> m_lru; // front is most recent
+    std::unordered_map<std::string, Entry> m_entries;
+};
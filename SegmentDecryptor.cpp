@@ -0,0 +1,312 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "SegmentDecryptor.h"
+#include "Aes128.h"
+#include "MediaHelpers.h"
+
+#include <algorithm>
+
+SegmentDecryptor::SegmentDecryptor()
+    : m_encrypted(false)
+{
+}
+
+void SegmentDecryptor::AddPlaylist(const HlsMasterPlaylist& master, const HlsMediaPlaylist& media)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // the variants of one master share a timeline
+    std::string group = master.uri.empty() ? media.uri : master.uri;
+    auto addUri = [this, &group](const std::string& uri)
+        {
+            if (!uri.empty() && std::find(m_playlistUris.begin(), m_playlistUris.end(), uri) == m_playlistUris.end())
+            {
+                m_playlistUris.push_back(uri);
+            }
+            if (!uri.empty())
+            {
+                m_playlistGroups[uri] = group;
+            }
+        };
+
+    addUri(media.uri);
+    for (const HlsVariant& variant : master.variants)
+    {
+        addUri(variant.uri);
+    }
+
+    AddSegmentsLocked(group, media);
+}
+
+HRESULT SegmentDecryptor::Decrypt(const std::string& cacheKey, const SegmentBuffer& spSegment, SegmentBuffer* pClear)
+{
+    NULL_CHK(pClear);
+    *pClear = spSegment;
+
+    SegmentKey segmentKey;
+    if (!FindSegment(cacheKey, &segmentKey) && !RefreshPlaylists(cacheKey, false, &segmentKey))
+        return S_FALSE;
+
+    HlsSegment segment;
+    segment.key = segmentKey.key;
+    segment.sequence = segmentKey.sequence;
+
+    return Decrypt(segment, spSegment, true, pClear);
+}
+
+HRESULT SegmentDecryptor::Decrypt(const HlsSegment& segment, const SegmentBuffer& spSegment, bool allowFetch, SegmentBuffer* pClear)
+{
+    NULL_CHK(pClear);
+    NULL_CHK(spSegment.get());
+
+    *pClear = spSegment;
+    if (!segment.key.IsEncrypted())
+        return S_FALSE;
+
+    // SAMPLE-AES leaves the container clear and encrypts inside the samples, that needs a remux
+    if (segment.key.method != "AES-128")
+        return MF_E_UNSUPPORTED_FORMAT;
+
+    uint8_t key[16];
+    IFR(GetKey(segment.key.uri, allowFetch, key));
+
+    uint8_t iv[16];
+    if (segment.key.iv.empty())
+    {
+        Aes128::SequenceIv(segment.sequence, iv);
+    }
+    else if (!Aes128::ParseIv(segment.key.iv, iv))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // the cached ciphertext is what the player reads, the copy is decrypted in place
+    auto spData = std::make_shared<std::vector<uint8_t>>(*spSegment);
+    Aes128CbcDecryptor decryptor(key, iv);
+    SecureZeroMemory(key, sizeof(key));
+
+    size_t size = 0;
+    if (!decryptor.Decrypt(spData->data(), spData->size()) || !Aes128::RemovePadding(spData->data(), spData->size(), &size))
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    spData->resize(size);
+    *pClear = spData;
+
+    return S_OK;
+}
+
+bool SegmentDecryptor::FindStartTime(const std::string& cacheKey, double* pStartTime)
+{
+    if (pStartTime == nullptr)
+        return false;
+
+    SegmentKey segmentKey;
+    if (!FindSegment(cacheKey, &segmentKey) && !RefreshPlaylists(cacheKey, true, &segmentKey))
+        return false;
+
+    *pStartTime = segmentKey.startTime;
+    return true;
+}
+
+void SegmentDecryptor::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_keys.clear();
+    m_segments.clear();
+    m_unknown.clear();
+    m_playlistUris.clear();
+    m_playlistGroups.clear();
+    m_sequenceStarts.clear();
+    m_encrypted = false;
+
+    // waiters find their key gone and download it themselves
+    m_keyReady.notify_all();
+}
+
+HRESULT SegmentDecryptor::GetKey(const std::string& uri, bool allowFetch, uint8_t key[16])
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (;;)
+    {
+        auto it = m_keys.find(uri);
+        if (it == m_keys.end() || (it->second.ready && FAILED(it->second.hr)))
+            break; // nobody has it or the last download failed, try again
+
+        if (it->second.ready)
+        {
+            memcpy(key, it->second.bytes, sizeof(it->second.bytes));
+            return S_OK;
+        }
+
+        if (!allowFetch)
+            return E_PENDING;
+
+        m_keyReady.wait(lock);
+
+        // the download this call waited for failed, do not start another one right away
+        it = m_keys.find(uri);
+        if (it != m_keys.end() && it->second.ready && FAILED(it->second.hr))
+            return it->second.hr;
+    }
+
+    if (!allowFetch)
+        return E_PENDING;
+
+    m_keys[uri] = KeyEntry();
+    lock.unlock();
+
+    std::vector<BYTE> data;
+    HRESULT hr = DownloadToBuffer(Utf8ToWide(uri).c_str(), 0, 0, &data);
+    if (SUCCEEDED(hr) && data.size() != sizeof(KeyEntry::bytes))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    lock.lock();
+    KeyEntry& entry = m_keys[uri];
+    entry.ready = true;
+    entry.hr = hr;
+    if (SUCCEEDED(hr))
+    {
+        memcpy(entry.bytes, data.data(), sizeof(entry.bytes));
+        memcpy(key, entry.bytes, sizeof(entry.bytes));
+    }
+    m_keyReady.notify_all();
+
+    LOG_RESULT_MSG(hr, L"SegmentDecryptor - key download failed");
+    return hr;
+}
+
+bool SegmentDecryptor::FindSegment(const std::string& cacheKey, SegmentKey* pSegmentKey)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_segments.find(cacheKey);
+    if (it == m_segments.end())
+        return false;
+
+    *pSegmentKey = it->second;
+    return true;
+}
+
+// Downloads the known media playlists again until one lists the segment, clear content only
+// when evenIfClear. Blocks on network I/O.
+bool SegmentDecryptor::RefreshPlaylists(const std::string& cacheKey, bool evenIfClear, SegmentKey* pSegmentKey)
+{
+    std::vector<std::string> uris;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if ((!m_encrypted && !evenIfClear) || m_unknown.count(cacheKey) != 0)
+            return false;
+
+        uris = m_playlistUris;
+    }
+
+    for (const std::string& uri : uris)
+    {
+        std::vector<BYTE> data;
+        if (FAILED(DownloadToBuffer(Utf8ToWide(uri).c_str(), 0, 0, &data)))
+            continue;
+
+        HlsMediaPlaylist playlist;
+        if (!Hls::ParseMediaPlaylist(std::string(data.begin(), data.end()), uri, &playlist))
+            continue;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto group = m_playlistGroups.find(uri);
+        AddSegmentsLocked(group != m_playlistGroups.end() ? group->second : uri, playlist);
+
+        auto it = m_segments.find(cacheKey);
+        if (it != m_segments.end())
+        {
+            // the variant playing now is the one to try first next time
+            auto position = std::find(m_playlistUris.begin(), m_playlistUris.end(), uri);
+            if (position != m_playlistUris.end())
+            {
+                std::rotate(m_playlistUris.begin(), position, position + 1);
+            }
+
+            *pSegmentKey = it->second;
+            return true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_unknown.size() >= SEGMENT_KEY_MAP_LIMIT)
+    {
+        m_unknown.clear();
+    }
+    m_unknown.insert(cacheKey);
+
+    return false;
+}
+
+// A parsed playlist starts its times at its first segment. A live reload or another variant is
+// moved onto the timeline already known for its content: by a segment both list, else by a
+// media sequence number both have.
+void SegmentDecryptor::AddSegmentsLocked(const std::string& group, const HlsMediaPlaylist& media)
+{
+    double shift = 0.0;
+    bool aligned = false;
+    for (const HlsSegment& segment : media.segments)
+    {
+        auto known = m_segments.find(SegmentCache::MakeKey(segment.uri, segment.byteOffset, segment.byteLength));
+        if (known != m_segments.end())
+        {
+            shift = known->second.startTime - segment.startTime;
+            aligned = true;
+            break;
+        }
+    }
+    for (size_t i = 0; !aligned && i < media.segments.size(); ++i)
+    {
+        auto known = m_sequenceStarts.find(group + "#" + std::to_string(media.segments[i].sequence));
+        if (known != m_sequenceStarts.end())
+        {
+            shift = known->second - media.segments[i].startTime;
+            aligned = true;
+        }
+    }
+
+    if (m_sequenceStarts.size() >= SEGMENT_KEY_MAP_LIMIT)
+    {
+        m_sequenceStarts.clear();
+    }
+
+    double firstStart = media.segments.empty() ? 0.0 : media.segments.front().startTime + shift;
+    if (!media.initSegment.uri.empty())
+    {
+        AddSegmentLocked(media.initSegment, firstStart);
+    }
+
+    for (const HlsSegment& segment : media.segments)
+    {
+        AddSegmentLocked(segment, segment.startTime + shift);
+        m_sequenceStarts[group + "#" + std::to_string(segment.sequence)] = segment.startTime + shift;
+    }
+}
+
+void SegmentDecryptor::AddSegmentLocked(const HlsSegment& segment, double startTime)
+{
+    if (m_segments.size() >= SEGMENT_KEY_MAP_LIMIT)
+    {
+        m_segments.clear();
+    }
+
+    std::string cacheKey = SegmentCache::MakeKey(segment.uri, segment.byteOffset, segment.byteLength);
+    m_segments[cacheKey] = { segment.key, segment.sequence, startTime };
+    m_unknown.erase(cacheKey);
+    m_encrypted = m_encrypted || segment.key.IsEncrypted();
+}
@@ -0,0 +1,91 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "HlsPlaylist.h"
+#include "SegmentCache.h"
+
+#define SEGMENT_KEY_MAP_LIMIT 16384 // segments whose EXT-X-KEY is remembered, the map starts over past it
+
+// Decrypts METHOD=AES-128 segments for the consumers that read segment bytes next to the
+// player, which decrypts its own copy from the same cached ciphertext. Each key is downloaded
+// once and shared by all segments using it, concurrent requests for a key wait on the one
+// download. The EXT-X-KEY of a cached segment is looked up by cache key in the media playlists
+// handed to AddPlaylist, and so is its start time for timed metadata. Decrypt and FindStartTime
+// block on network I/O for keys and playlists, call them from background work; calls on
+// different threads run in parallel.
+class SegmentDecryptor
+{
+public:
+    SegmentDecryptor();
+
+    // Remembers the key of every segment of the media playlist. The variants of the master are
+    // downloaded again when a segment is not known, after an ABR switch or a live refresh.
+    void AddPlaylist(_In_ const HlsMasterPlaylist& master, _In_ const HlsMediaPlaylist& media);
+
+    // Decrypted copy of the segment at the cache key in pClear, the segment itself and S_FALSE
+    // when it is clear or not listed in any playlist.
+    HRESULT Decrypt(_In_ const std::string& cacheKey, _In_ const SegmentBuffer& spSegment, _Out_ SegmentBuffer* pClear);
+
+    // Same for a segment whose EXT-X-KEY is at hand. Without allowFetch a key that is not
+    // downloaded yet fails with E_PENDING instead of blocking.
+    HRESULT Decrypt(_In_ const HlsSegment& segment, _In_ const SegmentBuffer& spSegment, _In_ bool allowFetch, _Out_ SegmentBuffer* pClear);
+
+    // Start of the segment at the cache key in seconds, on the timeline of the first playlist of
+    // its content that was handed in. Live reloads are aligned with it by the segments they share,
+    // other variants by media sequence number. Downloads the playlists again for a segment that is
+    // not known yet, false when none lists it.
+    bool FindStartTime(_In_ const std::string& cacheKey, _Out_ double* pStartTime);
+
+    // Forgets keys and playlists, for a content change
+    void Clear();
+
+private:
+    struct SegmentKey
+    {
+        HlsKey key;
+        uint64_t sequence;
+        double startTime;
+    };
+
+    struct KeyEntry
+    {
+        bool ready = false;
+        HRESULT hr = S_OK;
+        uint8_t bytes[16] = {};
+    };
+
+    HRESULT GetKey(_In_ const std::string& uri, _In_ bool allowFetch, _Out_writes_(16) uint8_t key[16]);
+    bool FindSegment(_In_ const std::string& cacheKey, _Out_ SegmentKey* pSegmentKey);
+    bool RefreshPlaylists(_In_ const std::string& cacheKey, _In_ bool evenIfClear, _Out_ SegmentKey* pSegmentKey);
+    void AddSegmentsLocked(_In_ const std::string& group, _In_ const HlsMediaPlaylist& media);
+    void AddSegmentLocked(_In_ const HlsSegment& segment, _In_ double startTime);
+
+    std::mutex m_lock;
+    std::condition_variable m_keyReady;
+    std::unordered_map<std::string, KeyEntry> m_keys;
+    std::unordered_map<std::string, SegmentKey> m_segments;
+    std::unordered_set<std::string> m_unknown; // refreshed for once and not found, not refreshed again
+    std::vector<std::string> m_playlistUris; // media playlists to refresh, the last one that helped first
+    std::unordered_map<std::string, std::string> m_playlistGroups; // media playlist to the master of its content
+    std::unordered_map<std::string, double> m_sequenceStarts; // group and media sequence to start time
+    bool m_encrypted; // some playlist had encrypted segments, misses of clear content never refresh
+};
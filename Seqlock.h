@@ -0,0 +1,135 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable snapshot of a small trivially copyable value for readers that poll it often, a
+// render loop for one. A writer makes the sequence odd, stores the value word by word and makes
+// the sequence even again. A reader copies the words and keeps the copy when the sequence was
+// even and unchanged around it, else it copies again. Readers never take a lock and never make
+// the writer wait. Writers are rare and take a lock among themselves. No Windows dependencies.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+template <typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock copies the value word by word");
+
+public:
+    Seqlock()
+        : m_sequence(0)
+    {
+        for (std::atomic<uint64_t>& word : m_words)
+        {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Seqlock(const Seqlock&) = delete;
+    Seqlock& operator=(const Seqlock&) = delete;
+
+    // Returns the version of the value, one more than the one before
+    uint64_t Publish(const T& value)
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+        return Store(value);
+    }
+
+    // update(T*) changes the current value, which is then published, for writers that keep
+    // part of what was there
+    template <typename TUpdate>
+    uint64_t Update(TUpdate&& update)
+    {
+        std::lock_guard<std::mutex> lock(m_writeLock);
+
+        T value;
+        Load(&value);
+        update(&value);
+        return Store(value);
+    }
+
+    // Any thread, lock free. Returns the version of the copy, 0 before the first Publish when
+    // the copy is all zero bytes.
+    uint64_t Read(T* pValue) const
+    {
+        for (;;)
+        {
+            uint64_t before = m_sequence.load(std::memory_order_acquire);
+            if ((before & 1) != 0)
+            {
+                std::this_thread::yield(); // a writer is in the middle of it
+                continue;
+            }
+
+            uint64_t words[WordCount];
+            for (size_t i = 0; i < WordCount; ++i)
+            {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+
+            // the words are read before the sequence is looked at again
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == before)
+            {
+                memcpy(pValue, words, sizeof(T));
+                return before / 2;
+            }
+        }
+    }
+
+    // Cheaper than Read, for a reader to skip an unchanged value. A publish in progress counts
+    // as the version before it.
+    uint64_t Version() const { return m_sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // under m_writeLock
+    void Load(T* pValue) const
+    {
+        uint64_t words[WordCount];
+        for (size_t i = 0; i < WordCount; ++i)
+        {
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        }
+        memcpy(pValue, words, sizeof(T));
+    }
+
+    uint64_t Store(const T& value)
+    {
+        uint64_t words[WordCount] = {};
+        memcpy(words, &value, sizeof(T));
+
+        uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+
+        // odd before any word changes
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WordCount; ++i)
+        {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        m_sequence.store(sequence + 2, std::memory_order_release);
+        return (sequence + 2) / 2;
+    }
+
+    std::mutex m_writeLock;
+    alignas(64) std::atomic<uint64_t> m_sequence; // odd while a writer stores, twice the version otherwise
+    std::atomic<uint64_t> m_words[WordCount];
+};
@@ -0,0 +1,221 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "SharedFetch.h"
+
+#include <chrono>
+
+SharedFetch& SharedFetch::Instance()
+{
+    static SharedFetch s_instance;
+    return s_instance;
+}
+
+SharedFetch::SharedFetch()
+    : m_stats()
+{
+}
+
+SharedFetch::~SharedFetch()
+{
+    // nobody waits at exit, downloads still running are canceled rather than waited for
+    std::vector<std::shared_ptr<Flight>> flights;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto& entry : m_flights)
+        {
+            flights.push_back(entry.second);
+        }
+    }
+
+    for (const std::shared_ptr<Flight>& flight : flights)
+    {
+        flight->cancellation->Cancel();
+    }
+
+    m_workQueue.Drain();
+}
+
+HRESULT SharedFetch::Fetch(const std::string& key, DWORD timeoutMs, const std::shared_ptr<AsyncCancellation>& cancellation,
+    const Download& download, SegmentBuffer* pData, double* pDownloadSeconds)
+{
+    NULL_CHK(pData);
+    *pData = nullptr;
+    if (pDownloadSeconds != nullptr)
+    {
+        *pDownloadSeconds = 0.0;
+    }
+
+    std::shared_ptr<Flight> flight;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.requests++;
+
+        auto it = m_flights.find(key);
+        if (it != m_flights.end())
+        {
+            flight = it->second;
+        }
+        else
+        {
+            flight = std::make_shared<Flight>();
+            flight->cancellation = std::make_shared<AsyncCancellation>();
+            m_flights.emplace(key, flight);
+            m_stats.downloads++;
+            leader = true;
+        }
+        flight->waiters++;
+    }
+
+    // the download belongs to the flight, not to the request that started it, so every request
+    // can leave while it runs
+    if (leader)
+    {
+        HRESULT hr = m_workQueue.Queue([this, key, flight, download]() { Run(key, flight, download); });
+        if (FAILED(hr))
+        {
+            Complete(key, flight, hr, nullptr, 0.0);
+        }
+    }
+
+    // registered after joining, a cancellation that came before runs it inline
+    auto waiter = std::make_shared<Waiter>();
+    uint64_t cookie = 0;
+    if (cancellation != nullptr)
+    {
+        cookie = cancellation->Register([this, key, flight, waiter]() { Leave(key, flight, waiter); });
+    }
+
+    bool timedOut = false;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        auto done = [&]() { return flight->finished || waiter->left; };
+        if (timeoutMs == INFINITE)
+        {
+            m_changed.wait(lock, done);
+        }
+        else
+        {
+            timedOut = !m_changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), done);
+        }
+    }
+
+    if (cancellation != nullptr)
+    {
+        cancellation->Unregister(cookie);
+    }
+
+    if (timedOut)
+    {
+        Leave(key, flight, waiter);
+        return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+
+    // finished from here on, a request canceled meanwhile does not take the buffer
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (waiter->left || (cancellation != nullptr && cancellation->IsCanceled()))
+        return E_ABORT;
+
+    IFR(flight->hr);
+
+    *pData = flight->data;
+    if (pDownloadSeconds != nullptr)
+    {
+        *pDownloadSeconds = flight->downloadSeconds;
+    }
+    if (!leader)
+    {
+        m_stats.joined++;
+        m_stats.bytesShared += flight->data->size();
+    }
+
+    return S_OK;
+}
+
+SHARED_FETCH_STATS SharedFetch::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+void SharedFetch::LogStats() const
+{
+    SHARED_FETCH_STATS stats = GetStats();
+    if (stats.requests == 0)
+        return;
+
+    Log(Log_Level_Info, L"SharedFetch - %llu requests, %llu downloads (%.2f requests each), %llu joined, %llu bytes downloaded, %llu bytes shared\n",
+        stats.requests, stats.downloads, stats.downloads != 0 ? static_cast<double>(stats.requests) / stats.downloads : 0.0,
+        stats.joined, stats.bytesDownloaded, stats.bytesShared);
+}
+
+// A canceled request stops waiting, the last one to leave cancels the download
+void SharedFetch::Leave(const std::string& key, const std::shared_ptr<Flight>& flight, const std::shared_ptr<Waiter>& waiter)
+{
+    bool cancel = false;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (waiter->left || flight->finished)
+            return;
+
+        waiter->left = true;
+        if (--flight->waiters == 0)
+        {
+            auto it = m_flights.find(key);
+            if (it != m_flights.end() && it->second == flight)
+            {
+                m_flights.erase(it);
+            }
+            cancel = true;
+        }
+    }
+    m_changed.notify_all();
+
+    if (cancel)
+    {
+        flight->cancellation->Cancel();
+    }
+}
+
+void SharedFetch::Run(const std::string& key, const std::shared_ptr<Flight>& flight, const Download& download)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto spData = std::make_shared<std::vector<uint8_t>>();
+    HRESULT hr = download(flight->cancellation, spData.get());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Complete(key, flight, hr, SUCCEEDED(hr) ? spData : nullptr, seconds);
+}
+
+void SharedFetch::Complete(const std::string& key, const std::shared_ptr<Flight>& flight, HRESULT hr, SegmentBuffer data, double downloadSeconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        flight->finished = true;
+        flight->hr = hr;
+        flight->downloadSeconds = downloadSeconds;
+        if (SUCCEEDED(hr))
+        {
+            flight->data = std::move(data);
+            m_stats.bytesDownloaded += flight->data->size();
+        }
+
+        // a flight everyone left is out of the table already, a new one may be in its place
+        auto it = m_flights.find(key);
+        if (it != m_flights.end() && it->second == flight)
+        {
+            m_flights.erase(it);
+        }
+    }
+    m_changed.notify_all();
+}
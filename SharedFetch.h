@@ -0,0 +1,88 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AsyncOperationAwaiter.h"
+#include "SegmentCache.h"
+#include "ThreadPoolWorkQueue.h"
+
+using SHARED_FETCH_STATS = struct _SHARED_FETCH_STATS
+{
+    UINT64 requests;
+    UINT64 downloads;       // requests that went to the network
+    UINT64 joined;          // requests served by a download already in flight
+    UINT64 bytesDownloaded;
+    UINT64 bytesShared;     // delivered to joined requests, neither downloaded nor held twice
+};
+
+// Single flight for downloads, process wide: concurrent requests for the same resource, from any
+// number of streamers, wait on one download and all get its one immutable buffer. Nothing is kept
+// once it finished, a later request downloads again. A request that is canceled or times out
+// leaves on its own, the download is canceled when the last one waiting on it leaves. Its
+// failure is shared like its bytes.
+class SharedFetch
+{
+public:
+    using Download = std::function<HRESULT(const std::shared_ptr<AsyncCancellation>& cancellation, std::vector<uint8_t>* pData)>;
+
+    static SharedFetch& Instance();
+
+    // The first request for the key starts the download on a work item of its own, every request,
+    // the first one too, waits for it and can leave on cancel or timeout. The download outlives the
+    // request that started it, what it captures must be owned. pDownloadSeconds is the network time
+    // of the download, the same for all.
+    HRESULT Fetch(_In_ const std::string& key, _In_ DWORD timeoutMs, _In_opt_ const std::shared_ptr<AsyncCancellation>& cancellation,
+        _In_ const Download& download, _Out_ SegmentBuffer* pData, _Out_opt_ double* pDownloadSeconds = nullptr);
+
+    SHARED_FETCH_STATS GetStats() const;
+    void LogStats() const;
+
+private:
+    struct Flight
+    {
+        std::shared_ptr<AsyncCancellation> cancellation; // canceled when nobody waits any more
+        size_t waiters = 0;
+        bool finished = false;
+        HRESULT hr = E_PENDING;
+        SegmentBuffer data;
+        double downloadSeconds = 0.0;
+    };
+
+    struct Waiter
+    {
+        bool left = false;
+    };
+
+    SharedFetch();
+    ~SharedFetch();
+
+    void Run(_In_ const std::string& key, _In_ const std::shared_ptr<Flight>& flight, _In_ const Download& download);
+    void Complete(_In_ const std::string& key, _In_ const std::shared_ptr<Flight>& flight, _In_ HRESULT hr, _In_opt_ SegmentBuffer data, _In_ double downloadSeconds);
+    void Leave(_In_ const std::string& key, _In_ const std::shared_ptr<Flight>& flight, _In_ const std::shared_ptr<Waiter>& waiter);
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_changed; // a flight finished or a waiter was canceled
+    std::unordered_map<std::string, std::shared_ptr<Flight>> m_flights;
+    SHARED_FETCH_STATS m_stats;
+
+    ThreadPoolWorkQueue m_workQueue; // last, drained before the rest goes
+};
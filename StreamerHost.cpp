@@ -0,0 +1,231 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "StreamerHost.h"
+#include "MediaHelpers.h"
+
+#include <algorithm>
+
+StreamerHost::StreamerHost(UINT64 memoryBudgetBytes, UINT32 bandwidthBudgetBps, UINT32 taskThreads)
+    : m_taskThreads(taskThreads)
+    , m_nextId(1)
+    , m_memoryBudgetBytes(memoryBudgetBytes)
+    , m_bandwidthBudgetBps(bandwidthBudgetBps)
+{
+}
+
+StreamerHost::~StreamerHost()
+{
+    std::vector<Stream> streams;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        streams.swap(m_streams);
+    }
+
+    // outside the lock, a streamer drains its work on the way out
+    streams.clear();
+}
+
+HRESULT StreamerHost::Initialize()
+{
+    if (m_device != nullptr)
+        return S_OK;
+
+    IFR(CreateMediaDevice(nullptr, &m_device));
+    m_taskPool = std::make_shared<TaskPool>(m_taskThreads);
+
+    return S_OK;
+}
+
+HRESULT StreamerHost::AddStream(StreamPriority priority, UINT32* pId)
+{
+    NULL_CHK(pId);
+    *pId = 0;
+    NULL_CHK_HR(m_device.Get(), E_ILLEGAL_METHOD_CALL);
+
+    // the player and its graph are created outside the lock, they take a while
+    auto streamer = std::make_shared<AdaptiveStreamer>();
+    streamer->SetSharedDevice(m_device.Get());
+    streamer->SetTaskPool(m_taskPool);
+    IFR(streamer->Initialize());
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    *pId = m_nextId++;
+    m_streams.push_back({ *pId, priority, std::move(streamer) });
+    RebalanceLocked();
+
+    return S_OK;
+}
+
+HRESULT StreamerHost::RemoveStream(UINT32 id)
+{
+    std::shared_ptr<AdaptiveStreamer> streamer;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = std::find_if(m_streams.begin(), m_streams.end(), [id](const Stream& stream) { return stream.id == id; });
+        if (it == m_streams.end())
+            return E_INVALIDARG;
+
+        streamer = std::move(it->streamer);
+        m_streams.erase(it);
+        RebalanceLocked();
+    }
+
+    LOG_RESULT(streamer->Stop());
+
+    return S_OK;
+}
+
+std::shared_ptr<AdaptiveStreamer> StreamerHost::GetStream(UINT32 id) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = std::find_if(m_streams.begin(), m_streams.end(), [id](const Stream& stream) { return stream.id == id; });
+    return it != m_streams.end() ? it->streamer : nullptr;
+}
+
+HRESULT StreamerHost::SetPriority(UINT32 id, StreamPriority priority)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = std::find_if(m_streams.begin(), m_streams.end(), [id](const Stream& stream) { return stream.id == id; });
+    if (it == m_streams.end())
+        return E_INVALIDARG;
+
+    if (it->priority != priority)
+    {
+        it->priority = priority;
+        RebalanceLocked();
+    }
+
+    return S_OK;
+}
+
+HRESULT StreamerHost::Focus(UINT32 id)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = std::find_if(m_streams.begin(), m_streams.end(), [id](const Stream& stream) { return stream.id == id; });
+    if (it == m_streams.end())
+        return E_INVALIDARG;
+
+    for (Stream& stream : m_streams)
+    {
+        stream.priority = (stream.id == id) ? StreamPriority::Focused : StreamPriority::Background;
+    }
+    RebalanceLocked();
+
+    return S_OK;
+}
+
+void StreamerHost::SetBudgets(UINT64 memoryBudgetBytes, UINT32 bandwidthBudgetBps)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_memoryBudgetBytes = memoryBudgetBytes;
+    m_bandwidthBudgetBps = bandwidthBudgetBps;
+    RebalanceLocked();
+}
+
+size_t StreamerHost::DispatchEvents()
+{
+    std::vector<Stream> streams;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        streams = m_streams;
+    }
+
+    // outside the lock, a handler may create textures or log
+    size_t handled = 0;
+    for (const Stream& stream : streams)
+    {
+        handled += stream.streamer->DispatchEvents();
+    }
+
+    return handled;
+}
+
+std::vector<HOSTED_STREAM_USAGE> StreamerHost::GetUsage() const
+{
+    std::vector<Stream> streams;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        streams = m_streams;
+    }
+
+    std::vector<HOSTED_STREAM_USAGE> usages;
+    usages.reserve(streams.size());
+    for (const Stream& stream : streams)
+    {
+        HOSTED_STREAM_USAGE usage;
+        usage.id = stream.id;
+        usage.priority = stream.priority;
+        usage.usage = stream.streamer->GetUsage();
+        usages.push_back(usage);
+    }
+
+    return usages;
+}
+
+void StreamerHost::LogUsage() const
+{
+    for (const HOSTED_STREAM_USAGE& hosted : GetUsage())
+    {
+        const STREAMER_USAGE& usage = hosted.usage;
+        Log(Log_Level_Info, L"StreamerHost - stream %u (%s): cpu %.2f s, %llu frame copies, call %.2f ms mean %.2f ms max, gpu %.3f ms mean %.3f ms max over %llu, %llu cache bytes of %llu, %llu texture bytes, %u bps cap\n",
+            hosted.id, hosted.priority == StreamPriority::Focused ? L"focused" : L"background",
+            usage.cpuTime / 10000000.0, usage.frameCopies,
+            usage.frameCopies != 0 ? usage.frameCopyCallSeconds * 1000.0 / usage.frameCopies : 0.0, usage.frameCopyCallMaxSeconds * 1000.0,
+            usage.frameCopiesGpuTimed != 0 ? usage.frameCopyGpuSeconds * 1000.0 / usage.frameCopiesGpuTimed : 0.0, usage.frameCopyGpuMaxSeconds * 1000.0,
+            usage.frameCopiesGpuTimed, usage.cacheBytes, usage.memoryBudgetBytes, usage.textureBytes, usage.bandwidthBudgetBps);
+    }
+
+    if (m_taskPool != nullptr)
+    {
+        m_taskPool->LogStats();
+    }
+}
+
+TASK_POOL_STATS StreamerHost::GetTaskPoolStats() const
+{
+    if (m_taskPool == nullptr)
+    {
+        TASK_POOL_STATS stats;
+        ZeroMemory(&stats, sizeof(stats));
+        return stats;
+    }
+
+    return m_taskPool->GetStats();
+}
+
+// Shares by weight, a focused stream counts STREAMER_HOST_FOCUSED_WEIGHT background ones
+void StreamerHost::RebalanceLocked()
+{
+    UINT64 totalWeight = 0;
+    for (const Stream& stream : m_streams)
+    {
+        totalWeight += (stream.priority == StreamPriority::Focused) ? STREAMER_HOST_FOCUSED_WEIGHT : 1;
+    }
+    if (totalWeight == 0)
+        return;
+
+    for (const Stream& stream : m_streams)
+    {
+        UINT64 weight = (stream.priority == StreamPriority::Focused) ? STREAMER_HOST_FOCUSED_WEIGHT : 1;
+        UINT64 memoryBytes = (std::max)(m_memoryBudgetBytes * weight / totalWeight, static_cast<UINT64>(STREAMER_HOST_MIN_CACHE_BYTES));
+        UINT32 bandwidthBps = static_cast<UINT32>(static_cast<UINT64>(m_bandwidthBudgetBps) * weight / totalWeight);
+
+        // a budget of 0 is uncapped, a share must not round down to it
+        if (m_bandwidthBudgetBps != 0 && bandwidthBps == 0)
+        {
+            bandwidthBps = 1;
+        }
+
+        stream.streamer->SetResourceBudget(memoryBytes, bandwidthBps);
+    }
+}
@@ -0,0 +1,103 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AdaptiveStreamer.h"
+#include "TaskPool.h"
+
+#define STREAMER_HOST_MEMORY_BUDGET_BYTES (512ull * 1024 * 1024) // segment caches of all streams together
+#define STREAMER_HOST_BANDWIDTH_BUDGET_BPS 0 // bitrates of all streams together, 0 leaves each stream to its ABR controller
+#define STREAMER_HOST_FOCUSED_WEIGHT 4 // budget shares a focused stream gets for each one of a background stream
+#define STREAMER_HOST_MIN_CACHE_BYTES (4 * 1024 * 1024) // no stream's cache goes below this, whatever the budget
+#define STREAMER_HOST_TASK_THREADS 0 // workers of the task pool the streams share, 0 is one per logical processor
+
+enum class StreamPriority : UINT32
+{
+    Focused = 0,    // the one the viewer watches, the larger share of the budgets
+    Background,
+};
+
+using HOSTED_STREAM_USAGE = struct _HOSTED_STREAM_USAGE
+{
+    UINT32 id;
+    StreamPriority priority;
+    STREAMER_USAGE usage;
+};
+
+// Runs many AdaptiveStreamers in one process, a multiview wall. They render into textures of one
+// D3D11 device, run their CPU work on the host's TaskPool, queue the rest and their downloads on
+// the one process thread pool and share the downloads they have in flight. The memory and bandwidth budgets are split among the streams by
+// priority and split again whenever a stream comes, goes or changes priority. Nothing a stream
+// does per frame or per segment takes a lock of the host.
+class StreamerHost
+{
+public:
+    StreamerHost(_In_ UINT64 memoryBudgetBytes = STREAMER_HOST_MEMORY_BUDGET_BYTES, _In_ UINT32 bandwidthBudgetBps = STREAMER_HOST_BANDWIDTH_BUDGET_BPS,
+        _In_ UINT32 taskThreads = STREAMER_HOST_TASK_THREADS);
+    ~StreamerHost();
+
+    // Creates the device and the task pool the streams share
+    HRESULT Initialize();
+
+    // Creates and initializes a stream on the shared device, the budgets are split again
+    HRESULT AddStream(_In_ StreamPriority priority, _Out_ UINT32* pId);
+
+    // The stream goes once the last reference GetStream handed out is released
+    HRESULT RemoveStream(_In_ UINT32 id);
+
+    // nullptr for an unknown id
+    std::shared_ptr<AdaptiveStreamer> GetStream(_In_ UINT32 id) const;
+
+    HRESULT SetPriority(_In_ UINT32 id, _In_ StreamPriority priority);
+
+    // Makes the stream the focused one and every other stream a background one
+    HRESULT Focus(_In_ UINT32 id);
+
+    void SetBudgets(_In_ UINT64 memoryBudgetBytes, _In_ UINT32 bandwidthBudgetBps);
+
+    // AdaptiveStreamer::DispatchEvents of every stream, on the thread that owns the host
+    size_t DispatchEvents();
+
+    std::vector<HOSTED_STREAM_USAGE> GetUsage() const;
+    void LogUsage() const;
+
+    ID3D11Device* Device() const { return m_device.Get(); }
+
+    // Queue depths and steal counts of the streams' task pool, zeroes before Initialize
+    TASK_POOL_STATS GetTaskPoolStats() const;
+
+private:
+    struct Stream
+    {
+        UINT32 id;
+        StreamPriority priority;
+        std::shared_ptr<AdaptiveStreamer> streamer;
+    };
+
+    void RebalanceLocked();
+
+    Microsoft::WRL::ComPtr<ID3D11Device> m_device;
+    std::shared_ptr<TaskPool> m_taskPool; // streams hold it too, it goes after the last of them
+    UINT32 m_taskThreads;
+
+    mutable std::mutex m_lock;
+    std::vector<Stream> m_streams;
+    UINT32 m_nextId;
+    UINT64 m_memoryBudgetBytes;
+    UINT32 m_bandwidthBudgetBps;
+};
@@ -0,0 +1,325 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "TaskPool.h"
+#include "ThreadPoolWorkQueue.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+namespace
+{
+    // the worker the calling thread is, tasks submitted by a task stay on it
+    thread_local const TaskPool* t_pool = nullptr;
+    thread_local size_t t_worker = 0;
+
+    struct NumaNode
+    {
+        UINT32 number;
+        GROUP_AFFINITY affinity;
+        UINT32 processors;
+    };
+
+    std::vector<NumaNode> GetNumaNodes()
+    {
+        std::vector<NumaNode> nodes;
+
+        ULONG highestNode = 0;
+        if (!GetNumaHighestNodeNumber(&highestNode))
+            return nodes;
+
+        for (ULONG node = 0; node <= highestNode; ++node)
+        {
+            GROUP_AFFINITY affinity = {};
+            if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) || affinity.Mask == 0)
+                continue;
+
+            UINT32 processors = 0;
+            for (KAFFINITY mask = affinity.Mask; mask != 0; mask &= mask - 1)
+            {
+                processors++;
+            }
+            nodes.push_back({ static_cast<UINT32>(node), affinity, processors });
+        }
+
+        return nodes;
+    }
+}
+
+TaskPool::TaskPool(UINT32 threadCount)
+    : m_nodeCount(1)
+    , m_pending(0)
+    , m_stopping(false)
+    , m_nextWorker(0)
+    , m_submitted(0)
+    , m_executed(0)
+    , m_stolen(0)
+    , m_stolenAcrossNodes(0)
+    , m_cpuTime(0)
+{
+    for (std::atomic<UINT64>& queued : m_queued)
+    {
+        queued = 0;
+    }
+
+    if (threadCount == 0)
+    {
+        threadCount = (std::max)(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS), static_cast<DWORD>(1));
+    }
+
+    std::vector<NumaNode> nodes = GetNumaNodes();
+    UINT32 totalProcessors = 0;
+    for (const NumaNode& node : nodes)
+    {
+        totalProcessors += node.processors;
+    }
+
+    // worker i sits at the i-th share of all processors, a node gets workers by its processor count
+    for (UINT32 i = 0; i < threadCount; ++i)
+    {
+        auto worker = std::make_unique<Worker>();
+        worker->node = 0;
+        worker->affinity = {};
+        worker->pinned = false;
+
+        if (nodes.size() > 1 && totalProcessors != 0)
+        {
+            UINT64 position = static_cast<UINT64>(i) * totalProcessors / threadCount;
+            size_t node = 0;
+            while (node + 1 < nodes.size() && position >= nodes[node].processors)
+            {
+                position -= nodes[node].processors;
+                node++;
+            }
+
+            worker->node = nodes[node].number;
+            worker->affinity = nodes[node].affinity;
+            worker->pinned = true;
+        }
+
+        m_workers.push_back(std::move(worker));
+    }
+    if (nodes.size() > 1)
+    {
+        m_nodeCount = static_cast<UINT32>(nodes.size());
+    }
+
+    // victims in turn from the next worker on, those on another node after all of the own node
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        std::vector<size_t> remote;
+        for (size_t step = 1; step < m_workers.size(); ++step)
+        {
+            size_t victim = (i + step) % m_workers.size();
+            if (m_workers[victim]->node == m_workers[i]->node)
+            {
+                m_workers[i]->victims.push_back(victim);
+            }
+            else
+            {
+                remote.push_back(victim);
+            }
+        }
+        m_workers[i]->victims.insert(m_workers[i]->victims.end(), remote.begin(), remote.end());
+    }
+
+    // every worker exists before the first one looks for victims
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->thread = std::thread([this, i]() { Run(i); });
+    }
+
+    Log(Log_Level_Info, L"TaskPool - %u threads on %u NUMA nodes\n", ThreadCount(), m_nodeCount);
+}
+
+// Must not run on one of the workers, it waits for them
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : m_workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
+HRESULT TaskPool::Submit(std::function<void()> task, TaskPriority priority)
+{
+    NULL_CHK(task);
+    if (priority >= TaskPriority::Count)
+        return E_INVALIDARG;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        if (m_stopping || m_workers.empty())
+            return E_ILLEGAL_METHOD_CALL;
+    }
+
+    // a task of a task stays on its worker, what it works on is likely in that core's cache still
+    size_t index = (t_pool == this) ? t_worker : m_nextWorker++ % m_workers.size();
+    size_t p = static_cast<size_t>(priority);
+    {
+        Worker& worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.lock);
+        worker.tasks[p].push_back(std::move(task));
+        m_pending++;
+        m_queued[p]++;
+    }
+    m_submitted++;
+
+    // taken and let go, a worker about to sleep either sees the task or gets the notification
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+    }
+    m_wake.notify_one();
+
+    return S_OK;
+}
+
+TASK_POOL_STATS TaskPool::GetStats() const
+{
+    TASK_POOL_STATS stats;
+    ZeroMemory(&stats, sizeof(stats));
+
+    stats.threads = ThreadCount();
+    stats.nodes = m_nodeCount;
+    for (size_t p = 0; p < static_cast<size_t>(TaskPriority::Count); ++p)
+    {
+        stats.queued[p] = m_queued[p];
+    }
+    stats.submitted = m_submitted;
+    stats.executed = m_executed;
+    stats.stolen = m_stolen;
+    stats.stolenAcrossNodes = m_stolenAcrossNodes;
+    stats.cpuTime = m_cpuTime;
+
+    return stats;
+}
+
+void TaskPool::LogStats() const
+{
+    TASK_POOL_STATS stats = GetStats();
+
+    Log(Log_Level_Info, L"TaskPool - %u threads on %u nodes: %llu submitted, %llu executed, %llu stolen (%llu across nodes), %llu/%llu/%llu queued high/normal/low, cpu %.2f s\n",
+        stats.threads, stats.nodes, stats.submitted, stats.executed, stats.stolen, stats.stolenAcrossNodes,
+        stats.queued[static_cast<size_t>(TaskPriority::High)], stats.queued[static_cast<size_t>(TaskPriority::Normal)],
+        stats.queued[static_cast<size_t>(TaskPriority::Low)], stats.cpuTime / 10000000.0);
+}
+
+void TaskPool::Run(size_t index)
+{
+    Worker& worker = *m_workers[index];
+    if (worker.pinned)
+    {
+        if (!SetThreadGroupAffinity(GetCurrentThread(), &worker.affinity, nullptr))
+        {
+            LOG_RESULT(HRESULT_FROM_WIN32(GetLastError()));
+        }
+    }
+
+    // tasks create WinRT objects, like the thread pool threads they replace
+    HRESULT hrInitialize = RoInitialize(RO_INIT_MULTITHREADED);
+
+    t_pool = this;
+    t_worker = index;
+    TRACE_THREAD_NAME("TaskPool worker");
+
+    std::function<void()> task;
+    for (;;)
+    {
+        if (TryTake(index, &task))
+        {
+            UINT64 cpuStart = CurrentThreadCpuTime();
+            task();
+            task = nullptr; // what it holds goes before it counts as run
+            m_cpuTime += CurrentThreadCpuTime() - cpuStart;
+            m_executed++;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepLock);
+        m_wake.wait(lock, [this]() { return m_pending != 0 || m_stopping; });
+        if (m_stopping && m_pending == 0)
+            break;
+    }
+
+    t_pool = nullptr;
+    if (SUCCEEDED(hrInitialize))
+    {
+        RoUninitialize();
+    }
+}
+
+// Highest priority first, the own deques before the victims'
+bool TaskPool::TryTake(size_t index, std::function<void()>* pTask)
+{
+    Worker& worker = *m_workers[index];
+    for (size_t p = 0; p < static_cast<size_t>(TaskPriority::Count); ++p)
+    {
+        // nothing of the priority anywhere, no lock is taken for it
+        if (m_queued[p] == 0)
+            continue;
+
+        TaskPriority priority = static_cast<TaskPriority>(p);
+        if (TryPop(worker, priority, false, pTask))
+            return true;
+
+        for (size_t victim : worker.victims)
+        {
+            if (TryPop(*m_workers[victim], priority, true, pTask))
+            {
+                m_stolen++;
+                if (m_workers[victim]->node != worker.node)
+                {
+                    m_stolenAcrossNodes++;
+                }
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// The owner takes the newest task, the one whose data is most likely still in its cache, a thief
+// the oldest. Each deque is under its worker's lock, owner and thieves alike
+bool TaskPool::TryPop(Worker& worker, TaskPriority priority, bool steal, std::function<void()>* pTask)
+{
+    size_t p = static_cast<size_t>(priority);
+
+    std::lock_guard<std::mutex> lock(worker.lock);
+    std::deque<std::function<void()>>& tasks = worker.tasks[p];
+    if (tasks.empty())
+        return false;
+
+    if (steal)
+    {
+        *pTask = std::move(tasks.front());
+        tasks.pop_front();
+    }
+    else
+    {
+        *pTask = std::move(tasks.back());
+        tasks.pop_back();
+    }
+    m_pending--;
+    m_queued[p]--;
+
+    return true;
+}
@@ -0,0 +1,103 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Taken in this order across the whole pool, a worker steals a higher priority task before it
+// runs a lower priority one of its own
+enum class TaskPriority : UINT32
+{
+    High = 0,   // someone waits on the result
+    Normal,
+    Low,        // housekeeping, runs when nothing else is queued
+    Count
+};
+
+using TASK_POOL_STATS = struct _TASK_POOL_STATS
+{
+    UINT32 threads;
+    UINT32 nodes;           // NUMA nodes the workers are spread over
+    UINT64 queued[static_cast<size_t>(TaskPriority::Count)]; // waiting now, by priority
+    UINT64 submitted;
+    UINT64 executed;
+    UINT64 stolen;          // taken from another worker's deque
+    UINT64 stolenAcrossNodes;
+    UINT64 cpuTime;         // 100 ns units, of the tasks
+};
+
+// Owned worker threads for CPU work, one per logical processor unless told otherwise. Every
+// worker has a deque per priority, guarded by a mutex of the worker: a task submitted on a worker
+// goes to its own deques, one submitted elsewhere to the next worker's in turn. A worker runs its
+// newest task first and, out of work, steals the oldest of the others, those on its NUMA node first. Workers are spread over the NUMA nodes by their processor counts
+// and kept on their node's processors. Tasks queued when the pool goes are run first.
+//
+// Not for work that blocks on the network, a few such tasks take the whole pool. Leave that to
+// the WinRT thread pool.
+class TaskPool
+{
+public:
+    explicit TaskPool(_In_ UINT32 threadCount = 0);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    HRESULT Submit(std::function<void()> task, TaskPriority priority = TaskPriority::Normal);
+
+    TASK_POOL_STATS GetStats() const;
+    void LogStats() const;
+
+    UINT32 ThreadCount() const { return static_cast<UINT32>(m_workers.size()); }
+
+private:
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks[static_cast<size_t>(TaskPriority::Count)];
+        std::vector<size_t> victims; // other workers, those on the same node first
+        UINT32 node;
+        GROUP_AFFINITY affinity;
+        bool pinned;
+        std::thread thread;
+    };
+
+    void Run(size_t index);
+    bool TryTake(size_t index, _Out_ std::function<void()>* pTask);
+    bool TryPop(Worker& worker, TaskPriority priority, bool steal, _Out_ std::function<void()>* pTask);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    UINT32 m_nodeCount;
+
+    // workers sleep when nothing is queued anywhere
+    std::mutex m_sleepLock;
+    std::condition_variable m_wake;
+    std::atomic<size_t> m_pending;
+    std::atomic<UINT64> m_queued[static_cast<size_t>(TaskPriority::Count)];
+    bool m_stopping;
+
+    std::atomic<size_t> m_nextWorker;
+    std::atomic<UINT64> m_submitted;
+    std::atomic<UINT64> m_executed;
+    std::atomic<UINT64> m_stolen;
+    std::atomic<UINT64> m_stolenAcrossNodes;
+    std::atomic<UINT64> m_cpuTime;
+};
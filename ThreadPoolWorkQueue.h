@@ -0,0 +1,135 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "TaskPool.h"
+
+// User and kernel CPU time of the calling thread so far, 100 ns units
+inline UINT64 CurrentThreadCpuTime()
+{
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+
+    return ((static_cast<UINT64>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime)
+        + ((static_cast<UINT64>(user.dwHighDateTime) << 32) | user.dwLowDateTime);
+}
+
+// Runs work items on the WinRT thread pool, or on a TaskPool once one is set, and keeps count
+// of them, so an owner whose members the work touches can Drain() before it goes away. The CPU
+// time the items took is added up, the pool's threads are shared by everyone who queues on them.
+class ThreadPoolWorkQueue
+{
+public:
+    ThreadPoolWorkQueue() : m_pending(0), m_closed(false), m_cpuTime(0)
+    {
+    }
+
+    ~ThreadPoolWorkQueue()
+    {
+        Drain();
+    }
+
+    // Work queued from now on runs on the pool, nullptr goes back to the WinRT thread pool
+    void SetTaskPool(std::shared_ptr<TaskPool> taskPool)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_taskPool = std::move(taskPool);
+    }
+
+    HRESULT Queue(std::function<void()> work, TaskPriority priority = TaskPriority::Normal)
+    {
+        std::shared_ptr<TaskPool> taskPool;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_closed)
+                return E_ILLEGAL_METHOD_CALL;
+            m_pending++;
+            taskPool = m_taskPool;
+        }
+
+        HRESULT hr = (taskPool != nullptr)
+            ? taskPool->Submit([this, work]() { Run(work); }, priority)
+            : QueueOnThreadPool(work, priority);
+        if (FAILED(hr))
+        {
+            Completed();
+        }
+
+        return hr;
+    }
+
+    // Refuses new work and waits for queued work to finish
+    void Drain()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_closed = true;
+        m_idle.wait(lock, [this]() { return m_pending == 0; });
+    }
+
+    // CPU time of the work run so far, 100 ns units
+    UINT64 CpuTime() const { return m_cpuTime; }
+
+private:
+    HRESULT QueueOnThreadPool(const std::function<void()>& work, TaskPriority priority)
+    {
+        Microsoft::WRL::ComPtr<ABI::Windows::System::Threading::IThreadPoolStatics> spThreadPool;
+        IFR(Windows::Foundation::GetActivationFactory(
+            Microsoft::WRL::Wrappers::HStringReference(RuntimeClass_Windows_System_Threading_ThreadPool).Get(),
+            &spThreadPool));
+
+        auto handler = Microsoft::WRL::Callback<ABI::Windows::System::Threading::IWorkItemHandler>(
+            [this, work](_In_ ABI::Windows::Foundation::IAsyncAction*) -> HRESULT
+            {
+                Run(work);
+                return S_OK;
+            });
+
+        ABI::Windows::System::Threading::WorkItemPriority workItemPriority =
+            (priority == TaskPriority::High) ? ABI::Windows::System::Threading::WorkItemPriority_High
+            : (priority == TaskPriority::Low) ? ABI::Windows::System::Threading::WorkItemPriority_Low
+            : ABI::Windows::System::Threading::WorkItemPriority_Normal;
+
+        Microsoft::WRL::ComPtr<ABI::Windows::Foundation::IAsyncAction> spAction;
+        return spThreadPool->RunWithPriorityAsync(handler.Get(), workItemPriority, &spAction);
+    }
+
+    void Run(const std::function<void()>& work)
+    {
+        UINT64 cpuStart = CurrentThreadCpuTime();
+        work();
+        m_cpuTime += CurrentThreadCpuTime() - cpuStart;
+        Completed();
+    }
+
+    void Completed()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pending--;
+        m_idle.notify_all();
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_idle;
+    size_t m_pending;
+    bool m_closed;
+    std::shared_ptr<TaskPool> m_taskPool;
+    std::atomic<UINT64> m_cpuTime;
+};
@@ -0,0 +1,227 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "Trace.h"
+
+#ifdef TRACE_SPANS
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Trace
+{
+    namespace
+    {
+        int64_t SteadyNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        using Detail::Buffer;
+        using Detail::Slot;
+
+        struct Event
+        {
+            const char* name;
+            int64_t startTicks;
+            int64_t endTicks;
+            uint32_t thread;
+        };
+
+        class Recorder
+        {
+        public:
+            static Recorder& Instance()
+            {
+                static Recorder s_instance;
+                return s_instance;
+            }
+
+            // Buffers stay until the process exits, a span of a thread that is gone still shows
+            Buffer* AddThread()
+            {
+                auto buffer = std::make_unique<Buffer>();
+                for (Slot& slot : buffer->slots)
+                {
+                    slot.name.store(nullptr, std::memory_order_relaxed);
+                    slot.startTicks.store(0, std::memory_order_relaxed);
+                    slot.endTicks.store(0, std::memory_order_relaxed);
+                }
+                buffer->reserved.store(0, std::memory_order_relaxed);
+                buffer->published.store(0, std::memory_order_relaxed);
+                buffer->threadName.store(nullptr, std::memory_order_relaxed);
+
+                std::lock_guard<std::mutex> lock(m_lock);
+                buffer->id = static_cast<uint32_t>(m_buffers.size() + 1);
+                m_buffers.push_back(std::move(buffer));
+                return m_buffers.back().get();
+            }
+
+            // Ticks per nanosecond, measured from the recorder's creation to now
+            double TicksPerNs() const
+            {
+#ifdef TRACE_TSC
+                int64_t ticks = NowTicks() - m_originTicks;
+                int64_t ns = SteadyNs() - m_originNs;
+                return (ns > 0 && ticks > 0) ? static_cast<double>(ticks) / ns : 1.0;
+#else
+                return 1.0;
+#endif
+            }
+
+            std::vector<Buffer*> Buffers()
+            {
+                std::vector<Buffer*> buffers;
+                std::lock_guard<std::mutex> lock(m_lock);
+                for (const std::unique_ptr<Buffer>& buffer : m_buffers)
+                {
+                    buffers.push_back(buffer.get());
+                }
+                return buffers;
+            }
+
+        private:
+            Recorder()
+                : m_originTicks(NowTicks())
+                , m_originNs(SteadyNs())
+            {
+            }
+
+            std::mutex m_lock;
+            std::vector<std::unique_ptr<Buffer>> m_buffers;
+            int64_t m_originTicks;
+            int64_t m_originNs;
+        };
+
+        // The spans of the buffer that were not overwritten while they were copied
+        void Collect(Buffer* pBuffer, std::vector<Event>* pEvents)
+        {
+            uint64_t published = pBuffer->published.load(std::memory_order_acquire);
+            uint64_t first = published > TRACE_BUFFER_SPANS ? published - TRACE_BUFFER_SPANS : 0;
+
+            std::vector<Event> events;
+            events.reserve(static_cast<size_t>(published - first));
+            for (uint64_t i = first; i < published; ++i)
+            {
+                const Slot& slot = pBuffer->slots[i % TRACE_BUFFER_SPANS];
+                events.push_back({ slot.name.load(std::memory_order_relaxed), slot.startTicks.load(std::memory_order_relaxed),
+                    slot.endTicks.load(std::memory_order_relaxed), pBuffer->id });
+            }
+
+            // the copies are done before the reservation is looked at
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t reserved = pBuffer->reserved.load(std::memory_order_relaxed);
+            uint64_t valid = reserved > TRACE_BUFFER_SPANS ? reserved - TRACE_BUFFER_SPANS : 0;
+
+            for (uint64_t i = first; i < published; ++i)
+            {
+                if (i >= valid)
+                {
+                    pEvents->push_back(events[static_cast<size_t>(i - first)]);
+                }
+            }
+        }
+
+        void WriteString(FILE* pFile, const char* text)
+        {
+            fputc('"', pFile);
+            for (const char* p = (text != nullptr) ? text : "?"; *p != '\0'; ++p)
+            {
+                if (*p == '"' || *p == '\\')
+                {
+                    fputc('\\', pFile);
+                }
+                if (static_cast<unsigned char>(*p) >= 0x20)
+                {
+                    fputc(*p, pFile);
+                }
+            }
+            fputc('"', pFile);
+        }
+    }
+
+    Detail::Buffer* Detail::AddThreadBuffer()
+    {
+        return Recorder::Instance().AddThread();
+    }
+
+    void SetThreadName(const char* name)
+    {
+        Detail::ThreadBuffer()->threadName.store(name, std::memory_order_relaxed);
+    }
+
+    bool WriteFile(const char* path)
+    {
+        if (path == nullptr)
+            return false;
+
+        std::vector<Buffer*> buffers = Recorder::Instance().Buffers();
+        std::vector<Event> events;
+        for (Buffer* pBuffer : buffers)
+        {
+            Collect(pBuffer, &events);
+        }
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.startTicks < b.startTicks; });
+
+        FILE* pFile = fopen(path, "wb");
+        if (pFile == nullptr)
+            return false;
+
+        // times from the first span on, microseconds as the format wants them
+        int64_t originTicks = events.empty() ? 0 : events.front().startTicks;
+        double ticksPerUs = Recorder::Instance().TicksPerNs() * 1000.0;
+
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", pFile);
+        bool first = true;
+        for (Buffer* pBuffer : buffers)
+        {
+            const char* threadName = pBuffer->threadName.load(std::memory_order_relaxed);
+            if (threadName == nullptr)
+                continue;
+
+            fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", pBuffer->id);
+            WriteString(pFile, threadName);
+            fputs("}}", pFile);
+            first = false;
+        }
+        for (const Event& event : events)
+        {
+            fprintf(pFile, "%s{\"name\":", first ? "" : ",\n");
+            WriteString(pFile, event.name);
+            fprintf(pFile, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.thread,
+                (event.startTicks - originTicks) / ticksPerUs, (event.endTicks - event.startTicks) / ticksPerUs);
+            first = false;
+        }
+        fputs("\n]}\n", pFile);
+
+        return fclose(pFile) == 0;
+    }
+
+    Stats GetStats()
+    {
+        Stats stats = {};
+        std::vector<Buffer*> buffers = Recorder::Instance().Buffers();
+        for (Buffer* pBuffer : buffers)
+        {
+            uint64_t published = pBuffer->published.load(std::memory_order_relaxed);
+            stats.spans += published;
+            stats.overwritten += published > TRACE_BUFFER_SPANS ? published - TRACE_BUFFER_SPANS : 0;
+        }
+        stats.threads = buffers.size();
+        return stats;
+    }
+}
+
+#endif
@@ -0,0 +1,158 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable scoped spans for startup and per-frame profiling. TRACE_SPAN("name") times the rest
+// of the enclosing scope and stores the span in a buffer of the calling thread, no lock, no
+// allocation once the thread has a buffer. A buffer keeps the newest TRACE_BUFFER_SPANS spans
+// of its thread. Trace::WriteFile writes the spans of all threads as a Chrome trace event JSON
+// file, for chrome://tracing or ui.perfetto.dev. Without TRACE_SPANS the macro is empty and
+// nothing of this is compiled in. No Windows dependencies.
+
+//#define TRACE_SPANS // uncomment, or define it for the build, to record spans
+
+#define TRACE_BUFFER_SPANS 16384 // per thread that records, older spans are overwritten
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TRACE_SPANS
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TRACE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_TSC
+#endif
+
+#define TRACE_SPAN(name) Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Trace::SetThreadName(name)
+
+namespace Trace
+{
+    // The time stamp counter on x86 and x64, a fraction of a clock read, WriteFile converts
+    // the ticks to time. Steady clock nanoseconds elsewhere.
+    inline int64_t NowTicks()
+    {
+#ifdef TRACE_TSC
+        return static_cast<int64_t>(__rdtsc());
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    namespace Detail
+    {
+        struct Slot
+        {
+            std::atomic<const char*> name;
+            std::atomic<int64_t> startTicks;
+            std::atomic<int64_t> endTicks;
+        };
+
+        // Written by its thread only. A writer reserves the slot, fills it, then publishes it,
+        // a reader drops what was reserved again while it copied.
+        struct Buffer
+        {
+            Slot slots[TRACE_BUFFER_SPANS];
+            std::atomic<uint64_t> reserved;
+            std::atomic<uint64_t> published;
+            std::atomic<const char*> threadName;
+            uint32_t id;
+        };
+
+        // constant initialized, reading it needs no initialization check
+        inline thread_local Buffer* t_buffer = nullptr;
+
+        // Creates the calling thread's buffer, once per thread
+        Buffer* AddThreadBuffer();
+
+        inline Buffer* ThreadBuffer()
+        {
+            Buffer* pBuffer = t_buffer;
+            if (pBuffer == nullptr)
+            {
+                pBuffer = t_buffer = AddThreadBuffer();
+            }
+            return pBuffer;
+        }
+    }
+
+    // Stores a finished span in the calling thread's buffer, name is a literal. Inline, a span
+    // costs its two tick reads and a few stores.
+    inline void Record(const char* name, int64_t startTicks, int64_t endTicks)
+    {
+        Detail::Buffer* pBuffer = Detail::ThreadBuffer();
+
+        uint64_t index = pBuffer->published.load(std::memory_order_relaxed);
+        pBuffer->reserved.store(index + 1, std::memory_order_relaxed);
+
+        // reserved before the slot changes
+        std::atomic_thread_fence(std::memory_order_release);
+        Detail::Slot& slot = pBuffer->slots[index % TRACE_BUFFER_SPANS];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.startTicks.store(startTicks, std::memory_order_relaxed);
+        slot.endTicks.store(endTicks, std::memory_order_relaxed);
+
+        pBuffer->published.store(index + 1, std::memory_order_release);
+    }
+
+    class Span
+    {
+    public:
+        explicit Span(const char* name)
+            : m_name(name)
+            , m_startTicks(NowTicks())
+        {
+        }
+
+        ~Span()
+        {
+            Record(m_name, m_startTicks, NowTicks());
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* m_name;
+        int64_t m_startTicks;
+    };
+
+    // Names the calling thread in the trace, a literal
+    void SetThreadName(const char* name);
+
+    // Writes the spans recorded so far, any thread, the recording threads go on meanwhile.
+    // Returns false when the file could not be written.
+    bool WriteFile(const char* path);
+
+    struct Stats
+    {
+        uint64_t spans;        // recorded
+        uint64_t overwritten;  // by newer spans of their thread, no longer in the trace
+        uint64_t threads;      // that have recorded
+    };
+    Stats GetStats();
+}
+
+#else
+
+#define TRACE_SPAN(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
@@ -0,0 +1,115 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "TrickPlay.h"
+
+#include "TsDemuxer.h"
+
+#include <algorithm>
+#include <cmath>
+
+TrickPlaySchedule::TrickPlaySchedule(const HlsMediaPlaylist& iFramePlaylist, double frameRate)
+    : m_averageInterval(0.0)
+    , m_frameRate(frameRate > 0.0 ? frameRate : 1.0)
+    , m_position(0.0)
+    , m_speed(0.0)
+{
+    m_times.reserve(iFramePlaylist.segments.size());
+    for (const HlsSegment& segment : iFramePlaylist.segments)
+    {
+        m_times.push_back(segment.startTime);
+    }
+
+    if (m_times.size() > 1)
+    {
+        m_averageInterval = (m_times.back() - m_times.front()) / (m_times.size() - 1);
+    }
+}
+
+void TrickPlaySchedule::Start(double position, double speed)
+{
+    m_position = position;
+    m_speed = speed;
+}
+
+bool TrickPlaySchedule::Next(size_t* pIndex)
+{
+    if (pIndex == nullptr || m_times.empty())
+        return false;
+
+    // a little past the last I-frame still shows it, the duration after it is unknown here
+    double end = m_times.back() + m_averageInterval;
+    if (m_position < m_times.front() - m_averageInterval || m_position > end)
+        return false;
+
+    *pIndex = FindNearest(m_position);
+    m_position += m_speed / m_frameRate;
+
+    return true;
+}
+
+double TrickPlaySchedule::IFramesPerSecond() const
+{
+    if (m_averageInterval <= 0.0)
+        return m_frameRate;
+
+    return (std::min)(m_frameRate, std::fabs(m_speed) / m_averageInterval);
+}
+
+size_t TrickPlaySchedule::FindNearest(double position) const
+{
+    auto it = std::lower_bound(m_times.begin(), m_times.end(), position);
+    if (it == m_times.end())
+        return m_times.size() - 1;
+
+    size_t index = static_cast<size_t>(it - m_times.begin());
+    if (index > 0 && position - m_times[index - 1] < *it - position)
+        index--;
+
+    return index;
+}
+
+bool TrickPlay::ExtractAccessUnit(
+    const uint8_t* init,
+    size_t initSize,
+    const uint8_t* data,
+    size_t size,
+    std::vector<uint8_t>* pAccessUnit,
+    uint8_t* pStreamType)
+{
+    if (pAccessUnit == nullptr || pStreamType == nullptr)
+        return false;
+
+    pAccessUnit->clear();
+
+    int videoPid = -1;
+    TsDemuxer demuxer([&](const PesPacket& packet)
+        {
+            TsElementaryStream stream = { packet.pid, packet.streamType };
+            if (!stream.IsVideo() || videoPid >= 0)
+                return;
+
+            // the demuxer reassembles a whole PES, the first one is the I-frame picture
+            videoPid = packet.pid;
+            *pStreamType = packet.streamType;
+            pAccessUnit->assign(packet.data, packet.data + packet.size);
+        });
+
+    if (init != nullptr && initSize != 0)
+    {
+        demuxer.Push(init, initSize);
+    }
+
+    demuxer.Push(data, size);
+    demuxer.Flush();
+
+    return !pAccessUnit->empty();
+}
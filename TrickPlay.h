@@ -0,0 +1,67 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable part of I-frame trick play: which entry of an EXT-X-I-FRAMES-ONLY playlist to show
+// for every output frame at a given speed, and the extraction of one I-frame's access unit from
+// its MPEG-TS byte range. No Windows dependencies.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "HlsPlaylist.h"
+
+class TrickPlaySchedule
+{
+public:
+    // frameRate is the output (thumbnail) rate, I-frames are picked to match it at any speed
+    TrickPlaySchedule(const HlsMediaPlaylist& iFramePlaylist, double frameRate);
+
+    // speed is a multiple of normal playback, negative rewinds
+    void Start(double position, double speed);
+    void SetSpeed(double speed) { m_speed = speed; }
+
+    // I-frame nearest to the position of the next output frame, then moves the position on.
+    // False once the position ran off either end of the playlist.
+    bool Next(size_t* pIndex);
+
+    double Position() const { return m_position; }
+    double Speed() const { return m_speed; }
+    double FrameRate() const { return m_frameRate; }
+
+    // I-frames fetched per second at the speed, capped by the output rate
+    double IFramesPerSecond() const;
+
+private:
+    size_t FindNearest(double position) const;
+
+    std::vector<double> m_times; // I-frame start times, ascending
+    double m_averageInterval;
+    double m_frameRate;
+    double m_position;
+    double m_speed;
+};
+
+namespace TrickPlay
+{
+    // Demuxes the video access unit of an I-frame byte range. init is the EXT-X-MAP section
+    // (PAT/PMT) when the playlist has one, the byte range carries them otherwise. streamType is
+    // the TsStreamType of the video stream.
+    bool ExtractAccessUnit(
+        const uint8_t* init,
+        size_t initSize,
+        const uint8_t* data,
+        size_t size,
+        std::vector<uint8_t>* pAccessUnit,
+        uint8_t* pStreamType);
+}
@@ -0,0 +1,469 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include "TrickPlayer.h"
+#include "MediaHelpers.h"
+
+#include <windows.media.mediaproperties.h>
+
+using namespace Microsoft::WRL;
+using namespace Microsoft::WRL::Wrappers;
+using namespace ABI::Windows::Media::Core;
+using namespace ABI::Windows::Media::MediaProperties;
+using namespace ABI::Windows::Media::Playback;
+using namespace ABI::Windows::Storage::Streams;
+
+namespace
+{
+    ABI::Windows::Foundation::TimeSpan ToTimeSpan(double seconds)
+    {
+        ABI::Windows::Foundation::TimeSpan time;
+        time.Duration = static_cast<INT64>(seconds * 10000000.0 + 0.5);
+        return time;
+    }
+}
+
+TrickPlayer::TrickPlayer(std::shared_ptr<SegmentCache> iFrameCache, PlaylistPrefetcher* pPlaylistPrefetcher)
+    : m_iFrameCache(std::move(iFrameCache))
+    , m_pPlaylistPrefetcher(pPlaylistPrefetcher)
+    , m_sampleRequestedToken()
+    , m_videoFrameAvailableToken()
+    , m_running(false)
+    , m_fetching(false)
+    , m_endOfStream(false)
+    , m_framesQueued(0)
+    , m_shownPosition(0.0)
+    , m_fetchedBytes(0)
+    , m_startTime(0)
+{
+    m_iFrameFetcher = std::make_unique<PlaylistPrefetcher>(m_iFrameCache, PlaylistPrefetcher::DefaultSettings(),
+        (pPlaylistPrefetcher != nullptr) ? pPlaylistPrefetcher->Scheduler() : nullptr, DownloadOrigin::TrickPlay);
+    QueryPerformanceFrequency(&m_qpcFrequency);
+}
+
+TrickPlayer::~TrickPlayer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_running = false;
+    }
+
+    // queued fetches hold a raw this
+    m_workQueue.Drain();
+
+    if (m_pendingDeferral != nullptr)
+    {
+        m_pendingDeferral->Complete();
+    }
+
+    if (m_streamSource != nullptr)
+    {
+        m_streamSource->remove_SampleRequested(m_sampleRequestedToken);
+    }
+
+    if (m_mediaPlayer5 != nullptr)
+    {
+        m_mediaPlayer5->remove_VideoFrameAvailable(m_videoFrameAvailableToken);
+    }
+
+    if (m_mediaPlayer != nullptr)
+    {
+        ComPtr<IMediaPlayerSource2> spPlayerSource;
+        if (SUCCEEDED(m_mediaPlayer.As(&spPlayerSource)))
+        {
+            spPlayerSource->put_Source(nullptr);
+        }
+
+        ComPtr<ABI::Windows::Foundation::IClosable> spClosable;
+        if (SUCCEEDED(m_mediaPlayer.As(&spClosable)))
+        {
+            spClosable->Close();
+        }
+    }
+}
+
+HRESULT TrickPlayer::Initialize(const std::wstring& url, FrameAvailableCallback onFrame)
+{
+    NULL_CHK_HR(m_pPlaylistPrefetcher, E_ILLEGAL_METHOD_CALL);
+
+    m_onFrame = std::move(onFrame);
+
+    // the master playlist is usually cached already, the main player fetched it
+    PrefetchedItem item;
+    IFR(m_pPlaylistPrefetcher->PrefetchSegments(url, 0, 0, &item));
+    if (item.masterPlaylist.iFrameVariants.empty())
+    {
+        Log(Log_Level_Warning, L"TrickPlayer::Initialize() - %s has no I-frame playlist\n", url.c_str());
+        return MF_E_UNSUPPORTED_FORMAT;
+    }
+
+    // thumbnails only need the smallest pictures
+    const HlsVariant& variant = item.masterPlaylist.iFrameVariants.front();
+
+    SegmentBuffer spText;
+    IFR(m_pPlaylistPrefetcher->FetchPlaylist(variant.uri, &spText));
+
+    std::string text(spText->begin(), spText->end());
+    if (!Hls::ParseMediaPlaylist(text, variant.uri, &m_iFramePlaylist) || m_iFramePlaylist.segments.empty())
+        return MF_E_INVALID_FORMAT;
+
+    const HlsSegment& init = m_iFramePlaylist.initSegment;
+    if (!init.uri.empty())
+    {
+        IFR(m_iFrameFetcher->FetchToCache(init.uri, init.byteOffset, init.byteLength, &m_initSection, DownloadPriority::VideoNearPlayhead));
+
+        // fMP4 I-frames would need their moov to be demuxed, only MPEG-TS ones are decoded
+        if (m_initSection->empty() || (*m_initSection)[0] != 0x47)
+            return MF_E_UNSUPPORTED_FORMAT;
+    }
+
+    m_schedule = std::make_unique<TrickPlaySchedule>(m_iFramePlaylist, TRICK_PLAY_DEFAULT_FRAME_RATE);
+
+    IFR(CreateStreamSource(variant));
+
+    Log(Log_Level_Info, L"TrickPlayer::Initialize() - %zu I-frames at %u bps\n",
+        m_iFramePlaylist.segments.size(), variant.bandwidth);
+
+    return S_OK;
+}
+
+HRESULT TrickPlayer::CreateStreamSource(const HlsVariant& variant)
+{
+    // the stream descriptor follows the codec of the I-frame variant
+    ComPtr<IVideoEncodingPropertiesStatics> spPropertiesStatics;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_MediaProperties_VideoEncodingProperties).Get(),
+        &spPropertiesStatics));
+
+    ComPtr<IVideoEncodingProperties> spProperties;
+    bool hevc = variant.codecs.find("hvc1") != std::string::npos || variant.codecs.find("hev1") != std::string::npos;
+    if (hevc)
+    {
+        ComPtr<IVideoEncodingPropertiesStatics2> spPropertiesStatics2;
+        IFR(spPropertiesStatics.As(&spPropertiesStatics2));
+        IFR(spPropertiesStatics2->CreateHevc(&spProperties));
+    }
+    else
+    {
+        IFR(spPropertiesStatics->CreateH264(&spProperties));
+    }
+
+    if (variant.width != 0 && variant.height != 0)
+    {
+        IFR(spProperties->put_Width(variant.width));
+        IFR(spProperties->put_Height(variant.height));
+    }
+
+    ComPtr<IVideoStreamDescriptorFactory> spDescriptorFactory;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_Core_VideoStreamDescriptor).Get(),
+        &spDescriptorFactory));
+
+    ComPtr<IVideoStreamDescriptor> spVideoDescriptor;
+    IFR(spDescriptorFactory->Create(spProperties.Get(), &spVideoDescriptor));
+
+    ComPtr<IMediaStreamDescriptor> spDescriptor;
+    IFR(spVideoDescriptor.As(&spDescriptor));
+
+    ComPtr<IMediaStreamSourceFactory> spSourceFactory;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_Core_MediaStreamSource).Get(),
+        &spSourceFactory));
+
+    IFR(spSourceFactory->CreateFromDescriptor(spDescriptor.Get(), &m_streamSource));
+
+    // every sample is a keyframe, there is nothing to buffer ahead of the first one
+    IFR(m_streamSource->put_BufferTime(ToTimeSpan(0.0)));
+    IFR(m_streamSource->put_CanSeek(false));
+
+    auto sampleRequested = Callback<IMediaStreamSourceSampleRequestedEventHandler>(this, &TrickPlayer::OnSampleRequested);
+    IFR(m_streamSource->add_SampleRequested(sampleRequested.Get(), &m_sampleRequestedToken));
+
+    // a player of its own, in frame server mode like the main one
+    IFR(ActivateInstance(HStringReference(RuntimeClass_Windows_Media_Playback_MediaPlayer).Get(), &m_mediaPlayer));
+    IFR(m_mediaPlayer->put_AutoPlay(false));
+    IFR(m_mediaPlayer->put_IsMuted(true));
+
+    IFR(m_mediaPlayer.As(&m_mediaPlayer5));
+    IFR(m_mediaPlayer5->put_IsVideoFrameServerEnabled(true));
+
+    auto videoFrameAvailable = Callback<IMediaPlayerEventHandler>(this, &TrickPlayer::OnVideoFrameAvailable);
+    IFR(m_mediaPlayer5->add_VideoFrameAvailable(videoFrameAvailable.Get(), &m_videoFrameAvailableToken));
+
+    ComPtr<IMediaSourceStatics> spMediaSourceStatics;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_Core_MediaSource).Get(),
+        &spMediaSourceStatics));
+
+    ComPtr<IMediaSource2> spMediaSource;
+    IFR(spMediaSourceStatics->CreateFromMediaStreamSource(m_streamSource.Get(), &spMediaSource));
+
+    ComPtr<IMediaPlaybackSource> spPlaybackSource;
+    IFR(spMediaSource.As(&spPlaybackSource));
+
+    ComPtr<IMediaPlayerSource2> spPlayerSource;
+    IFR(m_mediaPlayer.As(&spPlayerSource));
+    IFR(spPlayerSource->put_Source(spPlaybackSource.Get()));
+
+    return S_OK;
+}
+
+HRESULT TrickPlayer::Start(double position, double speed)
+{
+    NULL_CHK_HR(m_schedule.get(), E_ILLEGAL_METHOD_CALL);
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_schedule->Start(position, speed);
+        m_shownPosition = position;
+        m_running = true;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_startTime = now.QuadPart;
+
+    // the first thumbnails are fetched while the player opens the stream source
+    QueueFetch();
+
+    return m_mediaPlayer->Play();
+}
+
+void TrickPlayer::SetSpeed(double speed)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_schedule != nullptr)
+    {
+        m_schedule->SetSpeed(speed);
+    }
+}
+
+HRESULT TrickPlayer::Stop(double* pPosition)
+{
+    NULL_CHK(pPosition);
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_running = false;
+        m_readyFrames.clear();
+        *pPosition = m_shownPosition;
+    }
+
+    if (m_mediaPlayer != nullptr)
+    {
+        IFR(m_mediaPlayer->Pause());
+    }
+
+    Log(Log_Level_Info, L"TrickPlayer::Stop() - %llu thumbnails, %.1f kbps of I-frames fetched\n",
+        m_framesQueued, GetFetchedBitsPerSecond() / 1000.0);
+
+    return S_OK;
+}
+
+HRESULT TrickPlayer::CopyFrameToVideoSurface(ABI::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface* pSurface)
+{
+    NULL_CHK(pSurface);
+    NULL_CHK_HR(m_mediaPlayer5.Get(), E_ILLEGAL_METHOD_CALL);
+
+    return m_mediaPlayer5->CopyFrameToVideoSurface(pSurface);
+}
+
+double TrickPlayer::GetFetchedBitsPerSecond() const
+{
+    if (m_startTime == 0)
+        return 0.0;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    double seconds = static_cast<double>(now.QuadPart - m_startTime) / m_qpcFrequency.QuadPart;
+
+    return (seconds > 0.0) ? m_fetchedBytes * 8.0 / seconds : 0.0;
+}
+
+HRESULT TrickPlayer::OnSampleRequested(IMediaStreamSource* sender, IMediaStreamSourceSampleRequestedEventArgs* args)
+{
+    UNREFERENCED_PARAMETER(sender);
+
+    ComPtr<IMediaStreamSourceSampleRequest> spRequest;
+    IFR(args->get_Request(&spRequest));
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        if (!m_readyFrames.empty())
+        {
+            ReadyFrame frame = m_readyFrames.front();
+            m_readyFrames.pop_front();
+            m_shownPosition = frame.position;
+            IFR(spRequest->put_Sample(frame.sample.Get()));
+        }
+        else if (m_running && !m_endOfStream)
+        {
+            // answered by FetchFrames once the next I-frame is in
+            IFR(spRequest->GetDeferral(&m_pendingDeferral));
+            m_pendingRequest = spRequest;
+        }
+        // else no sample, which ends the stream
+    }
+
+    QueueFetch();
+
+    return S_OK;
+}
+
+HRESULT TrickPlayer::OnVideoFrameAvailable(IMediaPlayer* sender, IInspectable* args)
+{
+    UNREFERENCED_PARAMETER(sender);
+    UNREFERENCED_PARAMETER(args);
+
+    if (m_onFrame)
+    {
+        m_onFrame();
+    }
+
+    return S_OK;
+}
+
+void TrickPlayer::QueueFetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_fetching || !m_running || m_endOfStream || m_readyFrames.size() >= TRICK_PLAY_READY_FRAMES)
+            return;
+
+        m_fetching = true;
+    }
+
+    HRESULT hr = m_workQueue.Queue([this]() { FetchFrames(); });
+    if (FAILED(hr))
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_fetching = false;
+    }
+}
+
+// One fetch loop at a time keeps the thumbnails in schedule order
+void TrickPlayer::FetchFrames()
+{
+    for (;;)
+    {
+        size_t index = 0;
+        bool hasNext = false;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_running || m_readyFrames.size() >= TRICK_PLAY_READY_FRAMES)
+            {
+                m_fetching = false;
+                return;
+            }
+
+            hasNext = m_schedule->Next(&index);
+        }
+
+        ReadyFrame frame;
+        HRESULT hr = hasNext ? FetchFrame(index, &frame) : S_FALSE;
+        LOG_RESULT_MSG(hr, L"TrickPlayer - I-frame skipped");
+
+        ComPtr<IMediaStreamSourceSampleRequest> spRequest;
+        ComPtr<IMediaStreamSourceSampleRequestDeferral> spDeferral;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_running)
+            {
+                m_fetching = false;
+                return;
+            }
+
+            if (hr == S_OK)
+            {
+                m_readyFrames.push_back(frame);
+            }
+            else if (!hasNext)
+            {
+                m_endOfStream = true; // scrubbed past either end
+            }
+
+            // a request that waited gets the oldest frame, or nothing at the end of the stream
+            if (m_pendingRequest != nullptr && (!m_readyFrames.empty() || m_endOfStream))
+            {
+                spRequest.Swap(m_pendingRequest);
+                spDeferral.Swap(m_pendingDeferral);
+
+                if (!m_readyFrames.empty())
+                {
+                    LOG_RESULT(spRequest->put_Sample(m_readyFrames.front().sample.Get()));
+                    m_shownPosition = m_readyFrames.front().position;
+                    m_readyFrames.pop_front();
+                }
+            }
+
+            if (m_endOfStream)
+            {
+                m_fetching = false;
+            }
+        }
+
+        if (spDeferral != nullptr)
+        {
+            spDeferral->Complete();
+        }
+
+        if (!hasNext)
+            return;
+    }
+}
+
+HRESULT TrickPlayer::FetchFrame(size_t index, ReadyFrame* pFrame)
+{
+    const HlsSegment& iFrame = m_iFramePlaylist.segments[index];
+
+    // only misses cost bandwidth, a scrub back over the same span is served from the cache
+    bool cached = m_iFrameCache->Contains(SegmentCache::MakeKey(iFrame.uri, iFrame.byteOffset, iFrame.byteLength));
+
+    SegmentBuffer spBytes;
+    // the thumbnails are what is on screen
+    IFR(m_iFrameFetcher->FetchToCache(iFrame.uri, iFrame.byteOffset, iFrame.byteLength, &spBytes, DownloadPriority::VideoNearPlayhead));
+    if (!cached)
+    {
+        m_fetchedBytes += spBytes->size();
+    }
+
+    std::vector<uint8_t> accessUnit;
+    uint8_t streamType = 0;
+    const uint8_t* pInit = (m_initSection != nullptr) ? m_initSection->data() : nullptr;
+    size_t initSize = (m_initSection != nullptr) ? m_initSection->size() : 0;
+    if (!TrickPlay::ExtractAccessUnit(pInit, initSize, spBytes->data(), spBytes->size(), &accessUnit, &streamType))
+        return MF_E_INVALID_FORMAT;
+
+    ComPtr<IBuffer> spBuffer;
+    IFR(CreateBufferFromBytes(accessUnit.data(), static_cast<UINT32>(accessUnit.size()), &spBuffer));
+
+    // output timestamps advance at the thumbnail rate, the player paces the frames by them
+    ComPtr<IMediaStreamSampleStatics> spSampleStatics;
+    IFR(ABI::Windows::Foundation::GetActivationFactory(
+        HStringReference(RuntimeClass_Windows_Media_Core_MediaStreamSample).Get(),
+        &spSampleStatics));
+
+    double frameDuration = 1.0 / TRICK_PLAY_DEFAULT_FRAME_RATE;
+
+    ComPtr<IMediaStreamSample> spSample;
+    IFR(spSampleStatics->CreateFromBuffer(spBuffer.Get(), ToTimeSpan(m_framesQueued * frameDuration), &spSample));
+    IFR(spSample->put_Duration(ToTimeSpan(frameDuration)));
+    IFR(spSample->put_KeyFrame(true));
+
+    m_framesQueued++;
+
+    pFrame->sample = spSample;
+    pFrame->position = iFrame.startTime;
+
+    return S_OK;
+}
@@ -0,0 +1,109 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+#include "pch.h"
+
+#include <windows.media.core.h>
+#include <windows.media.playback.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "PlaylistPrefetcher.h"
+#include "SegmentCache.h"
+#include "ThreadPoolWorkQueue.h"
+#include "TrickPlay.h"
+
+#define TRICK_PLAY_DEFAULT_FRAME_RATE 4.0 // thumbnails per second, whatever the speed
+#define TRICK_PLAY_READY_FRAMES 2 // I-frames decoded ahead of the player's requests
+
+using IMediaStreamSourceSampleRequestedEventHandler = ABI::Windows::Foundation::ITypedEventHandler<
+    ABI::Windows::Media::Core::MediaStreamSource*, ABI::Windows::Media::Core::MediaStreamSourceSampleRequestedEventArgs*>;
+
+// Fast forward and rewind from the EXT-X-I-FRAME-STREAM-INF playlist of an HLS stream. Only the
+// byte ranges of the I-frames picked by a TrickPlaySchedule are fetched, into a byte-budgeted
+// SegmentCache, and their pictures go through a MediaStreamSource into a frame server mode
+// MediaPlayer at the thumbnail rate. One instance covers one scrub, from Start to Stop.
+class TrickPlayer
+{
+public:
+    using FrameAvailableCallback = std::function<void()>;
+
+    TrickPlayer(_In_ std::shared_ptr<SegmentCache> iFrameCache, _In_ PlaylistPrefetcher* pPlaylistPrefetcher);
+    ~TrickPlayer();
+
+    // Resolves the lowest I-frame variant of the content and builds the player. Blocks on
+    // network I/O. onFrame runs on media foundation threads for every decoded thumbnail.
+    HRESULT Initialize(_In_ const std::wstring& url, _In_ FrameAvailableCallback onFrame);
+
+    // position in seconds, speed as a multiple of normal playback, negative rewinds
+    HRESULT Start(double position, double speed);
+    void SetSpeed(double speed);
+
+    // Stops fetching and playback, returns the position of the last thumbnail shown
+    HRESULT Stop(_Out_ double* pPosition);
+
+    HRESULT CopyFrameToVideoSurface(_In_ ABI::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface* pSurface);
+
+    // I-frame bytes fetched from the network per second of scrubbing
+    double GetFetchedBitsPerSecond() const;
+
+private:
+    struct ReadyFrame
+    {
+        Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaStreamSample> sample;
+        double position;
+    };
+
+    HRESULT CreateStreamSource(_In_ const HlsVariant& variant);
+    HRESULT OnSampleRequested(_In_ ABI::Windows::Media::Core::IMediaStreamSource* sender, _In_ ABI::Windows::Media::Core::IMediaStreamSourceSampleRequestedEventArgs* args);
+    HRESULT OnVideoFrameAvailable(_In_ ABI::Windows::Media::Playback::IMediaPlayer* sender, _In_ IInspectable* args);
+
+    void QueueFetch();
+    void FetchFrames();
+    HRESULT FetchFrame(size_t index, _Out_ ReadyFrame* pFrame);
+
+    std::shared_ptr<SegmentCache> m_iFrameCache;
+    PlaylistPrefetcher* m_pPlaylistPrefetcher; // manifests, shared with the main player
+    std::unique_ptr<PlaylistPrefetcher> m_iFrameFetcher; // I-frames, into m_iFrameCache
+
+    HlsMediaPlaylist m_iFramePlaylist;
+    SegmentBuffer m_initSection; // EXT-X-MAP of the I-frame playlist, PAT/PMT
+
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaStreamSource> m_streamSource;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlayer> m_mediaPlayer;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Playback::IMediaPlayer5> m_mediaPlayer5;
+    EventRegistrationToken m_sampleRequestedToken;
+    EventRegistrationToken m_videoFrameAvailableToken;
+    FrameAvailableCallback m_onFrame;
+
+    // guards the schedule and the frame queue, requests and fetches run on different threads
+    std::mutex m_lock;
+    std::unique_ptr<TrickPlaySchedule> m_schedule;
+    std::deque<ReadyFrame> m_readyFrames;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaStreamSourceSampleRequest> m_pendingRequest;
+    Microsoft::WRL::ComPtr<ABI::Windows::Media::Core::IMediaStreamSourceSampleRequestDeferral> m_pendingDeferral;
+    bool m_running;
+    bool m_fetching;
+    bool m_endOfStream;
+    UINT64 m_framesQueued;
+    double m_shownPosition;
+
+    std::atomic<UINT64> m_fetchedBytes;
+    LARGE_INTEGER m_qpcFrequency;
+    LONGLONG m_startTime;
+
+    ThreadPoolWorkQueue m_workQueue; // last, drained in the destructor before anything else goes
+};
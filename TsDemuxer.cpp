@@ -0,0 +1,455 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "TsDemuxer.h"
+
+#include <cstring>
+
+namespace
+{
+    const uint8_t TableIdPat = 0x00;
+    const uint8_t TableIdPmt = 0x02;
+
+    // PES stream ids without the optional PES header (13818-1 table 2-21)
+    bool HasPesHeader(uint8_t streamId)
+    {
+        return streamId != 0xBC && streamId != 0xBE && streamId != 0xBF
+            && streamId != 0xF0 && streamId != 0xF1 && streamId != 0xFF
+            && streamId != 0xF2 && streamId != 0xF8;
+    }
+
+    int64_t ReadTimestamp(const uint8_t* p)
+    {
+        return (static_cast<int64_t>(p[0] & 0x0E) << 29)
+            | (static_cast<int64_t>(p[1]) << 22)
+            | (static_cast<int64_t>(p[2] & 0xFE) << 14)
+            | (static_cast<int64_t>(p[3]) << 7)
+            | (static_cast<int64_t>(p[4]) >> 1);
+    }
+
+    struct CrcTable
+    {
+        uint32_t entries[256];
+
+        CrcTable()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i << 24;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+                }
+                entries[i] = crc;
+            }
+        }
+    };
+}
+
+bool TsElementaryStream::IsAudio() const
+{
+    switch (static_cast<TsStreamType>(streamType))
+    {
+    case TsStreamType::TsStreamType_Mpeg1Audio:
+    case TsStreamType::TsStreamType_Mpeg2Audio:
+    case TsStreamType::TsStreamType_AacAdts:
+    case TsStreamType::TsStreamType_AacLatm:
+    case TsStreamType::TsStreamType_Ac3:
+    case TsStreamType::TsStreamType_Eac3:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TsElementaryStream::IsVideo() const
+{
+    return streamType == static_cast<uint8_t>(TsStreamType::TsStreamType_H264)
+        || streamType == static_cast<uint8_t>(TsStreamType::TsStreamType_Hevc);
+}
+
+uint32_t TsDemuxer::Crc32(const uint8_t* data, size_t size)
+{
+    static const CrcTable table;
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = (crc << 8) ^ table.entries[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+TsDemuxer::TsDemuxer(PesCallback onPes)
+    : m_onPes(std::move(onPes))
+    , m_pids(TS_PID_COUNT)
+    , m_partialSize(0)
+    , m_packetCount(0)
+    , m_continuityErrors(0)
+    , m_syncLosses(0)
+    , m_crcErrors(0)
+{
+    m_pids[0].kind = PidKind::PidKind_Pat;
+}
+
+void TsDemuxer::Reset()
+{
+    m_pids.assign(TS_PID_COUNT, PidState());
+    m_pids[0].kind = PidKind::PidKind_Pat;
+    m_streams.clear();
+    m_partialSize = 0;
+}
+
+void TsDemuxer::Push(const uint8_t* data, size_t size)
+{
+    if (data == nullptr)
+        return;
+
+    // complete a packet split across calls
+    if (m_partialSize > 0)
+    {
+        size_t needed = TS_PACKET_SIZE - m_partialSize;
+        size_t take = (size < needed) ? size : needed;
+        memcpy(m_partial + m_partialSize, data, take);
+        m_partialSize += take;
+        data += take;
+        size -= take;
+
+        if (m_partialSize < TS_PACKET_SIZE)
+            return;
+
+        m_partialSize = 0;
+        if (m_partial[0] == TS_SYNC_BYTE)
+        {
+            ParsePacket(m_partial);
+        }
+    }
+
+    size_t pos = 0;
+    while (pos + TS_PACKET_SIZE <= size)
+    {
+        if (data[pos] != TS_SYNC_BYTE
+            || (pos + 2 * TS_PACKET_SIZE <= size && data[pos + TS_PACKET_SIZE] != TS_SYNC_BYTE))
+        {
+            // resync on a sync byte that repeats one packet later
+            m_syncLosses++;
+            do
+            {
+                pos++;
+            } while (pos + TS_PACKET_SIZE <= size
+                && !(data[pos] == TS_SYNC_BYTE && (pos + TS_PACKET_SIZE >= size || data[pos + TS_PACKET_SIZE] == TS_SYNC_BYTE)));
+            continue;
+        }
+
+        ParsePacket(data + pos);
+        pos += TS_PACKET_SIZE;
+    }
+
+    if (pos < size)
+    {
+        m_partialSize = size - pos;
+        memcpy(m_partial, data + pos, m_partialSize);
+    }
+}
+
+void TsDemuxer::Flush()
+{
+    for (uint16_t pid = 0; pid < TS_PID_COUNT; ++pid)
+    {
+        PidState& state = m_pids[pid];
+        if (state.kind == PidKind::PidKind_Pes && state.started)
+        {
+            EmitPes(pid, state);
+        }
+    }
+    m_partialSize = 0;
+}
+
+void TsDemuxer::ParsePacket(const uint8_t* packet)
+{
+    m_packetCount++;
+
+    bool transportError = (packet[1] & 0x80) != 0;
+    bool unitStart = (packet[1] & 0x40) != 0;
+    uint16_t pid = static_cast<uint16_t>(((packet[1] & 0x1F) << 8) | packet[2]);
+    uint8_t adaptationControl = (packet[3] >> 4) & 0x03;
+    uint8_t continuity = packet[3] & 0x0F;
+
+    PidState& state = m_pids[pid];
+    if (transportError || state.kind == PidKind::PidKind_None)
+        return;
+
+    bool hasPayload = (adaptationControl & 0x01) != 0;
+    size_t offset = 4;
+    bool discontinuityFlag = false;
+    if (adaptationControl & 0x02)
+    {
+        uint8_t adaptationLength = packet[4];
+        if (adaptationLength > 0)
+        {
+            discontinuityFlag = (packet[5] & 0x80) != 0;
+        }
+        offset += 1 + adaptationLength;
+    }
+
+    // the counter only advances with payload, a repeat is a duplicate packet
+    if (hasPayload)
+    {
+        if (state.lastContinuity >= 0 && !discontinuityFlag)
+        {
+            uint8_t expected = (state.lastContinuity + 1) & 0x0F;
+            if (continuity == state.lastContinuity)
+                return;
+            if (continuity != expected)
+            {
+                m_continuityErrors++;
+                state.discontinuity = true;
+                // the unit in progress has a hole, drop it
+                if (!unitStart)
+                {
+                    state.started = false;
+                    state.buffer.clear();
+                }
+            }
+        }
+        state.lastContinuity = static_cast<int8_t>(continuity);
+    }
+
+    if (discontinuityFlag)
+    {
+        state.discontinuity = true;
+    }
+
+    if (!hasPayload || offset >= TS_PACKET_SIZE)
+        return;
+
+    const uint8_t* payload = packet + offset;
+    size_t payloadSize = TS_PACKET_SIZE - offset;
+
+    if (state.kind == PidKind::PidKind_Pes)
+    {
+        if (unitStart)
+        {
+            if (state.started)
+            {
+                EmitPes(pid, state);
+            }
+            state.buffer.clear();
+            state.started = true;
+        }
+
+        if (!state.started)
+            return;
+
+        state.buffer.insert(state.buffer.end(), payload, payload + payloadSize);
+
+        // bounded PES are complete as soon as all bytes are in, no need to wait for the next unit
+        if (state.buffer.size() >= 6)
+        {
+            size_t pesLength = (static_cast<size_t>(state.buffer[4]) << 8) | state.buffer[5];
+            if (pesLength != 0 && state.buffer.size() >= pesLength + 6)
+            {
+                EmitPes(pid, state);
+            }
+        }
+    }
+    else
+    {
+        OnPsi(state, payload, payloadSize, unitStart);
+    }
+}
+
+void TsDemuxer::OnPsi(PidState& state, const uint8_t* payload, size_t size, bool unitStart)
+{
+    if (unitStart)
+    {
+        uint8_t pointer = payload[0];
+        if (1 + static_cast<size_t>(pointer) > size)
+            return;
+
+        // the bytes before the pointer finish the previous section
+        if (state.started && pointer > 0)
+        {
+            state.buffer.insert(state.buffer.end(), payload + 1, payload + 1 + pointer);
+            ParseSection(state);
+        }
+
+        state.buffer.assign(payload + 1 + pointer, payload + size);
+        state.started = true;
+    }
+    else if (state.started)
+    {
+        state.buffer.insert(state.buffer.end(), payload, payload + size);
+    }
+
+    if (state.started)
+    {
+        ParseSection(state);
+    }
+}
+
+void TsDemuxer::ParseSection(PidState& state)
+{
+    if (state.buffer.size() < 3)
+        return;
+
+    // 0xFF is stuffing after the last section
+    if (state.buffer[0] == 0xFF)
+    {
+        state.started = false;
+        state.buffer.clear();
+        return;
+    }
+
+    size_t sectionLength = ((static_cast<size_t>(state.buffer[1]) & 0x0F) << 8) | state.buffer[2];
+    size_t total = 3 + sectionLength;
+    if (state.buffer.size() < total)
+        return;
+
+    const uint8_t* section = state.buffer.data();
+    if (sectionLength < 9 || Crc32(section, total) != 0)
+    {
+        m_crcErrors++;
+    }
+    else if (state.kind == PidKind::PidKind_Pat && section[0] == TableIdPat)
+    {
+        ParsePat(section, total);
+    }
+    else if (state.kind == PidKind::PidKind_Pmt && section[0] == TableIdPmt)
+    {
+        ParsePmt(section, total);
+    }
+
+    state.started = false;
+    state.buffer.clear();
+}
+
+void TsDemuxer::ParsePat(const uint8_t* section, size_t size)
+{
+    // 8 byte header, 4 byte entries, 4 byte CRC
+    for (size_t pos = 8; pos + 4 <= size - 4; pos += 4)
+    {
+        uint16_t program = static_cast<uint16_t>((section[pos] << 8) | section[pos + 1]);
+        uint16_t pid = static_cast<uint16_t>(((section[pos + 2] & 0x1F) << 8) | section[pos + 3]);
+        if (program == 0)
+            continue; // network information table
+
+        if (m_pids[pid].kind == PidKind::PidKind_None)
+        {
+            m_pids[pid].kind = PidKind::PidKind_Pmt;
+        }
+    }
+}
+
+void TsDemuxer::ParsePmt(const uint8_t* section, size_t size)
+{
+    if (size < 16)
+        return;
+
+    size_t programInfoLength = ((static_cast<size_t>(section[10]) & 0x0F) << 8) | section[11];
+    size_t pos = 12 + programInfoLength;
+    size_t end = size - 4;
+
+    while (pos + 5 <= end)
+    {
+        uint8_t streamType = section[pos];
+        uint16_t pid = static_cast<uint16_t>(((section[pos + 1] & 0x1F) << 8) | section[pos + 2]);
+        size_t esInfoLength = ((static_cast<size_t>(section[pos + 3]) & 0x0F) << 8) | section[pos + 4];
+        pos += 5 + esInfoLength;
+
+        PidState& state = m_pids[pid];
+        if (state.kind == PidKind::PidKind_Pes && state.streamType == streamType)
+            continue;
+        if (state.kind == PidKind::PidKind_Pat || state.kind == PidKind::PidKind_Pmt)
+            continue;
+
+        state.kind = PidKind::PidKind_Pes;
+        state.streamType = streamType;
+
+        bool known = false;
+        for (auto& stream : m_streams)
+        {
+            if (stream.pid == pid)
+            {
+                stream.streamType = streamType;
+                known = true;
+            }
+        }
+        if (!known)
+        {
+            m_streams.push_back({ pid, streamType });
+        }
+    }
+}
+
+void TsDemuxer::EmitPes(uint16_t pid, PidState& state)
+{
+    state.started = false;
+
+    const std::vector<uint8_t>& buffer = state.buffer;
+    if (buffer.size() < 6 || buffer[0] != 0x00 || buffer[1] != 0x00 || buffer[2] != 0x01)
+    {
+        state.buffer.clear();
+        return;
+    }
+
+    PesPacket packet = {};
+    packet.pid = pid;
+    packet.streamType = state.streamType;
+    packet.streamId = buffer[3];
+    packet.discontinuity = state.discontinuity;
+
+    size_t pesLength = (static_cast<size_t>(buffer[4]) << 8) | buffer[5];
+    size_t end = (pesLength != 0 && pesLength + 6 <= buffer.size()) ? pesLength + 6 : buffer.size();
+    size_t payloadStart = 6;
+
+    if (HasPesHeader(packet.streamId))
+    {
+        if (buffer.size() < 9)
+        {
+            state.buffer.clear();
+            return;
+        }
+
+        uint8_t ptsDtsFlags = buffer[7] >> 6;
+        size_t headerLength = buffer[8];
+        payloadStart = 9 + headerLength;
+
+        if ((ptsDtsFlags & 0x02) && 9 + 5 <= payloadStart)
+        {
+            packet.hasPts = true;
+            packet.pts = ReadTimestamp(&buffer[9]);
+        }
+        if (ptsDtsFlags == 0x03 && 14 + 5 <= payloadStart)
+        {
+            packet.hasDts = true;
+            packet.dts = ReadTimestamp(&buffer[14]);
+        }
+        if (!packet.hasDts)
+        {
+            packet.dts = packet.pts;
+        }
+    }
+
+    if (payloadStart <= end)
+    {
+        packet.data = buffer.data() + payloadStart;
+        packet.size = end - payloadStart;
+
+        if (m_onPes)
+        {
+            m_onPes(packet);
+        }
+    }
+
+    state.discontinuity = false;
+    state.buffer.clear();
+}
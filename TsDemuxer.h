@@ -0,0 +1,126 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable MPEG-2 transport stream demuxer (ISO/IEC 13818-1): PAT/PMT, PES reassembly and
+// PTS/DTS extraction. No Windows dependencies. Input may arrive in chunks of any size, PES
+// payloads are handed out as views into a per-PID buffer that is reused across packets.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_COUNT 8192
+
+enum class TsStreamType : uint8_t
+{
+    TsStreamType_Mpeg1Audio = 0x03,
+    TsStreamType_Mpeg2Audio = 0x04,
+    TsStreamType_AacAdts = 0x0F,
+    TsStreamType_Id3Metadata = 0x15,
+    TsStreamType_AacLatm = 0x11,
+    TsStreamType_H264 = 0x1B,
+    TsStreamType_Hevc = 0x24,
+    TsStreamType_Ac3 = 0x81,
+    TsStreamType_Eac3 = 0x87
+};
+
+struct TsElementaryStream
+{
+    uint16_t pid;
+    uint8_t streamType;
+
+    bool IsAudio() const;
+    bool IsVideo() const;
+};
+
+struct PesPacket
+{
+    uint16_t pid;
+    uint8_t streamType;
+    uint8_t streamId;
+    bool hasPts;
+    bool hasDts;
+    int64_t pts;            // 90 kHz, 33 bits
+    int64_t dts;            // equals pts when the stream carries none
+    bool discontinuity;     // continuity counter gap or adaptation field flag since the last packet
+    const uint8_t* data;    // elementary stream bytes, valid during the callback only
+    size_t size;
+};
+
+class TsDemuxer
+{
+public:
+    using PesCallback = std::function<void(const PesPacket&)>;
+
+    explicit TsDemuxer(PesCallback onPes);
+
+    // Feeds transport stream bytes, chunk boundaries need not be packet aligned
+    void Push(const uint8_t* data, size_t size);
+
+    // Emits PES packets still being reassembled, call at the end of a segment
+    void Flush();
+
+    // Forgets programs, streams and partial data
+    void Reset();
+
+    const std::vector<TsElementaryStream>& Streams() const { return m_streams; }
+
+    uint64_t PacketCount() const { return m_packetCount; }
+    uint64_t ContinuityErrors() const { return m_continuityErrors; }
+    uint64_t SyncLosses() const { return m_syncLosses; }
+    uint64_t CrcErrors() const { return m_crcErrors; }
+
+    // CRC-32/MPEG-2 as used by PSI sections, 0 over a section including its CRC
+    static uint32_t Crc32(const uint8_t* data, size_t size);
+
+private:
+    enum class PidKind : uint8_t
+    {
+        PidKind_None = 0,
+        PidKind_Pat,
+        PidKind_Pmt,
+        PidKind_Pes
+    };
+
+    struct PidState
+    {
+        PidKind kind = PidKind::PidKind_None;
+        uint8_t streamType = 0;
+        int8_t lastContinuity = -1;
+        bool started = false;        // a unit start was seen, buffer holds a unit
+        bool discontinuity = false;
+        std::vector<uint8_t> buffer; // PES or PSI section being reassembled
+    };
+
+    void ParsePacket(const uint8_t* packet);
+    void OnPsi(PidState& state, const uint8_t* payload, size_t size, bool unitStart);
+    void ParseSection(PidState& state);
+    void ParsePat(const uint8_t* section, size_t size);
+    void ParsePmt(const uint8_t* section, size_t size);
+    void EmitPes(uint16_t pid, PidState& state);
+
+    PesCallback m_onPes;
+    std::vector<PidState> m_pids; // indexed by PID
+    std::vector<TsElementaryStream> m_streams;
+
+    uint8_t m_partial[TS_PACKET_SIZE];
+    size_t m_partialSize;
+
+    uint64_t m_packetCount;
+    uint64_t m_continuityErrors;
+    uint64_t m_syncLosses;
+    uint64_t m_crcErrors;
+};
@@ -0,0 +1,594 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "WebVtt.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const int64_t MpegTsWrap = 1LL << 33;
+    const double DuplicateTolerance = 0.001; // seconds
+
+    // Splits on \n, \r\n and \r
+    class LineReader
+    {
+    public:
+        LineReader(const char* data, size_t size) : m_data(data), m_size(size), m_pos(0) {}
+
+        bool Next(const char** pLine, size_t* pLength)
+        {
+            if (m_pos >= m_size)
+                return false;
+
+            size_t start = m_pos;
+            while (m_pos < m_size && m_data[m_pos] != '\n' && m_data[m_pos] != '\r')
+            {
+                m_pos++;
+            }
+
+            *pLine = m_data + start;
+            *pLength = m_pos - start;
+
+            if (m_pos < m_size && m_data[m_pos++] == '\r' && m_pos < m_size && m_data[m_pos] == '\n')
+            {
+                m_pos++;
+            }
+
+            return true;
+        }
+
+    private:
+        const char* m_data;
+        size_t m_size;
+        size_t m_pos;
+    };
+
+    bool StartsWithKeyword(const char* line, size_t length, const char* keyword)
+    {
+        size_t keywordLength = strlen(keyword);
+        if (length < keywordLength || memcmp(line, keyword, keywordLength) != 0)
+            return false;
+
+        return length == keywordLength || line[keywordLength] == ' ' || line[keywordLength] == '\t';
+    }
+
+    const char* FindArrow(const char* line, size_t length)
+    {
+        for (size_t i = 0; i + 3 <= length; ++i)
+        {
+            if (line[i] == '-' && line[i + 1] == '-' && line[i + 2] == '>')
+                return line + i;
+        }
+
+        return nullptr;
+    }
+
+    size_t SkipBlanks(const char* line, size_t length, size_t pos)
+    {
+        while (pos < length && (line[pos] == ' ' || line[pos] == '\t'))
+        {
+            pos++;
+        }
+
+        return pos;
+    }
+
+    // "start --> end settings"
+    bool ParseTimingLine(const char* line, size_t length, double* pStart, double* pEnd, std::string* pSettings)
+    {
+        size_t pos = SkipBlanks(line, length, 0);
+        size_t used = WebVtt::ParseTimestamp(line + pos, length - pos, pStart);
+        if (used == 0)
+            return false;
+
+        pos = SkipBlanks(line, length, pos + used);
+        if (pos + 3 > length || memcmp(line + pos, "-->", 3) != 0)
+            return false;
+
+        pos = SkipBlanks(line, length, pos + 3);
+        used = WebVtt::ParseTimestamp(line + pos, length - pos, pEnd);
+        if (used == 0)
+            return false;
+
+        pos = SkipBlanks(line, length, pos + used);
+        pSettings->assign(line + pos, length - pos);
+
+        return true;
+    }
+
+    // X-TIMESTAMP-MAP=MPEGTS:<90 kHz>,LOCAL:<timestamp>, in either order
+    bool ParseTimestampMap(const char* line, size_t length, int64_t* pMpegTs, double* pLocal)
+    {
+        const char prefix[] = "X-TIMESTAMP-MAP=";
+        size_t prefixLength = sizeof(prefix) - 1;
+        if (length < prefixLength || memcmp(line, prefix, prefixLength) != 0)
+            return false;
+
+        bool hasMpegTs = false;
+        bool hasLocal = false;
+        size_t pos = prefixLength;
+        while (pos < length)
+        {
+            size_t end = pos;
+            while (end < length && line[end] != ',')
+            {
+                end++;
+            }
+
+            if (end - pos > 7 && memcmp(line + pos, "MPEGTS:", 7) == 0)
+            {
+                int64_t value = 0;
+                size_t digits = 0;
+                for (size_t i = pos + 7; i < end && line[i] >= '0' && line[i] <= '9'; ++i, ++digits)
+                {
+                    value = value * 10 + (line[i] - '0');
+                }
+                *pMpegTs = value;
+                hasMpegTs = digits != 0;
+            }
+            else if (end - pos > 6 && memcmp(line + pos, "LOCAL:", 6) == 0)
+            {
+                hasLocal = WebVtt::ParseTimestamp(line + pos + 6, end - pos - 6, pLocal) != 0;
+            }
+
+            pos = end + 1;
+        }
+
+        return hasMpegTs && hasLocal;
+    }
+}
+
+size_t WebVtt::ParseTimestamp(const char* data, size_t size, double* pSeconds)
+{
+    // up to three colon separated fields, the last one followed by ".ttt"
+    uint64_t fields[3] = {};
+    size_t fieldCount = 0;
+    size_t pos = 0;
+
+    for (;;)
+    {
+        size_t digits = 0;
+        uint64_t value = 0;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9' && digits < 10)
+        {
+            value = value * 10 + static_cast<uint64_t>(data[pos] - '0');
+            pos++;
+            digits++;
+        }
+
+        if (digits == 0 || fieldCount == 3)
+            return 0;
+
+        // minutes and seconds take exactly two digits, hours at least two
+        bool first = fieldCount == 0;
+        if ((!first && digits != 2) || (first && digits < 2))
+            return 0;
+
+        fields[fieldCount++] = value;
+
+        if (pos < size && data[pos] == ':')
+        {
+            pos++;
+            continue;
+        }
+
+        break;
+    }
+
+    if (fieldCount < 2 || pos + 4 > size || data[pos] != '.')
+        return 0;
+
+    uint32_t milliseconds = 0;
+    for (size_t i = 1; i <= 3; ++i)
+    {
+        char c = data[pos + i];
+        if (c < '0' || c > '9')
+            return 0;
+        milliseconds = milliseconds * 10 + static_cast<uint32_t>(c - '0');
+    }
+
+    uint64_t hours = (fieldCount == 3) ? fields[0] : 0;
+    uint64_t minutes = fields[fieldCount - 2];
+    uint64_t seconds = fields[fieldCount - 1];
+    if (minutes > 59 || seconds > 59 || (fieldCount == 2 && fields[0] > 59))
+        return 0;
+
+    *pSeconds = static_cast<double>(hours * 3600 + minutes * 60 + seconds) + milliseconds / 1000.0;
+
+    return pos + 4;
+}
+
+WebVttCueIndex::WebVttCueIndex()
+    : m_indexed(0)
+    , m_maxLevel(-1)
+    , m_generation(0)
+    , m_end(0.0)
+    , m_origin(0)
+    , m_hasOrigin(false)
+{
+}
+
+void WebVttCueIndex::SetMpegTsOrigin(int64_t origin)
+{
+    m_origin = origin;
+    m_hasOrigin = true;
+}
+
+void WebVttCueIndex::Clear()
+{
+    m_cues.clear();
+    m_nodes.clear();
+    m_arena.clear();
+    m_indexed = 0;
+    m_maxLevel = -1;
+    m_generation++;
+    m_end = 0.0;
+    m_hasOrigin = false;
+}
+
+size_t WebVttCueIndex::SizeBytes() const
+{
+    return sizeof(*this) + m_cues.capacity() * sizeof(WebVttCue) + m_nodes.capacity() * sizeof(Node) + m_arena.capacity();
+}
+
+std::string WebVttCueIndex::GetText(uint32_t id) const
+{
+    const WebVttCue& cue = m_cues[id];
+    uint32_t end = (id + 1 < m_cues.size()) ? m_cues[id + 1].idOffset : static_cast<uint32_t>(m_arena.size());
+    return m_arena.substr(cue.textOffset, end - cue.textOffset);
+}
+
+std::string WebVttCueIndex::GetId(uint32_t id) const
+{
+    return m_arena.substr(m_cues[id].idOffset, m_cues[id].idLength);
+}
+
+std::string WebVttCueIndex::GetSettings(uint32_t id) const
+{
+    return m_arena.substr(m_cues[id].settingsOffset, m_cues[id].settingsLength);
+}
+
+bool WebVttCueIndex::Append(const uint8_t* data, size_t size, size_t* pAdded)
+{
+    if (pAdded != nullptr)
+    {
+        *pAdded = 0;
+    }
+
+    const char* text = reinterpret_cast<const char*>(data);
+    if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0)
+    {
+        text += 3;
+        size -= 3;
+    }
+
+    LineReader reader(text, size);
+    const char* line = nullptr;
+    size_t length = 0;
+    if (text == nullptr || !reader.Next(&line, &length) || !StartsWithKeyword(line, length, "WEBVTT"))
+        return false;
+
+    // header, up to the first blank line
+    double offset = 0.0;
+    while (reader.Next(&line, &length) && length != 0)
+    {
+        int64_t mpegTs = 0;
+        double local = 0.0;
+        if (ParseTimestampMap(line, length, &mpegTs, &local))
+        {
+            if (!m_hasOrigin)
+            {
+                SetMpegTsOrigin(mpegTs - static_cast<int64_t>(local * 90000.0 + 0.5));
+            }
+
+            // the 33-bit MPEG-TS clock may have wrapped since the origin
+            int64_t elapsed = (mpegTs - m_origin) & (MpegTsWrap - 1);
+            if (elapsed >= MpegTsWrap / 2)
+            {
+                elapsed -= MpegTsWrap;
+            }
+            offset = elapsed / 90000.0 - local;
+        }
+    }
+
+    size_t added = 0;
+    std::string id;
+    std::string settings;
+    std::string cueText;
+
+    bool hasLine = reader.Next(&line, &length);
+    while (hasLine)
+    {
+        if (length == 0)
+        {
+            hasLine = reader.Next(&line, &length);
+            continue;
+        }
+
+        // comment, style and region blocks run to the next blank line
+        if (StartsWithKeyword(line, length, "NOTE") || StartsWithKeyword(line, length, "STYLE") || StartsWithKeyword(line, length, "REGION"))
+        {
+            while ((hasLine = reader.Next(&line, &length)) && length != 0) {}
+            continue;
+        }
+
+        id.clear();
+        if (FindArrow(line, length) == nullptr)
+        {
+            id.assign(line, length);
+            if (!(hasLine = reader.Next(&line, &length)) || length == 0)
+                continue;
+        }
+
+        double start = 0.0;
+        double end = 0.0;
+        if (!ParseTimingLine(line, length, &start, &end, &settings))
+        {
+            // not a cue, skip the block
+            while ((hasLine = reader.Next(&line, &length)) && length != 0) {}
+            continue;
+        }
+
+        // payload up to a blank line, a line with "-->" starts the next cue
+        cueText.clear();
+        while ((hasLine = reader.Next(&line, &length)) && length != 0 && FindArrow(line, length) == nullptr)
+        {
+            if (!cueText.empty())
+            {
+                cueText += '\n';
+            }
+            cueText.append(line, length);
+        }
+
+        if (end > start)
+        {
+            AddCue(start + offset, end + offset, id, settings, cueText, &added);
+        }
+    }
+
+    // the tail is scanned by every lookup, fold it into the tree once it grows
+    if (m_nodes.size() - m_indexed > WEBVTT_INDEX_TAIL_CUES)
+    {
+        BuildTree();
+    }
+
+    if (pAdded != nullptr)
+    {
+        *pAdded = added;
+    }
+
+    return true;
+}
+
+void WebVttCueIndex::AddCue(double start, double end, const std::string& id, const std::string& settings, const std::string& text, size_t* pAdded)
+{
+    if (IsDuplicate(start, end, text))
+        return;
+
+    WebVttCue cue = {};
+    cue.start = start;
+    cue.end = end;
+    cue.idOffset = static_cast<uint32_t>(m_arena.size());
+    cue.idLength = static_cast<uint16_t>((std::min)(id.size(), size_t(UINT16_MAX)));
+    m_arena.append(id, 0, cue.idLength);
+    cue.settingsOffset = static_cast<uint32_t>(m_arena.size());
+    cue.settingsLength = static_cast<uint16_t>((std::min)(settings.size(), size_t(UINT16_MAX)));
+    m_arena.append(settings, 0, cue.settingsLength);
+    cue.textOffset = static_cast<uint32_t>(m_arena.size());
+    m_arena.append(text);
+
+    uint32_t cueId = static_cast<uint32_t>(m_cues.size());
+    m_cues.push_back(cue);
+
+    // in order appends go to the end, an earlier cue shifts the nodes after it
+    size_t position = UpperBound(start);
+    m_nodes.insert(m_nodes.begin() + position, { start, end, end, cueId });
+    if (position + 1 != m_nodes.size())
+    {
+        m_generation++;
+    }
+    if (position < m_indexed)
+    {
+        m_indexed = 0; // the tree no longer matches, everything is tail until the next build
+        m_maxLevel = -1;
+    }
+
+    m_end = (std::max)(m_end, end);
+    (*pAdded)++;
+}
+
+bool WebVttCueIndex::IsDuplicate(double start, double end, const std::string& text) const
+{
+    size_t i = UpperBound(start - DuplicateTolerance);
+    for (; i < m_nodes.size() && m_nodes[i].start <= start + DuplicateTolerance; ++i)
+    {
+        const Node& node = m_nodes[i];
+        if (node.end < end - DuplicateTolerance || node.end > end + DuplicateTolerance)
+            continue;
+
+        uint32_t cueEnd = (node.cue + 1 < m_cues.size()) ? m_cues[node.cue + 1].idOffset : static_cast<uint32_t>(m_arena.size());
+        const WebVttCue& cue = m_cues[node.cue];
+        if (cueEnd - cue.textOffset == text.size() && m_arena.compare(cue.textOffset, text.size(), text) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+size_t WebVttCueIndex::UpperBound(double time) const
+{
+    auto it = std::upper_bound(m_nodes.begin(), m_nodes.end(), time,
+        [](double value, const Node& node) { return value < node.start; });
+
+    return static_cast<size_t>(it - m_nodes.begin());
+}
+
+// Implicit interval tree: the sorted array is an in-order layout of a complete binary tree,
+// node i is at the level of its trailing one bits and keeps the latest end of its subtree.
+void WebVttCueIndex::BuildTree()
+{
+    size_t n = m_nodes.size();
+    m_indexed = n;
+    m_maxLevel = -1;
+    if (n == 0)
+        return;
+
+    size_t lastIndex = 0;
+    double last = 0.0;
+    for (size_t i = 0; i < n; i += 2)
+    {
+        lastIndex = i;
+        last = m_nodes[i].maxEnd = m_nodes[i].end;
+    }
+
+    int level = 1;
+    for (; (size_t(1) << level) <= n; ++level)
+    {
+        size_t x = size_t(1) << (level - 1);
+        size_t step = x << 2;
+        for (size_t i = (x << 1) - 1; i < n; i += step)
+        {
+            double left = m_nodes[i - x].maxEnd;
+            double right = (i + x < n) ? m_nodes[i + x].maxEnd : last;
+            m_nodes[i].maxEnd = (std::max)({ m_nodes[i].end, left, right });
+        }
+
+        // the right spine past n borrows the latest end of the last real subtree
+        lastIndex = ((lastIndex >> level) & 1) ? lastIndex - x : lastIndex + x;
+        if (lastIndex < n && m_nodes[lastIndex].maxEnd > last)
+        {
+            last = m_nodes[lastIndex].maxEnd;
+        }
+    }
+
+    m_maxLevel = level - 1;
+}
+
+size_t WebVttCueIndex::FindActive(double time, std::vector<uint32_t>* pCues) const
+{
+    if (pCues == nullptr)
+        return 0;
+
+    pCues->clear();
+
+    if (m_maxLevel >= 0)
+    {
+        struct Frame
+        {
+            size_t x;
+            int level;
+            bool leftDone;
+        };
+
+        Frame stack[64];
+        int top = 0;
+        stack[top++] = { (size_t(1) << m_maxLevel) - 1, m_maxLevel, false };
+
+        while (top > 0)
+        {
+            Frame frame = stack[--top];
+            if (frame.level <= 3)
+            {
+                // small subtrees are cheaper to scan than to descend
+                size_t first = frame.x >> frame.level << frame.level;
+                size_t last = (std::min)(first + (size_t(1) << (frame.level + 1)) - 1, m_indexed);
+                for (size_t i = first; i < last && m_nodes[i].start <= time; ++i)
+                {
+                    if (time < m_nodes[i].end)
+                    {
+                        pCues->push_back(m_nodes[i].cue);
+                    }
+                }
+            }
+            else if (!frame.leftDone)
+            {
+                size_t left = frame.x - (size_t(1) << (frame.level - 1));
+                stack[top++] = { frame.x, frame.level, true };
+                if (left >= m_indexed || m_nodes[left].maxEnd > time)
+                {
+                    stack[top++] = { left, frame.level - 1, false };
+                }
+            }
+            else if (frame.x < m_indexed && m_nodes[frame.x].start <= time)
+            {
+                if (time < m_nodes[frame.x].end)
+                {
+                    pCues->push_back(m_nodes[frame.x].cue);
+                }
+                stack[top++] = { frame.x + (size_t(1) << (frame.level - 1)), frame.level - 1, false };
+            }
+        }
+    }
+
+    for (size_t i = m_indexed; i < m_nodes.size() && m_nodes[i].start <= time; ++i)
+    {
+        if (time < m_nodes[i].end)
+        {
+            pCues->push_back(m_nodes[i].cue);
+        }
+    }
+
+    return pCues->size();
+}
+
+bool WebVttCueIndex::Advance(double time, WebVttCursor* pCursor) const
+{
+    if (pCursor == nullptr)
+        return false;
+
+    if (pCursor->generation == m_generation && time >= pCursor->time)
+    {
+        // walk the cues that started since the last call, a long walk is a seek
+        size_t next = pCursor->nextNode;
+        size_t stop = (std::min)(m_nodes.size(), next + WEBVTT_CURSOR_MAX_STEP);
+        while (next < stop && m_nodes[next].start <= time)
+        {
+            next++;
+        }
+
+        if (next == m_nodes.size() || m_nodes[next].start > time)
+        {
+            std::vector<uint32_t>& active = pCursor->active;
+            size_t before = active.size();
+            auto ended = std::remove_if(active.begin(), active.end(),
+                [&](uint32_t cue) { return m_cues[cue].end <= time; });
+            active.erase(ended, active.end());
+            bool changed = active.size() != before;
+
+            for (size_t i = pCursor->nextNode; i < next; ++i)
+            {
+                if (time < m_nodes[i].end)
+                {
+                    active.push_back(m_nodes[i].cue);
+                    changed = true;
+                }
+            }
+
+            pCursor->nextNode = next;
+            pCursor->time = time;
+
+            return changed;
+        }
+    }
+
+    std::vector<uint32_t> active;
+    FindActive(time, &active);
+
+    bool changed = active != pCursor->active;
+    pCursor->active.swap(active);
+    pCursor->nextNode = UpperBound(time);
+    pCursor->generation = m_generation;
+    pCursor->time = time;
+
+    return changed;
+}
@@ -0,0 +1,110 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// Portable WebVTT cue store for HLS subtitle renditions. Whole files and live subtitle segments
+// are appended as they arrive. Cue strings live in one arena, and an implicit interval tree over
+// the cues sorted by start time answers "which cues are active at t" in O(log n + k). A cursor
+// follows forward playback in constant time per frame. Not thread-safe.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define WEBVTT_INDEX_TAIL_CUES 64 // cues appended after the last tree build, scanned linearly
+#define WEBVTT_CURSOR_MAX_STEP 16 // cues a cursor walks past before it falls back to a tree lookup
+
+// 32 bytes, strings are offsets into the arena of the index
+struct WebVttCue
+{
+    double start;               // seconds, on the timeline of the first X-TIMESTAMP-MAP
+    double end;
+    uint32_t idOffset;
+    uint32_t textOffset;        // lines joined with '\n'
+    uint32_t settingsOffset;    // everything after the end timestamp
+    uint16_t idLength;
+    uint16_t settingsLength;
+};
+
+// Active cues at the last time a WebVttCueIndex moved it to, by ascending start time
+struct WebVttCursor
+{
+    double time = -1.0;
+    std::vector<uint32_t> active; // cue ids
+    size_t nextNode = 0;        // first cue by start time not reached yet
+    uint64_t generation = UINT64_MAX;
+};
+
+class WebVttCueIndex
+{
+public:
+    WebVttCueIndex();
+
+    // Parses a WebVTT file or segment and adds its cues. Cues that repeat one already in the
+    // index, as live segments do for cues spanning a boundary, are dropped. False if the data
+    // is not WebVTT.
+    bool Append(const uint8_t* data, size_t size, size_t* pAdded = nullptr);
+
+    // MPEG-TS time (90 kHz) of timeline 0. Defaults to the first X-TIMESTAMP-MAP seen, minus
+    // its LOCAL time.
+    void SetMpegTsOrigin(int64_t origin);
+
+    void Clear();
+
+    // Ids of the cues with start <= time < end, by ascending start time
+    size_t FindActive(double time, std::vector<uint32_t>* pCues) const;
+
+    // Moves the cursor to time, true if its active cues changed. A step forward costs O(1 + k).
+    // Steps back, long jumps and appends that reorder cues fall back to FindActive.
+    bool Advance(double time, WebVttCursor* pCursor) const;
+
+    size_t Size() const { return m_cues.size(); }
+    size_t SizeBytes() const;
+    double End() const { return m_end; }
+
+    const WebVttCue& GetCue(uint32_t id) const { return m_cues[id]; }
+    std::string GetText(uint32_t id) const;
+    std::string GetId(uint32_t id) const;
+    std::string GetSettings(uint32_t id) const;
+
+private:
+    struct Node
+    {
+        double start;
+        double end;
+        double maxEnd;          // latest end in the node's subtree, valid below m_indexed
+        uint32_t cue;
+    };
+
+    void AddCue(double start, double end, const std::string& id, const std::string& settings, const std::string& text, size_t* pAdded);
+    bool IsDuplicate(double start, double end, const std::string& text) const;
+    void BuildTree();
+    size_t UpperBound(double time) const;
+
+    std::vector<WebVttCue> m_cues; // in arrival order, ids are stable
+    std::vector<Node> m_nodes;  // by start time
+    std::string m_arena;
+    size_t m_indexed;           // m_nodes below this are covered by the tree
+    int m_maxLevel;
+    uint64_t m_generation;      // bumped when node positions shift
+    double m_end;
+    int64_t m_origin;
+    bool m_hasOrigin;
+};
+
+namespace WebVtt
+{
+    // "hh:mm:ss.ttt" or "mm:ss.ttt" at data, the hours may have more than two digits.
+    // Returns the characters consumed, 0 if there is no timestamp.
+    size_t ParseTimestamp(const char* data, size_t size, double* pSeconds);
+}
@@ -4,9 +4,14 @@
 #include "framework.h"
 #include "WindowsProject1.h"
 
-#include "AdaptiveStreamer.h"
+#include "StreamerHost.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 #define MAX_LOADSTRING 100
+#define HOSTED_STREAMS 1 // streams played at once, more make a multiview wall of the content, the first one has the focus
+#define METRICS_FILE "AdaptiveStreamer.prom" // metrics exposition rewritten every METRICS_SNAPSHOT_MS, relative to the working directory
+#define TRACE_FILE "AdaptiveStreamer.trace.json" // spans written on F12 and at exit when Trace.h has TRACE_SPANS, for ui.perfetto.dev
 
 // Global Variables:
 HINSTANCE hInst;                                // current instance
@@ -29,11 +34,22 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
     // TODO: Place code here.
     CoInitialize(nullptr);
-    AdaptiveStreamer streamer;
-    streamer.Initialize();
-    //streamer.LoadContent(L"http://localhost:9001/filename.m3u8");
-    streamer.LoadContent(L"https://test-streams.mux.dev/x36xhzz/x36xhzz.m3u8");
-    streamer.Play();
+    TRACE_THREAD_NAME("main");
+    Metrics::Registry::Instance().StartSnapshots(METRICS_FILE);
+    StreamerHost host;
+    host.Initialize();
+    for (int i = 0; i < HOSTED_STREAMS; ++i)
+    {
+        UINT32 streamId = 0;
+        if (FAILED(host.AddStream(i == 0 ? StreamPriority::Focused : StreamPriority::Background, &streamId)))
+            break;
+
+        std::shared_ptr<AdaptiveStreamer> streamer = host.GetStream(streamId);
+        streamer->SetFastStart(true);
+        //streamer->LoadContent(L"http://localhost:9001/live/master.m3u8"); // tools/HlsOrigin.cpp
+        streamer->LoadContent(L"https://test-streams.mux.dev/x36xhzz/x36xhzz.m3u8");
+        streamer->Play();
+    }
 
     // Initialize global strings
     LoadStringW(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
@@ -50,16 +66,41 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
     MSG msg;
 
-    // Main message loop:
-    while (GetMessage(&msg, nullptr, 0, 0))
+    // Main message loop, the media events of the streams are handled on this thread between messages
+    bool quit = false;
+    while (!quit)
     {
-        if (!TranslateAccelerator(msg.hwnd, hAccelTable, &msg))
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+        {
+            if (msg.message == WM_QUIT)
+            {
+                quit = true;
+                break;
+            }
+
+            if (!TranslateAccelerator(msg.hwnd, hAccelTable, &msg))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+        }
+
+        if (!quit)
         {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+            host.DispatchEvents();
+
+            // wakes for input or after a frame period, whichever comes first
+            MsgWaitForMultipleObjects(0, nullptr, FALSE, 16, QS_ALLINPUT);
         }
     }
     
+    host.LogUsage();
+    Metrics::Registry::Instance().StopSnapshots();
+#ifdef TRACE_SPANS
+    Trace::WriteFile(TRACE_FILE);
+#endif
+    BinaryLog::Flush(); // the usage lines are out before the process goes
+
     return (int) msg.wParam;
 }
 
@@ -158,6 +199,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             EndPaint(hWnd, &ps);
         }
         break;
+#ifdef TRACE_SPANS
+    case WM_KEYDOWN:
+        if (wParam == VK_F12)
+        {
+            Trace::WriteFile(TRACE_FILE);
+        }
+        return DefWindowProc(hWnd, message, wParam, lParam);
+#endif
     case WM_DESTROY:
         PostQuitMessage(0);
         break;
@@ -72,64 +72,10 @@ typedef enum Log_Level
 #endif
 #endif
 
-inline void __stdcall Log(
-    _In_ Log_Level level,
-    _In_ _Printf_format_string_ STRSAFE_LPCWSTR pszFormat,
-    ...)
-{
-    if (LOG_LEVEL < level)
-    {
-        return;
-    }
-
-    wchar_t szTextBuf[2048];
-
-    va_list args;
-    va_start(args, pszFormat);
-
-    StringCchVPrintf(szTextBuf, _countof(szTextBuf), pszFormat, args);
-
-    va_end(args);
-
-    OutputDebugStringW(szTextBuf);
-}
-
-#define FORMAT_MESSAGE_ALLOCATE_BUFFER 0x00000100
-
-inline const LPWSTR ErrorMessage(HRESULT hr)
-{
-    LPWSTR pszMsg;
-
-    FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-                  FORMAT_MESSAGE_FROM_SYSTEM |
-                  FORMAT_MESSAGE_IGNORE_INSERTS,
-                  NULL,
-                  hr,
-                  MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                  (LPWSTR)&pszMsg,
-                  0,
-                  NULL);
-
-    if (pszMsg != NULL)
-    {
-#ifdef UNICODE
-        size_t const nLen = wcslen(pszMsg);
-#else
-        size_t const nLen = strlen(m_pszMsg);
-#endif
-        if (nLen > 1 && pszMsg[nLen - 1] == '\n')
-        {
-            pszMsg[nLen - 1] = 0;
-
-            if (pszMsg[nLen - 2] == '\r')
-            {
-                pszMsg[nLen - 2] = 0;
-            }
-        }
-    }
-
-    return pszMsg;
-}
+// Records the level, the format and the arguments, the drain thread of BinaryLog formats them.
+// Above LOG_LEVEL the call compiles to nothing and its arguments are not evaluated.
+#include "BinaryLog.h"
+#define Log(level, ...) ((LOG_LEVEL < (level)) ? (void)0 : BinaryLog::Write(static_cast<int>(level), __VA_ARGS__))
 
 inline void __stdcall LogResult(
     _In_ LPWSTR pszFile, //__FILEW__
@@ -154,11 +100,11 @@ inline void __stdcall LogResult(
         }
     }
 
-    // Gets the plain text error message
+    // the plain text error message is looked up when the record is formatted
     Log(
         Log_Level_Error,
         L"%sHR: 0x%x - %s\r\n\t%s(%d): %s\n"
-        , message, hr, ErrorMessage(hr), pszFile, nLine, pszFunc);
+        , message, hr, BinaryLog::MessageOf(hr), pszFile, nLine, pszFunc);
 }
 
 #ifndef LOG_RESULT
@@ -171,6 +117,12 @@ inline void __stdcall LogResult(
 #define IFR(hrToCheck) IFR_MSG(hrToCheck, L"RETURN_")
 #endif
 
+#ifndef CO_IFR
+// IFR for coroutines, they co_return the HRESULT
+#define CO_IFR_MSG(hrToCheck, message) if (FAILED(hrToCheck)) { LOG_RESULT_MSG(hrToCheck, message); co_return hrToCheck; }
+#define CO_IFR(hrToCheck) CO_IFR_MSG(hrToCheck, L"RETURN_")
+#endif
+
 #ifndef IFG
 #define IFG_MSG(hrToCheck, message) if (FAILED(hrToCheck)) { LOG_RESULT_MSG(hrToCheck, message); goto done; }
 #define IFG(hrToCheck) IFR_MSG(hrToCheck, L"GOTO DONE_")
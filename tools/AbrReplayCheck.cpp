@@ -0,0 +1,230 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Regression check of the ABR code. Replays recorded throughput traces through AbrController with
+// each estimator, using the session model of tools/AbrSimulator.cpp, and compares the bitrate
+// every segment was fetched at and the switch count with what was recorded for them. Also checks
+// the estimators on known samples: the harmonic mean and its window, the EWMA on a constant and a
+// stepped throughput, and the sample filter. A change that moves a decision shows up as a
+// different path; rerun with --print and update the expectation only if the new path is the
+// intended one. Exits 1 on a mismatch.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -I. tools/AbrReplayCheck.cpp AbrController.cpp -o abrreplay
+//
+//   abrreplay [--print]
+
+#include "AbrTrace.h"
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace AbrTrace;
+
+namespace
+{
+    // "seconds kbps [latency_ms]" steps as abrsim reads them, looping
+    struct ReplayCase
+    {
+        const char* name;
+        const char* trace;
+        const char* estimator;
+        const char* path;       // bitrate in kbps x segments fetched at it, in order
+        uint32_t switches;
+    };
+
+    const ReplayCase Cases[] =
+    {
+        // climbs one rung at a time, held by the low buffer and then by the hold after each switch
+        { "steady-high", "60 20000\n", "harmonic", "400x3 1200x7 3000x2 6000x48", 3 },
+        { "steady-high", "60 20000\n", "ewma", "400x3 1200x7 3000x2 6000x48", 3 },
+
+        // the next rung never fits with its margin
+        { "steady-low", "60 1000\n", "harmonic", "400x60", 0 },
+        { "steady-low", "60 1000\n", "ewma", "400x60", 0 },
+
+        // a drop goes down without a hold, the harmonic mean through the rung between
+        { "drop", "40 20000\n200 1500 60\n", "harmonic", "400x3 1200x7 3000x2 6000x6 3000x1 1200x41", 5 },
+        { "drop", "40 20000\n200 1500 60\n", "ewma", "400x3 1200x7 3000x2 6000x6 1200x42", 4 },
+
+        // one fast download is no reason to switch
+        { "spike", "20 1000\n2 50000\n40 1000\n", "harmonic", "400x60", 0 },
+        { "spike", "20 1000\n2 50000\n40 1000\n", "ewma", "400x60", 0 },
+
+        // the harmonic mean rides out the dips, the fast EWMA follows them until the hold settles it
+        { "oscillate", "10 9000\n10 2500\n", "harmonic", "400x3 1200x7 3000x50", 2 },
+        { "oscillate", "10 9000\n10 2500\n", "ewma", "400x3 1200x7 3000x1 1200x8 3000x1 1200x40", 5 },
+
+        // a slow start with latency, then a fast network: the EWMA remembers the slow part longer
+        { "recover", "30 800 100\n300 12000 20\n", "harmonic", "400x17 1200x2 3000x2 6000x39", 3 },
+        { "recover", "30 800 100\n300 12000 20\n", "ewma", "400x19 1200x5 3000x6 6000x30", 3 },
+    };
+
+    const std::vector<uint32_t> Ladder = { 400000, 1200000, 3000000, 6000000 };
+    const double SessionSeconds = 240.0;
+
+    uint32_t s_failures = 0;
+
+    void Fail(const std::string& what)
+    {
+        fprintf(stderr, "abrreplay: %s\n", what.c_str());
+        s_failures++;
+    }
+
+    void CheckNear(const char* what, double value, double expected)
+    {
+        if (std::fabs(value - expected) > expected * 1e-9)
+        {
+            char text[256];
+            snprintf(text, sizeof(text), "%s is %.3f bps, expected %.3f", what, value, expected);
+            Fail(text);
+        }
+    }
+
+    std::string PathOf(const std::vector<uint32_t>& bitrates)
+    {
+        std::string path;
+        for (size_t i = 0; i < bitrates.size();)
+        {
+            size_t run = 1;
+            while (i + run < bitrates.size() && bitrates[i + run] == bitrates[i])
+            {
+                run++;
+            }
+
+            if (!path.empty())
+                path += ' ';
+            path += std::to_string(bitrates[i] / 1000) + "x" + std::to_string(run);
+            i += run;
+        }
+        return path;
+    }
+
+    void CheckEstimators()
+    {
+        HarmonicMeanEstimator harmonic(5);
+        harmonic.AddSample(125000, 1.0);  // 1 Mbps
+        harmonic.AddSample(500000, 1.0);  // 4 Mbps
+        CheckNear("harmonic mean of 1 and 4 Mbps", harmonic.EstimateBps(), 1600000.0);
+
+        // the oldest sample leaves the window
+        HarmonicMeanEstimator window(2);
+        window.AddSample(125000, 1.0);
+        window.AddSample(500000, 1.0);
+        window.AddSample(500000, 1.0);
+        CheckNear("harmonic mean after the window moved", window.EstimateBps(), 4000000.0);
+
+        // the zero start is divided out, a constant throughput is exact from the first sample
+        EwmaEstimator constant;
+        for (int i = 0; i < 5; ++i)
+        {
+            constant.AddSample(250000, 1.0);
+            CheckNear("EWMA of a constant 2 Mbps", constant.EstimateBps(), 2000000.0);
+        }
+
+        // after a step down the fast average is the lower one, checked against the closed form
+        EwmaEstimator stepped(2.0, 5.0);
+        double fast = 0.0;
+        double slow = 0.0;
+        double weight = 0.0;
+        for (int i = 0; i < 11; ++i)
+        {
+            double bps = (i < 10) ? 8000000.0 : 2000000.0;
+            stepped.AddSample(static_cast<uint64_t>(bps / 8.0), 1.0);
+
+            fast = pow(0.5, 1.0 / 2.0) * fast + (1.0 - pow(0.5, 1.0 / 2.0)) * bps;
+            slow = pow(0.5, 1.0 / 5.0) * slow + (1.0 - pow(0.5, 1.0 / 5.0)) * bps;
+            weight += 1.0;
+        }
+        double fastEstimate = fast / (1.0 - pow(0.5, weight / 2.0));
+        double slowEstimate = slow / (1.0 - pow(0.5, weight / 5.0));
+        if (fastEstimate >= slowEstimate)
+            Fail("the fast EWMA should be below the slow one after a step down");
+        CheckNear("EWMA after a step from 8 to 2 Mbps", stepped.EstimateBps(), fastEstimate);
+
+        // small or instant downloads say nothing about throughput
+        AbrController controller(std::make_unique<HarmonicMeanEstimator>());
+        controller.SetLadder(Ladder);
+        controller.OnDownloadCompleted(controller.Settings().minSampleBytes - 1, 1.0);
+        controller.OnDownloadCompleted(1000000, controller.Settings().minSampleSeconds / 2.0);
+        if (controller.EstimateBps() != 0.0 || controller.InitialBitrate() != Ladder.front())
+            Fail("a filtered sample reached the estimator");
+    }
+
+    void CheckReplay(const ReplayCase& replay, bool print)
+    {
+        Trace trace;
+        std::istringstream text(replay.trace);
+        if (!ParseTrace(text, replay.name, &trace))
+        {
+            Fail(std::string(replay.name) + ": trace does not parse");
+            return;
+        }
+
+        SessionOptions options;
+        options.ladder = Ladder;
+        options.sessionSeconds = SessionSeconds;
+        options.estimator = replay.estimator;
+
+        std::vector<uint32_t> bitrates;
+        SessionResult result = RunSession(trace, 0.0, options, &bitrates);
+        std::string path = PathOf(bitrates);
+
+        if (print)
+        {
+            printf("%-12s %-9s %2u switches  %s\n", replay.name, replay.estimator, result.switches, path.c_str());
+        }
+
+        std::string name = std::string(replay.name) + " (" + replay.estimator + ")";
+        if (path != replay.path)
+            Fail(name + ": path " + path + ", expected " + replay.path);
+        if (result.switches != replay.switches)
+            Fail(name + ": " + std::to_string(result.switches) + " switches, expected " + std::to_string(replay.switches));
+        if (result.rebufferSeconds > 0.0)
+            Fail(name + ": rebuffered for " + std::to_string(result.rebufferSeconds) + " s");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool print = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--print")
+            print = true;
+        else
+        {
+            fprintf(stderr, "abrreplay: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    CheckEstimators();
+
+    for (const ReplayCase& replay : Cases)
+    {
+        CheckReplay(replay, print);
+    }
+
+    size_t cases = sizeof(Cases) / sizeof(Cases[0]);
+    if (s_failures != 0)
+    {
+        printf("FAILED, %u mismatches in %zu replays and the estimator checks\n", s_failures, cases);
+        return 1;
+    }
+
+    printf("%zu replays and the estimator checks ok\n", cases);
+    return 0;
+}
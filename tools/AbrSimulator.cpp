@@ -0,0 +1,256 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Offline, trace-driven simulation of the streamer's ABR decisions. Runs AbrController, the same
+// code AdaptiveStreamer uses, against a bitrate ladder and recorded bandwidth traces, and models
+// segment downloads and the playback buffer (tools/AbrTrace.h). Sessions run in parallel, one per
+// worker at a time.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -pthread -I. tools/AbrSimulator.cpp AbrController.cpp HlsPlaylist.cpp -o abrsim
+//
+// Trace files have one "seconds kbps [latency_ms]" step per line, '#' starts a comment, and the
+// trace loops when a session outlasts it. The ladder is the variants of an HLS master playlist
+// (--ladder) or a list of bitrates in bps (--bitrates).
+//
+//   abrsim --bitrates 400000,1200000,3000000,6000000 --sessions 1000 traces/*.txt
+
+#include "AbrTrace.h"
+#include "HlsPlaylist.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace AbrTrace;
+
+namespace
+{
+    struct SimulationOptions : SessionOptions
+    {
+        uint32_t sessionsPerTrace = 1;
+        uint32_t threads = 0;
+    };
+
+    bool LoadLadderFromPlaylist(const std::string& path, std::vector<uint32_t>* pLadder)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        std::stringstream text;
+        text << file.rdbuf();
+
+        HlsMasterPlaylist playlist;
+        if (!Hls::ParseMasterPlaylist(text.str(), "file:///" + path, &playlist))
+            return false;
+
+        for (const auto& variant : playlist.variants)
+        {
+            pLadder->push_back(variant.bandwidth);
+        }
+
+        return true;
+    }
+
+    std::vector<uint32_t> ParseBitrates(const std::string& list)
+    {
+        std::vector<uint32_t> ladder;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            uint32_t bitrate = static_cast<uint32_t>(strtoul(item.c_str(), nullptr, 10));
+            if (bitrate != 0)
+                ladder.push_back(bitrate);
+        }
+        return ladder;
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: abrsim (--ladder master.m3u8 | --bitrates b1,b2,...) [options] trace...\n"
+            "  --segment <s>          segment duration, default 4\n"
+            "  --duration <s>         media seconds per session, default 600\n"
+            "  --startup-buffer <s>   buffer needed to start playback, default 4\n"
+            "  --max-buffer <s>       buffer at which downloads pause, default 30\n"
+            "  --sessions <n>         sessions per trace with random start offsets, default 1\n"
+            "  --threads <n>          worker threads, default all cores\n"
+            "  --estimator <name>     harmonic or ewma, default harmonic\n"
+            "  --safety <f>           AbrSettings::safetyFactor\n"
+            "  --low-buffer <s>       AbrSettings::lowBufferSeconds\n"
+            "  --panic-buffer <s>     AbrSettings::panicBufferSeconds\n"
+            "  --hold <s>             AbrSettings::upSwitchHoldSeconds\n"
+            "  --margin <f>           AbrSettings::upSwitchMargin\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    SimulationOptions options;
+    std::vector<std::string> tracePaths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        bool takesValue = arg.size() > 2 && arg.compare(0, 2, "--") == 0;
+
+        if (takesValue && value == nullptr)
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        if (arg == "--ladder")
+        {
+            if (!LoadLadderFromPlaylist(value, &options.ladder))
+            {
+                fprintf(stderr, "abrsim: cannot read master playlist %s\n", value);
+                return 1;
+            }
+        }
+        else if (arg == "--bitrates") options.ladder = ParseBitrates(value);
+        else if (arg == "--segment") options.segmentSeconds = atof(value);
+        else if (arg == "--duration") options.sessionSeconds = atof(value);
+        else if (arg == "--startup-buffer") options.startupBufferSeconds = atof(value);
+        else if (arg == "--max-buffer") options.maxBufferSeconds = atof(value);
+        else if (arg == "--sessions") options.sessionsPerTrace = static_cast<uint32_t>(atoi(value));
+        else if (arg == "--threads") options.threads = static_cast<uint32_t>(atoi(value));
+        else if (arg == "--estimator") options.estimator = value;
+        else if (arg == "--safety") options.settings.safetyFactor = atof(value);
+        else if (arg == "--low-buffer") options.settings.lowBufferSeconds = atof(value);
+        else if (arg == "--panic-buffer") options.settings.panicBufferSeconds = atof(value);
+        else if (arg == "--hold") options.settings.upSwitchHoldSeconds = atof(value);
+        else if (arg == "--margin") options.settings.upSwitchMargin = atof(value);
+        else if (takesValue)
+        {
+            PrintUsage();
+            return 1;
+        }
+        else
+        {
+            tracePaths.push_back(arg);
+            continue;
+        }
+        ++i;
+    }
+
+    if (options.ladder.empty() || tracePaths.empty() || options.segmentSeconds <= 0.0 || options.sessionsPerTrace == 0)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    options.maxBufferSeconds = (std::max)(options.maxBufferSeconds, options.segmentSeconds);
+
+    std::vector<Trace> traces(tracePaths.size());
+    for (size_t i = 0; i < tracePaths.size(); ++i)
+    {
+        if (!LoadTrace(tracePaths[i], &traces[i]))
+        {
+            fprintf(stderr, "abrsim: cannot read trace %s\n", tracePaths[i].c_str());
+            return 1;
+        }
+    }
+
+    // every session writes only its own slot, workers share nothing but the counter
+    size_t sessionCount = traces.size() * options.sessionsPerTrace;
+    std::vector<SessionResult> results(sessionCount);
+    std::atomic<size_t> nextSession(0);
+
+    uint32_t threadCount = options.threads != 0 ? options.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    threadCount = static_cast<uint32_t>((std::min)(static_cast<size_t>(threadCount), sessionCount));
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        workers.emplace_back([&]()
+            {
+                for (size_t i = nextSession++; i < sessionCount; i = nextSession++)
+                {
+                    const Trace& trace = traces[i / options.sessionsPerTrace];
+
+                    // reproducible start offsets, seeded by the session index
+                    std::mt19937_64 random(i);
+                    double offset = (i % options.sessionsPerTrace == 0) ? 0.0
+                        : std::uniform_real_distribution<double>(0.0, trace.totalSeconds)(random);
+
+                    results[i] = RunSession(trace, offset, options);
+                }
+            });
+    }
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-32s %9s %10s %12s %9s\n", "trace", "startup_s", "rebuffer_%", "avg_kbps", "switches");
+
+    SessionResult total;
+    for (size_t t = 0; t < traces.size(); ++t)
+    {
+        SessionResult sum;
+        for (uint32_t s = 0; s < options.sessionsPerTrace; ++s)
+        {
+            const SessionResult& r = results[t * options.sessionsPerTrace + s];
+            sum.startupSeconds += r.startupSeconds;
+            sum.rebufferSeconds += r.rebufferSeconds;
+            sum.playedSeconds += r.playedSeconds;
+            sum.bitrateSecondsSum += r.bitrateSecondsSum;
+            sum.switches += r.switches;
+        }
+
+        double sessions = options.sessionsPerTrace;
+        printf("%-32s %9.2f %10.3f %12.0f %9.1f\n",
+            traces[t].name.c_str(),
+            sum.startupSeconds / sessions,
+            100.0 * sum.rebufferSeconds / (sum.playedSeconds + sum.rebufferSeconds),
+            sum.bitrateSecondsSum / (sessions * options.sessionSeconds) / 1000.0,
+            sum.switches / sessions);
+
+        total.startupSeconds += sum.startupSeconds;
+        total.rebufferSeconds += sum.rebufferSeconds;
+        total.playedSeconds += sum.playedSeconds;
+        total.bitrateSecondsSum += sum.bitrateSecondsSum;
+        total.switches += sum.switches;
+    }
+
+    double sessions = static_cast<double>(sessionCount);
+    printf("%-32s %9.2f %10.3f %12.0f %9.1f\n", "all",
+        total.startupSeconds / sessions,
+        100.0 * total.rebufferSeconds / (total.playedSeconds + total.rebufferSeconds),
+        total.bitrateSecondsSum / (sessions * options.sessionSeconds) / 1000.0,
+        total.switches / sessions);
+
+    double simulatedHours = (total.playedSeconds + total.rebufferSeconds) / 3600.0;
+    printf("\n%zu sessions, %.0f simulated hours in %.2f s on %u threads (%.0f hours/min)\n",
+        sessionCount, simulatedHours, wallSeconds, threadCount,
+        wallSeconds > 0.0 ? simulatedHours * 60.0 / wallSeconds : 0.0);
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#pragma once
+
+// The trace and session model of tools/AbrSimulator.cpp, shared with tools/AbrReplayCheck.cpp so
+// the check replays exactly what the simulator runs. A session runs AbrController, the same code
+// AdaptiveStreamer uses, against a looping bandwidth trace, and models segment downloads and the
+// playback buffer. Portable, no Windows dependencies.
+
+#include "AbrController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace AbrTrace
+{
+    struct TraceStep
+    {
+        double seconds;
+        double bps;
+        double latencySeconds;
+    };
+
+    struct Trace
+    {
+        std::string name;
+        std::vector<TraceStep> steps;
+        double totalSeconds = 0.0;
+    };
+
+    struct SessionOptions
+    {
+        std::vector<uint32_t> ladder;
+        double segmentSeconds = 4.0;
+        double sessionSeconds = 600.0;     // media duration played per session
+        double startupBufferSeconds = 4.0; // playback starts once this much is buffered
+        double maxBufferSeconds = 30.0;    // downloads pause above this
+        std::string estimator = "harmonic";
+        AbrSettings settings;
+    };
+
+    struct SessionResult
+    {
+        double startupSeconds = 0.0;
+        double rebufferSeconds = 0.0;
+        double playedSeconds = 0.0;
+        double bitrateSecondsSum = 0.0; // bitrate x media seconds
+        uint32_t switches = 0;
+    };
+
+    // Position in a looping trace
+    class TraceCursor
+    {
+    public:
+        TraceCursor(const Trace& trace, double startOffsetSeconds)
+            : m_trace(trace), m_index(0), m_offset(0.0)
+        {
+            Advance(fmod(startOffsetSeconds, trace.totalSeconds));
+        }
+
+        void Advance(double seconds)
+        {
+            while (seconds > 0.0)
+            {
+                const TraceStep& step = m_trace.steps[m_index];
+                double left = step.seconds - m_offset;
+                if (seconds < left)
+                {
+                    m_offset += seconds;
+                    return;
+                }
+                seconds -= left;
+                Next();
+            }
+        }
+
+        // Seconds to receive the bits, starting with the request latency of the current step
+        double Download(double bits)
+        {
+            double elapsed = m_trace.steps[m_index].latencySeconds;
+            Advance(elapsed);
+
+            while (bits > 0.0)
+            {
+                const TraceStep& step = m_trace.steps[m_index];
+                double left = step.seconds - m_offset;
+                double capacity = step.bps * left;
+                if (bits < capacity)
+                {
+                    double seconds = bits / step.bps;
+                    m_offset += seconds;
+                    return elapsed + seconds;
+                }
+                bits -= capacity;
+                elapsed += left;
+                Next();
+            }
+
+            return elapsed;
+        }
+
+    private:
+        void Next()
+        {
+            m_offset = 0.0;
+            m_index = (m_index + 1) % m_trace.steps.size();
+        }
+
+        const Trace& m_trace;
+        size_t m_index;
+        double m_offset;
+    };
+
+    inline std::unique_ptr<ThroughputEstimator> CreateEstimator(const std::string& name)
+    {
+        if (name == "ewma")
+            return std::make_unique<EwmaEstimator>();
+
+        return std::make_unique<HarmonicMeanEstimator>();
+    }
+
+    // One session from startOffsetSeconds into the trace. pBitrates, when given, receives the
+    // bitrate each segment was downloaded at.
+    inline SessionResult RunSession(const Trace& trace, double startOffsetSeconds, const SessionOptions& options,
+        std::vector<uint32_t>* pBitrates = nullptr)
+    {
+        SessionResult result;
+        TraceCursor cursor(trace, startOffsetSeconds);
+
+        AbrController controller(CreateEstimator(options.estimator), options.settings);
+        controller.SetLadder(options.ladder);
+
+        double now = 0.0;
+        double buffer = 0.0;
+        double downloaded = 0.0;
+        bool playing = false;
+        uint32_t bitrate = controller.InitialBitrate();
+
+        while (downloaded < options.sessionSeconds)
+        {
+            // the player stops fetching while the buffer is full
+            if (buffer + options.segmentSeconds > options.maxBufferSeconds)
+            {
+                double idle = buffer + options.segmentSeconds - options.maxBufferSeconds;
+                cursor.Advance(idle);
+                now += idle;
+                buffer -= idle;
+                result.playedSeconds += idle;
+            }
+
+            if (pBitrates != nullptr)
+            {
+                pBitrates->push_back(bitrate);
+            }
+
+            double bits = static_cast<double>(bitrate) * options.segmentSeconds;
+            double seconds = cursor.Download(bits);
+            now += seconds;
+
+            if (playing)
+            {
+                double played = (std::min)(buffer, seconds);
+                result.playedSeconds += played;
+                result.rebufferSeconds += seconds - played;
+                buffer -= played;
+            }
+
+            buffer += options.segmentSeconds;
+            downloaded += options.segmentSeconds;
+            result.bitrateSecondsSum += static_cast<double>(bitrate) * options.segmentSeconds;
+
+            if (!playing && buffer >= options.startupBufferSeconds)
+            {
+                playing = true;
+                result.startupSeconds = now;
+            }
+
+            controller.OnDownloadCompleted(static_cast<uint64_t>(bits / 8.0), seconds);
+            bitrate = controller.Decide(buffer, now);
+        }
+
+        if (!playing)
+        {
+            result.startupSeconds = now;
+        }
+
+        // drain what is left, no more stalls are possible
+        result.playedSeconds += buffer;
+        result.switches = controller.SwitchCount();
+
+        return result;
+    }
+
+    // "seconds kbps [latency_ms]" steps, one per line, '#' starts a comment
+    inline bool ParseTrace(std::istream& text, const std::string& name, Trace* pTrace)
+    {
+        pTrace->name = name;
+
+        std::string line;
+        while (std::getline(text, line))
+        {
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream fields(line);
+            TraceStep step = {};
+            double kbps = 0.0;
+            double latencyMs = 0.0;
+            if (!(fields >> step.seconds >> kbps))
+                continue;
+            fields >> latencyMs;
+
+            if (step.seconds <= 0.0 || kbps <= 0.0)
+                continue;
+
+            step.bps = kbps * 1000.0;
+            step.latencySeconds = latencyMs / 1000.0;
+            pTrace->steps.push_back(step);
+            pTrace->totalSeconds += step.seconds;
+        }
+
+        return !pTrace->steps.empty();
+    }
+
+    inline bool LoadTrace(const std::string& path, Trace* pTrace)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        return ParseTrace(file, path, pTrace);
+    }
+}
@@ -0,0 +1,411 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Race check of AsyncOperationAwaiter against a fake operation that completes on another thread,
+// the way a WinRT operation does. Each round races completion against the timeout, against a
+// cancellation, or all three, through Wait() and through co_await. It also runs the edges: a
+// source canceled before the awaiter exists, an operation done before Subscribe, a failing
+// Subscribe, and an awaiter destroyed while its operation is still running and then canceled,
+// which must not leave the operation referenced by the awaiter's state. The task round runs an
+// AsyncTask that co_awaits the operation through WaitForAsyncTask and must return what won.
+// Exactly one outcome must win and never change afterwards. The operation is canceled only when
+// the timeout or the cancellation won. A coroutine resumes once and sees the winning outcome.
+// Completed is only reported for an operation that completed. Prints how often each side won and
+// exits 1 on a violation.
+//
+// Build (portable, no Windows dependencies), ThreadSanitizer and AddressSanitizer are worth a run too:
+//   g++ -std=c++20 -O2 -pthread -I. tools/AwaiterStress.cpp -o awaiterstress
+//   g++ -std=c++20 -O1 -g -fsanitize=thread -pthread -I. tools/AwaiterStress.cpp -o awaiterstress
+//
+//   awaiterstress [--rounds 4000] [--timeout-ms 1] [--spread-us 2000] [--seed 1]
+
+#include "AsyncOperationAwaiter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+namespace
+{
+    // Completes once, with whatever comes first of Finish and Cancel. The handler runs outside
+    // the lock and at most once, like the completed handler of a WinRT operation.
+    struct FakeOperation
+    {
+        std::mutex lock;
+        AsyncOutcome status = AsyncOutcome::AsyncOutcome_Pending;
+        std::function<void(AsyncOutcome)> handler;
+        bool failSubscribe = false;
+        std::atomic<uint32_t> subscribeCalls{ 0 };
+        std::atomic<uint32_t> handlerCalls{ 0 };
+        std::atomic<uint32_t> cancelCalls{ 0 };
+
+        void Finish(AsyncOutcome result)
+        {
+            std::function<void(AsyncOutcome)> onCompleted;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (status != AsyncOutcome::AsyncOutcome_Pending)
+                    return;
+                status = result;
+                onCompleted.swap(handler);
+            }
+
+            if (onCompleted)
+            {
+                handlerCalls++;
+                onCompleted(result);
+            }
+        }
+
+        AsyncOutcome Status()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return status;
+        }
+    };
+
+    struct FakeTraits
+    {
+        using OperationPtr = std::shared_ptr<FakeOperation>;
+
+        static bool Subscribe(const OperationPtr& op, std::function<void(AsyncOutcome)> onCompleted)
+        {
+            if (op == nullptr || op->failSubscribe)
+                return false;
+
+            op->subscribeCalls++;
+            AsyncOutcome status;
+            {
+                std::lock_guard<std::mutex> guard(op->lock);
+                status = op->status;
+                if (status == AsyncOutcome::AsyncOutcome_Pending)
+                {
+                    op->handler = std::move(onCompleted);
+                    return true;
+                }
+            }
+
+            // already done, report it inline as WinRT does
+            op->handlerCalls++;
+            onCompleted(status);
+            return true;
+        }
+
+        static void Cancel(const OperationPtr& op)
+        {
+            op->cancelCalls++;
+            op->Finish(AsyncOutcome::AsyncOutcome_Canceled);
+        }
+    };
+
+    using Awaiter = AsyncOperationAwaiter<FakeTraits>;
+
+    enum class Round : uint32_t
+    {
+        CompleteVsTimeout,
+        CompleteVsCancel,
+        AwaitAll,
+        Edges,
+        Abandon,
+        Task,
+        Count
+    };
+
+    const char* RoundNames[] = { "complete/timeout", "complete/cancel", "co_await all three", "edges", "abandoned", "task" };
+    const char* OutcomeNames[] = { "pending", "completed", "error", "canceled", "timed out" };
+
+    struct Tally
+    {
+        uint64_t outcomes[static_cast<size_t>(Round::Count)][5] = {};
+        uint64_t violations = 0;
+
+        void Fail(Round round, uint64_t index, const char* what)
+        {
+            if (violations++ < 20)
+            {
+                fprintf(stderr, "awaiterstress: round %llu (%s): %s\n", (unsigned long long)index,
+                    RoundNames[static_cast<size_t>(round)], what);
+            }
+        }
+    };
+
+    // What every finished round must hold, whoever won
+    void CheckSettled(Tally* pTally, Round round, uint64_t index, AsyncOutcome outcome, FakeOperation& op)
+    {
+        pTally->outcomes[static_cast<size_t>(round)][static_cast<size_t>(outcome)]++;
+
+        if (outcome == AsyncOutcome::AsyncOutcome_Pending)
+            pTally->Fail(round, index, "still pending after the wait");
+
+        bool lostToCaller = outcome == AsyncOutcome::AsyncOutcome_Canceled || outcome == AsyncOutcome::AsyncOutcome_TimedOut;
+        if (op.cancelCalls != (lostToCaller ? 1u : 0u))
+            pTally->Fail(round, index, "operation canceled when it should not be, or not exactly once");
+
+        if (outcome == AsyncOutcome::AsyncOutcome_Completed && op.Status() != AsyncOutcome::AsyncOutcome_Completed)
+            pTally->Fail(round, index, "completed reported for an operation that did not complete");
+
+        if (op.handlerCalls > 1)
+            pTally->Fail(round, index, "completed handler ran more than once");
+    }
+
+    struct CoroutineResult
+    {
+        std::atomic<uint32_t> resumed{ 0 };
+        std::atomic<bool> done{ false };
+        AsyncOutcome seen = AsyncOutcome::AsyncOutcome_Pending;
+        AsyncOutcome after = AsyncOutcome::AsyncOutcome_Pending;
+    };
+
+    // Resumes on whichever thread wins, the awaiter lives in the coroutine frame
+    AsyncAction AwaitOperation(std::shared_ptr<FakeOperation> op, std::chrono::milliseconds timeout,
+        std::shared_ptr<AsyncCancellation> cancellation, CoroutineResult* pResult)
+    {
+        Awaiter awaiter(op, timeout, cancellation);
+        AsyncOutcome outcome = co_await awaiter;
+
+        pResult->seen = outcome;
+        pResult->resumed++;
+
+        // a later loser must not change what won
+        std::this_thread::yield();
+        pResult->after = awaiter.Outcome();
+        pResult->done = true;
+    }
+
+    // A helper's co_await form, the way MediaHelpers' ...Async functions are written
+    AsyncTask<AsyncOutcome> AwaitOperationTask(std::shared_ptr<FakeOperation> op, std::chrono::milliseconds timeout,
+        std::shared_ptr<AsyncCancellation> cancellation)
+    {
+        Awaiter awaiter(op, timeout, cancellation);
+        AsyncOutcome outcome = co_await awaiter;
+        co_return outcome;
+    }
+
+    void Sleep(std::mt19937& random, uint32_t spreadUs)
+    {
+        uint32_t us = spreadUs != 0 ? random() % spreadUs : 0;
+        if (us != 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t rounds = 4000;
+    uint32_t timeoutMs = 1;
+    uint32_t spreadUs = 2000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        uint64_t value = static_cast<uint64_t>(atoll(argv[i + 1]));
+        if (arg == "--rounds")
+            rounds = value;
+        else if (arg == "--timeout-ms")
+            timeoutMs = static_cast<uint32_t>(value);
+        else if (arg == "--spread-us")
+            spreadUs = static_cast<uint32_t>(value);
+        else if (arg == "--seed")
+            seed = static_cast<uint32_t>(value);
+        else
+        {
+            fprintf(stderr, "awaiterstress: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::chrono::milliseconds timeout(timeoutMs);
+
+    Tally tally;
+    std::mt19937 random(seed);
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t index = 0; index < rounds; ++index)
+    {
+        Round round = static_cast<Round>(index % static_cast<uint64_t>(Round::Count));
+        uint32_t completeSeed = random();
+        uint32_t cancelSeed = random();
+        auto op = std::make_shared<FakeOperation>();
+        auto cancellation = std::make_shared<AsyncCancellation>();
+
+        auto completer = [op, completeSeed, spreadUs]()
+            {
+                std::mt19937 local(completeSeed);
+                Sleep(local, spreadUs);
+                op->Finish(AsyncOutcome::AsyncOutcome_Completed);
+            };
+        auto canceler = [cancellation, cancelSeed, spreadUs]()
+            {
+                std::mt19937 local(cancelSeed);
+                Sleep(local, spreadUs);
+                cancellation->Cancel();
+            };
+
+        switch (round)
+        {
+        case Round::CompleteVsTimeout:
+        {
+            Awaiter awaiter(op, timeout);
+            std::thread completing(completer);
+            AsyncOutcome outcome = awaiter.Wait();
+            completing.join();
+
+            if (awaiter.Outcome() != outcome)
+                tally.Fail(round, index, "outcome changed after the wait");
+            if (outcome != AsyncOutcome::AsyncOutcome_Completed && outcome != AsyncOutcome::AsyncOutcome_TimedOut)
+                tally.Fail(round, index, "neither completed nor timed out");
+            CheckSettled(&tally, round, index, awaiter.Outcome(), *op);
+            break;
+        }
+
+        case Round::CompleteVsCancel:
+        {
+            Awaiter awaiter(op, Awaiter::Infinite, cancellation);
+            std::thread completing(completer);
+            std::thread canceling(canceler);
+            AsyncOutcome outcome = awaiter.Wait();
+            completing.join();
+            canceling.join();
+
+            if (awaiter.Outcome() != outcome)
+                tally.Fail(round, index, "outcome changed after the wait");
+            if (outcome != AsyncOutcome::AsyncOutcome_Completed && outcome != AsyncOutcome::AsyncOutcome_Canceled)
+                tally.Fail(round, index, "neither completed nor canceled");
+            CheckSettled(&tally, round, index, awaiter.Outcome(), *op);
+            break;
+        }
+
+        case Round::AwaitAll:
+        {
+            CoroutineResult result;
+            std::thread completing(completer);
+            std::thread canceling(canceler);
+            AwaitOperation(op, timeout, cancellation, &result);
+            completing.join();
+            canceling.join();
+
+            // the timeout may still be the one to resume it
+            while (!result.done)
+            {
+                std::this_thread::yield();
+            }
+
+            if (result.resumed != 1)
+                tally.Fail(round, index, "coroutine not resumed exactly once");
+            if (result.after != result.seen)
+                tally.Fail(round, index, "outcome changed after the coroutine resumed");
+            CheckSettled(&tally, round, index, result.seen, *op);
+            break;
+        }
+
+        case Round::Edges:
+        {
+            switch ((index / static_cast<uint64_t>(Round::Count)) % 3)
+            {
+            case 0:
+            {
+                // canceled before the awaiter exists: no subscription, the operation is canceled
+                cancellation->Cancel();
+                Awaiter awaiter(op, timeout, cancellation);
+                if (awaiter.Outcome() != AsyncOutcome::AsyncOutcome_Canceled || op->subscribeCalls != 0)
+                    tally.Fail(round, index, "a canceled source still subscribed");
+                CheckSettled(&tally, round, index, awaiter.Wait(), *op);
+                break;
+            }
+            case 1:
+            {
+                // done before Subscribe: ready without suspending, nothing canceled
+                op->Finish(AsyncOutcome::AsyncOutcome_Completed);
+                Awaiter awaiter(op, timeout, cancellation);
+                if (!awaiter.await_ready())
+                    tally.Fail(round, index, "a finished operation is not ready");
+                cancellation->Cancel();
+                CheckSettled(&tally, round, index, awaiter.Wait(), *op);
+                break;
+            }
+            default:
+            {
+                op->failSubscribe = true;
+                Awaiter awaiter(op, timeout, cancellation);
+                if (awaiter.Outcome() != AsyncOutcome::AsyncOutcome_Error)
+                    tally.Fail(round, index, "a failed Subscribe is not an error");
+                CheckSettled(&tally, round, index, awaiter.Wait(), *op);
+                break;
+            }
+            }
+            break;
+        }
+
+        case Round::Abandon:
+        {
+            // the awaiter goes away first, completion and cancellation come later. Its cancellation
+            // registration goes with it, the completion still lands in the shared state.
+            {
+                Awaiter awaiter(op, Awaiter::Infinite, cancellation);
+            }
+
+            // op here and in completer, the state that held a third went with the awaiter
+            if (op.use_count() != 2)
+                tally.Fail(round, index, "an abandoned awaiter's state still holds its operation");
+
+            std::thread completing(completer);
+            std::thread canceling(canceler);
+            completing.join();
+            canceling.join();
+
+            if (op->Status() != AsyncOutcome::AsyncOutcome_Completed || op->cancelCalls != 0)
+                tally.Fail(round, index, "an abandoned awaiter still acted on its operation");
+            tally.outcomes[static_cast<size_t>(round)][static_cast<size_t>(op->Status())]++;
+            break;
+        }
+
+        case Round::Task:
+        {
+            std::thread completing(completer);
+            std::thread canceling(canceler);
+            AsyncOutcome outcome = WaitForAsyncTask(AwaitOperationTask(op, timeout, cancellation));
+            completing.join();
+            canceling.join();
+
+            CheckSettled(&tally, round, index, outcome, *op);
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%llu rounds in %.1f s, timeout %u ms, spread %u us\n", (unsigned long long)rounds, seconds, timeoutMs, spreadUs);
+    for (size_t round = 0; round < static_cast<size_t>(Round::Count); ++round)
+    {
+        printf("%-20s", RoundNames[round]);
+        for (size_t outcome = 1; outcome < 5; ++outcome)
+        {
+            printf(" %s %-6llu", OutcomeNames[outcome], (unsigned long long)tally.outcomes[round][outcome]);
+        }
+        printf("\n");
+    }
+
+    if (tally.violations != 0)
+    {
+        printf("FAILED, %llu violations\n", (unsigned long long)tally.violations);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,1260 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Deterministic local HLS origin, the fixed backend for streaming benchmarks. Serves a generated
+// ladder (MPEG-TS with H.264 and AAC stand-in frames, IDR at every segment start, live or VOD,
+// LL-HLS parts with blocking reloads, preload hints and delta updates) and recorded ladders from
+// a directory, VOD playlists there optionally replayed as a looping live window. Every byte it
+// serves follows from the options and the seed.
+//
+// Each connection gets a network profile, round robin over the --profile files. A profile is a
+// trace in the ABR simulator format, one "seconds kbps [latency_ms [loss]]" step per line and
+// looping, timed from the connection's accept or with --shared-clock from the server start.
+// Bandwidth paces the body, latency delays the response headers, and loss is the probability
+// that a response is cut off at a random byte and the connection reset, which is what HTTP sees
+// of a lossy link. --fail rules inject errors on matching paths:
+//   path=GLOB,status=503|reset|stall[,p=PROBABILITY][,every=N][,from=SECONDS][,to=SECONDS]
+//
+// Every request is logged as a tab separated line: start, connection, method, target, status,
+// body bytes sent of the total, time to first byte, total time, profile and outcome.
+//
+// Build (Linux):
+//   g++ -std=c++17 -O2 -pthread -I. tools/HlsOrigin.cpp HlsPlaylist.cpp -o hlsorigin
+//
+//   hlsorigin [--port 9001] [--bind 127.0.0.1] [--seed 1] [--log requests.tsv]
+//             [--generate live] [--variants 400,1200,3500] [--segment 2] [--part 0.5]
+//             [--window 6] [--vod SECONDS]
+//             [--root DIR] [--live-window N]
+//             [--profile trace.txt]... [--bandwidth KBPS] [--latency MS] [--loss P] [--shared-clock]
+//             [--fail RULE]...
+//
+// With the defaults the generated LL-HLS ladder is at http://localhost:9001/live/master.m3u8.
+
+#include "HlsPlaylist.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const Clock::time_point ServerStart = Clock::now();
+
+    double SecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    void SleepSeconds(double seconds)
+    {
+        if (seconds > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    }
+
+    // ---------------------------------------------------------------- options
+
+    struct ProfileStep
+    {
+        double seconds;
+        double kbps;        // 0 is unthrottled
+        double latencyMs;
+        double loss;
+    };
+
+    struct Profile
+    {
+        std::string name;
+        std::vector<ProfileStep> steps;
+        double totalSeconds = 0.0;
+
+        const ProfileStep& At(double seconds) const
+        {
+            double t = (totalSeconds > 0.0) ? fmod(seconds, totalSeconds) : 0.0;
+            size_t i = 0;
+            while (i + 1 < steps.size() && steps[i + 1].seconds <= t)
+                i++;
+            return steps[i];
+        }
+    };
+
+    enum class FailureAction
+    {
+        Status,
+        Reset,
+        Stall,
+    };
+
+    struct FailureRule
+    {
+        std::string pattern = "*";
+        FailureAction action = FailureAction::Status;
+        int status = 503;
+        double probability = 1.0;
+        uint64_t every = 0;
+        double from = 0.0;
+        double to = 0.0;    // 0 is open ended
+        std::shared_ptr<std::atomic<uint64_t>> matches = std::make_shared<std::atomic<uint64_t>>(0);
+    };
+
+    struct Options
+    {
+        uint16_t port = 9001;
+        std::string bind = "127.0.0.1";
+        uint32_t seed = 1;
+        std::string logPath;
+
+        std::string generateName = "live";
+        std::vector<uint32_t> variantsKbps = { 400, 1200, 3500 };
+        double segmentSeconds = 2.0;
+        double partSeconds = 0.5;   // 0 turns LL-HLS off
+        uint32_t window = 6;
+        double vodSeconds = 0.0;    // 0 is live
+
+        std::string root;
+        uint32_t liveWindow = 0;
+
+        std::vector<Profile> profiles;
+        bool sharedClock = false;
+        std::vector<FailureRule> failures;
+    };
+
+    Options g_options;
+
+    // ---------------------------------------------------------------- request log
+
+    std::mutex g_logLock;
+    FILE* g_log = stderr;
+
+    void LogRequest(double start, uint64_t connection, const std::string& method, const std::string& target, int status,
+        size_t sent, size_t total, double ttfb, double elapsed, const std::string& profile, const char* outcome)
+    {
+        std::lock_guard<std::mutex> lock(g_logLock);
+        fprintf(g_log, "%.3f\t%llu\t%s\t%s\t%d\t%zu/%zu\t%.1f\t%.1f\t%s\t%s\n", start, static_cast<unsigned long long>(connection),
+            method.c_str(), target.c_str(), status, sent, total, ttfb * 1000.0, elapsed * 1000.0, profile.c_str(), outcome);
+        fflush(g_log);
+    }
+
+    // ---------------------------------------------------------------- MPEG-TS generator
+
+    const size_t TsPacket = 188;
+    const uint16_t PmtPid = 0x1000;
+    const uint16_t VideoPid = 0x100;
+    const uint16_t AudioPid = 0x101;
+    const double FrameRate = 25.0;
+    const double AudioFrameSeconds = 1024.0 / 48000.0;
+    const uint32_t AudioKbps = 128;
+
+    uint32_t Crc32(const uint8_t* data, size_t size)
+    {
+        uint32_t crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc ^= uint32_t(data[i]) << 24;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        return crc;
+    }
+
+    class TsWriter
+    {
+    public:
+        explicit TsWriter(std::vector<uint8_t>* pOut) : m_out(pOut) {}
+
+        // payload over as many packets as it takes, the last one padded with adaptation stuffing
+        void Write(uint16_t pid, const uint8_t* payload, size_t size)
+        {
+            bool first = true;
+            while (size > 0 || first)
+            {
+                size_t chunk = (std::min)(size, TsPacket - 4);
+                size_t stuffing = TsPacket - 4 - chunk;
+
+                uint8_t packet[TsPacket];
+                packet[0] = 0x47;
+                packet[1] = static_cast<uint8_t>((first ? 0x40 : 0) | (pid >> 8));
+                packet[2] = static_cast<uint8_t>(pid);
+                packet[3] = static_cast<uint8_t>((stuffing ? 0x30 : 0x10) | (m_continuity[pid]++ & 0x0F));
+
+                size_t pos = 4;
+                if (stuffing != 0)
+                {
+                    packet[pos++] = static_cast<uint8_t>(stuffing - 1);
+                    if (stuffing > 1)
+                    {
+                        packet[pos++] = 0;
+                        memset(packet + pos, 0xFF, stuffing - 2);
+                        pos += stuffing - 2;
+                    }
+                }
+
+                memcpy(packet + pos, payload, chunk);
+                m_out->insert(m_out->end(), packet, packet + TsPacket);
+
+                payload += chunk;
+                size -= chunk;
+                first = false;
+            }
+        }
+
+        void WriteSection(uint16_t pid, std::vector<uint8_t> section)
+        {
+            uint32_t crc = Crc32(section.data(), section.size());
+            for (int shift = 24; shift >= 0; shift -= 8)
+                section.push_back(static_cast<uint8_t>(crc >> shift));
+
+            section.insert(section.begin(), 0); // pointer field
+            Write(pid, section.data(), section.size());
+        }
+
+        void WritePes(uint16_t pid, uint8_t streamId, uint64_t pts, const std::vector<uint8_t>& data)
+        {
+            pts &= (uint64_t(1) << 33) - 1;
+            std::vector<uint8_t> pes = { 0, 0, 1, streamId, 0, 0, 0x80, 0x80, 5 };
+            size_t length = data.size() + 8;
+            if (streamId != 0xE0 && length <= 0xFFFF)
+            {
+                pes[4] = static_cast<uint8_t>(length >> 8);
+                pes[5] = static_cast<uint8_t>(length);
+            }
+            pes.push_back(static_cast<uint8_t>(0x21 | ((pts >> 29) & 0x0E)));
+            pes.push_back(static_cast<uint8_t>(pts >> 22));
+            pes.push_back(static_cast<uint8_t>(0x01 | ((pts >> 14) & 0xFE)));
+            pes.push_back(static_cast<uint8_t>(pts >> 7));
+            pes.push_back(static_cast<uint8_t>(0x01 | ((pts << 1) & 0xFE)));
+            pes.insert(pes.end(), data.begin(), data.end());
+            Write(pid, pes.data(), pes.size());
+        }
+
+    private:
+        std::vector<uint8_t>* m_out;
+        std::map<uint16_t, uint8_t> m_continuity;
+    };
+
+    struct GeneratedSegment
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<size_t> partOffsets; // start of every part, one more entry for the end
+    };
+
+    // Filler that never forms a start code, stand-in frames stay one NAL unit each
+    void Fill(std::mt19937& random, std::vector<uint8_t>* pData, size_t size)
+    {
+        while (pData->size() < size)
+            pData->push_back(static_cast<uint8_t>(random() | 0x01));
+    }
+
+    std::shared_ptr<const GeneratedSegment> GenerateSegment(size_t variant, uint64_t sequence)
+    {
+        static std::mutex s_lock;
+        static std::map<std::pair<size_t, uint64_t>, std::shared_ptr<const GeneratedSegment>> s_cache;
+
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            auto it = s_cache.find({ variant, sequence });
+            if (it != s_cache.end())
+                return it->second;
+        }
+
+        const Options& o = g_options;
+        auto segment = std::make_shared<GeneratedSegment>();
+        std::mt19937 random(o.seed * 2654435761u ^ static_cast<uint32_t>(variant * 40503u) ^ static_cast<uint32_t>(sequence * 97u));
+
+        TsWriter writer(&segment->bytes);
+        writer.WriteSection(0, { 0x00, 0xB0, 13, 0x00, 0x01, 0xC1, 0x00, 0x00, 0x00, 0x01, static_cast<uint8_t>(0xE0 | (PmtPid >> 8)), static_cast<uint8_t>(PmtPid) });
+        writer.WriteSection(PmtPid, { 0x02, 0xB0, 23, 0x00, 0x01, 0xC1, 0x00, 0x00,
+            static_cast<uint8_t>(0xE0 | (VideoPid >> 8)), static_cast<uint8_t>(VideoPid), 0xF0, 0x00,
+            0x1B, static_cast<uint8_t>(0xE0 | (VideoPid >> 8)), static_cast<uint8_t>(VideoPid), 0xF0, 0x00,
+            0x0F, static_cast<uint8_t>(0xE0 | (AudioPid >> 8)), static_cast<uint8_t>(AudioPid), 0xF0, 0x00 });
+
+        double videoBytesPerSecond = (std::max)(o.variantsKbps[variant] * 1000.0 / 8.0 - AudioKbps * 1000.0 / 8.0, 8000.0);
+        size_t videoFrames = static_cast<size_t>(o.segmentSeconds * FrameRate + 0.5);
+        size_t frameBytes = static_cast<size_t>(videoBytesPerSecond * o.segmentSeconds / (videoFrames + 2)); // the IDR is three frames
+        size_t audioBytes = static_cast<size_t>(AudioKbps * 1000.0 / 8.0 * AudioFrameSeconds);
+        uint64_t base = 900000 + static_cast<uint64_t>(sequence * o.segmentSeconds * 90000.0 + 0.5);
+
+        size_t parts = (o.partSeconds > 0.0) ? (std::max)(static_cast<size_t>(o.segmentSeconds / o.partSeconds + 0.5), size_t(1)) : 1;
+        double partSeconds = o.segmentSeconds / parts;
+        segment->partOffsets.push_back(0);
+
+        // frames in presentation order, audio interleaved by time
+        double audioTime = 0.0;
+        for (size_t frame = 0; frame < videoFrames; ++frame)
+        {
+            double time = frame / FrameRate;
+            if (segment->partOffsets.size() < parts && time >= segment->partOffsets.size() * partSeconds - 1e-9)
+                segment->partOffsets.push_back(segment->bytes.size());
+
+            while (audioTime < time + 1.0 / FrameRate - 1e-9 && audioTime < o.segmentSeconds)
+            {
+                std::vector<uint8_t> adts = { 0xFF, 0xF1, 0x4C, 0x80, 0, 0, 0xFC };
+                size_t length = audioBytes;
+                adts[3] |= static_cast<uint8_t>(length >> 11);
+                adts[4] = static_cast<uint8_t>(length >> 3);
+                adts[5] = static_cast<uint8_t>(((length & 7) << 5) | 0x1F);
+                Fill(random, &adts, length);
+                writer.WritePes(AudioPid, 0xC0, base + static_cast<uint64_t>(audioTime * 90000.0), adts);
+                audioTime += AudioFrameSeconds;
+            }
+
+            // access unit delimiter, then an IDR on the first frame and non-IDR slices after it
+            bool idr = frame == 0;
+            std::vector<uint8_t> video = { 0, 0, 0, 1, 0x09, 0xF0, 0, 0, 0, 1, static_cast<uint8_t>(idr ? 0x65 : 0x41) };
+            Fill(random, &video, idr ? frameBytes * 3 : frameBytes);
+            writer.WritePes(VideoPid, 0xE0, base + static_cast<uint64_t>(time * 90000.0), video);
+        }
+
+        while (segment->partOffsets.size() < parts)
+            segment->partOffsets.push_back(segment->bytes.size());
+        segment->partOffsets.push_back(segment->bytes.size());
+
+        std::lock_guard<std::mutex> lock(s_lock);
+        if (s_cache.size() >= 256)
+            s_cache.clear();
+        s_cache[{ variant, sequence }] = segment;
+        return segment;
+    }
+
+    // ---------------------------------------------------------------- generated ladder
+
+    size_t PartsPerSegment()
+    {
+        const Options& o = g_options;
+        return (o.partSeconds > 0.0) ? (std::max)(static_cast<size_t>(o.segmentSeconds / o.partSeconds + 0.5), size_t(1)) : 0;
+    }
+
+    bool IsLive()
+    {
+        return g_options.vodSeconds <= 0.0;
+    }
+
+    // Seconds of content produced so far, a full window is there from the start
+    double ProducedSeconds()
+    {
+        return SecondsSince(ServerStart) + g_options.window * g_options.segmentSeconds;
+    }
+
+    uint64_t SegmentCount()
+    {
+        const Options& o = g_options;
+        double produced = IsLive() ? ProducedSeconds() : o.vodSeconds;
+        return static_cast<uint64_t>(produced / o.segmentSeconds + 1e-9);
+    }
+
+    // Seconds until the part (or the whole segment when part is -1) exists, 0 if it does
+    double SecondsUntilAvailable(uint64_t sequence, int64_t part)
+    {
+        if (!IsLive())
+            return 0.0;
+
+        const Options& o = g_options;
+        size_t parts = PartsPerSegment();
+        double end = (part < 0 || parts == 0) ? (sequence + 1) * o.segmentSeconds
+            : sequence * o.segmentSeconds + (part + 1) * (o.segmentSeconds / parts);
+        return (std::max)(end - ProducedSeconds(), 0.0);
+    }
+
+    std::string MasterPlaylist()
+    {
+        static const char* Resolutions[] = { "416x234", "640x360", "854x480", "1280x720", "1920x1080", "2560x1440", "3840x2160" };
+
+        std::string text = "#EXTM3U\n#EXT-X-VERSION:6\n#EXT-X-INDEPENDENT-SEGMENTS\n";
+        for (size_t i = 0; i < g_options.variantsKbps.size(); ++i)
+        {
+            text += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(g_options.variantsKbps[i] * 1000)
+                + ",RESOLUTION=" + Resolutions[(std::min)(i, sizeof(Resolutions) / sizeof(Resolutions[0]) - 1)]
+                + ",CODECS=\"avc1.64001f,mp4a.40.2\"\n" + std::to_string(i) + "/playlist.m3u8\n";
+        }
+        return text;
+    }
+
+    std::string MediaPlaylist(bool skip)
+    {
+        const Options& o = g_options;
+        size_t parts = PartsPerSegment();
+        double partSeconds = parts ? o.segmentSeconds / parts : 0.0;
+        uint64_t count = SegmentCount();
+
+        HlsMediaPlaylist playlist;
+        playlist.targetDuration = o.segmentSeconds;
+        playlist.endList = !IsLive();
+        playlist.mediaSequence = (IsLive() && count > o.window) ? count - o.window : 0;
+
+        auto partOf = [&](uint64_t sequence, size_t k)
+            {
+                HlsPartialSegment part;
+                part.uri = "seg" + std::to_string(sequence) + "." + std::to_string(k) + ".ts";
+                part.duration = partSeconds;
+                part.independent = k == 0;
+                return part;
+            };
+
+        for (uint64_t sequence = playlist.mediaSequence; sequence < count; ++sequence)
+        {
+            HlsSegment segment;
+            segment.uri = "seg" + std::to_string(sequence) + ".ts";
+            segment.duration = o.segmentSeconds;
+            segment.sequence = sequence;
+
+            // parts stay listed for the last three target durations
+            if (IsLive() && parts != 0 && sequence + 3 >= count)
+            {
+                for (size_t k = 0; k < parts; ++k)
+                    segment.parts.push_back(partOf(sequence, k));
+            }
+            playlist.segments.push_back(segment);
+        }
+
+        if (IsLive() && parts != 0)
+        {
+            playlist.partTargetDuration = partSeconds;
+            playlist.serverControl.canBlockReload = true;
+            playlist.serverControl.canSkipUntil = 6 * o.segmentSeconds;
+            playlist.serverControl.partHoldBack = 3 * partSeconds;
+            playlist.serverControl.holdBack = 3 * o.segmentSeconds;
+
+            double inSegment = ProducedSeconds() - count * o.segmentSeconds;
+            size_t pending = (std::min)(static_cast<size_t>(inSegment / partSeconds + 1e-9), parts - 1);
+            for (size_t k = 0; k < pending; ++k)
+                playlist.pendingParts.push_back(partOf(count, k));
+
+            playlist.preloadHint.type = "PART";
+            playlist.preloadHint.uri = partOf(count, pending).uri;
+
+            // delta update, segments older than CAN-SKIP-UNTIL from the end are left out
+            if (skip)
+            {
+                size_t keep = static_cast<size_t>(playlist.serverControl.canSkipUntil / o.segmentSeconds);
+                if (playlist.segments.size() > keep)
+                {
+                    playlist.skippedSegments = playlist.segments.size() - keep;
+                    playlist.segments.erase(playlist.segments.begin(), playlist.segments.begin() + playlist.skippedSegments);
+                }
+            }
+        }
+
+        return Hls::WriteMediaPlaylist(playlist, true);
+    }
+
+    // ---------------------------------------------------------------- recorded ladders
+
+    bool ReadFile(const std::string& path, std::vector<uint8_t>* pData)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        pData->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // A VOD playlist replayed as live: the window slides one segment per segment duration and
+    // wraps around with a discontinuity
+    std::string LiveWindowPlaylist(const HlsMediaPlaylist& vod)
+    {
+        size_t count = vod.segments.size();
+        std::vector<double> ends;
+        double total = 0.0;
+        for (const HlsSegment& segment : vod.segments)
+        {
+            total += segment.duration;
+            ends.push_back(total);
+        }
+
+        size_t window = (std::min)(static_cast<size_t>(g_options.liveWindow), count);
+        double produced = SecondsSince(ServerStart) + total * window / count;
+        uint64_t loops = static_cast<uint64_t>(produced / total);
+        double rest = produced - loops * total;
+        uint64_t completed = loops * count + (std::upper_bound(ends.begin(), ends.end(), rest + 1e-9) - ends.begin());
+
+        HlsMediaPlaylist live;
+        live.uri = vod.uri;
+        live.targetDuration = vod.targetDuration;
+        live.initSegment = vod.initSegment;
+        live.mediaSequence = completed - window;
+
+        for (uint64_t sequence = live.mediaSequence; sequence < completed; ++sequence)
+        {
+            HlsSegment segment = vod.segments[sequence % count];
+            segment.discontinuity = segment.discontinuity || (sequence % count == 0 && sequence != 0);
+
+            // the IV defaults to the sequence number, the replayed one is not the recorded one
+            if (segment.key.IsEncrypted() && segment.key.iv.empty())
+            {
+                char iv[40];
+                snprintf(iv, sizeof(iv), "0x%032llx", static_cast<unsigned long long>(segment.sequence));
+                segment.key.iv = iv;
+            }
+
+            segment.sequence = sequence;
+            live.segments.push_back(segment);
+        }
+
+        return Hls::WriteMediaPlaylist(live, false);
+    }
+
+    // ---------------------------------------------------------------- HTTP
+
+    struct Request
+    {
+        std::string method;
+        std::string target;
+        std::string path;
+        std::map<std::string, std::string> query;
+        std::map<std::string, std::string> headers; // names lower case
+    };
+
+    struct Response
+    {
+        int status = 200;
+        std::string contentType = "application/octet-stream";
+        std::vector<uint8_t> body;
+        std::string extraHeaders;
+    };
+
+    const char* StatusText(int status)
+    {
+        switch (status)
+        {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 416: return "Range Not Satisfiable";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Error";
+        }
+    }
+
+    std::string ContentType(const std::string& path)
+    {
+        auto endsWith = [&](const char* suffix)
+            {
+                size_t length = strlen(suffix);
+                return path.size() >= length && path.compare(path.size() - length, length, suffix) == 0;
+            };
+
+        if (endsWith(".m3u8")) return "application/vnd.apple.mpegurl";
+        if (endsWith(".ts")) return "video/mp2t";
+        if (endsWith(".mp4") || endsWith(".m4s")) return "video/mp4";
+        if (endsWith(".aac")) return "audio/aac";
+        if (endsWith(".vtt")) return "text/vtt";
+        return "application/octet-stream";
+    }
+
+    std::string PercentDecode(const std::string& text)
+    {
+        std::string out;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '%' && i + 2 < text.size())
+            {
+                out.push_back(static_cast<char>(strtol(text.substr(i + 1, 2).c_str(), nullptr, 16)));
+                i += 2;
+            }
+            else
+            {
+                out.push_back(text[i]);
+            }
+        }
+        return out;
+    }
+
+    void SetText(Response* pResponse, int status, const std::string& text, const std::string& contentType = "text/plain")
+    {
+        pResponse->status = status;
+        pResponse->contentType = contentType;
+        pResponse->body.assign(text.begin(), text.end());
+    }
+
+    void ServeGenerated(const Request& request, const std::string& rest, Response* pResponse)
+    {
+        if (rest == "master.m3u8")
+        {
+            SetText(pResponse, 200, MasterPlaylist(), ContentType(rest));
+            return;
+        }
+
+        size_t slash = rest.find('/');
+        size_t variant = static_cast<size_t>(atoi(rest.substr(0, slash).c_str()));
+        if (slash == std::string::npos || variant >= g_options.variantsKbps.size())
+        {
+            SetText(pResponse, 404, "no such variant\n");
+            return;
+        }
+
+        std::string file = rest.substr(slash + 1);
+        double holdLimit = 3.0 * g_options.segmentSeconds;
+
+        if (file == "playlist.m3u8")
+        {
+            // blocking reload: held until the requested segment or part exists
+            auto msn = request.query.find("_HLS_msn");
+            if (msn != request.query.end() && IsLive() && PartsPerSegment() != 0)
+            {
+                uint64_t sequence = strtoull(msn->second.c_str(), nullptr, 10);
+                auto partParameter = request.query.find("_HLS_part");
+                int64_t part = (partParameter == request.query.end()) ? -1 : atoll(partParameter->second.c_str());
+                if (part >= static_cast<int64_t>(PartsPerSegment()))
+                {
+                    sequence++;
+                    part = 0;
+                }
+
+                if (sequence > SegmentCount() + 2)
+                {
+                    SetText(pResponse, 400, "_HLS_msn too far ahead\n");
+                    return;
+                }
+
+                double wait = SecondsUntilAvailable(sequence, part);
+                if (wait > holdLimit)
+                {
+                    SleepSeconds(holdLimit);
+                    SetText(pResponse, 503, "blocking reload timed out\n");
+                    return;
+                }
+                SleepSeconds(wait);
+            }
+
+            auto skip = request.query.find("_HLS_skip");
+            SetText(pResponse, 200, MediaPlaylist(skip != request.query.end() && skip->second == "YES"), ContentType(file));
+            pResponse->extraHeaders = "Cache-Control: no-cache\r\n";
+            return;
+        }
+
+        // segN.ts or segN.K.ts for a part
+        uint64_t sequence = 0;
+        int64_t part = -1;
+        unsigned long long parsedSequence = 0;
+        long long parsedPart = 0;
+        char tail[8] = {};
+        if (sscanf(file.c_str(), "seg%llu.%lld.t%2s", &parsedSequence, &parsedPart, tail) == 3 && strcmp(tail, "s") == 0 && PartsPerSegment() != 0)
+        {
+            sequence = parsedSequence;
+            part = parsedPart;
+        }
+        else if (sscanf(file.c_str(), "seg%llu.t%2s", &parsedSequence, tail) == 2 && strcmp(tail, "s") == 0)
+        {
+            sequence = parsedSequence;
+        }
+        else
+        {
+            SetText(pResponse, 404, "not found\n");
+            return;
+        }
+
+        if (part >= static_cast<int64_t>(PartsPerSegment()) || (!IsLive() && sequence >= SegmentCount()))
+        {
+            SetText(pResponse, 404, "not found\n");
+            return;
+        }
+
+        // a preload hint asks for a part before it exists
+        double wait = SecondsUntilAvailable(sequence, part);
+        if (wait > holdLimit)
+        {
+            SetText(pResponse, 404, "not produced yet\n");
+            return;
+        }
+        SleepSeconds(wait);
+
+        auto segment = GenerateSegment(variant, sequence);
+        size_t begin = (part < 0) ? 0 : segment->partOffsets[part];
+        size_t end = (part < 0) ? segment->bytes.size() : segment->partOffsets[part + 1];
+        pResponse->status = 200;
+        pResponse->contentType = "video/mp2t";
+        pResponse->body.assign(segment->bytes.begin() + begin, segment->bytes.begin() + end);
+    }
+
+    void ServeDirectory(const Request& request, Response* pResponse)
+    {
+        if (request.path.find("..") != std::string::npos)
+        {
+            SetText(pResponse, 403, "forbidden\n");
+            return;
+        }
+
+        std::string path = g_options.root + request.path;
+        if (!ReadFile(path, &pResponse->body))
+        {
+            SetText(pResponse, 404, "not found\n");
+            return;
+        }
+
+        pResponse->status = 200;
+        pResponse->contentType = ContentType(path);
+
+        if (g_options.liveWindow != 0 && pResponse->contentType == "application/vnd.apple.mpegurl")
+        {
+            std::string text(pResponse->body.begin(), pResponse->body.end());
+            auto host = request.headers.find("host");
+            std::string baseUri = "http://" + ((host != request.headers.end()) ? host->second : std::string("localhost")) + request.path;
+
+            HlsMediaPlaylist vod;
+            if (!Hls::IsMasterPlaylist(text) && Hls::ParseMediaPlaylist(text, baseUri, &vod) && vod.endList && !vod.segments.empty())
+            {
+                SetText(pResponse, 200, LiveWindowPlaylist(vod), pResponse->contentType);
+                pResponse->extraHeaders = "Cache-Control: no-cache\r\n";
+            }
+        }
+    }
+
+    void Route(const Request& request, Response* pResponse)
+    {
+        std::string prefix = "/" + g_options.generateName + "/";
+        if (!g_options.generateName.empty() && request.path.compare(0, prefix.size(), prefix) == 0)
+        {
+            ServeGenerated(request, request.path.substr(prefix.size()), pResponse);
+        }
+        else if (!g_options.root.empty())
+        {
+            ServeDirectory(request, pResponse);
+        }
+        else
+        {
+            SetText(pResponse, 404, "not found\n");
+        }
+    }
+
+    bool ParseRequest(const std::string& head, Request* pRequest)
+    {
+        std::istringstream lines(head);
+        std::string line;
+        if (!std::getline(lines, line))
+            return false;
+
+        std::istringstream requestLine(line);
+        std::string version;
+        requestLine >> pRequest->method >> pRequest->target >> version;
+        if (pRequest->method.empty() || pRequest->target.empty() || pRequest->target[0] != '/')
+            return false;
+
+        size_t question = pRequest->target.find('?');
+        pRequest->path = PercentDecode(pRequest->target.substr(0, question));
+        if (question != std::string::npos)
+        {
+            std::istringstream query(pRequest->target.substr(question + 1));
+            std::string pair;
+            while (std::getline(query, pair, '&'))
+            {
+                size_t equals = pair.find('=');
+                pRequest->query[PercentDecode(pair.substr(0, equals))] = (equals == std::string::npos) ? std::string() : PercentDecode(pair.substr(equals + 1));
+            }
+        }
+
+        while (std::getline(lines, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+            size_t valueStart = line.find_first_not_of(' ', colon + 1);
+            pRequest->headers[name] = (valueStart == std::string::npos) ? std::string() : line.substr(valueStart);
+        }
+
+        return true;
+    }
+
+    // "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+    bool ParseRange(const std::string& value, size_t size, size_t* pBegin, size_t* pEnd)
+    {
+        if (value.compare(0, 6, "bytes=") != 0 || size == 0)
+            return false;
+
+        std::string range = value.substr(6);
+        size_t dash = range.find('-');
+        if (dash == std::string::npos || range.find(',') != std::string::npos)
+            return false;
+
+        std::string first = range.substr(0, dash);
+        std::string last = range.substr(dash + 1);
+        if (first.empty())
+        {
+            size_t suffix = static_cast<size_t>(strtoull(last.c_str(), nullptr, 10));
+            *pBegin = size - (std::min)(suffix, size);
+            *pEnd = size;
+        }
+        else
+        {
+            *pBegin = static_cast<size_t>(strtoull(first.c_str(), nullptr, 10));
+            *pEnd = last.empty() ? size : (std::min)(static_cast<size_t>(strtoull(last.c_str(), nullptr, 10)) + 1, size);
+        }
+
+        return *pBegin < *pEnd;
+    }
+
+    class Connection
+    {
+    public:
+        Connection(int socket, uint64_t id)
+            : m_socket(socket)
+            , m_id(id)
+            , m_accepted(Clock::now())
+            , m_random(g_options.seed * 7919u + static_cast<uint32_t>(id))
+            , m_profile(g_options.profiles[id % g_options.profiles.size()])
+        {
+        }
+
+        ~Connection()
+        {
+            close(m_socket);
+        }
+
+        void Run()
+        {
+            std::string buffer;
+            for (;;)
+            {
+                size_t headEnd;
+                while ((headEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+                {
+                    char chunk[4096];
+                    ssize_t received = recv(m_socket, chunk, sizeof(chunk), 0);
+                    if (received <= 0 || buffer.size() > 64 * 1024)
+                        return;
+                    buffer.append(chunk, static_cast<size_t>(received));
+                }
+
+                std::string head = buffer.substr(0, headEnd);
+                buffer.erase(0, headEnd + 4);
+
+                Request request;
+                if (!ParseRequest(head, &request))
+                    return;
+
+                if (!Handle(request))
+                    return;
+
+                auto connection = request.headers.find("connection");
+                if (connection != request.headers.end() && strcasecmp(connection->second.c_str(), "close") == 0)
+                    return;
+            }
+        }
+
+    private:
+        double ProfileClock() const
+        {
+            return SecondsSince(g_options.sharedClock ? ServerStart : m_accepted);
+        }
+
+        // False when the connection is done, after a reset or a stall
+        bool Handle(const Request& request)
+        {
+            Clock::time_point start = Clock::now();
+            double startSeconds = SecondsSince(ServerStart);
+
+            Response response;
+            const FailureRule* pFailure = MatchFailure(request.path, startSeconds);
+            if (pFailure != nullptr && pFailure->action == FailureAction::Status)
+            {
+                SetText(&response, pFailure->status, "injected failure\n");
+            }
+            else if (request.method != "GET" && request.method != "HEAD")
+            {
+                SetText(&response, 400, "only GET and HEAD\n");
+            }
+            else
+            {
+                Route(request, &response);
+            }
+
+            size_t begin = 0;
+            size_t end = response.body.size();
+            auto range = request.headers.find("range");
+            if (response.status == 200 && range != request.headers.end())
+            {
+                if (ParseRange(range->second, response.body.size(), &begin, &end))
+                {
+                    response.status = 206;
+                    response.extraHeaders += "Content-Range: bytes " + std::to_string(begin) + "-" + std::to_string(end - 1) + "/" + std::to_string(response.body.size()) + "\r\n";
+                }
+                else
+                {
+                    response.extraHeaders += "Content-Range: bytes */" + std::to_string(response.body.size()) + "\r\n";
+                    SetText(&response, 416, "bad range\n");
+                    begin = 0;
+                    end = response.body.size();
+                }
+            }
+
+            const ProfileStep& step = m_profile.At(ProfileClock());
+            double jitter = std::uniform_real_distribution<double>(0.0, 1.0)(m_random);
+            SleepSeconds(step.latencyMs / 1000.0 * (0.75 + 0.5 * jitter));
+
+            if (pFailure != nullptr && pFailure->action == FailureAction::Reset)
+            {
+                Reset();
+                LogRequest(startSeconds, m_id, request.method, request.target, 0, 0, end - begin, SecondsSince(start), SecondsSince(start), m_profile.name, "injected-reset");
+                return false;
+            }
+
+            std::string headers = "HTTP/1.1 " + std::to_string(response.status) + " " + StatusText(response.status) + "\r\n"
+                + "Content-Type: " + response.contentType + "\r\n"
+                + "Content-Length: " + std::to_string(end - begin) + "\r\n"
+                + "Accept-Ranges: bytes\r\n"
+                + "Access-Control-Allow-Origin: *\r\n"
+                + response.extraHeaders + "\r\n";
+            if (!SendAll(reinterpret_cast<const uint8_t*>(headers.data()), headers.size()))
+                return false;
+            double ttfb = SecondsSince(start);
+
+            size_t bodySize = (request.method == "HEAD") ? 0 : end - begin;
+            const uint8_t* body = response.body.data() + begin;
+
+            // where a lossy link or a stall cuts the body off
+            size_t cut = bodySize;
+            const char* outcome = "ok";
+            if (pFailure != nullptr && pFailure->action == FailureAction::Stall)
+            {
+                cut = bodySize / 2;
+                outcome = "injected-stall";
+            }
+            else if (bodySize != 0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_random) < step.loss)
+            {
+                cut = std::uniform_int_distribution<size_t>(0, bodySize - 1)(m_random);
+                outcome = "loss-reset";
+            }
+
+            size_t sent = SendPaced(body, cut);
+            if (sent < cut)
+                outcome = "client-gone";
+
+            if (sent == cut && cut < bodySize)
+            {
+                if (pFailure != nullptr && pFailure->action == FailureAction::Stall)
+                {
+                    // the client's timeout ends it, or the server gives up after a minute
+                    char probe;
+                    for (int i = 0; i < 600 && recv(m_socket, &probe, 1, MSG_PEEK | MSG_DONTWAIT) != 0; ++i)
+                        SleepSeconds(0.1);
+                }
+                Reset();
+            }
+
+            LogRequest(startSeconds, m_id, request.method, request.target, response.status, sent, bodySize, ttfb, SecondsSince(start), m_profile.name, outcome);
+            return sent == bodySize;
+        }
+
+        const FailureRule* MatchFailure(const std::string& path, double now)
+        {
+            for (const FailureRule& rule : g_options.failures)
+            {
+                if (fnmatch(rule.pattern.c_str(), path.c_str(), 0) != 0)
+                    continue;
+                if (now < rule.from || (rule.to > 0.0 && now >= rule.to))
+                    continue;
+
+                uint64_t match = ++*rule.matches;
+                if (rule.every != 0 && match % rule.every != 0)
+                    continue;
+                if (std::uniform_real_distribution<double>(0.0, 1.0)(m_random) >= rule.probability)
+                    continue;
+
+                return &rule;
+            }
+            return nullptr;
+        }
+
+        bool SendAll(const uint8_t* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = send(m_socket, data, size, MSG_NOSIGNAL);
+                if (written <= 0)
+                    return false;
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+
+        // Paced to the profile's bandwidth in chunks of about 10 ms, a change of step applies to
+        // the rest of the body. Returns the bytes sent.
+        size_t SendPaced(const uint8_t* data, size_t size)
+        {
+            size_t sent = 0;
+            double budget = 0.0;
+            Clock::time_point last = Clock::now();
+            while (sent < size)
+            {
+                double kbps = m_profile.At(ProfileClock()).kbps;
+                if (kbps <= 0.0)
+                    return SendAll(data + sent, size - sent) ? size : sent;
+
+                double bytesPerSecond = kbps * 1000.0 / 8.0;
+                size_t chunk = (std::min)(size - sent, (std::max)(static_cast<size_t>(bytesPerSecond / 100.0), size_t(1460)));
+
+                // waits until the link has carried the bytes already sent
+                budget -= SecondsSince(last);
+                last = Clock::now();
+                SleepSeconds(budget);
+                budget = (std::max)(budget, 0.0) + chunk / bytesPerSecond;
+
+                if (!SendAll(data + sent, chunk))
+                    return sent;
+                sent += chunk;
+            }
+            return sent;
+        }
+
+        void Reset()
+        {
+            linger hard = { 1, 0 };
+            setsockopt(m_socket, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+        }
+
+        int m_socket;
+        uint64_t m_id;
+        Clock::time_point m_accepted;
+        std::mt19937 m_random;
+        const Profile& m_profile;
+    };
+
+    // ---------------------------------------------------------------- command line
+
+    bool LoadProfile(const std::string& path, Profile* pProfile)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        pProfile->name = path.substr(path.find_last_of('/') + 1);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            ProfileStep step = {};
+            int fields = sscanf(line.c_str(), "%lf %lf %lf %lf", &step.seconds, &step.kbps, &step.latencyMs, &step.loss);
+            if (fields >= 2)
+                pProfile->steps.push_back(step);
+        }
+
+        if (pProfile->steps.empty())
+            return false;
+
+        std::sort(pProfile->steps.begin(), pProfile->steps.end(), [](const ProfileStep& a, const ProfileStep& b) { return a.seconds < b.seconds; });
+        pProfile->steps.front().seconds = 0.0;
+
+        // loops after the last step, which lasts as long as the average step
+        double last = pProfile->steps.back().seconds;
+        pProfile->totalSeconds = (pProfile->steps.size() > 1) ? last + last / (pProfile->steps.size() - 1) : 0.0;
+        return true;
+    }
+
+    bool ParseFailure(const std::string& text, FailureRule* pRule)
+    {
+        std::istringstream fields(text);
+        std::string field;
+        while (std::getline(fields, field, ','))
+        {
+            size_t equals = field.find('=');
+            if (equals == std::string::npos)
+                return false;
+
+            std::string key = field.substr(0, equals);
+            std::string value = field.substr(equals + 1);
+            if (key == "path") pRule->pattern = value;
+            else if (key == "status")
+            {
+                if (value == "reset") pRule->action = FailureAction::Reset;
+                else if (value == "stall") pRule->action = FailureAction::Stall;
+                else pRule->status = atoi(value.c_str());
+            }
+            else if (key == "p") pRule->probability = atof(value.c_str());
+            else if (key == "every") pRule->every = strtoull(value.c_str(), nullptr, 10);
+            else if (key == "from") pRule->from = atof(value.c_str());
+            else if (key == "to") pRule->to = atof(value.c_str());
+            else return false;
+        }
+        return pRule->action != FailureAction::Status || (pRule->status >= 100 && pRule->status < 600);
+    }
+
+    std::vector<uint32_t> ParseList(const char* text)
+    {
+        std::vector<uint32_t> values;
+        std::istringstream items(text);
+        std::string item;
+        while (std::getline(items, item, ','))
+        {
+            uint32_t value = static_cast<uint32_t>(atoi(item.c_str()));
+            if (value != 0)
+                values.push_back(value);
+        }
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: hlsorigin [--port 9001] [--bind 127.0.0.1] [--seed 1] [--log FILE]\n"
+            "                 [--generate NAME] [--variants KBPS,...] [--segment S] [--part S] [--window N] [--vod S]\n"
+            "                 [--root DIR] [--live-window N]\n"
+            "                 [--profile TRACE]... [--bandwidth KBPS] [--latency MS] [--loss P] [--shared-clock]\n"
+            "                 [--fail path=GLOB,status=CODE|reset|stall[,p=P][,every=N][,from=S][,to=S]]...\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options& o = g_options;
+    ProfileStep constant = { 0.0, 0.0, 0.0, 0.0 };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--shared-clock")
+        {
+            o.sharedClock = true;
+            continue;
+        }
+
+        const char* value = (i + 1 < argc) ? argv[++i] : nullptr;
+        if (value == nullptr)
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        if (arg == "--port") o.port = static_cast<uint16_t>(atoi(value));
+        else if (arg == "--bind") o.bind = value;
+        else if (arg == "--seed") o.seed = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        else if (arg == "--log") o.logPath = value;
+        else if (arg == "--generate") o.generateName = value;
+        else if (arg == "--variants") o.variantsKbps = ParseList(value);
+        else if (arg == "--segment") o.segmentSeconds = atof(value);
+        else if (arg == "--part") o.partSeconds = atof(value);
+        else if (arg == "--window") o.window = static_cast<uint32_t>(atoi(value));
+        else if (arg == "--vod") o.vodSeconds = atof(value);
+        else if (arg == "--root") o.root = value;
+        else if (arg == "--live-window") o.liveWindow = static_cast<uint32_t>(atoi(value));
+        else if (arg == "--bandwidth") constant.kbps = atof(value);
+        else if (arg == "--latency") constant.latencyMs = atof(value);
+        else if (arg == "--loss") constant.loss = atof(value);
+        else if (arg == "--profile")
+        {
+            Profile profile;
+            if (!LoadProfile(value, &profile))
+            {
+                fprintf(stderr, "hlsorigin: cannot read profile %s\n", value);
+                return 1;
+            }
+            o.profiles.push_back(profile);
+        }
+        else if (arg == "--fail")
+        {
+            FailureRule rule;
+            if (!ParseFailure(value, &rule))
+            {
+                fprintf(stderr, "hlsorigin: bad failure rule %s\n", value);
+                return 1;
+            }
+            o.failures.push_back(rule);
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (o.variantsKbps.empty() || o.segmentSeconds <= 0.0 || o.window == 0 || o.partSeconds < 0.0 || o.partSeconds > o.segmentSeconds)
+    {
+        fprintf(stderr, "hlsorigin: need variants, a segment duration, a window and parts no longer than a segment\n");
+        return 1;
+    }
+
+    if (o.profiles.empty())
+    {
+        Profile profile;
+        profile.name = "constant";
+        profile.steps.push_back(constant);
+        o.profiles.push_back(profile);
+    }
+
+    if (!o.logPath.empty())
+    {
+        g_log = fopen(o.logPath.c_str(), "w");
+        if (g_log == nullptr)
+        {
+            fprintf(stderr, "hlsorigin: cannot write %s\n", o.logPath.c_str());
+            return 1;
+        }
+    }
+    fprintf(g_log, "start_s\tconnection\tmethod\ttarget\tstatus\tbytes\tttfb_ms\ttotal_ms\tprofile\toutcome\n");
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(o.port);
+    if (inet_pton(AF_INET, o.bind.c_str(), &address.sin_addr) != 1
+        || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 64) != 0)
+    {
+        fprintf(stderr, "hlsorigin: cannot listen on %s:%u: %s\n", o.bind.c_str(), o.port, strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "hlsorigin: http://%s:%u/%s/master.m3u8 (%s, %zu variants%s)%s%s\n", o.bind.c_str(), o.port, o.generateName.c_str(),
+        IsLive() ? "live" : "VOD", o.variantsKbps.size(), (IsLive() && o.partSeconds > 0.0) ? ", LL-HLS" : "",
+        o.root.empty() ? "" : ", files from ", o.root.c_str());
+
+    uint64_t nextId = 0;
+    for (;;)
+    {
+        int socket = accept(listener, nullptr, nullptr);
+        if (socket < 0)
+            continue;
+
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        std::thread([socket, id = nextId++]()
+            {
+                Connection connection(socket, id);
+                connection.Run();
+            }).detach();
+    }
+}
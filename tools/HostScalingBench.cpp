@@ -0,0 +1,216 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+
+// How the per-segment CPU work of a multiview wall scales with the threads of the pool it runs
+// on. Every stream has its own key and its own segments. A segment is copied, decrypted with
+// Aes128CbcDecryptor and its ADTS frames indexed into a fresh AudioFrameIndex, what
+// SegmentDecryptor and the audio fork do with each segment on the host's TaskPool. The work
+// items share nothing, so the speedup over one thread should stay close to the thread count
+// up to the physical cores. Prints the throughput, speedup and efficiency per thread count and
+// exits 1 when the efficiency at the most threads is below --min-efficiency.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -pthread -I. tools/HostScalingBench.cpp Aes128.cpp AudioFrameIndex.cpp -o hostscaling
+//
+//   hostscaling [--streams 16] [--segments 8] [--segment-kb 512] [--threads N] [--min-efficiency 0]
+
+#include "Aes128.h"
+#include "AudioFrameIndex.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const size_t FrameSize = 384; // one ADTS frame, header included
+
+    struct Stream
+    {
+        uint8_t key[16];
+        std::vector<std::vector<uint8_t>> ciphertext; // random, CBC decryption does not care
+        std::vector<std::vector<uint8_t>> audio;      // the ADTS the fork indexes
+    };
+
+    double Elapsed(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // AAC-LC, 48 kHz, stereo, no CRC
+    std::vector<uint8_t> MakeAdts(size_t bytes, std::mt19937& random)
+    {
+        std::vector<uint8_t> data;
+        data.reserve(bytes);
+        while (data.size() + FrameSize <= bytes)
+        {
+            const uint8_t header[7] = { 0xFF, 0xF1, 0x4C, static_cast<uint8_t>(0x80 | (FrameSize >> 11)),
+                static_cast<uint8_t>((FrameSize >> 3) & 0xFF), static_cast<uint8_t>(((FrameSize & 7) << 5) | 0x1F), 0xFC };
+            data.insert(data.end(), header, header + sizeof(header));
+            for (size_t i = sizeof(header); i < FrameSize; ++i)
+            {
+                // no 0xFF, a payload byte never starts a sync word
+                data.push_back(static_cast<uint8_t>(random() % 0xFF));
+            }
+        }
+        return data;
+    }
+
+    // Segments per second with threadCount threads taking the next segment of any stream
+    double Run(const std::vector<Stream>& streams, size_t threadCount, size_t passes, std::atomic<uint64_t>* pFrames)
+    {
+        size_t segmentCount = streams[0].ciphertext.size();
+        size_t total = streams.size() * segmentCount * passes;
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]()
+            {
+                uint64_t frames = 0;
+                for (size_t i = next++; i < total; i = next++)
+                {
+                    const Stream& stream = streams[i % streams.size()];
+                    size_t segment = (i / streams.size()) % segmentCount;
+
+                    // the player keeps the ciphertext, the fork decrypts a copy of its own
+                    std::vector<uint8_t> plaintext = stream.ciphertext[segment];
+                    uint8_t iv[16];
+                    Aes128::SequenceIv(segment, iv);
+                    Aes128CbcDecryptor decryptor(stream.key, iv);
+                    decryptor.Decrypt(plaintext.data(), plaintext.size());
+
+                    const std::vector<uint8_t>& audio = stream.audio[segment];
+                    AudioFrameIndex index;
+                    AudioFrames::IndexElementaryStream(audio.data(), audio.size(), 0, &index);
+                    frames += index.frames.size();
+                }
+                *pFrames += frames;
+            };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < threadCount; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        return total / Elapsed(start);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t streamCount = 16;
+    size_t segmentCount = 8;
+    size_t segmentKb = 512;
+    size_t maxThreads = std::thread::hardware_concurrency();
+    double minEfficiency = 0.0;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        size_t value = static_cast<size_t>(atoll(argv[i + 1]));
+        if (arg == "--streams")
+            streamCount = value;
+        else if (arg == "--segments")
+            segmentCount = value;
+        else if (arg == "--segment-kb")
+            segmentKb = value;
+        else if (arg == "--threads")
+            maxThreads = value;
+        else if (arg == "--min-efficiency")
+            minEfficiency = atof(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "hostscaling: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if (streamCount == 0 || segmentCount == 0 || segmentKb == 0 || maxThreads == 0)
+    {
+        fprintf(stderr, "hostscaling: sizes and counts must not be 0\n");
+        return 1;
+    }
+
+    std::mt19937 random(1);
+    std::vector<Stream> streams(streamCount);
+    for (Stream& stream : streams)
+    {
+        for (uint8_t& byte : stream.key)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        for (size_t i = 0; i < segmentCount; ++i)
+        {
+            std::vector<uint8_t> ciphertext(segmentKb * 1024);
+            for (uint8_t& byte : ciphertext)
+            {
+                byte = static_cast<uint8_t>(random());
+            }
+            stream.ciphertext.push_back(std::move(ciphertext));
+            stream.audio.push_back(MakeAdts(segmentKb * 1024 / 8, random));
+        }
+    }
+
+    // 1, 2, 4 ... and the most threads asked for
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < maxThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    printf("%zu streams, %zu segments of %zu KB each, AES-NI %s\n", streamCount, segmentCount, segmentKb,
+        Aes128CbcDecryptor::IsAesNiSupported() ? "available" : "not available");
+
+    // warms the caches, a pass over every segment
+    std::atomic<uint64_t> frames(0);
+    Run(streams, 1, 1, &frames);
+
+    double single = 0.0;
+    double efficiency = 1.0;
+    for (size_t threads : threadCounts)
+    {
+        double rate = Run(streams, threads, threads, &frames);
+        if (threads == 1)
+        {
+            single = rate;
+        }
+        double speedup = rate / single;
+        efficiency = speedup / threads;
+        printf("%3zu threads  %8.1f segments/s  speedup %5.2f  efficiency %4.2f\n", threads, rate, speedup, efficiency);
+    }
+
+    if (frames == 0)
+    {
+        fprintf(stderr, "hostscaling: no audio frame was indexed\n");
+        return 1;
+    }
+
+    if (efficiency < minEfficiency)
+    {
+        fprintf(stderr, "hostscaling: efficiency %.2f at %zu threads is below %.2f\n", efficiency, maxThreads, minEfficiency);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Stress run of MediaEventQueue: many producer threads post every event type the way media
+// callbacks do, one owner thread drains at a fixed cadence. Failures are posted uncoalesced
+// and must arrive in order per producer. Every posted event must be handled, merged into a
+// handled record or counted as dropped. A drain after the producers finished must leave
+// nothing behind. Prints the callback to drain latency per type and exits 1 on a violation.
+//
+// Build (portable, no Windows dependencies), ThreadSanitizer is worth a run too:
+//   g++ -std=c++17 -O2 -pthread -I. tools/MediaEventStress.cpp -o eventstress
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -I. tools/MediaEventStress.cpp -o eventstress
+//
+//   eventstress [--producers 32] [--events 200000] [--capacity 64] [--drain-us 500]
+
+#include "MediaEventQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const char* TypeNames[] = { "state", "size", "failed", "frame" };
+
+    struct Totals
+    {
+        uint64_t events[static_cast<size_t>(MediaEventType::Count)] = {};   // summed counts of the handled records
+        uint64_t records[static_cast<size_t>(MediaEventType::Count)] = {};
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    size_t producerCount = 32;
+    size_t eventsPerProducer = 200000;
+    size_t capacity = 64;
+    size_t drainUs = 500;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        size_t value = static_cast<size_t>(atoll(argv[i + 1]));
+        if (arg == "--producers")
+            producerCount = value;
+        else if (arg == "--events")
+            eventsPerProducer = value;
+        else if (arg == "--capacity")
+            capacity = value;
+        else if (arg == "--drain-us")
+            drainUs = value;
+        else
+        {
+            fprintf(stderr, "eventstress: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    if (producerCount == 0 || eventsPerProducer == 0 || capacity == 0)
+    {
+        fprintf(stderr, "eventstress: counts must not be 0\n");
+        return 1;
+    }
+
+    MediaEventQueue queue(capacity);
+    std::vector<int> producerIds(producerCount);
+    std::atomic<size_t> running(producerCount);
+    bool failed = false;
+
+    // failures carry a sequence number per producer, they must come out in the order they went in
+    std::vector<int32_t> lastFailure(producerCount, -1);
+    Totals totals;
+
+    auto handle = [&](const MediaEvent& event)
+        {
+            size_t type = static_cast<size_t>(event.type);
+            totals.events[type] += event.count;
+            totals.records[type]++;
+
+            if (event.type == MediaEventType::Failed)
+            {
+                size_t producer = static_cast<const int*>(event.source) - producerIds.data();
+                if (event.coalesced || event.count != 1 || producer >= producerCount || event.value <= lastFailure[producer])
+                {
+                    fprintf(stderr, "eventstress: failure %d of producer %zu out of order\n", event.value, producer);
+                    failed = true;
+                }
+                else
+                {
+                    lastFailure[producer] = event.value;
+                }
+            }
+        };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&, p]()
+            {
+                std::mt19937 random(static_cast<uint32_t>(p + 1));
+                int32_t failures = 0;
+                for (size_t i = 0; i < eventsPerProducer; ++i)
+                {
+                    // mostly frames, as a playing player posts them
+                    uint32_t roll = random() % 100;
+                    MediaEventType type = roll < 85 ? MediaEventType::VideoFrameAvailable
+                        : roll < 93 ? MediaEventType::StateChanged
+                        : roll < 98 ? MediaEventType::SizeChanged
+                        : MediaEventType::Failed;
+
+                    if (type == MediaEventType::Failed)
+                    {
+                        queue.Post(type, &producerIds[p], failures++, false);
+                    }
+                    else
+                    {
+                        queue.Post(type, &producerIds[p], static_cast<int32_t>(i));
+                    }
+                }
+                running--;
+            });
+    }
+
+    size_t drains = 0;
+    while (running != 0)
+    {
+        queue.Drain(handle);
+        drains++;
+        std::this_thread::sleep_for(std::chrono::microseconds(drainUs));
+    }
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    while (queue.Drain(handle) != 0)
+    {
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // a coalesced type with nothing waiting must post a record again
+    for (size_t type = 0; type < static_cast<size_t>(MediaEventType::Count); ++type)
+    {
+        uint64_t records = totals.records[type];
+        queue.Post(static_cast<MediaEventType>(type), nullptr, 0, type != static_cast<size_t>(MediaEventType::Failed));
+        queue.Drain([&](const MediaEvent&) { totals.records[type]++; });
+        if (totals.records[type] != records + 1)
+        {
+            fprintf(stderr, "eventstress: %s events stuck after the producers finished\n", TypeNames[type]);
+            failed = true;
+        }
+    }
+
+    uint64_t posted = 0;
+    printf("%zu producers, %zu events each, capacity %zu, drained every %zu us (%zu drains)\n",
+        producerCount, eventsPerProducer, queue.Capacity(), drainUs, drains);
+    for (size_t type = 0; type < static_cast<size_t>(MediaEventType::Count); ++type)
+    {
+        MediaEventStats stats = queue.GetStats(static_cast<MediaEventType>(type));
+        uint64_t handledEvents = totals.events[type] + 1;
+        posted += stats.posted;
+
+        // a merge into a record whose push then failed on a full queue is lost with it
+        if (handledEvents + stats.dropped > stats.posted || (stats.dropped == 0 && handledEvents != stats.posted))
+        {
+            fprintf(stderr, "eventstress: %s posted %llu, handled %llu, dropped %llu\n", TypeNames[type],
+                (unsigned long long)stats.posted, (unsigned long long)handledEvents, (unsigned long long)stats.dropped);
+            failed = true;
+        }
+
+        printf("%-7s %10llu posted %10llu coalesced %8llu dropped %8llu records, latency %8.1f us mean %8.1f us max\n", TypeNames[type],
+            (unsigned long long)stats.posted, (unsigned long long)stats.coalesced, (unsigned long long)stats.dropped,
+            (unsigned long long)stats.handled,
+            stats.handled != 0 ? stats.latencySecondsTotal * 1e6 / stats.handled : 0.0, stats.latencySecondsMax * 1e6);
+    }
+    printf("%.1f M posts/s\n", posted / seconds / 1e6);
+
+    if (failed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,192 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Cost of recording into the Metrics registry from many threads at once, the way frame copies
+// and downloads record. Each thread adds to one shared counter and records a copy latency like
+// value into one shared histogram. The counter must come out at the number of adds, the
+// histogram's count at what was recorded, and its sum, max and quantiles within the bucket
+// precision of the exact ones. Prints the time per Add and per Record and the exposition text, exits 1 on
+// a mismatch.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -pthread -I. tools/MetricsBench.cpp Metrics.cpp -o metricsbench
+//
+//   metricsbench [--threads 4] [--ops 2000000] [--file metrics.prom]
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // copy latencies in microseconds, mostly a few hundred with a long tail
+    uint64_t Latency(uint64_t n)
+    {
+        uint64_t x = n * 0x9e3779b97f4a7c15ull;
+        x ^= x >> 29;
+        uint64_t value = 200 + x % 300;
+        if (x % 100 == 0)
+        {
+            value += (x >> 8) % 20000;
+        }
+        return value;
+    }
+
+    template <typename TCall>
+    double Measure(size_t threadCount, size_t ops, TCall call)
+    {
+        std::atomic<size_t> ready(0);
+        std::atomic<bool> go(false);
+        std::vector<double> seconds(threadCount, 0.0);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]()
+                {
+                    ready++;
+                    while (!go)
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    auto start = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < ops; ++i)
+                    {
+                        call(t * ops + i);
+                    }
+                    seconds[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                });
+        }
+        while (ready != threadCount)
+        {
+            std::this_thread::yield();
+        }
+        go = true;
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        double total = 0.0;
+        for (double s : seconds)
+        {
+            total += s;
+        }
+        return total * 1e9 / (static_cast<double>(ops) * threadCount);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t threadCount = 4;
+    size_t ops = 2000000;
+    std::string file;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads")
+            threadCount = static_cast<size_t>(atoll(argv[i + 1]));
+        else if (arg == "--ops")
+            ops = static_cast<size_t>(atoll(argv[i + 1]));
+        else if (arg == "--file")
+            file = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "metricsbench: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    Metrics::Registry& registry = Metrics::Registry::Instance();
+    Metrics::Counter& frames = registry.GetCounter("bench_frames_total", "Frames copied");
+    Metrics::Histogram& copyUs = registry.GetHistogram("bench_copy_us", "Frame copy time in microseconds");
+    Metrics::Gauge& threads = registry.GetGauge("bench_threads", "Recording threads");
+    threads.Set(static_cast<int64_t>(threadCount));
+
+    if (!file.empty())
+    {
+        registry.StartSnapshots(file.c_str(), 100);
+    }
+
+    double addNs = Measure(threadCount, ops, [&](size_t) { frames.Add(); });
+    double recordNs = Measure(threadCount, ops, [&](size_t n) { copyUs.Record(Latency(n)); });
+
+    if (!file.empty())
+    {
+        registry.StopSnapshots();
+    }
+
+    bool failed = false;
+    uint64_t expected = static_cast<uint64_t>(threadCount) * ops;
+    if (frames.Value() != expected)
+    {
+        fprintf(stderr, "metricsbench: counter is %llu, expected %llu\n", (unsigned long long)frames.Value(), (unsigned long long)expected);
+        failed = true;
+    }
+
+    std::vector<uint64_t> values(expected);
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < expected; ++n)
+    {
+        values[n] = Latency(n);
+        sum += values[n];
+    }
+    std::sort(values.begin(), values.end());
+
+    // sum and max come from the buckets, the sum of midpoints is off by half a bucket's width
+    Metrics::HistogramSnapshot snapshot = copyUs.Snapshot();
+    double precision = 1.0 / Metrics::Histogram::SubBuckets;
+    double sumError = sum != 0 ? std::fabs(static_cast<double>(snapshot.sum) - sum) / sum : 0.0;
+    double maxError = (static_cast<double>(snapshot.max) - values.back()) / (values.back() != 0 ? values.back() : 1);
+    if (snapshot.count != expected || sumError > precision / 2 || maxError < 0.0 || maxError > precision)
+    {
+        fprintf(stderr, "metricsbench: histogram count %llu sum %llu max %llu, expected %llu %llu %llu\n",
+            (unsigned long long)snapshot.count, (unsigned long long)snapshot.sum, (unsigned long long)snapshot.max,
+            (unsigned long long)expected, (unsigned long long)sum, (unsigned long long)values.back());
+        failed = true;
+    }
+
+    for (double q : { 0.5, 0.9, 0.99, 0.999 })
+    {
+        size_t rank = static_cast<size_t>(q * expected + 0.5);
+        uint64_t exact = values[rank == 0 ? 0 : rank - 1];
+        uint64_t reported = snapshot.Quantile(q);
+        double error = exact != 0 ? (static_cast<double>(reported) - exact) / exact : 0.0;
+        printf("p%g %llu us, exact %llu us\n", q * 100, (unsigned long long)reported, (unsigned long long)exact);
+        if (error < 0.0 || error > 1.0 / Metrics::Histogram::SubBuckets)
+        {
+            fprintf(stderr, "metricsbench: p%g is off by %.2f%%\n", q * 100, error * 100);
+            failed = true;
+        }
+    }
+
+    printf("%zu threads x %zu ops\n", threadCount, ops);
+    printf("Counter::Add %.1f ns, Histogram::Record %.1f ns\n", addNs, recordNs);
+    printf("%s", registry.Exposition().c_str());
+
+    if (failed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Fuzz target for Mp4BoxParser. Every entry point runs over the same input, the movie parsed
+// from it feeds the fragment indexer so both halves see hostile track tables.
+//
+// libFuzzer:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -I. tools/Mp4BoxFuzz.cpp Mp4BoxParser.cpp -o mp4fuzz
+//   ./mp4fuzz corpus/
+//
+// Without clang, a mutation driver over seed files (init and media segments) is built in:
+//   g++ -std=c++17 -g -O1 -fsanitize=address,undefined -DMP4_FUZZ_STANDALONE -I. tools/Mp4BoxFuzz.cpp Mp4BoxParser.cpp -o mp4fuzz
+//   ./mp4fuzz --iterations 200000 init.mp4 segment.m4s
+
+#include "Mp4BoxParser.h"
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    Mp4MovieInfo movie;
+    Mp4::ParseMovie(data, size, &movie);
+
+    Mp4Sample samples[64];
+    Mp4FragmentStats stats;
+    Mp4::IndexFragments(data, size, movie, samples, sizeof(samples) / sizeof(samples[0]), &stats);
+
+    // every stored sample must lie inside the input
+    size_t stored = stats.sampleCount < 64 ? stats.sampleCount : 64;
+    for (size_t i = 0; i < stored; ++i)
+    {
+        if (samples[i].offset > size || samples[i].size > size - samples[i].offset)
+            __builtin_trap();
+    }
+
+    uint32_t timescale = 0;
+    Mp4SegmentReference references[16];
+    size_t count = 0;
+    Mp4::ParseSegmentIndex(data, size, &timescale, references, 16, &count);
+
+    uint64_t decodeTime = 0;
+    Mp4::GetBaseMediaDecodeTime(data, size, 1, &decodeTime);
+
+    Mp4BoxReader reader(data, size);
+    Mp4Box box;
+    while (reader.Next(&box))
+    {
+        Mp4BoxReader children(box);
+        Mp4Box child;
+        while (children.Next(&child))
+        {
+        }
+    }
+
+    return 0;
+}
+
+#ifdef MP4_FUZZ_STANDALONE
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    uint64_t iterations = 100000;
+    std::vector<std::vector<uint8_t>> seeds;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc)
+        {
+            iterations = strtoull(argv[++i], nullptr, 10);
+            continue;
+        }
+
+        std::ifstream file(arg, std::ios::binary);
+        seeds.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    if (seeds.empty())
+    {
+        fprintf(stderr, "usage: mp4fuzz [--iterations <n>] seed...\n");
+        return 1;
+    }
+
+    // concatenated seeds give the indexer a movie and fragments in one input
+    std::vector<uint8_t> all;
+    for (const auto& seed : seeds)
+    {
+        all.insert(all.end(), seed.begin(), seed.end());
+    }
+    seeds.push_back(all);
+
+    std::mt19937_64 random(1);
+    std::vector<uint8_t> input;
+    for (uint64_t n = 0; n < iterations; ++n)
+    {
+        input = seeds[random() % seeds.size()];
+        if (input.empty())
+            continue;
+
+        // flip bytes, favoring the box headers near the front
+        size_t mutations = 1 + random() % 8;
+        for (size_t m = 0; m < mutations; ++m)
+        {
+            size_t limit = (random() % 2) ? (input.size() < 512 ? input.size() : 512) : input.size();
+            size_t pos = random() % limit;
+            switch (random() % 4)
+            {
+            case 0: input[pos] = static_cast<uint8_t>(random()); break;
+            case 1: input[pos] ^= static_cast<uint8_t>(1u << (random() % 8)); break;
+            case 2: input[pos] = (random() % 2) ? 0x00 : 0xFF; break;
+            default: input.resize(pos + 1); break;
+            }
+        }
+
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    printf("%llu inputs, no faults\n", static_cast<unsigned long long>(iterations));
+    return 0;
+}
+
+#endif
@@ -0,0 +1,118 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Throughput of Mp4::IndexFragments over recorded fMP4/CMAF segments, indexed in place the way
+// the streamer indexes cached segments. The init segment supplies track defaults.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -I. tools/Mp4IndexBench.cpp Mp4BoxParser.cpp -o mp4bench
+//
+//   mp4bench [--seconds 2] --init init.mp4 segment.m4s...
+
+#include "Mp4BoxParser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+    bool ReadFile(const std::string& path, std::vector<uint8_t>* pData)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        pData->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    double minSeconds = 2.0;
+    std::vector<uint8_t> init;
+    std::vector<std::vector<uint8_t>> segments;
+    size_t totalBytes = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc)
+        {
+            minSeconds = atof(argv[++i]);
+        }
+        else if (arg == "--init" && i + 1 < argc)
+        {
+            if (!ReadFile(argv[++i], &init))
+            {
+                fprintf(stderr, "mp4bench: cannot read %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            segments.emplace_back();
+            if (!ReadFile(arg, &segments.back()))
+            {
+                fprintf(stderr, "mp4bench: cannot read %s\n", arg.c_str());
+                return 1;
+            }
+            totalBytes += segments.back().size();
+        }
+    }
+
+    Mp4MovieInfo movie = {};
+    if (segments.empty() || totalBytes == 0 || (!init.empty() && !Mp4::ParseMovie(init.data(), init.size(), &movie)))
+    {
+        fprintf(stderr, "usage: mp4bench [--seconds <s>] [--init init.mp4] segment.m4s...\n");
+        return 1;
+    }
+
+    // one index buffer for the whole run, the indexer never allocates
+    std::vector<Mp4Sample> samples(1 << 16);
+    uint64_t sampleCount = 0;
+    uint64_t fragmentCount = 0;
+    uint64_t failures = 0;
+    uint64_t passes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+
+    do
+    {
+        for (const auto& segment : segments)
+        {
+            Mp4FragmentStats stats;
+            if (!Mp4::IndexFragments(segment.data(), segment.size(), movie, samples.data(), samples.size(), &stats))
+                failures++;
+
+            sampleCount += stats.sampleCount;
+            fragmentCount += stats.fragmentCount;
+        }
+
+        passes++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    printf("%zu segments, %.2f MB per pass, %llu passes in %.2f s\n",
+        segments.size(), totalBytes / (1024.0 * 1024.0), static_cast<unsigned long long>(passes), elapsed);
+    printf("throughput: %.1f MB/s, %.1f M samples/s\n",
+        totalBytes * static_cast<double>(passes) / (1024.0 * 1024.0) / elapsed, sampleCount / elapsed / 1e6);
+    printf("per pass: %llu fragments, %llu samples, %llu malformed segments\n",
+        static_cast<unsigned long long>(fragmentCount / passes), static_cast<unsigned long long>(sampleCount / passes),
+        static_cast<unsigned long long>(failures / passes));
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Cost of polling a Seqlock snapshot the size of PLAYBACK_STATE while it is published. One
+// writer publishes at a fixed rate, the reader threads read as fast as they can. Every field of
+// a published value is derived from its first one, a copy mixing two values is a torn read.
+// Versions a reader sees must never go down. Prints the time per read and per version check,
+// exits 1 on a violation.
+//
+// Build (portable, no Windows dependencies), ThreadSanitizer is worth a run too:
+//   g++ -std=c++17 -O2 -pthread -I. tools/SeqlockBench.cpp -o seqbench
+//
+//   seqbench [--readers 4] [--seconds 2] [--publish-us 100]
+
+#include "Seqlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // laid out like PLAYBACK_STATE with its MEDIA_DESCRIPTION, 40 bytes
+    struct State
+    {
+        uint32_t type;
+        uint32_t state;
+        int32_t hresult;
+        uint32_t width;
+        uint32_t height;
+        int64_t duration;
+        uint8_t canSeek;
+        uint8_t isStereoscopic;
+    };
+
+    State MakeState(uint32_t n)
+    {
+        State state = {};
+        state.type = n;
+        state.state = n * 3 + 1;
+        state.hresult = static_cast<int32_t>(n ^ 0x5a5a5a5a);
+        state.width = n * 7;
+        state.height = n * 11;
+        state.duration = static_cast<int64_t>(n) * 10000000;
+        state.canSeek = static_cast<uint8_t>(n & 1);
+        state.isStereoscopic = static_cast<uint8_t>(n >> 8);
+        return state;
+    }
+
+    bool IsConsistent(const State& state)
+    {
+        State expected = MakeState(state.type);
+        return state.state == expected.state && state.hresult == expected.hresult && state.width == expected.width
+            && state.height == expected.height && state.duration == expected.duration
+            && state.canSeek == expected.canSeek && state.isStereoscopic == expected.isStereoscopic;
+    }
+
+    struct ReaderResult
+    {
+        uint64_t reads = 0;
+        uint64_t changes = 0;
+        double readSeconds = 0.0;
+        uint64_t checks = 0;
+        double checkSeconds = 0.0;
+        bool failed = false;
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    size_t readerCount = 4;
+    double seconds = 2.0;
+    size_t publishUs = 100;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--readers")
+            readerCount = static_cast<size_t>(atoll(argv[i + 1]));
+        else if (arg == "--seconds")
+            seconds = atof(argv[i + 1]);
+        else if (arg == "--publish-us")
+            publishUs = static_cast<size_t>(atoll(argv[i + 1]));
+        else
+        {
+            fprintf(stderr, "seqbench: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    Seqlock<State> snapshot;
+    snapshot.Publish(MakeState(0));
+
+    std::atomic<bool> running(true);
+    std::vector<ReaderResult> results(readerCount);
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < readerCount; ++r)
+    {
+        readers.emplace_back([&, r]()
+            {
+                ReaderResult& result = results[r];
+                uint64_t lastVersion = 0;
+                while (running)
+                {
+                    // a render loop's frame: a version check, a copy only when it changed
+                    auto start = std::chrono::steady_clock::now();
+                    uint64_t version = 0;
+                    for (int i = 0; i < 1000; ++i)
+                    {
+                        version = snapshot.Version();
+                    }
+                    auto checked = std::chrono::steady_clock::now();
+                    result.checks += 1000;
+                    result.checkSeconds += std::chrono::duration<double>(checked - start).count();
+                    if (version < lastVersion)
+                    {
+                        fprintf(stderr, "seqbench: version went back from %llu to %llu\n", (unsigned long long)lastVersion, (unsigned long long)version);
+                        result.failed = true;
+                    }
+
+                    State state;
+                    for (int i = 0; i < 1000; ++i)
+                    {
+                        version = snapshot.Read(&state);
+                        if (!IsConsistent(state) || version < lastVersion)
+                        {
+                            fprintf(stderr, "seqbench: torn or stale read of version %llu\n", (unsigned long long)version);
+                            result.failed = true;
+                        }
+                        if (version != lastVersion)
+                        {
+                            result.changes++;
+                            lastVersion = version;
+                        }
+                    }
+                    result.reads += 1000;
+                    result.readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - checked).count();
+                }
+            });
+    }
+
+    uint32_t published = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    while (std::chrono::steady_clock::now() < end)
+    {
+        snapshot.Publish(MakeState(++published));
+        if (publishUs != 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(publishUs));
+        }
+    }
+    running = false;
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    bool failed = snapshot.Version() != published + 1ull;
+    printf("%u publishes, %zu readers\n", published, readerCount);
+    for (size_t r = 0; r < readerCount; ++r)
+    {
+        const ReaderResult& result = results[r];
+        failed = failed || result.failed;
+        printf("reader %zu: %llu reads %.1f ns each, %llu version checks %.1f ns each, %llu changes seen\n", r,
+            (unsigned long long)result.reads, result.reads != 0 ? result.readSeconds * 1e9 / result.reads : 0.0,
+            (unsigned long long)result.checks, result.checks != 0 ? result.checkSeconds * 1e9 / result.checks : 0.0,
+            (unsigned long long)result.changes);
+    }
+
+    if (failed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
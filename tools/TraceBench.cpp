@@ -0,0 +1,167 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Cost of a TRACE_SPAN and a check of the trace file. Threads record spans nested two deep, a
+// frame and its copy, as fast as they can while another thread writes the trace file every
+// few milliseconds. The last file must hold every span still in the buffers, each with a valid duration.
+// Prints the time per span and the file's size, exits 1 on a mismatch. Open the file in
+// ui.perfetto.dev to see it.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -pthread -DTRACE_SPANS -I. tools/TraceBench.cpp Trace.cpp -o tracebench
+//
+//   tracebench [--threads 4] [--spans 1000000] [--file trace.json] [--write-ms 50]
+
+#include "Trace.h"
+
+#ifndef TRACE_SPANS
+#error build with -DTRACE_SPANS
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    size_t threadCount = 4;
+    size_t spans = 1000000;
+    std::string file = "trace.json";
+    size_t writeMs = 50;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads")
+            threadCount = static_cast<size_t>(atoll(argv[i + 1]));
+        else if (arg == "--spans")
+            spans = static_cast<size_t>(atoll(argv[i + 1]));
+        else if (arg == "--file")
+            file = argv[i + 1];
+        else if (arg == "--write-ms")
+            writeMs = static_cast<size_t>(atoll(argv[i + 1]));
+        else
+        {
+            fprintf(stderr, "tracebench: unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    Trace::SetThreadName("main");
+
+    std::atomic<bool> running(true);
+    size_t writes = 0;
+    std::thread writer([&]()
+        {
+            Trace::SetThreadName("writer");
+            while (running)
+            {
+                {
+                    TRACE_SPAN("WriteFile");
+                    Trace::WriteFile(file.c_str());
+                    writes++;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(writeMs));
+            }
+        });
+
+    std::vector<double> seconds(threadCount, 0.0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+            {
+                Trace::SetThreadName("frames");
+                volatile uint64_t work = 0;
+                auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < spans; i += 2)
+                {
+                    TRACE_SPAN("OnVideoFrameAvailable");
+                    work = work + i;
+                    {
+                        TRACE_SPAN("CopyFrameToVideoSurface");
+                        work = work + 1;
+                    }
+                }
+                seconds[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    running = false;
+    writer.join();
+
+    if (!Trace::WriteFile(file.c_str()))
+    {
+        fprintf(stderr, "tracebench: could not write %s\n", file.c_str());
+        return 1;
+    }
+
+    // the spans in the file, as the trace viewer would take them
+    size_t events = 0;
+    bool failed = false;
+    FILE* pFile = fopen(file.c_str(), "rb");
+    long bytes = 0;
+    if (pFile != nullptr)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), pFile) != nullptr)
+        {
+            const char* dur = strstr(line, "\"ph\":\"X\"");
+            if (dur == nullptr)
+                continue;
+
+            events++;
+            const char* value = strstr(line, "\"dur\":");
+            if (value == nullptr || atof(value + 6) < 0.0)
+            {
+                fprintf(stderr, "tracebench: bad span %s", line);
+                failed = true;
+            }
+        }
+        bytes = ftell(pFile);
+        fclose(pFile);
+    }
+
+    Trace::Stats stats = Trace::GetStats();
+    size_t expected = static_cast<size_t>(stats.spans - stats.overwritten);
+    if (events != expected)
+    {
+        fprintf(stderr, "tracebench: %zu spans in the file, %zu in the buffers\n", events, expected);
+        failed = true;
+    }
+
+    double total = 0.0;
+    for (double s : seconds)
+    {
+        total += s;
+    }
+    printf("%zu threads x %zu spans, %zu trace files written meanwhile\n", threadCount, spans, writes);
+    printf("TRACE_SPAN %.1f ns per span\n", total * 1e9 / (static_cast<double>(spans) * threadCount));
+    printf("%llu spans recorded, %llu overwritten, %zu in %s (%ld bytes)\n", (unsigned long long)stats.spans,
+        (unsigned long long)stats.overwritten, events, file.c_str(), bytes);
+
+    if (failed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Throughput of TsDemuxer over recorded .ts segments. Each segment is demuxed on its own, the
+// way the streamer sees them, for at least --seconds of wall time.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -I. tools/TsDemuxBench.cpp TsDemuxer.cpp -o tsbench
+//
+//   tsbench [--seconds 2] [--chunk 65536] segment.ts...
+
+#include "TsDemuxer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    double minSeconds = 2.0;
+    size_t chunkSize = 64 * 1024; // network reads hand the demuxer chunks like this
+    std::vector<std::vector<uint8_t>> segments;
+    size_t totalBytes = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc)
+        {
+            minSeconds = atof(argv[++i]);
+        }
+        else if (arg == "--chunk" && i + 1 < argc)
+        {
+            chunkSize = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+        }
+        else
+        {
+            std::ifstream file(arg, std::ios::binary);
+            if (!file)
+            {
+                fprintf(stderr, "tsbench: cannot read %s\n", arg.c_str());
+                return 1;
+            }
+            segments.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            totalBytes += segments.back().size();
+        }
+    }
+
+    if (segments.empty() || totalBytes == 0 || chunkSize == 0)
+    {
+        fprintf(stderr, "usage: tsbench [--seconds <s>] [--chunk <bytes>] segment.ts...\n");
+        return 1;
+    }
+
+    uint64_t pesCount = 0;
+    uint64_t audioBytes = 0;
+    uint64_t videoBytes = 0;
+    uint64_t continuityErrors = 0;
+    uint64_t passes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+
+    do
+    {
+        for (const auto& segment : segments)
+        {
+            TsDemuxer demuxer([&](const PesPacket& packet)
+                {
+                    pesCount++;
+                    TsElementaryStream stream = { packet.pid, packet.streamType };
+                    if (stream.IsAudio())
+                        audioBytes += packet.size;
+                    else if (stream.IsVideo())
+                        videoBytes += packet.size;
+                });
+
+            for (size_t pos = 0; pos < segment.size(); pos += chunkSize)
+            {
+                size_t size = (segment.size() - pos < chunkSize) ? segment.size() - pos : chunkSize;
+                demuxer.Push(segment.data() + pos, size);
+            }
+            demuxer.Flush();
+
+            continuityErrors += demuxer.ContinuityErrors();
+        }
+
+        passes++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    double megabytes = static_cast<double>(totalBytes) * passes / (1024.0 * 1024.0);
+    printf("%zu segments, %.2f MB per pass, %llu passes in %.2f s\n",
+        segments.size(), totalBytes / (1024.0 * 1024.0), static_cast<unsigned long long>(passes), elapsed);
+    printf("throughput: %.1f MB/s\n", megabytes / elapsed);
+    printf("per pass: %llu PES, %.2f MB video, %.2f MB audio, %llu continuity errors\n",
+        static_cast<unsigned long long>(pesCount / passes),
+        videoBytes / passes / (1024.0 * 1024.0), audioBytes / passes / (1024.0 * 1024.0),
+        static_cast<unsigned long long>(continuityErrors / passes));
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+// Cost of WebVttCueIndex on long recordings: parse time of the appended files, random lookups
+// (seeks) and per-frame cursor updates at 60 fps. Without files a synthetic recording is used,
+// one cue every two seconds with a long overlapping one every tenth.
+//
+// Build (portable, no Windows dependencies):
+//   g++ -std=c++17 -O2 -I. tools/WebVttBench.cpp WebVtt.cpp -o vttbench
+//
+//   vttbench [--cues 50000] [file.vtt...]
+
+#include "WebVtt.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    std::string FormatTimestamp(uint64_t milliseconds)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%02llu:%02llu:%02llu.%03llu",
+            static_cast<unsigned long long>(milliseconds / 3600000), static_cast<unsigned long long>(milliseconds / 60000 % 60),
+            static_cast<unsigned long long>(milliseconds / 1000 % 60), static_cast<unsigned long long>(milliseconds % 1000));
+        return text;
+    }
+
+    std::vector<uint8_t> MakeRecording(size_t cueCount)
+    {
+        std::string text = "WEBVTT\n\n";
+        for (size_t i = 0; i < cueCount; ++i)
+        {
+            uint64_t start = i * 2000;
+            uint64_t end = start + ((i % 10 == 0) ? 8000 : 1800);
+            text += FormatTimestamp(start) + " --> " + FormatTimestamp(end) + " line:85%\n";
+            text += "Subtitle line " + std::to_string(i) + "\nsecond line\n\n";
+        }
+
+        return std::vector<uint8_t>(text.begin(), text.end());
+    }
+
+    double Elapsed(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t cueCount = 50000;
+    std::vector<std::vector<uint8_t>> files;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--cues" && i + 1 < argc)
+        {
+            cueCount = static_cast<size_t>(atoll(argv[++i]));
+            continue;
+        }
+
+        std::ifstream file(arg, std::ios::binary);
+        if (!file)
+        {
+            fprintf(stderr, "vttbench: cannot read %s\n", arg.c_str());
+            return 1;
+        }
+        files.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    if (files.empty())
+    {
+        files.push_back(MakeRecording(cueCount));
+    }
+
+    size_t totalBytes = 0;
+    WebVttCueIndex index;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::vector<uint8_t>& file : files)
+    {
+        if (!index.Append(file.data(), file.size()))
+        {
+            fprintf(stderr, "vttbench: not WebVTT\n");
+            return 1;
+        }
+        totalBytes += file.size();
+    }
+    double parseSeconds = Elapsed(start);
+
+    if (index.Size() == 0)
+    {
+        fprintf(stderr, "vttbench: no cues\n");
+        return 1;
+    }
+
+    printf("%zu cues, %.1f hours, %.1f KB of index\n", index.Size(), index.End() / 3600.0, index.SizeBytes() / 1024.0);
+    printf("parse      %8.2f ms  %8.1f MB/s\n", parseSeconds * 1000.0, totalBytes / parseSeconds / 1e6);
+
+    // random positions, as seeks see them
+    const size_t lookups = 1000000;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> position(0.0, index.End());
+    std::vector<double> times(lookups);
+    for (double& time : times)
+    {
+        time = position(random);
+    }
+
+    std::vector<uint32_t> active;
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (double time : times)
+    {
+        found += index.FindActive(time, &active);
+    }
+    double lookupSeconds = Elapsed(start);
+    printf("lookup     %8.1f ns  %8.2f cues active on average\n", lookupSeconds * 1e9 / lookups, double(found) / lookups);
+
+    // every frame of the whole recording at 60 fps
+    WebVttCursor cursor;
+    size_t frames = static_cast<size_t>(index.End() * 60.0);
+    size_t changes = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t frame = 0; frame < frames; ++frame)
+    {
+        changes += index.Advance(frame / 60.0, &cursor) ? 1 : 0;
+    }
+    double cursorSeconds = Elapsed(start);
+    printf("per frame  %8.1f ns  %zu frames, %zu changes\n", cursorSeconds * 1e9 / frames, frames, changes);
+
+    return 0;
+}